@@ -177,16 +177,16 @@ void setup()
     spec.setIntTime(500);   // 0.5s to start with
     spec.setAdcReference(ADC_4V);
 
-    // get the wavelength label indexes
-    uint16_t idx = 0;
+    // get the wavelength label indexes - first pixel at or above
+    // the label wavelength
     for (int i=0; i<WV_LABELS; i++)
     {
         uint16_t lblWavelength = WV_LABEL_START + (i * WV_LABEL_STEP);
-        while (idx < SPEC_PIXELS &&
-               lblWavelength > spec.getWavelength(idx))
-               ++idx;
-        if (idx < SPEC_PIXELS)
-            wvLabelIndex[i] = idx;
+        float pixel = spec.getPixelIndex(lblWavelength);
+        if (pixel <= 0)
+            wvLabelIndex[i] = 0;
+        else if (pixel < SPEC_PIXELS)
+            wvLabelIndex[i] = (uint16_t)ceilf(pixel);
         else
             wvLabelIndex[i] = SPEC_PIXELS;
     }
@@ -1,11 +1,8 @@
 /*
  *  DRV8884.cpp - Texas Instruments DRV8884 driver for Motor board.
  *                This controls stepper motor and rotary encoder.
- *                Rotary encoder bit is supposed to be used as
- *                confirmaion mechanism for stepper motor position.
- *                At this point only basic readings of rotary
- *                encoder are developed - no confirmation code is
- *                implemented.
+ *                Rotary encoder is used as confirmaion mechanism
+ *                for stepper motor position in closed loop mode.
  *
  *  Copyright 2017 Alexey Danilchenko, Iliah Borg
  *
@@ -37,8 +34,12 @@
 #define EEPROM_TRQ_ADDR             24
 #define EEPROM_STEP_ADDR            28
 #define EEPROM_STEPS_PER_POS_ADDR   32
+#define EEPROM_MAX_SPEED_ADDR       36
+#define EEPROM_ACCEL_ADDR           40
+#define EEPROM_ENC_PER_POS_ADDR     44
+#define EEPROM_CORRECTIONS_ADDR     48
 
-#define EEPROM_FREE_ADDR            36  // free address for application usage
+#define EEPROM_FREE_ADDR            52  // free address for application usage
 
 //
 // Timer prescaler - this is what CPU counter clock frequency is divided by to get the frequency
@@ -53,9 +54,12 @@
 #define  MAX_TIMER_PERIOD    50000     // max timer tick - in above 10us units it will trigger every 500ms
 uint32_t TIMER_PERIOD_CNT =  1000;     // in above 10us units it will trigger every 10ms
 
+#define  DWELL_TIMER_PERIOD  100       // dwell timer tick - in above 10us units it will trigger every 1ms
+
 // State machine
 enum state_t {
     STATE_RUN,
+    STATE_DWELL,
     STATE_STOP
 };
 
@@ -63,11 +67,40 @@ enum state_t {
 static volatile state_t drvState      = STATE_STOP;
 static bool             drvCLK        = LOW;
 static int32_t          drvPulsesCount  = 0;
+static int32_t          drvPulsesTotal  = 0;
 static volatile bool    timerOn       = false;
 static volatile int32_t rotaryCounter = false;
 
+// position tracking - the position is advanced after every steps
+// per position STEP pulses
+static volatile int*    drvCurPos     = NULL;
+static int32_t          drvPosDir     = 1;
+static int32_t          drvStepsPerPos = 1;
+static int32_t          drvStepsInPos = 0;
+
+// motion queue - segments are executed back to back from the timer
+// interrupt when queue is running
+struct drv_segment_t {
+    int32_t  pos;           // absolute position to move to
+    uint16_t dwellMs;       // dwell time at the position
+    bool     trigger;       // trigger output is held high while dwelling
+};
+
+static drv_segment_t    drvQueue[DRV_QUEUE_SIZE];
+static volatile uint16_t drvQueueLen  = 0;
+static volatile uint16_t drvQueueIdx  = 0;
+static volatile uint16_t drvQueueEnd  = 0;  // segments run up to this index
+static volatile bool    drvQueueRun   = false;
+static volatile int32_t drvReachedPos = 0;  // last queue segment position reached
+static int32_t          drvDwellTicks = 0;
+
 // Driver pins
 uint8_t drvPinCLK  = NO_PIN;
+uint8_t drvPinDir  = NO_PIN;
+uint8_t drvPinTrg  = NO_PIN;
+
+// Acceleration ramp, used when its length is not 0
+static drv_ramp_t drvRamp;
 
 // Decay DAC values
 static const int decayDAC[] = {
@@ -101,6 +134,43 @@ void rotaryDown(void)
     --rotaryCounter;
 }
 
+// dwell at the position reached by the current queue segment
+static inline void drvStartDwell()
+{
+    const drv_segment_t& segment = drvQueue[drvQueueIdx];
+    drvReachedPos = segment.pos;
+    if (segment.trigger && drvPinTrg != NO_PIN)
+        pinSetFast(drvPinTrg);
+
+    drvDwellTicks = segment.dwellMs > 0 ? segment.dwellMs : 1;
+    drvState = STATE_DWELL;
+    TIM7->ARR = DWELL_TIMER_PERIOD;
+}
+
+// start moving to the current queue segment position
+static inline void drvStartSegment()
+{
+    int32_t delta = drvQueue[drvQueueIdx].pos - *drvCurPos;
+    drvPosDir = delta < 0 ? -1 : 1;
+    if (delta < 0)
+        pinSetFast(drvPinDir);
+    else
+        pinResetFast(drvPinDir);
+
+    drvStepsInPos = 0;
+    drvPulsesCount = abs(delta)*drvStepsPerPos*2;
+    drvPulsesTotal = drvPulsesCount;
+    if (drvPulsesCount == 0)
+    {
+        drvStartDwell();
+        return;
+    }
+
+    drvCLK = HIGH;
+    drvState = STATE_RUN;
+    TIM7->ARR = drvRamp.len ? drvRamp.period[0] : TIMER_PERIOD_CNT;
+}
+
 void drvClockInterrupt(void)
 {
     if (TIM_GetITStatus(TIM7, TIM_IT_Update) != RESET)
@@ -111,16 +181,44 @@ void drvClockInterrupt(void)
 
         switch (drvState) {
             case STATE_RUN:
+                if (drvCLK == HIGH && ++drvStepsInPos >= drvStepsPerPos)
+                {
+                    drvStepsInPos = 0;
+                    *drvCurPos += drvPosDir;
+                }
+
                 --drvPulsesCount;
                 if (drvPulsesCount <= 0) {
                     drvPulsesCount = 0;
-                    drvState = STATE_STOP;
                     drvCLK = LOW;
+                    if (drvQueueRun && drvQueueIdx < drvQueueEnd)
+                        drvStartDwell();
+                    else
+                        drvState = STATE_STOP;
                 }
                 else
+                {
                     drvCLK = (drvCLK == HIGH) ? LOW : HIGH;
+                    // ARR preload is off - takes effect from this period
+                    if (drvRamp.len)
+                        TIM7->ARR = drvRampPeriod(drvRamp,
+                                                  drvPulsesTotal - drvPulsesCount,
+                                                  drvPulsesCount);
+                }
                 break;
 
+            case STATE_DWELL:
+                if (--drvDwellTicks <= 0)
+                {
+                    if (drvPinTrg != NO_PIN)
+                        pinResetFast(drvPinTrg);
+
+                    if (++drvQueueIdx < drvQueueEnd)
+                        drvStartSegment();
+                    else
+                        drvState = STATE_STOP;
+                }
+                break;
 
             case STATE_STOP:
             default:
@@ -143,10 +241,11 @@ void startDrvTimer(int32_t pulses)
 
     // init state
     drvPulsesCount = pulses;
+    drvPulsesTotal = pulses;
     drvState = STATE_RUN;
 
     // next value of CLK
-    drvCLK = HIGH;
+    drvCLK = pulses > 0 ? HIGH : LOW;
 
     // enable TIM7 clock
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM7, ENABLE);
@@ -161,7 +260,7 @@ void startDrvTimer(int32_t pulses)
     // setup timer
     timerInit.TIM_Prescaler         = TIMER_PRESCALER;
     timerInit.TIM_CounterMode       = TIM_CounterMode_Up;
-    timerInit.TIM_Period            = TIMER_PERIOD_CNT;
+    timerInit.TIM_Period            = drvRamp.len ? drvRamp.period[0] : TIMER_PERIOD_CNT;
     timerInit.TIM_ClockDivision     = TIM_CKD_DIV1;
     timerInit.TIM_RepetitionCounter = 0;
 
@@ -196,7 +295,7 @@ void stopDrvTimer()
 // Constructor/destructor
 DRV8884::DRV8884(uint8_t nfault, uint8_t decay, uint8_t trq, uint8_t m0, uint8_t m1,
                  uint8_t dir, uint8_t step, uint8_t enable, uint8_t nsleep, uint8_t pref,
-                 uint8_t up_clk, uint8_t down_clk)
+                 uint8_t up_clk, uint8_t down_clk, uint8_t trg_out)
 {
     pinNfault_  = nfault;
     pinDecay_   = decay;
@@ -210,15 +309,26 @@ DRV8884::DRV8884(uint8_t nfault, uint8_t decay, uint8_t trq, uint8_t m0, uint8_t
     pinPREF_    = pref;
     pinUpCLK_   = up_clk;
     pinDownCLK_ = down_clk;
+    pinTrgOut_  = trg_out;
     drvState    = STATE_STOP;
     drvCLK      = LOW;
 
     drvPinCLK     = pinStep_;
+    drvPinDir     = pinDir_;
+    drvPinTrg     = pinTrgOut_;
+    drvCurPos     = &curPos_;
     isRunning_    = false;
     decayMode_    = DECAY_SLOW_MIXED;
     torqueMode_   = TORQUE_FULL;
     steppingMode_ = STEP_FULL;
     direction_    = DIR_FORWARD;
+    maxStepsPerSec_ = 0;
+    accel_        = 0;
+    corrections_  = 0;
+    posError_     = 0;
+    maxFollowErr_ = 0;
+    queueIdx_     = 0;
+    reachedPos_   = 0;
 
     // read position details from EPROM
     EEPROM.get(EEPROM_CUR_POS_ADDR, curPos_);
@@ -253,6 +363,23 @@ DRV8884::DRV8884(uint8_t nfault, uint8_t decay, uint8_t trq, uint8_t m0, uint8_t
     else
         setRotationSpeed(stepsPerSec_, false);
 
+    EEPROM.get(EEPROM_MAX_SPEED_ADDR, maxStepsPerSec_);
+    EEPROM.get(EEPROM_ACCEL_ADDR, accel_);
+    if (maxStepsPerSec_ == 0xFFFFFFFF || accel_ == 0xFFFFFFFF)
+        // EEPROM was empty
+        setRamp(stepsPerSec_, 0, false);
+    else
+        setRamp(maxStepsPerSec_, accel_, false);
+
+    EEPROM.get(EEPROM_ENC_PER_POS_ADDR, encPerPos_);
+    EEPROM.get(EEPROM_CORRECTIONS_ADDR, maxCorrections_);
+    if (encPerPos_ == 0xFFFFFFFF || maxCorrections_ < 0)
+    {
+        // EEPROM was empty
+        encPerPos_ = 0;
+        maxCorrections_ = 0;
+    }
+
     EEPROM.get(EEPROM_TRQ_ADDR, torqueMode_);
     if (torqueMode_ == 0xFFFFFFFF)
         // EEPROM was empty
@@ -293,12 +420,16 @@ void DRV8884::begin()
     pinMode(pinNfault_, INPUT_PULLUP);
     pinMode(pinUpCLK_,  INPUT_PULLDOWN);
     pinMode(pinDownCLK_,INPUT_PULLDOWN);
+    if (pinTrgOut_ != NO_PIN)
+        pinMode(pinTrgOut_, OUTPUT);
 
     // reset everything
     pinResetFast(pinEnable_);
     pinResetFast(pinNsleep_);
     pinResetFast(pinDir_);
     pinResetFast(pinStep_);
+    if (pinTrgOut_ != NO_PIN)
+        pinResetFast(pinTrgOut_);
 #ifdef DRV8884_PREF_DAC_CONTROL_ENABLED
     prefDAC_ = PREF_DAC_FULL_CURRENT;
     analogWrite(pinPREF_,  prefDAC_);
@@ -323,6 +454,12 @@ void DRV8884::begin()
     Particle.variable("drvDecayMod",  decayMode_);
     Particle.variable("drvStepsSec",  stepsPerSec_);
     Particle.variable("drvTrqMode",   torqueMode_);
+    Particle.variable("drvRunning",   isRunning_);
+    Particle.variable("drvMaxStpSec", maxStepsPerSec_);
+    Particle.variable("drvAccel",     accel_);
+    Particle.variable("drvEncPerPos", encPerPos_);
+    Particle.variable("drvPosError",  posError_);
+    Particle.variable("drvQueueIdx",  queueIdx_);
 }
 
 // Move number of positions in the current direction. By default this will
@@ -333,8 +470,6 @@ void DRV8884::movePositions(uint32_t positions, bool allowBeyondLimits)
     if (isRunning_ || timerOn || positions == 0)
         return;
 
-    isRunning_ = true;
-
     // check against the steps beyond limits
     if (!allowBeyondLimits)
         if (direction_ == DIR_REVERSE && curPos_ < minPos_ + positions)
@@ -342,8 +477,17 @@ void DRV8884::movePositions(uint32_t positions, bool allowBeyondLimits)
         else if (direction_ == DIR_FORWARD && curPos_ > maxPos_ - positions)
             positions = maxPos_ - curPos_;
 
-    // reset
-    pinResetFast(pinStep_);
+    if (positions == 0)
+        return;
+
+    isRunning_ = true;
+    moveStartPos_ = curPos_;
+    reachedPos_ = curPos_;
+    drvReachedPos = curPos_;
+    moveTarget_ = direction_ == DIR_FORWARD ? curPos_ + positions : curPos_ - positions;
+    corrections_ = 0;
+    posError_ = 0;
+    maxFollowErr_ = 0;
 
     // wake up the chip
     pinSetFast(pinEnable_);
@@ -351,37 +495,103 @@ void DRV8884::movePositions(uint32_t positions, bool allowBeyondLimits)
 
     // set rotary
     rotaryCounter = rotaryCounter_;
+    moveStartRotary_ = rotaryCounter_;
 
     // attach rotary pin interrupts
     attachInterrupt(pinUpCLK_,   rotaryUp,   RISING, 3);
     attachInterrupt(pinDownCLK_, rotaryDown, RISING, 3);
 
+    startSteps(positions);
+}
+
+// Start timer driven stepping of positions in the current direction
+void DRV8884::startSteps(uint32_t positions)
+{
+    // position tracking
+    drvPosDir = direction_ == DIR_FORWARD ? 1 : -1;
+    drvStepsPerPos = fullStepsPerPos_*fullStepMultiplier[steppingMode_];
+    drvStepsInPos = 0;
+
+    // reset
+    pinResetFast(pinStep_);
+
     // start the timer
-    int32_t driveSteps = positions*fullStepsPerPos_*fullStepMultiplier[steppingMode_];
+    int32_t driveSteps = positions*drvStepsPerPos;
     startDrvTimer(driveSteps*2);
+}
+
+// Completes the move once the motor has stopped
+bool DRV8884::update()
+{
+    if (!isRunning_)
+        return false;
+
+    rotaryCounter_ = rotaryCounter;
+    if (drvQueueRun)
+        queueIdx_ = drvQueueIdx;
+
+    // position by encoder since the start of the move
+    double encPos = moveStartPos_;
+    if (encPerPos_ != 0)
+        encPos += (double)(rotaryCounter_ - moveStartRotary_)/encPerPos_;
+
+    // queue positions reached before the driver has reported a fault
+    int reached = drvReachedPos;
+    bool fault = pinReadFast(pinNfault_) != HIGH;
+    if (!fault)
+        reachedPos_ = reached;
 
-    // loop until state machine is running
-    while (drvState != STATE_STOP)
-        ;
+    if (drvState != STATE_STOP && !fault)
+    {
+        // lag of the encoder behind the steps made
+        if (encPerPos_ != 0)
+        {
+            double followErr = encPos - curPos_;
+            if (fabs(followErr) > fabs(maxFollowErr_))
+                maxFollowErr_ = followErr;
+        }
+        return false;
+    }
 
-    // stop the timer
+    // stop the timer - also the move in progress on fault
     stopDrvTimer();
 
-    // detach pin interrupts
-    detachInterrupt(pinUpCLK_);
-    detachInterrupt(pinDownCLK_);
+    if (fault)
+    {
+        drvState = STATE_STOP;
+        if (drvPinTrg != NO_PIN)
+            pinResetFast(drvPinTrg);
 
-    rotaryCounter_ = rotaryCounter;
+        // the steps are not trusted if the driver has reported a fault -
+        // position is what encoder says or the last one reached before it
+        curPos_ = encPerPos_ != 0 ? lround(encPos) : reachedPos_;
+    }
+    else if (encPerPos_ != 0)
+    {
+        // position reached is what encoder says
+        posError_ = encPos - moveTarget_;
+        curPos_ = lround(encPos);
+
+        if (curPos_ != moveTarget_ && corrections_ < maxCorrections_)
+        {
+            ++corrections_;
+            writeDirection(moveTarget_ > curPos_ ? DIR_FORWARD : DIR_REVERSE);
+            startSteps(abs(moveTarget_ - curPos_));
+            return false;
+        }
+    }
 
-    // adjust the current position
-    if (pinReadFast(pinNfault_) == HIGH)
+    // queue has left the direction at the last segment
+    if (drvQueueRun)
     {
-        if (direction_ == DIR_FORWARD)
-            curPos_ += positions;
-        else
-            curPos_ -= positions;
+        drvQueueRun = false;
+        direction_ = drvPosDir < 0 ? DIR_REVERSE : DIR_FORWARD;
     }
 
+    // detach pin interrupts
+    detachInterrupt(pinUpCLK_);
+    detachInterrupt(pinDownCLK_);
+
     // sleep
     pinResetFast(pinEnable_);
     pinResetFast(pinNsleep_);
@@ -392,6 +602,96 @@ void DRV8884::movePositions(uint32_t positions, bool allowBeyondLimits)
 
     // reset guard
     isRunning_ = false;
+
+    return true;
+}
+
+// Motion queue
+bool DRV8884::queueAdd(int pos, int dwellMs, bool trigger)
+{
+    if (isRunning_ || timerOn || drvQueueLen >= DRV_QUEUE_SIZE
+        || dwellMs < 0 || dwellMs > 65535)
+        return false;
+
+    // keep within limits
+    if (pos < minPos_)
+        pos = minPos_;
+    else if (pos > maxPos_)
+        pos = maxPos_;
+
+    drv_segment_t& segment = drvQueue[drvQueueLen];
+    segment.pos = pos;
+    segment.dwellMs = dwellMs;
+    segment.trigger = trigger;
+    ++drvQueueLen;
+
+    return true;
+}
+
+void DRV8884::queueClear()
+{
+    if (isRunning_ || timerOn)
+        return;
+
+    drvQueueLen = 0;
+    queueIdx_ = 0;
+}
+
+int DRV8884::queueSize()
+{
+    return drvQueueLen;
+}
+
+bool DRV8884::runQueue()
+{
+    if (isRunning_ || timerOn || drvQueueLen == 0)
+        return false;
+
+    isRunning_ = true;
+    moveStartPos_ = curPos_;
+    reachedPos_ = curPos_;
+    drvReachedPos = curPos_;
+    moveTarget_ = drvQueue[drvQueueLen-1].pos;
+    corrections_ = 0;
+    posError_ = 0;
+    maxFollowErr_ = 0;
+    queueIdx_ = 0;
+
+    // wake up the chip
+    pinSetFast(pinEnable_);
+    pinSetFast(pinNsleep_);
+
+    // set rotary
+    rotaryCounter = rotaryCounter_;
+    moveStartRotary_ = rotaryCounter_;
+
+    // attach rotary pin interrupts
+    attachInterrupt(pinUpCLK_,   rotaryUp,   RISING, 3);
+    attachInterrupt(pinDownCLK_, rotaryDown, RISING, 3);
+
+    // the first segment is started here, the rest from timer interrupt
+    drvQueueIdx = 0;
+    drvQueueEnd = drvQueueLen;
+    drvQueueRun = true;
+    int delta = drvQueue[0].pos - curPos_;
+    writeDirection(delta < 0 ? DIR_REVERSE : DIR_FORWARD);
+    startSteps(abs(delta));
+
+    return true;
+}
+
+// Finish the segment in progress and stop - the queue itself is kept
+void DRV8884::stopQueue()
+{
+    int primask = __get_PRIMASK();
+    __disable_irq();
+    if (drvQueueRun && drvQueueIdx < drvQueueEnd)
+    {
+        drvQueueEnd = drvQueueIdx+1;
+        moveTarget_ = drvQueue[drvQueueIdx].pos;
+    }
+    if ((primask & 1) == 0)
+        __enable_irq();
 }
 
 // Sets number of full motor steps per one position unit. The postions
@@ -516,6 +816,11 @@ void DRV8884::setDirection(dir_t direction)
     if (isRunning_ || timerOn)
         return;
 
+    writeDirection(direction);
+}
+
+void DRV8884::writeDirection(dir_t direction)
+{
     direction_ = direction;
     if (direction_ == DIR_FORWARD)
         pinResetFast(pinDir_);
@@ -544,6 +849,53 @@ bool DRV8884::setRotationSpeed(int stepsPerSec, bool storeInEeprom)
     if (storeInEeprom)
         EEPROM.put(EEPROM_TIMER_PER_ADDR, stepsPerSec_);
 
+    // ramp starts at this speed
+    if (accel_ > 0)
+        setRamp(maxStepsPerSec_, accel_, storeInEeprom);
+
+    return true;
+}
+
+// Set closed loop mode
+bool DRV8884::setClosedLoop(int encPerPos, int maxCorrections, bool storeInEeprom)
+{
+    if (isRunning_ || timerOn || maxCorrections < 0)
+        return false;
+
+    encPerPos_ = encPerPos;
+    maxCorrections_ = maxCorrections;
+
+    // store them in EEPROM
+    if (storeInEeprom)
+    {
+        EEPROM.put(EEPROM_ENC_PER_POS_ADDR, encPerPos_);
+        EEPROM.put(EEPROM_CORRECTIONS_ADDR, maxCorrections_);
+    }
+
+    return true;
+}
+
+// Set acceleration ramp
+bool DRV8884::setRamp(int maxStepsPerSec, int accel, bool storeInEeprom)
+{
+    if (isRunning_ || timerOn || accel < 0)
+        return false;
+
+    // max speed below the start speed disables the ramp
+    if (maxStepsPerSec < stepsPerSec_)
+        maxStepsPerSec = stepsPerSec_;
+
+    maxStepsPerSec_ = maxStepsPerSec;
+    accel_ = accel;
+    drvRampBuild(drvRamp, TIMER_UNITS_PER_SEC, stepsPerSec_, maxStepsPerSec_, accel_, MIN_TIMER_PERIOD);
+
+    // store them in EEPROM
+    if (storeInEeprom)
+    {
+        EEPROM.put(EEPROM_MAX_SPEED_ADDR, maxStepsPerSec_);
+        EEPROM.put(EEPROM_ACCEL_ADDR, accel_);
+    }
+
     return true;
 }
 
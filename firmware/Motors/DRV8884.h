@@ -23,6 +23,7 @@
 #define _DRV8884_H_
 
 #include "application.h"
+#include "DRV8884_ramp.h"
 
 // It is possible to connect PREF pin directly to Photon
 // without resistor if no fine control over output current
@@ -35,6 +36,9 @@
 // No pin assigned
 #define NO_PIN (TOTAL_PINS+1)
 
+// Max number of motion queue segments
+#define DRV_QUEUE_SIZE  128
+
 // Direction (see DRV8884 spec sheet)
 enum dir_t {
     DIR_FORWARD = 0,
@@ -86,28 +90,47 @@ private:
     uint8_t pinNfault_, pinDecay_, pinTRQ_, pinM0_, pinM1_, pinDir_, pinStep_;
     uint8_t pinEnable_, pinNsleep_, pinPREF_;
 
-    // These are rotary encoder pins for counting ups and downs. Not used
-    // for currently but could be used to double check on precision of
-    // stepper movements
+    // These are rotary encoder pins for counting ups and downs. Used to
+    // verify and correct the position reached in closed loop mode
     uint8_t pinUpCLK_, pinDownCLK_;
 
+    // Trigger output held high while dwelling at queued positions
+    uint8_t pinTrgOut_;
+
     // Variables
     bool     isRunning_;       // Is the motor currently running
     int      minPos_;          // Minimum allowed position - lower limit
     int      maxPos_;          // Maximum allowed position - upper limit
-    int      curPos_;          // Current position
+    int      curPos_;          // Current position, updated by the timer interrupt while moving
+    int      moveStartPos_;    // Position at the start of the current move
+    int      reachedPos_;      // Last queue position reached without driver fault
+    int      moveTarget_;      // Target position of the current move
+    int      moveStartRotary_; // Rotary counter at the start of the current move
+    int      encPerPos_;       // Rotary encoder counts per position, 0 - no closed loop
+    int      maxCorrections_;  // Max corrective moves to reach the target
+    int      corrections_;     // Corrective moves done in the current move
+    double   posError_;        // Position error (by encoder) after the last move
+    double   maxFollowErr_;    // Max encoder position lag during the last move
+    int      queueIdx_;        // Motion queue segment in progress
     int      fullStepsPerPos_; // Full steps per one position
     int      rotaryCounter_;   // Current position
     int      decayMode_;       // Current decay mode
     int      torqueMode_;      // Current torque mode
     int      steppingMode_;    // Current stepping mode
     int      direction_;       // Current direction
-    int      stepsPerSec_;     // Current rotation speed 
+    int      stepsPerSec_;     // Current rotation speed (from rest)
+    int      maxStepsPerSec_;  // Max rotation speed reached by acceleration
+    int      accel_;           // Acceleration in steps/sec^2, 0 - no ramp
 
 #ifdef DRV8884_PREF_DAC_CONTROL_ENABLED
     int      prefDAC_;      // Current PREF setting
 #endif
 
+    // Start timer driven stepping of positions in the current direction
+    void startSteps(uint32_t positions);
+    // Set direction pin
+    void writeDirection(dir_t direction);
+
 public:
 
     // Constructor/destructor
@@ -123,9 +146,10 @@ public:
     //     pref         - DRV8884 current limit control pin
     //     up_clk       - LS7083 up clock pin
     //     down_clk     - LS7083 down clock pin
+    //     trg_out      - motion queue dwell trigger output pin
     DRV8884(uint8_t nfault, uint8_t decay, uint8_t trq, uint8_t m0, uint8_t m1,
             uint8_t dir, uint8_t step, uint8_t enable, uint8_t nsleep, uint8_t pref,
-            uint8_t up_clk, uint8_t down_clk);
+            uint8_t up_clk, uint8_t down_clk, uint8_t trg_out = NO_PIN);
     ~DRV8884();
 
     // Setup methods and setters
@@ -133,9 +157,32 @@ public:
 
     // Move number of positions in the current direction. By default this will
     // not move past origin (min position). Specifying allowBeyondLimits
-    // will allow to ignore that (it should be used for calibration)
+    // will allow to ignore that (it should be used for calibration).
+    // This only starts the move, update() completes it.
     void movePositions(uint32_t positions, bool allowBeyondLimits = false);
 
+    // Completes the move once the motor has stopped - has to be called from
+    // the main loop. Returns true once for each completed move.
+    //
+    // In closed loop mode (encoder counts per position set) the position
+    // is verified by the rotary encoder. Position lag behind the steps made
+    // is tracked during the move and the position reached is taken from
+    // the encoder counts. If it misses the target, corrective moves are
+    // made before the move is reported as completed.
+    bool update();
+
+    // Motion queue - absolute positions with dwell times executed back to
+    // back from the timer interrupt. Trigger output (if the pin is set) is
+    // held high while dwelling at the positions with trigger. Positions are
+    // kept within limits. The queue is kept after it has run, so it can be
+    // run again. Running queue is completed by update() as any other move,
+    // stopping it finishes the segment in progress and keeps the queue.
+    bool queueAdd(int pos, int dwellMs, bool trigger = false);
+    void queueClear();
+    int  queueSize();
+    bool runQueue();
+    void stopQueue();
+
     // Reset postion (set the cur pos to specified value)
     void resetPosition(int curPos);
 
@@ -165,6 +212,15 @@ public:
     // Set rotation speed
     bool setRotationSpeed(int stepsPerSec, bool storeInEeprom = true);
 
+    // Set closed loop mode - rotary encoder counts per position (negative
+    // if encoder counts down when moving forward), 0 disables closed loop
+    bool setClosedLoop(int encPerPos, int maxCorrections, bool storeInEeprom = true);
+
+    // Set acceleration ramp - moves start at rotation speed and accelerate
+    // up to maxStepsPerSec at accel steps/sec^2, then decelerate back before
+    // stopping. Ramp is disabled with 0 acceleration.
+    bool setRamp(int maxStepsPerSec, int accel, bool storeInEeprom = true);
+
 #ifdef DRV8884_PREF_DAC_CONTROL_ENABLED
     // Get/Set the current limit via DAC controlled PREF (see DRV8884 spec sheet)
     void    setPREF(pref_t prefDAC);
@@ -173,6 +229,12 @@ public:
 
     // Getters
     int      getCurPos()        { return curPos_; }
+    int      getRotaryCounter() { return rotaryCounter_; }
+    int      getEncoderPerPos() { return encPerPos_; }
+    int      getQueueIndex()    { return queueIdx_; }
+    int      getCorrections()   { return corrections_; }
+    double   getPosError()      { return posError_; }
+    double   getMaxFollowError() { return maxFollowErr_; }
     int      getMaxPos()        { return maxPos_; }
     int      getMinPos()        { return minPos_; }
     decay_t  getDecayMode()     { return (decay_t)decayMode_; }
@@ -180,6 +242,8 @@ public:
     step_t   getSteppingMode()  { return (step_t)steppingMode_; }
     dir_t    getDirection()     { return (dir_t)direction_; }
     int      getRotationSpeed() { return stepsPerSec_; }
+    int      getMaxRotationSpeed() { return maxStepsPerSec_; }
+    int      getAcceleration()  { return accel_; }
     bool     isRunning()        { return isRunning_; }
 };
 #endif
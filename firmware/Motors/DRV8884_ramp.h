@@ -0,0 +1,95 @@
+/*
+ *  DRV8884_ramp.h - Stepper acceleration ramp for DRV8884 driver on
+ *                   Motor board. This part is hardware independent
+ *                   (no Particle/STM32 headers) so it can be compiled
+ *                   and checked on the host as is.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_DRV8884_RAMP_H_)
+#define _DRV8884_RAMP_H_
+
+#include <stdint.h>
+#include <math.h>
+
+// Maximum number of acceleration steps in the ramp table. Acceleration
+// stops at the last table entry if max speed is not reached by then.
+#ifndef DRV_RAMP_SIZE
+#define DRV_RAMP_SIZE   256
+#endif
+
+// Trapezoidal ramp. The timer toggles STEP pin on every tick so a step
+// takes two ticks. Table holds timer periods (half step periods) for
+// each step of acceleration at constant rate from the start speed:
+//
+//      v(n) = sqrt(v0^2 + 2*a*n)
+//
+// Deceleration uses the same table backwards. Moves too short to reach
+// max speed make a triangular profile.
+struct drv_ramp_t {
+    uint16_t period[DRV_RAMP_SIZE]; // timer periods for each step of acceleration
+    uint16_t len;                   // used table entries, 0 - no ramp
+};
+
+// Build the ramp table for start (from rest) and max speeds in steps per
+// second and acceleration in steps per second squared. Periods are in
+// timer units, minPeriod is the shortest timer period allowed. No ramp
+// is built if acceleration is 0 or max speed is not above start speed.
+// Returns number of table entries.
+inline uint16_t drvRampBuild(drv_ramp_t& ramp,
+                             uint32_t unitsPerSec,
+                             uint32_t startStepsPerSec,
+                             uint32_t maxStepsPerSec,
+                             uint32_t accel,
+                             uint16_t minPeriod)
+{
+    ramp.len = 0;
+    if (accel == 0 || startStepsPerSec == 0 || maxStepsPerSec <= startStepsPerSec)
+        return 0;
+
+    float maxPeriod = (float)unitsPerSec/(2*maxStepsPerSec);
+    if (maxPeriod < minPeriod)
+        maxPeriod = minPeriod;
+
+    float v0sq = (float)startStepsPerSec*startStepsPerSec;
+    for (uint16_t n=0; n<DRV_RAMP_SIZE; n++)
+    {
+        float period = unitsPerSec/(2*sqrtf(v0sq + 2.0f*accel*n));
+        if (period <= maxPeriod)
+        {
+            ramp.period[ramp.len++] = (uint16_t)(maxPeriod + 0.5f);
+            break;
+        }
+        ramp.period[ramp.len++] = (uint16_t)(period + 0.5f);
+    }
+
+    return ramp.len;
+}
+
+// Timer period for the next tick given the ticks already done and the
+// ticks left in the move (including the next one) - whichever end of
+// the move is closer picks the ramp step
+inline uint16_t drvRampPeriod(const drv_ramp_t& ramp, int32_t ticksDone, int32_t ticksLeft)
+{
+    --ticksLeft;
+    uint32_t step = (uint32_t)(ticksDone < ticksLeft ? ticksDone : ticksLeft) >> 1;
+    return ramp.period[step < ramp.len ? step : ramp.len-1];
+}
+
+#endif
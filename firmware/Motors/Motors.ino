@@ -37,6 +37,9 @@ SYSTEM_THREAD(ENABLED);
 #define DOWN_CLK    D0
 #define UP_CLK      D1
 
+// motion queue dwell trigger output (i.e. to spectrometer board trigger input)
+#define TRG_OUT     D3
+
 // Motor board DRV8884 driver - can be only one per application
 DRV8884 motor(NFAULT,
               DECAY,
@@ -49,7 +52,8 @@ DRV8884 motor(NFAULT,
               NSLEEP,
               PREF,
               UP_CLK,
-              DOWN_CLK);
+              DOWN_CLK,
+              TRG_OUT);
 
 // Board type identifier
 static String BOARD_TYPE = "SPEC2_MOTOR";
@@ -70,6 +74,11 @@ void initDRV8884()
 STARTUP(initDRV8884());
 
 // cloud functions
+
+// Starts the move and returns without waiting for it to finish.
+// Completion is published as drvMoveDone event with data
+//    "<position>,<rotary>,<position error>,<max following error>,<corrections>"
+// drvRunning variable can be polled as well.
 int drvMoveToPosition(String paramStr)
 {
     paramStr.trim().toUpperCase();
@@ -184,6 +193,116 @@ int drvSetRotationSpeed(String stepsPerSecStr)
     return -1;
 }
 
+// "<max steps per sec>,<acceleration steps/sec^2>", 0 acceleration
+// disables the ramp
+int drvSetRamp(String rampStr)
+{
+    if (motor.isRunning())
+        return -1;
+
+    // parse the string
+    int sepIdx = rampStr.indexOf(',');
+    if (sepIdx <= 0 || sepIdx+1 == rampStr.length())
+        return -1;
+
+    int maxStepsPerSec = rampStr.substring(0, sepIdx).toInt();
+    int accel = rampStr.substring(sepIdx+1).toInt();
+
+    if (motor.setRamp(maxStepsPerSec, accel))
+        return 0;
+
+    return -1;
+}
+
+// "<encoder counts per position>[,<max corrections>]", 0 counts
+// disables closed loop mode
+int drvSetClosedLoop(String paramStr)
+{
+    if (motor.isRunning() || paramStr.length() == 0)
+        return -1;
+
+    int encPerPos = paramStr.toInt();
+    int maxCorrections = 0;
+    int sepIdx = paramStr.indexOf(',');
+    if (sepIdx > 0)
+        maxCorrections = paramStr.substring(sepIdx+1).toInt();
+
+    if (motor.setClosedLoop(encPerPos, maxCorrections))
+        return 0;
+
+    return -1;
+}
+
+// Motion queue control. Format of the parameter string:
+//    ADD,<pos>,<dwell ms>[,TRG]                 - add position to the queue
+//    SWEEP,<from>,<to>,<step>,<dwell ms>[,TRG]  - add positions from..to
+//    RUN                                        - run the queue
+//    STOP                                       - stop after the segment in progress
+//    CLEAR                                      - clear the queue
+// With TRG the trigger output is held high while dwelling. Returns the number
+// of queued positions, completion is published as drvMoveDone event.
+int drvQueue(String paramStr)
+{
+    paramStr.trim().toUpperCase();
+
+    if (paramStr.equals("STOP"))
+    {
+        motor.stopQueue();
+        return 0;
+    }
+
+    if (motor.isRunning())
+        return -1;
+
+    if (paramStr.equals("CLEAR"))
+        motor.queueClear();
+    else if (paramStr.equals("RUN"))
+    {
+        if (!motor.runQueue())
+            return -1;
+    }
+    else
+    {
+        // parse numeric values
+        bool trigger = paramStr.endsWith(",TRG");
+        int values[4];
+        int count = 0;
+        int idx = paramStr.indexOf(',');
+        while (idx > 0 && count < 4)
+        {
+            int nextIdx = paramStr.indexOf(',', idx+1);
+            String value = nextIdx > 0 ? paramStr.substring(idx+1, nextIdx) : paramStr.substring(idx+1);
+            if (value.equals("TRG"))
+                break;
+            values[count++] = value.toInt();
+            idx = nextIdx;
+        }
+
+        if (paramStr.startsWith("ADD,") && count == 2)
+        {
+            if (!motor.queueAdd(values[0], values[1], trigger))
+                return -1;
+        }
+        else if (paramStr.startsWith("SWEEP,") && count == 4 && values[2] != 0)
+        {
+            // whole sweep has to fit, the queue is not changed otherwise
+            int positions = abs(values[1] - values[0])/abs(values[2]) + 1;
+            if (positions > DRV_QUEUE_SIZE - motor.queueSize()
+                || values[3] < 0 || values[3] > 65535)
+                return -1;
+
+            int step = values[0] <= values[1] ? abs(values[2]) : -abs(values[2]);
+            for (int pos = values[0]; step > 0 ? pos <= values[1] : pos >= values[1]; pos += step)
+                if (!motor.queueAdd(pos, values[3], trigger))
+                    return -1;
+        }
+        else
+            return -1;
+    }
+
+    return motor.queueSize();
+}
+
 int drvSetTorqueMode(String torqueModeStr)
 {
     int32_t torqueMode = torqueModeStr.toInt();
@@ -214,9 +333,23 @@ void setup()
     initSuccess = initSuccess && Particle.function("drvSetStpMd",  drvSetSteppingMode);
     initSuccess = initSuccess && Particle.function("drvSetRotSpd", drvSetRotationSpeed);
     initSuccess = initSuccess && Particle.function("drvSetTrqMod", drvSetTorqueMode);
+    initSuccess = initSuccess && Particle.function("drvSetRamp",   drvSetRamp);
+    initSuccess = initSuccess && Particle.function("drvSetClLoop", drvSetClosedLoop);
+    initSuccess = initSuccess && Particle.function("drvQueue",     drvQueue);
 }
 
-// Main event loop - nothing to do here
+// Main event loop - completes motor moves
 void loop(void)
 {
+    if (motor.update())
+    {
+        char data[64];
+        snprintf(data, sizeof(data), "%d,%d,%.2f,%.2f,%d",
+                 motor.getCurPos(),
+                 motor.getRotaryCounter(),
+                 motor.getPosError(),
+                 motor.getMaxFollowError(),
+                 motor.getCorrections());
+        Particle.publish("drvMoveDone", data, PRIVATE);
+    }
 }
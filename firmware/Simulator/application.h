@@ -0,0 +1,125 @@
+/*
+ *  application.h - Host simulation of Particle firmware API used by Spectron
+ *                  spectrometer drivers - pins, timing, EEPROM and SPI.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_APPLICATION_H_)
+#define _SIM_APPLICATION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "pinmap_hal.h"
+
+typedef uint8_t byte;
+
+#define HIGH    1
+#define LOW     0
+
+// ------------------------------
+//   Pins
+// ------------------------------
+void pinMode(pin_t pin, PinMode mode);
+void pinSetFast(pin_t pin);
+void pinResetFast(pin_t pin);
+int32_t pinReadFast(pin_t pin);
+void digitalWrite(pin_t pin, uint8_t value);
+int32_t digitalRead(pin_t pin);
+
+// ------------------------------
+//   Time - virtual time of the simulator
+// ------------------------------
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+class SystemClass {
+public:
+    static uint32_t ticksPerMicrosecond() { return 120; }
+    static uint32_t ticks();
+    static void ticksDelay(uint32_t ticks);
+};
+
+extern SystemClass System;
+
+// ------------------------------
+//   EEPROM - emulated in RAM, erased (0xFF) on start
+// ------------------------------
+class EEPROMClass {
+public:
+    EEPROMClass() { clear(); }
+
+    template <typename T> T& get(int idx, T& t)
+    {
+        if (idx >= 0 && idx + sizeof(T) <= sizeof(data_))
+            memcpy(&t, data_+idx, sizeof(T));
+        return t;
+    }
+
+    template <typename T> const T& put(int idx, const T& t)
+    {
+        if (idx >= 0 && idx + sizeof(T) <= sizeof(data_))
+            memcpy(data_+idx, &t, sizeof(T));
+        return t;
+    }
+
+    uint8_t read(int idx) { return idx >= 0 && idx < length() ? data_[idx] : 0xFF; }
+    void write(int idx, uint8_t value) { if (idx >= 0 && idx < length()) data_[idx] = value; }
+    int length() { return sizeof(data_); }
+    void clear() { memset(data_, 0xFF, sizeof(data_)); }
+
+private:
+    uint8_t data_[2047];
+};
+
+extern EEPROMClass EEPROM;
+
+// ------------------------------
+//   Cloud and watchdog - the simulated board is never connected
+// ------------------------------
+class ApplicationWatchdog {
+public:
+    static void checkin() {}
+};
+
+class CloudClass {
+public:
+    static bool connected() { return false; }
+    static void process() {}
+};
+
+extern CloudClass Particle;
+
+// ------------------------------
+//   SPI - drivers only release it from wiring
+// ------------------------------
+class SPIClass {
+public:
+    void begin() {}
+    void end() {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ *  gpio_hal.h - Host simulation of Particle GPIO HAL header
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_GPIO_HAL_H_)
+#define _SIM_GPIO_HAL_H_
+
+#include "pinmap_hal.h"
+
+#endif
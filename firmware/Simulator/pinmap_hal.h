@@ -0,0 +1,83 @@
+/*
+ *  pinmap_hal.h - Host simulation of Particle Photon pin map. Every pin
+ *                 has its own GPIO port register block here so that
+ *                 writes to different pins by the same interrupt do not
+ *                 overwrite each other in the simulated set/reset register.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_PINMAP_HAL_H_)
+#define _SIM_PINMAP_HAL_H_
+
+#include "stm32f2xx.h"
+
+typedef uint16_t pin_t;
+
+typedef enum {
+    INPUT,
+    OUTPUT,
+    INPUT_PULLUP,
+    INPUT_PULLDOWN,
+    AF_OUTPUT_PUSHPULL,
+    AN_INPUT,
+    AF_OUTPUT_DRAIN,
+    PIN_MODE_NONE = 0xFF
+} PinMode;
+
+typedef struct {
+    GPIO_TypeDef* gpio_peripheral;
+    pin_t         gpio_pin;
+    uint8_t       gpio_pin_source;
+    uint8_t       adc_channel;
+    uint8_t       timer_peripheral;
+    uint16_t      timer_ch;
+    PinMode       pin_mode;
+} STM32_Pin_Info;
+
+// Photon pins
+#define D0          0
+#define D1          1
+#define D2          2
+#define D3          3
+#define D4          4
+#define D5          5
+#define D6          6
+#define D7          7
+#define A0          10
+#define A1          11
+#define A2          12
+#define A3          13
+#define A4          14
+#define A5          15
+#define A6          16
+#define A7          17
+#define RX          18
+#define TX          19
+#define DAC         A6
+#define WKP         A7
+#define SS          A2
+#define SCK         A3
+#define MISO        A4
+#define MOSI        A5
+#define TOTAL_PINS  24
+
+STM32_Pin_Info* HAL_Pin_Map();
+void HAL_Pin_Mode(pin_t pin, PinMode mode);
+
+#endif
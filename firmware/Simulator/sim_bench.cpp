@@ -0,0 +1,307 @@
+/*
+ *  sim_bench.cpp - Runs spectrometer driver acquisition paths on the host
+ *                 simulator and reports virtual and wall clock timing
+ *                 together with the key results. Results vary slightly
+ *                 between runs as the driver and interrupt threads are
+ *                 scheduled by the host, results outside of the expected
+ *                 range from the simulated sensor make the exit code
+ *                 non zero.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "sim_hardware.h"
+
+#include <stdio.h>
+#include <chrono>
+
+#ifdef SIM_C12666
+#include "C12666MA.h"
+#define SIM_SPEC_CLASS  C12666MA
+#else
+#include "C12880MA.h"
+#define SIM_SPEC_CLASS  C12880MA
+#endif
+
+// Board pins as in Spectron.ino
+#define ADC_REF_SEL_1  A1
+#define ADC_REF_SEL_2  A0
+#define ADC_CNV        DAC
+#define TRG_CAMERA     D2
+#define TRG_3V         D3
+#define EOS_3V         D4
+#define CLK_3V         D5
+#define ST_3V          D6
+#define GAIN_3V        D7
+#define TRG_IN         A2
+
+// Lamp used for the light and spectral response calibration
+#define LAMP_TEMP_K    2856
+
+// tungsten emissivity used by the driver spectral response calibration
+double emvTungst(double wvL, double tempK);
+
+static std::chrono::steady_clock::time_point wallStart;
+static int failures = 0;
+
+// silicon sensor response the lamp is seen through
+static double sensorResponse(double wavelength)
+{
+    return exp(-pow((wavelength-600.0)/250.0, 2));
+}
+
+// Check the result against expected range, failures set the exit code
+static void expect(const char* what, double value, double minValue, double maxValue)
+{
+    if (value >= minValue && value <= maxValue)
+        return;
+
+    printf("%-22s FAILED: %s %.4f, expected %.4f..%.4f\n", "", what, value, minValue, maxValue);
+    ++failures;
+}
+
+static void expectNear(const char* what, double value, double expected, double tolerance)
+{
+    expect(what, value, expected-tolerance, expected+tolerance);
+}
+
+static void startStep()
+{
+    SimHardware::get().resetStats();
+    wallStart = std::chrono::steady_clock::now();
+}
+
+static void endStep(const char* name)
+{
+    double wallMs = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - wallStart).count();
+    sim_stats_t stats = SimHardware::get().getStats();
+
+    printf("%-22s virtual %10.3f ms, wall %9.3f ms\n", name, stats.timeNs*1e-6, wallMs);
+    printf("%-22s timer irqs %llu, trg irqs %llu, adc reads %llu, isr load %.1f%%, "
+           "max isr %llu ns, overruns %llu\n", "",
+           (unsigned long long)stats.timerIrqs,
+           (unsigned long long)stats.trgIrqs,
+           (unsigned long long)stats.adcReads,
+           stats.timeNs ? 100.0*stats.isrBusyNs/stats.timeNs : 0.0,
+           (unsigned long long)stats.maxIsrNs,
+           (unsigned long long)stats.overruns);
+}
+
+static void printMeasurement(SIM_SPEC_CLASS& spec)
+{
+    int pixels = spec.getTotalPixels();
+    double maxValue = 0, sum = 0;
+    int maxIdx = 0;
+    for (int i=0; i<pixels; i++)
+    {
+        double value = spec.getMeasurement(i, false);
+        sum += value;
+        if (value > maxValue)
+        {
+            maxValue = value;
+            maxIdx = i;
+        }
+    }
+
+    printf("%-22s integ %lu us, max %.6f at %.1f nm, mean %.6f\n", "",
+           (unsigned long)spec.getIntTime(), maxValue,
+           spec.getWavelength(maxIdx), pixels ? sum/pixels : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    // light intensity - sensor output rate at 560nm, volts per second
+    double lightRate = argc > 1 ? atof(argv[1]) : 100.0;
+    int measurements = argc > 2 ? atoi(argv[2]) : 10;
+
+#ifdef SIM_C12666
+    SimSensor sensor(SimSensor::C12666MAConfig());
+    sim_pins_t pins = { CLK_3V, ST_3V, TRG_3V, ADC_REF_SEL_1, ADC_REF_SEL_2, GAIN_3V };
+    SIM_SPEC_CLASS spec(GAIN_3V, EOS_3V, TRG_3V, CLK_3V, ST_3V, ADC_REF_SEL_1, ADC_REF_SEL_2,
+                        ADC_CNV, TRG_CAMERA, NO_PIN, sensor.config().calibration);
+#else
+    SimSensor sensor(SimSensor::C12880MAConfig());
+    sim_pins_t pins = { CLK_3V, ST_3V, TRG_3V, ADC_REF_SEL_1, ADC_REF_SEL_2, NO_PIN };
+    SIM_SPEC_CLASS spec(EOS_3V, TRG_3V, CLK_3V, ST_3V, ADC_REF_SEL_1, ADC_REF_SEL_2,
+                        ADC_CNV, TRG_CAMERA, NO_PIN, sensor.config().calibration, TRG_IN);
+#endif
+
+    // tungsten lamp seen through the silicon sensor response
+    sim_spectrum_t lamp = [lightRate](double wavelength) {
+        return lightRate*sensorResponse(wavelength)*SimSensor::blackbody(wavelength, LAMP_TEMP_K);
+    };
+    sensor.setSpectrum(lamp);
+    SimHardware::get().connect(&sensor, pins);
+
+    startStep();
+    spec.begin();
+    endStep("begin");
+
+    startStep();
+    for (int i=0; i<measurements; i++)
+        spec.takeMeasurement(10 _mSEC);
+    endStep("takeMeasurement x10ms");
+    printMeasurement(spec);
+
+    // free running frames of 30ms - both drivers accumulate as many read
+    // cycles into a frame as fit into the frame time
+    startStep();
+    spec.startContinuous(30 _mSEC);
+    uint32_t frameSeq = 0, frameMs = 0, firstSeq = 0, firstMs = 0;
+#ifndef SIM_C12666
+    uint16_t minReadings = UINT16_MAX, maxReadings = 0;
+#endif
+    for (int i=0; i<measurements; i++)
+    {
+        while (!spec.popFrame(frameSeq, frameMs))
+            delay(1);
+        if (i == 0)
+        {
+            firstSeq = frameSeq;
+            firstMs = frameMs;
+        }
+#ifndef SIM_C12666
+        uint16_t readings = spec.getMeasurementReadings();
+        if (minReadings > readings)
+            minReadings = readings;
+        if (maxReadings < readings)
+            maxReadings = readings;
+#endif
+    }
+    spec.stopContinuous();
+    endStep("continuous frames 30ms");
+    double frameInterval = frameSeq > firstSeq ? (double)(frameMs-firstMs)/(frameSeq-firstSeq) : 0.0;
+    printf("%-22s frames %d, last seq %lu, dropped %lu, frame interval %.1f ms\n", "",
+           measurements, (unsigned long)frameSeq, (unsigned long)spec.getDroppedFrames(),
+           frameInterval);
+    printMeasurement(spec);
+    // free running frames may be dropped as the bench polls in wall time,
+    // the sequence still counts every frame
+    expect("last seq", frameSeq, measurements-1, measurements-1+spec.getDroppedFrames());
+#ifdef SIM_C12666
+    // integration is longer than the frame time
+    expect("frame interval", frameInterval, 30.0, 1000.0);
+#else
+    expectNear("frame interval", frameInterval, 30.0, 2.0);
+    // released frames start from zero - each one has the same readings
+    expect("frame readings", maxReadings, minReadings, minReadings);
+#endif
+
+#ifndef SIM_C12666
+    // frames started by trigger input - second edge of each pair comes
+    // during the frame and is ignored
+    startStep();
+    spec.startContinuous(10 _mSEC, true);
+    uint32_t frames = 0, seq = 0, timeMs = 0;
+    for (int i=0; i<measurements; i++)
+    {
+        SimHardware::get().setInput(TRG_IN, true);
+        SimHardware::get().setInput(TRG_IN, false);
+        SimHardware::get().setInput(TRG_IN, true);
+        SimHardware::get().setInput(TRG_IN, false);
+        while (!spec.popFrame(seq, timeMs))
+            delay(1);
+        ++frames;
+    }
+    spec.stopContinuous();
+    endStep("triggered frames x10ms");
+    printf("%-22s frames %lu, last seq %lu, dropped %lu, missed triggers %lu\n", "",
+           (unsigned long)frames, (unsigned long)seq,
+           (unsigned long)spec.getDroppedFrames(), (unsigned long)spec.getMissedTriggers());
+    printMeasurement(spec);
+    expect("frames", frames, measurements, measurements);
+    expect("last seq", seq, measurements-1, measurements-1);
+    expect("dropped", spec.getDroppedFrames(), 0, 0);
+    expect("missed triggers", spec.getMissedTriggers(), measurements, measurements);
+#endif
+
+    startStep();
+    spec.takeAutoMeasurement();
+    endStep("takeAutoMeasurement");
+    printMeasurement(spec);
+
+    startStep();
+#ifdef SIM_C12666
+    spec.measureSaturationVoltages();
+    endStep("measureSaturation");
+    printf("%-22s saturation %.4f V (no gain), %.4f V (high gain)\n", "",
+           spec.getNoGainSatVoltage(), spec.getHighGainSatVoltage());
+    expectNear("saturation", spec.getNoGainSatVoltage(), sensor.config().satVoltage, 0.02);
+    expectNear("high gain saturation", spec.getHighGainSatVoltage(),
+               sensor.config().satVoltageHighGain, 0.02);
+#else
+    spec.measureSaturationVoltage();
+    endStep("measureSaturation");
+    printf("%-22s saturation %.4f V\n", "", spec.getSatVoltage());
+    expectNear("saturation", spec.getSatVoltage(), sensor.config().satVoltage, 0.02);
+#endif
+
+    // calibration lamp is dimmer so the shortest C12666MA integration is
+    // not saturated - exposure for it is set first, then black levels are
+    // taken without light at the same integration
+    sim_spectrum_t calLamp = [lightRate](double wavelength) {
+        return 0.25*lightRate*sensorResponse(wavelength)*SimSensor::blackbody(wavelength, LAMP_TEMP_K);
+    };
+    sensor.setSpectrum(calLamp);
+    spec.takeAutoMeasurement();
+    sensor.setSpectrum(sim_spectrum_t());
+    spec.takeBlackMeasurement();
+    sensor.setSpectrum(calLamp);
+
+    startStep();
+    spec.calibrateSpectralResponse(LAMP_TEMP_K, false);
+    endStep("calibrateResponse");
+    int pixels = spec.getTotalPixels();
+    printf("%-22s normalisation %.4f %.4f %.4f (first, middle, last)\n", "",
+           spec.getNormalisationCoef(0),
+           spec.getNormalisationCoef(pixels/2),
+           spec.getNormalisationCoef(pixels-1));
+
+    // coefficients undo the sensor response relative to the tungsten
+    // lamp - compared against the middle pixel as the scale comes from
+    // the largest coefficient of a noisy low signal pixel, which is
+    // checked to be 1
+    double maxCoef = 0, peak = 0;
+    for (int i=0; i<pixels; i++)
+    {
+        maxCoef = fmax(maxCoef, spec.getNormalisationCoef(i));
+        peak = fmax(peak, spec.getMeasurement(i, false));
+    }
+    expectNear("max normalisation", maxCoef, 1.0, 1e-6);
+
+    double midWavelength = spec.getWavelength(pixels/2);
+    double midExpected = emvTungst(midWavelength, LAMP_TEMP_K)/sensorResponse(midWavelength);
+    double worstError = 0;
+    for (int i=0; i<pixels; i++)
+    {
+        if (spec.getMeasurement(i, false) < peak*0.25)
+            continue;
+        double wavelength = spec.getWavelength(i);
+        double expected = emvTungst(wavelength, LAMP_TEMP_K)/sensorResponse(wavelength)/midExpected;
+        double relCoef = spec.getNormalisationCoef(i)/spec.getNormalisationCoef(pixels/2);
+        worstError = fmax(worstError, fabs(relCoef/expected - 1));
+    }
+    printf("%-22s normalisation shape error %.2f%%\n", "", worstError*100);
+    expect("normalisation shape error", worstError, 0, 0.04);
+
+    if (failures)
+        printf("%d result(s) outside of expected range\n", failures);
+
+    return failures ? 1 : 0;
+}
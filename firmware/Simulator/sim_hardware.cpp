@@ -0,0 +1,674 @@
+/*
+ *  sim_hardware.cpp - Host simulation of Spectron board (Particle Photon)
+ *                    for running spectrometer drivers off target.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "sim_hardware.h"
+#include <stdio.h>
+#include <chrono>
+
+// Timer peripheral clock for basic timers on Photon
+#define SIM_TIMER_CLOCK_MHZ  60
+
+// Vector table - drivers patch it with 32 bit handler addresses read
+// from SCB->VTOR so the build must not be position independent (-no-pie)
+// to keep the table and the code in the low 4GB
+static uint32_t simVectorTable[128];
+
+// ADC reference voltages selected by the reference pins
+static const double simAdcVoltages[] = { 2.5, 3.0, 4.096, 5.0 };
+
+// STM32 pin numbers within the port for Photon pins - these select EXTI
+// lines (D0-D7, 8-9 unused, A0-A7, RX, TX, 20-23 unused)
+static const uint8_t simPinSources[TOTAL_PINS] = {
+    7, 6, 5, 4, 3, 15, 14, 13,
+    0, 0,
+    5, 3, 2, 5, 6, 7, 4, 0,
+    10, 9,
+    0, 0, 0, 0
+};
+
+TIM_TypeDef  simTIM7;
+EXTI_TypeDef simEXTI;
+SPI_TypeDef  simSPI1;
+DMA_Stream_TypeDef simDMA2Stream0;
+SCB_Type     simSCB = { (uint32_t)(uintptr_t)simVectorTable };
+RCC_TypeDef  simRCC;
+DWT_Type     simDWT;
+CoreDebug_Type simCoreDebug;
+GPIO_TypeDef simGPIOA, simGPIOB, simGPIOC, simGPIOD;
+
+SystemClass  System;
+EEPROMClass  EEPROM;
+SPIClass     SPI;
+CloudClass   Particle;
+
+// ------------------------------
+//   Simulated board
+// ------------------------------
+SimHardware& SimHardware::get()
+{
+    static SimHardware hardware;
+    return hardware;
+}
+
+SimHardware::SimHardware()
+    : sensor_(0),
+      statsStartNs_(0),
+      clkLevel_(false),
+      stLevel_(false),
+      trgHigh_(false),
+      timerIdle_(false),
+      tickNs_(0),
+      isrNs_(0),
+      timeNs_(0),
+      running_(true),
+      primask_(0)
+{
+    if ((uintptr_t)simVectorTable > UINT32_MAX)
+    {
+        fprintf(stderr, "Simulator: vector table is not 32 bit addressable, build with -no-pie\n");
+        abort();
+    }
+
+    memset(ports_, 0, sizeof(ports_));
+    memset(nvic_, 0, sizeof(nvic_));
+    memset(&stats_, 0, sizeof(stats_));
+    memset(&pins_, 0xFF, sizeof(pins_));
+
+    for (int i=0; i<TOTAL_PINS; i++)
+    {
+        memset(&pinMap_[i], 0, sizeof(STM32_Pin_Info));
+        pinMap_[i].gpio_peripheral = &ports_[i];
+        pinMap_[i].gpio_pin_source = simPinSources[i];
+        pinMap_[i].gpio_pin        = 1 << simPinSources[i];
+        pinMap_[i].pin_mode        = PIN_MODE_NONE;
+    }
+
+    // ADC sample is clocked in on the read, so SPI always has received data
+    SPI1->SR = SPI_I2S_FLAG_RXNE;
+
+    timing_.timerIsrNs = 400;
+    timing_.trgIsrNs   = 400;
+    timing_.spiReadNs  = 600;
+
+    thread_ = std::thread(&SimHardware::run, this);
+}
+
+SimHardware::~SimHardware()
+{
+    running_ = false;
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void SimHardware::connect(SimSensor* sensor, const sim_pins_t& pins)
+{
+    std::lock_guard<std::mutex> lock(irqLock_);
+    sensor_ = sensor;
+    pins_ = pins;
+}
+
+void SimHardware::resetStats()
+{
+    std::lock_guard<std::mutex> lock(irqLock_);
+    memset(&stats_, 0, sizeof(stats_));
+    statsStartNs_ = timeNs_;
+}
+
+sim_stats_t SimHardware::getStats()
+{
+    std::lock_guard<std::mutex> lock(irqLock_);
+    sim_stats_t stats = stats_;
+    stats.timeNs = timeNs_ - statsStartNs_;
+    return stats;
+}
+
+// CPU cycle counter - interrupt code sees time passing within the tick
+uint32_t SimHardware::cycles()
+{
+    uint64_t ns = timeNs_;
+    if (onIsrThread())
+        ns += isrNs_;
+
+    return (uint32_t)(ns*System.ticksPerMicrosecond()/1000);
+}
+
+void SimHardware::setPin(pin_t pin, bool high)
+{
+    if (pin >= TOTAL_PINS)
+        return;
+
+    GPIO_TypeDef* port = pinMap_[pin].gpio_peripheral;
+    if (high)
+        port->ODR |= pinMap_[pin].gpio_pin;
+    else
+        port->ODR &= ~pinMap_[pin].gpio_pin;
+
+    if (pin != pins_.trg)
+        port->IDR = port->ODR;
+
+    // sensor sees CLK and ST set by the driver outside of interrupts straight
+    // away, interrupt writes are passed to it at the end of the tick
+    if ((pin == pins_.clk || pin == pins_.st) && !onIsrThread())
+    {
+        if (primask_)
+            sensorEdges();
+        else
+        {
+            std::lock_guard<std::mutex> lock(irqLock_);
+            sensorEdges();
+        }
+    }
+}
+
+// External signal on input pin - rising edge raises EXTI interrupt if
+// enabled, as if it came in at the current virtual time
+void SimHardware::setInput(pin_t pin, bool high)
+{
+    if (pin >= TOTAL_PINS)
+        return;
+
+    std::lock_guard<std::mutex> lock(irqLock_);
+
+    STM32_Pin_Info& info = pinMap_[pin];
+    bool rising = high && !(info.gpio_peripheral->IDR & info.gpio_pin);
+    if (high)
+        info.gpio_peripheral->IDR |= info.gpio_pin;
+    else
+        info.gpio_peripheral->IDR &= ~info.gpio_pin;
+
+    if (rising && (EXTI->IMR & EXTI->RTSR & info.gpio_pin))
+        raiseLine(info.gpio_pin_source);
+    wakeTimer();
+}
+
+bool SimHardware::getPin(pin_t pin)
+{
+    if (pin >= TOTAL_PINS)
+        return false;
+
+    return (pinMap_[pin].gpio_peripheral->IDR & pinMap_[pin].gpio_pin) != 0;
+}
+
+// Wait in virtual time. When the timer is running the time is advanced
+// by the interrupt thread, otherwise it is advanced straight away. The
+// timer is not held while waiting - a tick without pin changes does not
+// mean the driver has nothing more to do within the delay.
+void SimHardware::delayNs(uint64_t ns)
+{
+    uint64_t target = timeNs_ + ns;
+    while (timeNs_ < target)
+    {
+        if (timerRunning())
+        {
+            wakeTimer();
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(irqLock_);
+            if (timeNs_ < target)
+                timeNs_ = target;
+        }
+    }
+}
+
+void SimHardware::cpuDelay(uint32_t cpuTicks)
+{
+    uint64_t ns = (uint64_t)cpuTicks*1000/System.ticksPerMicrosecond();
+    if (onIsrThread())
+        addIsrTime(ns);
+    else
+        delayNs(ns);
+}
+
+// AD7980 conversion result of the sensor video output
+uint16_t SimHardware::adcRead()
+{
+    if (onIsrThread())
+    {
+        ++stats_.adcReads;
+        addIsrTime(timing_.spiReadNs);
+    }
+
+    if (!sensor_)
+        return 0;
+
+    int ref = (getPin(pins_.adcRefSel1) ? 1 : 0) | (getPin(pins_.adcRefSel2) ? 2 : 0);
+    double code = sensor_->videoOutput()/simAdcVoltages[ref]*65536.0;
+    if (code <= 0)
+        return 0;
+    if (code >= UINT16_MAX)
+        return UINT16_MAX;
+
+    return (uint16_t)code;
+}
+
+void SimHardware::nvicEnable(uint8_t irq, bool enable)
+{
+    if (irq < sizeof(nvic_))
+        nvic_[irq] = enable;
+}
+
+// Wait for the interrupt being executed to finish. On the target interrupts
+// preempt the driver code, so once the timer is disabled no timer interrupt
+// code runs concurrently with it.
+void SimHardware::waitIsr()
+{
+    if (onIsrThread() || primask_)
+        return;
+
+    std::lock_guard<std::mutex> lock(irqLock_);
+}
+
+void SimHardware::disableIrq()
+{
+    if (onIsrThread() || primask_)
+        return;
+
+    irqLock_.lock();
+    primask_ = 1;
+}
+
+void SimHardware::enableIrq()
+{
+    if (onIsrThread() || !primask_)
+        return;
+
+    primask_ = 0;
+    irqLock_.unlock();
+}
+
+// Interrupt thread - one timer update per loop while the timer runs
+void SimHardware::run()
+{
+    isrThreadId_ = std::this_thread::get_id();
+
+    while (running_)
+    {
+        if (timerRunning() && !timerIdle_)
+            tick();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+}
+
+bool SimHardware::timerRunning()
+{
+    return (TIM7->CR1 & TIM_CR1_CEN) && (TIM7->DIER & TIM_IT_Update) && nvic_[TIM7_IRQn];
+}
+
+void SimHardware::tick()
+{
+    std::lock_guard<std::mutex> lock(irqLock_);
+
+    // timer may have been stopped while waiting for the lock
+    if (!timerRunning())
+        return;
+
+    tickNs_ = (uint64_t)(TIM7->ARR+1)*(TIM7->PSC+1)*1000/SIM_TIMER_CLOCK_MHZ;
+    isrNs_ = 0;
+
+    // TRG follows CLK and goes down with it
+    if (trgHigh_)
+    {
+        trgHigh_ = false;
+        pinMap_[pins_.trg].gpio_peripheral->IDR &= ~pinMap_[pins_.trg].gpio_pin;
+    }
+
+    TIM7->SR |= TIM_IT_Update;
+    ++stats_.timerIrqs;
+    callVector(TIM7_IRQn);
+    isrNs_ += timing_.timerIsrNs;
+
+    applyPortWrites();
+    bool clk = clkLevel_, st = stLevel_;
+    sensorEdges();
+    timerIdle_ = clk == clkLevel_ && st == stLevel_;
+
+    // software interrupts
+    uint32_t pending = EXTI->SWIER & EXTI->IMR;
+    EXTI->SWIER = 0;
+    for (uint8_t line=0; pending; line++, pending >>= 1)
+        if (pending & 1)
+            raiseLine(line);
+
+    stats_.isrBusyNs += isrNs_;
+    if (stats_.maxIsrNs < isrNs_)
+        stats_.maxIsrNs = isrNs_;
+    if (isrNs_ > tickNs_)
+        ++stats_.overruns;
+
+    timeNs_ += tickNs_;
+}
+
+void SimHardware::callVector(uint8_t irq)
+{
+    uint32_t* isrs = (uint32_t*)(uintptr_t)SCB->VTOR;
+    uint32_t handler = isrs[irq + 0x10];
+    if (handler)
+        ((void (*)(void))(uintptr_t)handler)();
+}
+
+// Apply bit set/reset register writes done by interrupts
+void SimHardware::applyPortWrites()
+{
+    for (int i=0; i<TOTAL_PINS; i++)
+    {
+        GPIO_TypeDef& port = ports_[i];
+        if (port.BSRRL || port.BSRRH)
+        {
+            port.ODR = (port.ODR | port.BSRRL) & ~(uint32_t)port.BSRRH;
+            port.BSRRL = port.BSRRH = 0;
+            if (i != pins_.trg)
+                port.IDR = port.ODR;
+        }
+    }
+}
+
+// Pass CLK and ST changes to the sensor and raise TRG
+void SimHardware::sensorEdges()
+{
+    if (!sensor_)
+        return;
+
+    bool st = getPin(pins_.st);
+    if (st != stLevel_)
+    {
+        stLevel_ = st;
+        sensor_->setHighGain(getPin(pins_.gain));
+        sensor_->stEdge(st, timeNs_);
+    }
+
+    bool clk = getPin(pins_.clk);
+    if (clk != clkLevel_)
+    {
+        clkLevel_ = clk;
+        if (clk && sensor_->clockRising(timeNs_) && pins_.trg < TOTAL_PINS)
+        {
+            STM32_Pin_Info& trg = pinMap_[pins_.trg];
+            trg.gpio_peripheral->IDR |= trg.gpio_pin;
+            trgHigh_ = true;
+            if (EXTI->IMR & EXTI->RTSR & trg.gpio_pin)
+                raiseLine(trg.gpio_pin_source);
+        }
+    }
+}
+
+// Interrupt work takes time - TRG pulse ends one tick after it started
+void SimHardware::addIsrTime(uint64_t ns)
+{
+    isrNs_ += ns;
+    if (trgHigh_ && isrNs_ >= tickNs_)
+    {
+        trgHigh_ = false;
+        pinMap_[pins_.trg].gpio_peripheral->IDR &= ~pinMap_[pins_.trg].gpio_pin;
+    }
+}
+
+// Set EXTI line pending and call its handler if enabled in NVIC
+void SimHardware::raiseLine(uint8_t line)
+{
+    uint8_t irq;
+    if (line < 5)
+        irq = EXTI0_IRQn + line;
+    else if (line < 10)
+        irq = EXTI9_5_IRQn;
+    else
+        irq = EXTI15_10_IRQn;
+
+    EXTI->PR.set(1 << line);
+    if (nvic_[irq])
+    {
+        ++stats_.trgIrqs;
+        addIsrTime(timing_.trgIsrNs);
+        callVector(irq);
+    }
+}
+
+// ------------------------------
+//   STM32 shims
+// ------------------------------
+SimSPIData::operator uint16_t()
+{
+    return SimHardware::get().adcRead();
+}
+
+// Write clocks out the next sample - with RX DMA enabled it is deposited
+// by DMA2 stream 0 (SPI1 RX) into the memory buffer
+SimSPIData& SimSPIData::operator=(uint16_t)
+{
+    DMA_Stream_TypeDef* stream = DMA2_Stream0;
+    if (!(SPI1->CR2 & SPI_CR2_RXDMAEN) || !(stream->CR & DMA_SxCR_EN) || stream->NDTR == 0)
+        return *this;
+
+    uint16_t* memory = (uint16_t*)(uintptr_t)stream->M0AR;
+    memory[stream->simSize - stream->NDTR] = SimHardware::get().adcRead();
+
+    // circular mode reloads the counter, otherwise the stream stops
+    if (--stream->NDTR == 0)
+    {
+        if (stream->CR & DMA_Mode_Circular)
+            stream->NDTR = stream->simSize;
+        else
+            stream->CR &= ~DMA_SxCR_EN;
+    }
+
+    return *this;
+}
+
+SimCycleCounter::operator uint32_t()
+{
+    return SimHardware::get().cycles();
+}
+
+void TIM_TimeBaseInit(TIM_TypeDef* TIMx, TIM_TimeBaseInitTypeDef* init)
+{
+    SimHardware::get().wakeTimer();
+    TIMx->PSC = init->TIM_Prescaler;
+    TIMx->ARR = init->TIM_Period;
+    TIMx->CNT = 0;
+}
+
+void TIM_ITConfig(TIM_TypeDef* TIMx, uint16_t it, FunctionalState state)
+{
+    if (state == ENABLE)
+        TIMx->DIER |= it;
+    else
+        TIMx->DIER &= ~(uint32_t)it;
+}
+
+void TIM_Cmd(TIM_TypeDef* TIMx, FunctionalState state)
+{
+    SimHardware::get().wakeTimer();
+    if (state == ENABLE)
+        TIMx->CR1 |= TIM_CR1_CEN;
+    else
+    {
+        TIMx->CR1 &= ~(uint32_t)TIM_CR1_CEN;
+        SimHardware::get().waitIsr();
+    }
+}
+
+void TIM_DeInit(TIM_TypeDef* TIMx)
+{
+    SimHardware::get().wakeTimer();
+    SimHardware::get().waitIsr();
+    memset((void*)TIMx, 0, sizeof(TIM_TypeDef));
+}
+
+void NVIC_Init(NVIC_InitTypeDef* init)
+{
+    SimHardware::get().wakeTimer();
+    SimHardware::get().nvicEnable(init->NVIC_IRQChannel, init->NVIC_IRQChannelCmd == ENABLE);
+    if (init->NVIC_IRQChannelCmd != ENABLE)
+        SimHardware::get().waitIsr();
+}
+
+void DMA_DeInit(DMA_Stream_TypeDef* stream)
+{
+    memset((void*)stream, 0, sizeof(DMA_Stream_TypeDef));
+}
+
+void DMA_StructInit(DMA_InitTypeDef* init)
+{
+    memset(init, 0, sizeof(DMA_InitTypeDef));
+}
+
+void DMA_Init(DMA_Stream_TypeDef* stream, DMA_InitTypeDef* init)
+{
+    stream->CR = init->DMA_Channel | init->DMA_DIR | init->DMA_PeripheralInc
+                 | init->DMA_MemoryInc | init->DMA_PeripheralDataSize
+                 | init->DMA_MemoryDataSize | init->DMA_Mode | init->DMA_Priority;
+    stream->NDTR = init->DMA_BufferSize;
+    stream->PAR = init->DMA_PeripheralBaseAddr;
+    stream->M0AR = init->DMA_Memory0BaseAddr;
+    stream->simSize = init->DMA_BufferSize;
+}
+
+void DMA_Cmd(DMA_Stream_TypeDef* stream, FunctionalState state)
+{
+    if (state == ENABLE)
+        stream->CR |= DMA_SxCR_EN;
+    else
+        stream->CR &= ~DMA_SxCR_EN;
+}
+
+void RCC_AHB1PeriphClockCmd(uint32_t periph, FunctionalState state)
+{
+    if (state == ENABLE)
+        RCC->AHB1ENR |= periph;
+    else
+        RCC->AHB1ENR &= ~periph;
+}
+
+void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state)
+{
+    if (state == ENABLE)
+        RCC->APB1ENR |= periph;
+    else
+        RCC->APB1ENR &= ~periph;
+}
+
+void RCC_APB2PeriphResetCmd(uint32_t periph, FunctionalState state)
+{
+    if (state == ENABLE)
+        RCC->APB2RSTR |= periph;
+    else
+        RCC->APB2RSTR &= ~periph;
+}
+
+void GPIO_PinAFConfig(GPIO_TypeDef*, uint16_t, uint8_t)
+{
+}
+
+void SYSCFG_EXTILineConfig(uint8_t, uint8_t)
+{
+}
+
+uint32_t __get_PRIMASK()
+{
+    return SimHardware::get().primask();
+}
+
+void __disable_irq()
+{
+    SimHardware::get().disableIrq();
+}
+
+void __enable_irq()
+{
+    SimHardware::get().enableIrq();
+}
+
+// ------------------------------
+//   Particle shims
+// ------------------------------
+STM32_Pin_Info* HAL_Pin_Map()
+{
+    return SimHardware::get().pinMap();
+}
+
+void HAL_Pin_Mode(pin_t pin, PinMode mode)
+{
+    if (pin < TOTAL_PINS)
+        SimHardware::get().pinMap()[pin].pin_mode = mode;
+}
+
+void pinMode(pin_t pin, PinMode mode)
+{
+    HAL_Pin_Mode(pin, mode);
+}
+
+void pinSetFast(pin_t pin)
+{
+    SimHardware::get().setPin(pin, true);
+}
+
+void pinResetFast(pin_t pin)
+{
+    SimHardware::get().setPin(pin, false);
+}
+
+int32_t pinReadFast(pin_t pin)
+{
+    return SimHardware::get().getPin(pin);
+}
+
+void digitalWrite(pin_t pin, uint8_t value)
+{
+    SimHardware::get().setPin(pin, value != 0);
+}
+
+int32_t digitalRead(pin_t pin)
+{
+    return SimHardware::get().getPin(pin);
+}
+
+uint32_t millis()
+{
+    return (uint32_t)(SimHardware::get().timeNs()/1000000);
+}
+
+uint32_t micros()
+{
+    return (uint32_t)(SimHardware::get().timeNs()/1000);
+}
+
+void delay(uint32_t ms)
+{
+    SimHardware::get().delayNs((uint64_t)ms*1000000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    SimHardware::get().delayNs((uint64_t)us*1000);
+}
+
+uint32_t SystemClass::ticks()
+{
+    return SimHardware::get().cycles();
+}
+
+void SystemClass::ticksDelay(uint32_t ticks)
+{
+    SimHardware::get().cpuDelay(ticks);
+}
@@ -0,0 +1,142 @@
+/*
+ *  sim_hardware.h - Host simulation of Spectron board (Particle Photon) for
+ *                  running spectrometer drivers off target. Simulated
+ *                  interrupts run in a separate thread in virtual time.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_HARDWARE_H_)
+#define _SIM_HARDWARE_H_
+
+#include "application.h"
+#include "sim_sensor.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Sensor and ADC pins connected to the simulated sensor
+struct sim_pins_t {
+    pin_t clk;
+    pin_t st;
+    pin_t trg;
+    pin_t adcRefSel1;
+    pin_t adcRefSel2;
+    pin_t gain;         // NO_PIN if sensor has no gain control
+};
+
+// Modelled interrupt durations, ns. Defaults are set so that at the
+// default 156KHz sensor clock two ADC reads fit into one TRG pulse as
+// observed on Photon.
+struct sim_timing_t {
+    uint32_t timerIsrNs;    // timer interrupt, before TRG interrupt can start
+    uint32_t trgIsrNs;      // TRG interrupt entry and dispatch
+    uint32_t spiReadNs;     // AD7980 16 bit SPI read
+};
+
+// Counters since the last resetStats()
+struct sim_stats_t {
+    uint64_t timeNs;        // virtual time passed
+    uint64_t timerIrqs;     // timer interrupts
+    uint64_t trgIrqs;       // TRG (or software) interrupts
+    uint64_t adcReads;      // ADC conversions read
+    uint64_t isrBusyNs;     // modelled time spent in interrupts
+    uint64_t maxIsrNs;      // longest modelled timer tick processing
+    uint64_t overruns;      // ticks where interrupt work spilled into the next tick
+};
+
+//
+// Simulated board. Registers are plain memory written by the driver,
+// the interrupt thread emulates TIM7 updates by calling the vector
+// table entry, applies GPIO writes, feeds CLK and ST edges to the sensor
+// and raises EXTI interrupts for TRG edges (or software interrupts).
+// Virtual time advances by the timer period on every tick, so the results
+// do not depend on host speed. When a tick does not change sensor pins
+// (stopped sensor clock) the timer is held until the driver touches the
+// hardware again - this stands for the driver polling loop noticing the
+// state change immediately.
+//
+class SimHardware {
+public:
+    static SimHardware& get();
+
+    // Connect sensor model - must be done before driver begin()
+    void connect(SimSensor* sensor, const sim_pins_t& pins);
+
+    sim_timing_t& timing() { return timing_; }
+
+    uint64_t timeNs() { return timeNs_; }
+    uint32_t cycles();
+    void resetStats();
+    sim_stats_t getStats();
+
+    // Board side used by Particle and STM32 shims
+    STM32_Pin_Info* pinMap() { return pinMap_; }
+    void setPin(pin_t pin, bool high);
+    void setInput(pin_t pin, bool high);
+    bool getPin(pin_t pin);
+    void delayNs(uint64_t ns);
+    void cpuDelay(uint32_t cpuTicks);
+    uint16_t adcRead();
+    void nvicEnable(uint8_t irq, bool enable);
+    void wakeTimer() { timerIdle_ = false; }
+    void waitIsr();
+    uint32_t primask() { return primask_; }
+    void disableIrq();
+    void enableIrq();
+
+private:
+    SimHardware();
+    ~SimHardware();
+
+    void run();
+    bool timerRunning();
+    void tick();
+    void callVector(uint8_t irq);
+    void applyPortWrites();
+    void sensorEdges();
+    void addIsrTime(uint64_t ns);
+    void raiseLine(uint8_t line);
+    bool onIsrThread() { return std::this_thread::get_id() == isrThreadId_; }
+
+    STM32_Pin_Info pinMap_[TOTAL_PINS];
+    GPIO_TypeDef   ports_[TOTAL_PINS];
+    bool           nvic_[128];
+
+    SimSensor*     sensor_;
+    sim_pins_t     pins_;
+    sim_timing_t   timing_;
+    sim_stats_t    stats_;
+    uint64_t       statsStartNs_;
+    bool           clkLevel_;
+    bool           stLevel_;
+    bool           trgHigh_;
+    volatile bool  timerIdle_;      // sensor clock stopped, wait for the driver
+    uint64_t       tickNs_;         // current tick period
+    uint64_t       isrNs_;          // modelled interrupt time in current tick
+
+    std::atomic<uint64_t> timeNs_;
+    std::atomic<bool>     running_;
+    std::mutex            irqLock_;
+    uint32_t              primask_;
+    std::thread           thread_;
+    std::thread::id       isrThreadId_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ *  sim_sensor.cpp - Virtual Hamamatsu micro spectrometer sensor for the host
+ *                  simulator.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "sim_sensor.h"
+#include <math.h>
+
+// second radiation constant, nm*K
+#define PLANCK_C2   1.4388e7
+
+SimSensor::SimSensor(const sim_sensor_config_t& config, uint32_t seed)
+    : config_(config),
+      rate_(config.pixels, 0.0),
+      frame_(config.pixels, config.darkVoltage),
+      highGain_(false),
+      stRiseNs_(0),
+      stFallNs_(0),
+      clkRiseNs_(0),
+      clkPeriodNs_(0),
+      clocks_(0),
+      exposure_(0),
+      rng_(seed),
+      noise_(0.0, 1.0)
+{
+}
+
+sim_sensor_config_t SimSensor::C12880MAConfig()
+{
+    // 16H00851 sensor calibration, datasheet timing and typical levels
+    sim_sensor_config_t config = {
+        288, true, true, 48, 89, 1,
+        { 305.0440912, 2.715822498, -1.072966469E-03,
+          -8.897283237E-06, 1.519598265E-08, -4.899202027E-12 },
+        0.5, 0.05, 4.6, 4.6, 1.0, 20e-6, 0.001
+    };
+    return config;
+}
+
+sim_sensor_config_t SimSensor::C12666MAConfig()
+{
+    // 15F00163 sensor calibration, datasheet timing and typical levels
+    sim_sensor_config_t config = {
+        256, false, false, 0, 4, 4,
+        { 323.3668711, 2.384682045, -5.995865297E-4,
+          -8.602293347E-6, 1.840343099E-8, -1.424592223E-11 },
+        0.3, 0.02, 2.0, 3.2, 4.0, 10e-6, 0.001
+    };
+    return config;
+}
+
+double SimSensor::blackbody(double wavelength, double tempK)
+{
+    if (wavelength <= 0 || tempK <= 0)
+        return 0;
+
+    double ref = pow(560.0, 5)*(exp(PLANCK_C2/(560.0*tempK)) - 1);
+    return ref/(pow(wavelength, 5)*(exp(PLANCK_C2/(wavelength*tempK)) - 1));
+}
+
+double SimSensor::wavelength(int pixelIdx) const
+{
+    double p = pixelIdx+1;
+    const double* c = config_.calibration;
+    return c[0] + p*(c[1] + p*(c[2] + p*(c[3] + p*(c[4] + p*c[5]))));
+}
+
+void SimSensor::setSpectrum(const sim_spectrum_t& spectrum)
+{
+    for (int i=0; i<config_.pixels; i++)
+    {
+        double rate = spectrum ? spectrum(wavelength(i)) : 0;
+        rate_[i] = rate > 0 ? rate : 0;
+    }
+}
+
+void SimSensor::setHighGain(bool highGain)
+{
+    highGain_ = highGain;
+}
+
+// Freeze accumulated charge of all pixels into video output levels
+void SimSensor::capture(double exposure)
+{
+    double gain = highGain_ ? config_.highGainFactor : 1.0;
+    double satVoltage = highGain_ ? config_.satVoltageHighGain : config_.satVoltage;
+
+    exposure_ = exposure;
+    for (int i=0; i<config_.pixels; i++)
+    {
+        double signal = (rate_[i]*gain + config_.darkCurrent)*exposure;
+        if (config_.voltsPerElectron > 0 && signal > 0)
+            signal += noise_(rng_)*sqrt(signal*config_.voltsPerElectron*gain);
+
+        if (response_)
+            signal = response_(signal);
+
+        double value = config_.darkVoltage + signal;
+        if (value > satVoltage)
+            value = satVoltage;
+        frame_[i] = value < 0 ? 0 : value;
+    }
+}
+
+void SimSensor::stEdge(bool high, uint64_t timeNs)
+{
+    if (high)
+    {
+        stRiseNs_ = timeNs;
+        return;
+    }
+
+    // ST fall ends integration and starts video readout
+    double exposure;
+    if (config_.integrateStHigh)
+        exposure = (timeNs - stRiseNs_ + config_.integExtraClocks*clkPeriodNs_)*1e-9;
+    else
+        exposure = (timeNs - stFallNs_)*1e-9;
+
+    stFallNs_ = timeNs;
+    clocks_ = 0;
+    capture(exposure);
+}
+
+bool SimSensor::clockRising(uint64_t timeNs)
+{
+    if (clkRiseNs_ && timeNs > clkRiseNs_)
+        clkPeriodNs_ = timeNs - clkRiseNs_;
+    clkRiseNs_ = timeNs;
+    ++clocks_;
+
+    return config_.hasTrg;
+}
+
+double SimSensor::videoOutput()
+{
+    double value = config_.darkVoltage;
+    if (clocks_ >= config_.videoStartClock)
+    {
+        uint32_t pixel = (clocks_ - config_.videoStartClock)/config_.clocksPerPixel;
+        if (pixel < (uint32_t)config_.pixels)
+            value = frame_[pixel];
+    }
+
+    return value + noise_(rng_)*config_.readNoise;
+}
@@ -0,0 +1,114 @@
+/*
+ *  sim_sensor.h - Virtual Hamamatsu micro spectrometer sensor for the host
+ *                simulator. Produces video output (and TRG pulses) from
+ *                CLK and ST signals with configurable spectrum, noise
+ *                and saturation model.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_SENSOR_H_)
+#define _SIM_SENSOR_H_
+
+#include <stdint.h>
+#include <vector>
+#include <random>
+#include <functional>
+
+// Sensor model parameters. Timing is in CLK cycles counted from ST signal
+// edges the same way as in Hamamatsu datasheets.
+struct sim_sensor_config_t {
+    int      pixels;             // number of pixels
+    bool     hasTrg;             // sensor outputs TRG pulse on each CLK rising edge
+    bool     integrateStHigh;    // integration is ST high period (C12880), otherwise
+                                 // the period between ST falling edges (C12666)
+    uint32_t integExtraClocks;   // CLK cycles added to ST high period
+    uint32_t videoStartClock;    // CLK rising edge after ST fall with the first pixel
+    uint32_t clocksPerPixel;     // CLK cycles per pixel on video output
+    double   calibration[6];     // wavelength calibration, pixel numbers start with 1
+    double   darkVoltage;        // video output without light, volts
+    double   darkCurrent;        // dark output increase, volts per second
+    double   satVoltage;         // saturation output voltage
+    double   satVoltageHighGain; // saturation output voltage with high gain
+    double   highGainFactor;     // sensitivity multiplier with high gain
+    double   voltsPerElectron;   // conversion gain - sets shot noise, 0 for none
+    double   readNoise;          // video and ADC noise per conversion, volts RMS
+};
+
+// Light spectrum falling on the sensor as output increase rate (volts
+// per second of integration) for the wavelength in nm. This includes
+// sensor spectral response.
+typedef std::function<double(double)> sim_spectrum_t;
+
+// Sensor output signal above dark voltage for the signal of the ideal
+// linear sensor, both in volts
+typedef std::function<double(double)> sim_response_t;
+
+class SimSensor {
+public:
+    SimSensor(const sim_sensor_config_t& config, uint32_t seed = 1);
+
+    // Typical parameters of the sensors used on Spectron boards
+    static sim_sensor_config_t C12880MAConfig();
+    static sim_sensor_config_t C12666MAConfig();
+
+    // Planck spectrum normalised to 1 at 560nm - scale it for the
+    // light intensity and multiply by sensor response as needed
+    static double blackbody(double wavelength, double tempK);
+
+    // Set light on the sensor. This should be called between
+    // measurements as it is not synchronised with the readout.
+    void setSpectrum(const sim_spectrum_t& spectrum);
+
+    // Set output response to model sensor non-linearity - the sensor
+    // is linear up to saturation if not set
+    void setResponse(const sim_response_t& response) { response_ = response; }
+
+    // Reseed noise generator for reproducible runs
+    void seed(uint32_t seed) { rng_.seed(seed); }
+
+    const sim_sensor_config_t& config() const { return config_; }
+    double wavelength(int pixelIdx) const;
+    double lastExposure() const { return exposure_; }
+
+    // Sensor signals driven by simulated board
+    void setHighGain(bool highGain);
+    void stEdge(bool high, uint64_t timeNs);
+    bool clockRising(uint64_t timeNs);
+    double videoOutput();
+
+private:
+    void capture(double exposure);
+
+    sim_sensor_config_t config_;
+    std::vector<double> rate_;      // output increase rate per pixel
+    std::vector<double> frame_;     // captured video output per pixel
+    sim_response_t      response_;  // non-linear output response
+    bool     highGain_;
+    uint64_t stRiseNs_;             // last ST rising edge
+    uint64_t stFallNs_;             // last ST falling edge
+    uint64_t clkRiseNs_;            // last CLK rising edge
+    uint64_t clkPeriodNs_;          // CLK period measured from the edges
+    uint32_t clocks_;               // CLK rising edges since ST fall
+    double   exposure_;             // last captured frame exposure, seconds
+
+    std::mt19937 rng_;
+    std::normal_distribution<double> noise_;
+};
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ *  stm32f2xx.h - Host simulation of the STM32F2xx registers and standard
+ *                peripheral library calls used by Spectron spectrometer
+ *                drivers. Only what the drivers touch is here - TIM7,
+ *                EXTI, SPI1, DMA2, SCB, RCC, GPIO and NVIC.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_SIM_STM32F2XX_H_)
+#define _SIM_STM32F2XX_H_
+
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+typedef enum { RESET = 0, SET = !RESET } FlagStatus, ITStatus;
+
+// IRQ numbers (vector table index is IRQ number + 16)
+typedef enum {
+    EXTI0_IRQn      = 6,
+    EXTI1_IRQn      = 7,
+    EXTI2_IRQn      = 8,
+    EXTI3_IRQn      = 9,
+    EXTI4_IRQn      = 10,
+    EXTI9_5_IRQn    = 23,
+    EXTI15_10_IRQn  = 40,
+    TIM7_IRQn       = 55
+} IRQn_Type;
+
+// ------------------------------
+//   Registers
+// ------------------------------
+// Plain registers are simple memory, the ones with side effects are
+// proxies implemented by the simulator (sim_hardware.cpp).
+
+// SPI data register - reading it returns the next AD7980 sample
+class SimSPIData {
+public:
+    operator uint16_t();
+    SimSPIData& operator=(uint16_t value);
+};
+
+// DWT cycle counter - CPU cycles of the virtual time including the
+// modelled time of the interrupt being executed
+class SimCycleCounter {
+public:
+    operator uint32_t();
+    SimCycleCounter& operator=(uint32_t) { return *this; }
+};
+
+// EXTI pending register - writing 1 clears the bit
+class SimPendingReg {
+public:
+    SimPendingReg() : bits_(0) {}
+    operator uint32_t() const { return bits_; }
+    SimPendingReg& operator=(uint32_t clearBits) { bits_ &= ~clearBits; return *this; }
+    void set(uint32_t bits) { bits_ |= bits; }
+
+private:
+    volatile uint32_t bits_;
+};
+
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint16_t BSRRL;
+    __IO uint16_t BSRRH;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SMCR;
+    __IO uint32_t DIER;
+    __IO uint32_t SR;
+    __IO uint32_t EGR;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+} TIM_TypeDef;
+
+typedef struct {
+    __IO uint32_t IMR;
+    __IO uint32_t EMR;
+    __IO uint32_t RTSR;
+    __IO uint32_t FTSR;
+    __IO uint32_t SWIER;
+    SimPendingReg PR;
+} EXTI_TypeDef;
+
+typedef struct {
+    __IO uint16_t CR1;
+    __IO uint16_t CR2;
+    __IO uint16_t SR;
+    SimSPIData    DR;
+    __IO uint16_t CRCPR;
+    __IO uint16_t RXCRCR;
+    __IO uint16_t TXCRCR;
+    __IO uint16_t I2SCFGR;
+    __IO uint16_t I2SPR;
+} SPI_TypeDef;
+
+// DMA stream - simSize keeps the transfer count NDTR is reloaded
+// from in circular mode
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t NDTR;
+    __IO uint32_t PAR;
+    __IO uint32_t M0AR;
+    __IO uint32_t M1AR;
+    __IO uint32_t FCR;
+    uint32_t      simSize;
+} DMA_Stream_TypeDef;
+
+typedef struct {
+    __IO uint32_t VTOR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t   CTRL;
+    SimCycleCounter CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    __IO uint32_t AHB1ENR;
+    __IO uint32_t APB1ENR;
+    __IO uint32_t APB2ENR;
+    __IO uint32_t APB1RSTR;
+    __IO uint32_t APB2RSTR;
+} RCC_TypeDef;
+
+extern TIM_TypeDef  simTIM7;
+extern EXTI_TypeDef simEXTI;
+extern SPI_TypeDef  simSPI1;
+extern DMA_Stream_TypeDef simDMA2Stream0;
+extern SCB_Type     simSCB;
+extern RCC_TypeDef  simRCC;
+extern DWT_Type     simDWT;
+extern CoreDebug_Type simCoreDebug;
+extern GPIO_TypeDef simGPIOA, simGPIOB, simGPIOC, simGPIOD;
+
+#define TIM7        (&simTIM7)
+#define EXTI        (&simEXTI)
+#define SPI1_BASE   (&simSPI1)
+#define SPI1        (&simSPI1)
+#define DMA2_Stream0 (&simDMA2Stream0)
+#define SCB         (&simSCB)
+#define RCC         (&simRCC)
+#define DWT         (&simDWT)
+#define CoreDebug   (&simCoreDebug)
+#define GPIOA       (&simGPIOA)
+#define GPIOB       (&simGPIOB)
+#define GPIOC       (&simGPIOC)
+#define GPIOD       (&simGPIOD)
+
+// ------------------------------
+//   Register bits
+// ------------------------------
+#define TIM_IT_Update                   ((uint16_t)0x0001)
+#define TIM_CR1_CEN                     ((uint16_t)0x0001)
+#define TIM_CounterMode_Up              ((uint16_t)0x0000)
+#define TIM_CKD_DIV1                    ((uint16_t)0x0000)
+
+#define SPI_CR1_SPE                     ((uint16_t)0x0040)
+#define SPI_CR2_RXDMAEN                 ((uint16_t)0x0001)
+#define SPI_I2SCFGR_I2SMOD              ((uint16_t)0x0800)
+#define SPI_I2S_FLAG_RXNE               ((uint16_t)0x0001)
+#define SPI_I2S_FLAG_BSY                ((uint16_t)0x0080)
+#define SPI_Direction_2Lines_FullDuplex ((uint16_t)0x0000)
+#define SPI_Direction_2Lines_RxOnly     ((uint16_t)0x0400)
+#define SPI_Mode_Master                 ((uint16_t)0x0104)
+#define SPI_DataSize_16b                ((uint16_t)0x0800)
+#define SPI_CPOL_Low                    ((uint16_t)0x0000)
+#define SPI_CPHA_1Edge                  ((uint16_t)0x0000)
+#define SPI_NSS_Soft                    ((uint16_t)0x0200)
+#define SPI_BaudRatePrescaler_2         ((uint16_t)0x0000)
+#define SPI_FirstBit_MSB                ((uint16_t)0x0000)
+
+#define DWT_CTRL_CYCCNTENA_Msk          ((uint32_t)0x00000001)
+#define CoreDebug_DEMCR_TRCENA_Msk      ((uint32_t)0x01000000)
+
+#define DMA_SxCR_EN                     ((uint32_t)0x00000001)
+#define DMA_Channel_3                   ((uint32_t)0x06000000)
+#define DMA_DIR_PeripheralToMemory      ((uint32_t)0x00000000)
+#define DMA_PeripheralInc_Disable       ((uint32_t)0x00000000)
+#define DMA_MemoryInc_Enable            ((uint32_t)0x00000400)
+#define DMA_PeripheralDataSize_HalfWord ((uint32_t)0x00000800)
+#define DMA_MemoryDataSize_HalfWord     ((uint32_t)0x00002000)
+#define DMA_Mode_Normal                 ((uint32_t)0x00000000)
+#define DMA_Mode_Circular               ((uint32_t)0x00000100)
+#define DMA_Priority_VeryHigh           ((uint32_t)0x00030000)
+
+#define RCC_AHB1Periph_DMA2             ((uint32_t)0x00400000)
+#define RCC_APB1Periph_TIM7             ((uint32_t)0x00000020)
+#define RCC_APB2Periph_SPI1             ((uint32_t)0x00001000)
+#define GPIO_AF_SPI1                    ((uint8_t)0x05)
+
+// ------------------------------
+//   Standard peripheral library
+// ------------------------------
+typedef struct {
+    uint16_t TIM_Prescaler;
+    uint16_t TIM_CounterMode;
+    uint32_t TIM_Period;
+    uint16_t TIM_ClockDivision;
+    uint8_t  TIM_RepetitionCounter;
+} TIM_TimeBaseInitTypeDef;
+
+typedef struct {
+    uint32_t DMA_Channel;
+    uint32_t DMA_PeripheralBaseAddr;
+    uint32_t DMA_Memory0BaseAddr;
+    uint32_t DMA_DIR;
+    uint32_t DMA_BufferSize;
+    uint32_t DMA_PeripheralInc;
+    uint32_t DMA_MemoryInc;
+    uint32_t DMA_PeripheralDataSize;
+    uint32_t DMA_MemoryDataSize;
+    uint32_t DMA_Mode;
+    uint32_t DMA_Priority;
+} DMA_InitTypeDef;
+
+typedef struct {
+    uint8_t         NVIC_IRQChannel;
+    uint8_t         NVIC_IRQChannelPreemptionPriority;
+    uint8_t         NVIC_IRQChannelSubPriority;
+    FunctionalState NVIC_IRQChannelCmd;
+} NVIC_InitTypeDef;
+
+void TIM_TimeBaseInit(TIM_TypeDef* TIMx, TIM_TimeBaseInitTypeDef* init);
+void TIM_ITConfig(TIM_TypeDef* TIMx, uint16_t it, FunctionalState state);
+void TIM_Cmd(TIM_TypeDef* TIMx, FunctionalState state);
+void TIM_DeInit(TIM_TypeDef* TIMx);
+void NVIC_Init(NVIC_InitTypeDef* init);
+void DMA_DeInit(DMA_Stream_TypeDef* stream);
+void DMA_StructInit(DMA_InitTypeDef* init);
+void DMA_Init(DMA_Stream_TypeDef* stream, DMA_InitTypeDef* init);
+void DMA_Cmd(DMA_Stream_TypeDef* stream, FunctionalState state);
+void RCC_AHB1PeriphClockCmd(uint32_t periph, FunctionalState state);
+void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state);
+void RCC_APB2PeriphResetCmd(uint32_t periph, FunctionalState state);
+void GPIO_PinAFConfig(GPIO_TypeDef* GPIOx, uint16_t pinSource, uint8_t af);
+void SYSCFG_EXTILineConfig(uint8_t portSource, uint8_t pinSource);
+
+// Core interrupt masking - serialises with the simulated interrupts
+uint32_t __get_PRIMASK();
+void __disable_irq();
+void __enable_irq();
+
+#endif
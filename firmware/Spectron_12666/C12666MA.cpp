@@ -90,9 +90,11 @@ enum spec_state_t {
 #ifdef ADC_AVG_4
     // 4 ADC averaging reads - min integration time 18.51 ms
     #define SPEC_CLK_TICK_TIMER  85
+    #define ADC_READS            4
 #else
     // 2 ADC averaging reads - min integration time 11.3 ms
     #define SPEC_CLK_TICK_TIMER  50
+    #define ADC_READS            2
 #endif
 
 // Macro to convert ticks to uSec
@@ -150,6 +152,8 @@ static uint32_t              specCounter = 0;          // counter
 static uint32_t              extTRGCounter = 0;        // ext trigger counter
 static uint32_t* volatile    specData = 0;             // pointer to current data for ADC reads
 static uint8_t* volatile     specDataCounter = 0;      // pointer to current data for ADC reads counter
+static uint32_t*             specFrameData = 0;        // start of data accumulated for current frame
+static uint8_t*              specFrameCounts = 0;      // start of data counters for current frame
 
 // spectrometer pins used by timer
 uint8_t adcPinCNV   = NO_PIN;
@@ -172,6 +176,31 @@ uint16_t specPinTRG = 0;    STM32_Pin_Info* specPinTRG_Info = 0;
 uint32_t data[SPEC_PIXELS];
 uint8_t  dataCounts[SPEC_PIXELS];
 
+// Continuous mode frames queue. Timer interrupt accumulates readings
+// directly into the head frame and moves the head on frame completion,
+// consumer pops frames from the tail and clears them on release. When the
+// queue is full the completed frame is held in the head and the following
+// frames are accumulated into the single measurement arrays and dropped
+// (sequence numbers still advance so the gaps are visible to the consumer).
+#define SPEC_FRAME_QUEUE_SIZE  3
+
+struct spec_frame_t {
+    uint32_t seq;                   // frame sequence number
+    uint32_t timeMs;                // frame completion time, millis()
+    uint32_t data[SPEC_PIXELS];     // aggregated sensor readings
+    uint8_t  counts[SPEC_PIXELS];   // readings counts
+};
+
+static spec_frame_t          specFrames[SPEC_FRAME_QUEUE_SIZE];
+static volatile bool         specContinuous = false;   // continuous mode is on
+static volatile uint8_t      specFrameHead = 0;        // frame being acquired
+static volatile uint8_t      specFrameTail = 0;        // oldest completed frame
+static volatile uint32_t     specFrameSeq = 0;         // next frame sequence number
+static volatile uint32_t     specFramesDropped = 0;    // frames dropped on full queue
+static volatile bool         specFrameDiscard = false; // frame being acquired is dropped
+static uint16_t              specFrameCycles = 1;      // read cycles per frame
+static volatile uint16_t     specReadCycleCounter = 0; // read cycles left in the current frame
+
 // ------------------------------
 //   Hardware specific routines
 // ------------------------------
@@ -276,10 +305,10 @@ inline void readADC(uint32_t* data, uint8_t* dataCounter)
     SPI_BASE->CR1 |= SPI_CR1_SPE;
 
     // Wait for SPI data reception
-    while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
+    while (!(SPI_BASE->SR & SPI_I2S_FLAG_RXNE)) ;
 
     // Read SPI received data
-    *data = SPI_BASE->DR;
+    *data += SPI_BASE->DR;
     ++(*dataCounter);
 
     // disable
@@ -297,7 +326,7 @@ inline void readADC(uint32_t* data, uint8_t* dataCounter)
     SPI_BASE->CR1 |= SPI_CR1_SPE;
 
     // Wait for SPI data reception
-    while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
+    while (!(SPI_BASE->SR & SPI_I2S_FLAG_RXNE)) ;
 
     // Read SPI received data
     if (specDataReady)
@@ -322,7 +351,7 @@ inline void readADC(uint32_t* data, uint8_t* dataCounter)
     SPI_BASE->CR1 |= SPI_CR1_SPE;
 
     // Wait for SPI data reception
-    while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
+    while (!(SPI_BASE->SR & SPI_I2S_FLAG_RXNE)) ;
 
     // Read SPI received data
     if (specDataReady)
@@ -346,7 +375,7 @@ inline void readADC(uint32_t* data, uint8_t* dataCounter)
     SPI_BASE->CR1 |= SPI_CR1_SPE;
 
     // Wait for SPI data reception
-    while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
+    while (!(SPI_BASE->SR & SPI_I2S_FLAG_RXNE)) ;
 
     // Read SPI received data
     if (specDataReady)
@@ -389,6 +418,40 @@ void initSpecTimerData()
 // --------------------------------------------------
 //   Timer and spectrometer clock handling routines
 // --------------------------------------------------
+// Queue completed continuous mode frame and start accumulating the next one.
+// Called from the timer interrupt at the end of the frame - the next frame
+// has been cleared on release by the consumer so only the pointers change.
+void nextContinuousFrame()
+{
+    if (specFrameDiscard)
+    {
+        // frame acquired while the queue was full
+        ++specFrameSeq;
+        ++specFramesDropped;
+    }
+    else
+    {
+        spec_frame_t* frame = &specFrames[specFrameHead];
+        frame->seq = specFrameSeq++;
+        frame->timeMs = millis();
+    }
+
+    uint8_t nextHead = (specFrameHead+1) % SPEC_FRAME_QUEUE_SIZE;
+    specFrameDiscard = nextHead == specFrameTail;
+    if (specFrameDiscard)
+    {
+        // queue is full - hold completed frame and drop the next one
+        specFrameData = data;
+        specFrameCounts = dataCounts;
+    }
+    else
+    {
+        specFrameHead = nextHead;
+        specFrameData = specFrames[specFrameHead].data;
+        specFrameCounts = specFrames[specFrameHead].counts;
+    }
+}
+
 // TRG pin handling interrupt
 void spectroTRGInterrupt(void)
 {
@@ -495,7 +558,20 @@ void spectroClockInterrupt(void)
 
             case SPEC_TRAIL:
                 ++specCounter;
-                 if (specCounter == TRAIL_TICKS) {
+                if (specCounter == TRAIL_TICKS && specContinuous) {
+                    // queue the frame once all its read cycles are done and
+                    // go straight to the next integration as the read has
+                    // just reset the sensor
+                    if (--specReadCycleCounter == 0) {
+                        nextContinuousFrame();
+                        specReadCycleCounter = specFrameCycles;
+                    }
+                    specData = specFrameData;
+                    specDataCounter = specFrameCounts;
+                    specCounter = 0;
+                    specState = SPEC_INTEGRATION;
+                }
+                else if (specCounter == TRAIL_TICKS) {
                     specCounter = 0;
                     specState = SPEC_STOP;
                     specCLK = LOW;
@@ -775,6 +851,8 @@ C12666MA::C12666MA(uint8_t spec_gain, uint8_t spec_eos, uint8_t spec_trg,
         setWavelengthCalibrationInternal(defaultCalibration);
     }
 
+    buildWavelengthTable();
+
     // initialise ranges
     int minWavelength, maxWavelength;
     getSensorRangeInternal(minWavelength, maxWavelength);
@@ -854,7 +932,7 @@ bool C12666MA::begin()
     const unsigned TIM7Index = 71;
     uint8_t trgPinSource = specPinTRG_Info->gpio_pin_source;
     uint8_t trgISRIndex = GPIO_IRQn[trgPinSource] + 0x10;
-    uint32_t* isrs = (uint32_t*)(SCB->VTOR);
+    uint32_t* isrs = (uint32_t*)(uintptr_t)(SCB->VTOR);
 
     // disable interrupts
     int is = __get_PRIMASK();
@@ -863,11 +941,11 @@ bool C12666MA::begin()
     // store the system interrupt if TRG pin ISR is shared across several pins
     if (GPIO_IRQn[trgPinSource] == EXTI9_5_IRQn ||
         GPIO_IRQn[trgPinSource] == EXTI15_10_IRQn)
-        sysIrqHandler = (EXT_IRQ_Handler)isrs[trgISRIndex];
+        sysIrqHandler = (EXT_IRQ_Handler)(uintptr_t)isrs[trgISRIndex];
 
     // override TIM7 and TRG pin interrupts
-    isrs[TIM7Index]   = (uint32_t)spectroClockInterrupt;
-    isrs[trgISRIndex] = (uint32_t)spectroTRGInterrupt;
+    isrs[TIM7Index]   = (uint32_t)(uintptr_t)spectroClockInterrupt;
+    isrs[trgISRIndex] = (uint32_t)(uintptr_t)spectroTRGInterrupt;
 
     // enable interrupts
     if ((is & 1) == 0) {
@@ -1105,6 +1183,9 @@ bool C12666MA::setWavelengthCalibrationInternal(const double* wavelengthCal)
         EEPROM.put(EEPROM_CALIBRATION_COEF_6, calibration_[5]);
     }
 
+    if (changed)
+        buildWavelengthTable();
+
     return changed;
 }
 
@@ -1216,6 +1297,15 @@ uint32_t C12666MA::getIntTime()
 // Convert aggregated readouts to voltage measurement floating point data
 // and return the max value
 float C12666MA::processMeasurement(float* measurement)
+{
+    return processMeasurement(measurement, data, dataCounts);
+}
+
+// Convert specified aggregated readouts to voltage measurement floating
+// point data and return the max value
+float C12666MA::processMeasurement(float* measurement,
+                                   const uint32_t* readings,
+                                   const uint8_t* readingCounts)
 {
     // Initialize arrays
     float maxVal = 0.0;
@@ -1224,10 +1314,10 @@ float C12666MA::processMeasurement(float* measurement)
     {
         measurement[i] = 0.0;
 
-        if (dataCounts[i])
+        if (readingCounts[i+rangeStartIdx_])
             measurement[i] =
-                    ((float)data[i+rangeStartIdx_]*adcRefVoltage) /
-                    ((float)dataCounts[i+rangeStartIdx_]*ADC_MAX_VALUE);
+                    ((float)readings[i+rangeStartIdx_]*adcRefVoltage) /
+                    ((float)readingCounts[i+rangeStartIdx_]*ADC_MAX_VALUE);
 
         if (measurement[i] > maxVal)
             maxVal = measurement[i];
@@ -1662,8 +1752,9 @@ void C12666MA::readSpectrometer(uint32_t timeUs,
         setIntTime(timeUs, false);
 
     // initialise variables
-    specData = data;
-    specDataCounter = dataCounts;
+    specContinuous = false;
+    specFrameData = specData = data;
+    specFrameCounts = specDataCounter = dataCounts;
 
     // init stats and data
     for (int i=0; i<SPEC_PIXELS; i++)
@@ -1702,6 +1793,104 @@ void C12666MA::readSpectrometer(uint32_t timeUs,
     extPinLIGHT = NO_PIN;
 }
 
+// Start continuous free running measurements. The spectrometer is read
+// in a loop and each completed frame is queued to be retrieved by
+// popFrame(). The timeUs parameter is the frame time - each frame
+// accumulates as many read cycles at set integration time as fit into
+// it, 0 means a single read cycle.
+//
+// Returns false if the measurement is already in progress.
+bool C12666MA::startContinuous(uint32_t timeUs)
+{
+    // no action if timer is on or in measurement
+    if (timerOn || measuringData_)
+        return false;
+
+    measuringData_ = true;
+
+    // number of reading cycles per frame - continuous read cycle is
+    // Integration -> Read -> Trail
+    uint32_t cycleTime = (INTEG_TICKS+READ_TICKS+TRAIL_TICKS) * SPEC_CLK_TICK_TIMER;
+    uint32_t readCycles = ((uint64_t)timeUs * TIMER_US_FACTOR) / cycleTime;
+
+    if (readCycles < 1)
+        readCycles = 1;
+    if (readCycles*ADC_READS > UINT8_MAX)
+        readCycles = UINT8_MAX/ADC_READS;
+
+    specFrameCycles = readCycles;
+    specReadCycleCounter = readCycles;
+
+    // reset frames queue
+    specFrameHead = specFrameTail = 0;
+    specFrameSeq = 0;
+    specFramesDropped = 0;
+    specFrameDiscard = false;
+    memset(specFrames, 0, sizeof(specFrames));
+    specFrameData = specData = specFrames[0].data;
+    specFrameCounts = specDataCounter = specFrames[0].counts;
+    specContinuous = true;
+
+    // init ADC and initiate the timer - no triggering in continuous mode
+    startADC(adc_cnv_);
+    startSpecTimer(extTrgMeasDelayUs_, false);
+
+    return true;
+}
+
+// Stop continuous measurements. The frame being acquired is discarded,
+// already queued frames are still available via popFrame().
+void C12666MA::stopContinuous()
+{
+    if (!specContinuous)
+        return;
+
+    stopSpecTimer();
+    endADC();
+
+    specContinuous = false;
+    specState = SPEC_STOP;
+    specData = 0;
+    specDataCounter = 0;
+
+    measuringData_ = false;
+}
+
+// Retrieve the oldest queued continuous mode frame into the current
+// measurement so it is available via getMeasurement(). Returns frame
+// sequence number and completion time in milliseconds.
+//
+// Returns false if no frame is available.
+bool C12666MA::popFrame(uint32_t& frameSeq, uint32_t& frameTimeMs)
+{
+    if (specFrameTail == specFrameHead)
+        return false;
+
+    spec_frame_t* frame = &specFrames[specFrameTail];
+    frameSeq = frame->seq;
+    frameTimeMs = frame->timeMs;
+    processMeasurement(meas_, frame->data, frame->counts);
+
+    // clear the frame for reuse and release it
+    memset(frame->data, 0, sizeof(frame->data));
+    memset(frame->counts, 0, sizeof(frame->counts));
+    specFrameTail = (specFrameTail+1) % SPEC_FRAME_QUEUE_SIZE;
+
+    return true;
+}
+
+// Continuous mode status
+bool C12666MA::isContinuous()
+{
+    return specContinuous;
+}
+
+// Number of continuous mode frames dropped because the queue was full
+uint32_t C12666MA::getDroppedFrames()
+{
+    return specFramesDropped;
+}
+
 // Enable/disable Stearns and Stearns (1988) bandpass correction
 void C12666MA::enableBandpassCorrection(bool enable)
 {
@@ -2038,15 +2227,54 @@ double C12666MA::getMeasurement(uint16_t pixelIdx, bool normalise)
     return data;
 }
 
+// Calculate the wavelength for specified sensor pixel index from
+// the calibration polynomial (in Horner form)
+double C12666MA::calcWavelength(int pixelIdx)
+{
+    // pixel number in formula start with 1
+    double p = pixelIdx+1;
+    return calibration_[0]
+           + p*(calibration_[1]
+           + p*(calibration_[2]
+           + p*(calibration_[3]
+           + p*(calibration_[4]
+           + p*calibration_[5]))));
+}
+
+// Build the wavelength table for all sensor pixels - this is done
+// once the calibration changes
+void C12666MA::buildWavelengthTable()
+{
+    for (int i=0; i<SPEC_PIXELS; i++)
+        wavelengths_[i] = calcWavelength(i);
+}
+
 // get the wavelength for specified pixel
 double C12666MA::getWavelength(uint16_t pixelNumber)
 {
-    // pixelNumber in formula start with 1
-    double p = pixelNumber+rangeStartIdx_+1;
-    return calibration_[0]
-           + (p*calibration_[1])
-           + (p*p*calibration_[2])
-           + (p*p*p*calibration_[3])
-           + (p*p*p*p*calibration_[4])
-           + (p*p*p*p*p*calibration_[5]);
+    int idx = pixelNumber+rangeStartIdx_;
+    return idx < SPEC_PIXELS ? wavelengths_[idx] : calcWavelength(idx);
+}
+
+// get the fractional pixel index for specified wavelength
+float C12666MA::getPixelIndex(float wavelength)
+{
+    // binary search for the segment containing the wavelength,
+    // wavelengths are increasing with pixel index
+    int lo = 0;
+    int hi = SPEC_PIXELS-1;
+    while (hi-lo > 1)
+    {
+        int mid = (lo+hi)/2;
+        if (wavelengths_[mid] <= wavelength)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // interpolate within the segment (extrapolate outside of the sensor)
+    float step = wavelengths_[hi]-wavelengths_[lo];
+    float pixel = step > 0 ? lo + (wavelength-wavelengths_[lo])/step : lo;
+
+    return pixel-rangeStartIdx_;
 }
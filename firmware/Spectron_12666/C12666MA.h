@@ -109,6 +109,7 @@ private:
 
     // Variables
     double    calibration_[6];  // Hamamatsu calibration constants to provide wavelenghts
+    float     wavelengths_[SPEC_PIXELS]; // Wavelength of each sensor pixel from calibration
     int       rangeStartIdx_;   // Index of the first spectrometer pixel in a spectrometer range
     int       rangePixels_;     // Total pixels in a measured spectral range
     gain_t    gain_;            // High/low gain
@@ -134,8 +135,11 @@ private:
     void setSensorRangeInternal(int& minWavelength, int& maxWavelength);
     void getSensorRangeInternal(int& minWavelength, int &maxWavelength);
     float processMeasurement(float* measurement);
+    float processMeasurement(float* measurement, const uint32_t* readings, const uint8_t* readingCounts);
     float getAveragedMax(float maxVal, float* measurement);
     bool setWavelengthCalibrationInternal(const double* wavelengthCal);
+    double calcWavelength(int pixelIdx);
+    void buildWavelengthTable();
     bool findSaturatedExposure();
 
 public:
@@ -332,6 +336,29 @@ public:
     // levels are reset to calibrated minimum black (default behavior).
     void resetBlackLevels(float resetVoltage = -1.0);
 
+    // Start continuous free running measurements. Spectrometer is read in
+    // a loop (Integration -> Read -> Trail after the initial sensor reset)
+    // and every completed frame is placed into a small frames queue. The
+    // timeUs parameter is the frame time - several read cycles at set
+    // integration time are accumulated into a frame to fit it, as in
+    // C12880MA::startContinuous(). If it is 0 each read is a frame.
+    //
+    // While running, all other measurement and setup calls are ignored.
+    // Returns false if measurement is already in progress.
+    bool startContinuous(uint32_t timeUs = 0);
+
+    // Stop continuous measurements. Already queued frames can still be
+    // retrieved after stopping.
+    void stopContinuous();
+
+    // Retrieve the oldest queued frame into the current measurement (so it
+    // is accessible via getMeasurement()) returning its sequence number and
+    // completion time in milliseconds. Gaps in sequence numbers indicate
+    // frames dropped because the queue was full.
+    //
+    // Returns false if there is no frame available.
+    bool popFrame(uint32_t& frameSeq, uint32_t& frameTimeMs);
+
     // Get measured data for specified pixel (normalised or as is)
     double getMeasurement(uint16_t pixelIdx, bool normalise=true);
 
@@ -344,6 +371,11 @@ public:
     // Get the wavelength for specified pixel in nanometers
     double getWavelength(uint16_t pixel);
 
+    // Get the fractional pixel index for specified wavelength in nanometers.
+    // The index is relative to the current range start as for getWavelength()
+    // and is extrapolated if the wavelength is outside of the sensor range.
+    float getPixelIndex(float wavelength);
+
     // Attribute getters
     const double* getWavelengthCalibration() { return calibration_; }
     int getTotalPixels()                     { return rangePixels_; }
@@ -358,6 +390,8 @@ public:
     bool isBandpassCorrected()               { return applyBandPassCorrection_; }
     int32_t getExtTrgMeasDelay()             { return extTrgMeasDelayUs_; }
     uint32_t getIntTime();             // returns currently set integration time in uSec
+    bool isContinuous();               // returns true if continuous mode is on
+    uint32_t getDroppedFrames();       // returns continuous mode frames dropped so far
 };
 
 #endif
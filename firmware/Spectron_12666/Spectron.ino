@@ -26,6 +26,7 @@ SYSTEM_MODE(MANUAL);
 #define EEPROM_C12666_BASE_ADDR  0
 
 #include "C12666MA.h"
+#include "rng_hal.h"
 
 #define ADC_REF_SEL_1  A1
 #define ADC_REF_SEL_2  A0
@@ -69,6 +70,14 @@ SYSTEM_MODE(MANUAL);
 
 #define ENC_RESULT_STR_SIZE (((SPEC_PIXELS)*sizeof(float)*4/3)+16)
 
+// Local binary frame transport - TCP port and packet identification
+#define FRAME_SERVER_PORT   5880
+#define FRAME_MAGIC         0x46435053  // "SPCF" in little endian
+#define FRAME_VERSION       1
+
+// Size of device state snapshot JSON string
+#define STATE_STR_SIZE      384
+
 // Board type identifier
 static String BOARD_TYPE = "SPEC2_SPECTROMETER";
 
@@ -104,6 +113,9 @@ double     specMinBlackVoltage;
 uint32_t   specIntegTime;
 int32_t    specExtTrigDelay;
 char       specEncData[ENC_RESULT_STR_SIZE]; // Base64 encoded floats
+char       specLocalIP[16];                  // local IP address for frame transport
+char       specStateStr[STATE_STR_SIZE];     // JSON snapshot of the state above
+uint32_t   specStateVersion;                 // bumped when the snapshot changes
 
 // maximum size for string variable data in Particle
 const int  maxVarSize = 620;
@@ -114,6 +126,10 @@ static bool initSuccess = true;
 // re-entry prevention
 static bool measuring = false;
 
+// last measurement sequence number and time
+static uint32_t measurementSeq = 0;
+static uint32_t measurementTimeMs = 0;
+
 // Auxiliary functions
 enum encode_t {
     ET_MEASUREMENT   = 0,
@@ -121,6 +137,21 @@ enum encode_t {
     ET_NORMALISATION = 3
 };
 
+// Get single pixel value of the requested data type
+inline float getPixelValue(encode_t encodeType, int pixelIdx, bool normalise)
+{
+    switch (encodeType)
+    {
+        case ET_BLACK_LEVELS:
+            return spec.getBlackLevelVoltage(pixelIdx);
+        case ET_NORMALISATION:
+            return spec.getNormalisationCoef(pixelIdx);
+        case ET_MEASUREMENT:
+        default:
+            return spec.getMeasurement(pixelIdx, normalise);
+    }
+}
+
 // Encode measurement result in Base64
 void encodeMeasurement(encode_t encodeType, bool normalise=true)
 {
@@ -141,18 +172,7 @@ void encodeMeasurement(encode_t encodeType, bool normalise=true)
     {
         // read the next float
         if ((inCnt&3) == 0)
-            switch (encodeType)
-            {
-                case ET_MEASUREMENT:
-                    floatVal = spec.getMeasurement(inCnt>>2, normalise);
-                    break;
-                case ET_BLACK_LEVELS:
-                    floatVal = spec.getBlackLevelVoltage(inCnt>>2);
-                    break;
-                case ET_NORMALISATION:
-                    floatVal = spec.getNormalisationCoef(inCnt>>2);
-                    break;
-            }
+            floatVal = getPixelValue(encodeType, inCnt>>2, normalise);
 
         value = (value<<8) + data[inCnt&3];
         ++inCnt;
@@ -184,6 +204,226 @@ void encodeMeasurement(encode_t encodeType, bool normalise=true)
 }
 
 
+// Local binary frame transport
+//
+// Frame server accepts TCP connections on FRAME_SERVER_PORT and answers
+// each request line with a single binary packet: frame_header_t followed
+// by the payload of header.pixels values. All fields are little endian.
+//
+// Request line format:
+//    <data type>[,U16] - data type as for spGetData, or FRAME to get the
+//                        next continuous mode frame (frames queued before
+//                        STOP are still returned); U16 requests 16 bit
+//                        payload (value = raw * scale), float32 otherwise
+//
+// If the data is not available the packet has no payload and 0 pixels.
+enum frame_format_t {
+    FF_FLOAT32 = 0,
+    FF_UINT16  = 1
+};
+
+struct __attribute__((packed)) frame_header_t {
+    uint32_t magic;         // FRAME_MAGIC
+    uint16_t version;       // FRAME_VERSION
+    uint16_t headerSize;    // size of this header
+    uint32_t payloadSize;   // payload size in bytes following the header
+    uint32_t seq;           // measurement or continuous frame sequence number
+    uint32_t timeMs;        // measurement completion time, millis()
+    uint32_t integTimeUs;   // integration time
+    uint8_t  dataType;      // 0 - measurement, 1 - black levels, 2 - normalisation
+    uint8_t  format;        // frame_format_t
+    uint8_t  adcRef;        // ADC reference
+    uint8_t  gain;          // gain (0 if not supported)
+    uint8_t  measType;      // measurement type
+    uint8_t  reserved1;
+    uint16_t pixels;        // number of values in payload
+    uint16_t pixelOffset;   // index of the first pixel in the sensor range
+    uint16_t reserved2;
+    float    scale;         // multiplier for FF_UINT16 values
+};
+
+// frame packet buffer - word aligned to build float payload in place
+static uint32_t frameBuf[(sizeof(frame_header_t)+SPEC_PIXELS*sizeof(float)+3)/4];
+
+static TCPServer frameServer(FRAME_SERVER_PORT);
+static TCPClient frameClient;
+static char      frameRequest[32];
+static int       frameRequestLen = 0;
+
+// Build frame packet in frameBuf and return its size
+int buildFramePacket(encode_t encodeType,
+                     bool normalise,
+                     frame_format_t format,
+                     uint32_t seq,
+                     uint32_t timeMs)
+{
+    frame_header_t* header = (frame_header_t*)frameBuf;
+    float* values = (float*)((uint8_t*)frameBuf + sizeof(frame_header_t));
+    uint16_t pixels = spec.getTotalPixels();
+
+    memset(header, 0, sizeof(frame_header_t));
+    header->magic       = FRAME_MAGIC;
+    header->version     = FRAME_VERSION;
+    header->headerSize  = sizeof(frame_header_t);
+    header->seq         = seq;
+    header->timeMs      = timeMs;
+    header->integTimeUs = spec.getIntTime();
+    header->dataType    = encodeType == ET_BLACK_LEVELS ? 1 :
+                          encodeType == ET_NORMALISATION ? 2 : 0;
+    header->format      = format;
+    header->adcRef      = spec.getAdcReference();
+    header->gain        = spec.getGain();
+    header->measType    = spec.getMeasurementType();
+    header->pixels      = pixels;
+    header->pixelOffset = spec.getStartPixelIdx();
+    header->scale       = 1.0;
+
+    // single pass over the data
+    float maxVal = 0.0;
+    for (int i=0; i<pixels; i++)
+    {
+        values[i] = getPixelValue(encodeType, i, normalise);
+        if (values[i] > maxVal)
+            maxVal = values[i];
+    }
+
+    if (format == FF_UINT16)
+    {
+        // convert in place - 16 bit value i only overwrites
+        // float values that were already converted
+        uint16_t* scaled = (uint16_t*)values;
+        float toScaled = maxVal > 0.0 ? UINT16_MAX/maxVal : 0.0;
+        for (int i=0; i<pixels; i++)
+            scaled[i] = values[i] > 0.0 ? (uint16_t)(values[i]*toScaled + 0.5) : 0;
+        header->scale = maxVal > 0.0 ? maxVal/UINT16_MAX : 1.0;
+        header->payloadSize = pixels*sizeof(uint16_t);
+    }
+    else
+        header->payloadSize = pixels*sizeof(float);
+
+    return sizeof(frame_header_t) + header->payloadSize;
+}
+
+// Serve single frame request line
+void serveFrameRequest(String paramStr)
+{
+    paramStr.trim().toUpperCase();
+
+    frame_format_t format = FF_FLOAT32;
+    if (paramStr.endsWith(",U16"))
+    {
+        format = FF_UINT16;
+        paramStr = paramStr.substring(0, paramStr.length()-4);
+    }
+
+    // get data type
+    bool valid = true;
+    bool normalise = true;
+    encode_t encType = ET_MEASUREMENT;
+    uint32_t seq = measurementSeq;
+    uint32_t timeMs = measurementTimeMs;
+    if (paramStr == "FRAME")
+        valid = spec.popFrame(seq, timeMs);
+    else if (paramStr == "BLACK_LEVELS")
+        encType = ET_BLACK_LEVELS;
+    else if (paramStr == "NORMALISATION")
+        encType = ET_NORMALISATION;
+    else if (paramStr == "MEASUREMENT")
+        normalise = false;
+    else if (paramStr != "MEAS_NORMALISED")
+        valid = false;
+
+    int size = sizeof(frame_header_t);
+    if (valid)
+        size = buildFramePacket(encType, normalise, format, seq, timeMs);
+    else
+    {
+        // no data - empty packet
+        frame_header_t* header = (frame_header_t*)frameBuf;
+        memset(header, 0, sizeof(frame_header_t));
+        header->magic      = FRAME_MAGIC;
+        header->version    = FRAME_VERSION;
+        header->headerSize = sizeof(frame_header_t);
+        header->scale      = 1.0;
+    }
+
+    // short write means the client has gone or does not read - it is
+    // dropped so that the host sees closed transport, not a cut frame
+    if (frameClient.write((const uint8_t*)frameBuf, size) != (size_t)size)
+    {
+        frameClient.stop();
+        frameRequestLen = 0;
+    }
+}
+
+// Process local frame transport connection and requests
+void processFrameRequests()
+{
+    if (!frameClient.connected())
+    {
+        frameClient = frameServer.available();
+        frameRequestLen = 0;
+        return;
+    }
+
+    while (frameClient.available() > 0)
+    {
+        char ch = frameClient.read();
+        if (ch == '\n')
+        {
+            frameRequest[frameRequestLen] = 0;
+            frameRequestLen = 0;
+            serveFrameRequest(frameRequest);
+        }
+        else if (ch != '\r' && frameRequestLen < (int)sizeof(frameRequest)-1)
+            frameRequest[frameRequestLen++] = ch;
+    }
+}
+
+// Rebuild device state snapshot from the Particle variables. This lets the
+// host read the complete state in a single request instead of a request per
+// variable. Snapshot is a JSON object with the following fields:
+//    v    - state version, only changes when any of the fields below change
+//    adc  - ADC reference
+//    gain - gain
+//    mt   - measurement type
+//    it   - integration time in uSec
+//    trg  - external trigger to measurement delay in uSec (-1 if off)
+//    sat  - saturation voltages indexed by gain (no gain, high gain)
+//    mbv  - minimal black level voltage
+//    px   - number of pixels in the current range
+//    off  - index of the first pixel in the current range
+//    cal  - wavelength calibration coefficients
+void updateState()
+{
+    static char lastState[STATE_STR_SIZE];
+    char state[STATE_STR_SIZE];
+
+    snprintf(state, sizeof(state),
+             "\"adc\":%d,\"gain\":%d,\"mt\":%d,\"it\":%lu,\"trg\":%ld,"
+             "\"sat\":[%.6G,%.6G],\"mbv\":%.6G,\"px\":%d,\"off\":%d,\"cal\":[%s]",
+             specAdcRef,
+             specGain,
+             specMeasureType,
+             (unsigned long)specIntegTime,
+             (long)specExtTrigDelay,
+             noGainSatVoltage,
+             highGainSatVoltage,
+             specMinBlackVoltage,
+             specPixels,
+             specOffsetIdx,
+             specCalibrationStr);
+
+    // only bump version if something has changed
+    if (strcmp(state, lastState) == 0)
+        return;
+
+    strcpy(lastState, state);
+    ++specStateVersion;
+    snprintf(specStateStr, sizeof(specStateStr), "{\"v\":%lu,%s}",
+             (unsigned long)specStateVersion, lastState);
+}
+
 // Cloud functions
 
 // Gets the requested pixel array data into spLastMeasN variables. Format of
@@ -268,6 +508,8 @@ int specSetWavelengthCalibration(String paramStr)
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
 
+    updateState();
+
     return 0;
 }
 
@@ -301,6 +543,9 @@ int specResetToDefaults(String paramStr)
                    calibration[4],
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
+
+    updateState();
+
     return 0;
 }
 
@@ -343,6 +588,8 @@ int specSetRange(String paramStr)
     specPixels    = spec.getTotalPixels();
     specOffsetIdx = spec.getStartPixelIdx();
 
+    updateState();
+
     return 0;
 }
 
@@ -371,6 +618,8 @@ int specSetTriggerMeasurementDelay(String paramStr)
     // update Particle variable
     specExtTrigDelay = spec.getExtTrgMeasDelay();
 
+    updateState();
+
     return 0;
 }
 
@@ -389,6 +638,8 @@ int specSetGain(String paramStr)
     // update Particle variable
     specGain = spec.getGain();
 
+    updateState();
+
     return 0;
 }
 
@@ -409,6 +660,8 @@ int specSetADCRef(String paramStr)
     // update Particle variable
     specAdcRef = spec.getAdcReference();
 
+    updateState();
+
     return adcRef==spec.getAdcReference() ? 0 : -1;
 }
 
@@ -428,6 +681,8 @@ int specSetMeasurementType(String paramStr)
     // update Particle variable
     specMeasureType = spec.getMeasurementType();
 
+    updateState();
+
     return 0;
 }
 
@@ -447,6 +702,8 @@ int specSetIntegrationTime(String intTimeStr)
     // update Particle variable
     specIntegTime = spec.getIntTime();
 
+    updateState();
+
     return 0;
 }
 
@@ -502,12 +759,17 @@ int specMeasure(String paramStr)
         spec.takeMeasurement(measTimeUs, doExtTrg);
     }
 
+    ++measurementSeq;
+    measurementTimeMs = millis();
+
     // transfer measurement as Base64 data to series of string variables
     encodeMeasurement(ET_MEASUREMENT);
 
     // reset measurement mode
     measuring = false;
 
+    updateState();
+
     return 0;
 }
 
@@ -598,6 +860,8 @@ int specSetSaturationVoltages(String paramStr)
     highGainSatVoltage = spec.getHighGainSatVoltage();
     noGainSatVoltage   = spec.getNoGainSatVoltage();
 
+    updateState();
+
     return 0;
 }
 
@@ -622,6 +886,8 @@ int specSetMinBlack(String paramStr)
     // update variable
     specMinBlackVoltage = spec.getMinBlackVoltage();
 
+    updateState();
+
     return 0;
 }
 
@@ -678,11 +944,36 @@ int specCalibrateSpectralResponse(String paramStr)
     return 0;
 }
 
+// Start or stop continuous measurements. Frames are retrieved via local
+// frame transport. Format of the parameter string:
+//    <time>      - frame time in uSec (if 0 uses current integration)
+//    STOP        - stop continuous measurements
+int specContinuous(String paramStr)
+{
+    paramStr.trim().toUpperCase();
+
+    if (paramStr.equals("STOP"))
+    {
+        spec.stopContinuous();
+        return 0;
+    }
+
+    if (measuring || spec.isMeasuring())
+        return -1;
+
+    int32_t frameTimeUs = paramStr.toInt();
+    if (frameTimeUs < 0)
+        return -1;
+
+    return spec.startContinuous(frameTimeUs) ? 0 : -1;
+}
+
 // main firmware initialisation
 void setup()
 {
     // initialise variables
     memset(specEncData, 0, sizeof(specEncData));
+    memset(specLocalIP, 0, sizeof(specLocalIP));
 
     pinMode(TRG_CAMERA, OUTPUT);
     pinMode(TRG_LIGHT_SRC,  OUTPUT);
@@ -713,6 +1004,11 @@ void setup()
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
 
+    // initial state snapshot - start version from a random number so the
+    // host does not mistake state after restart for already seen one
+    specStateVersion = HAL_RNG_GetRandomNumber();
+    updateState();
+
     // register Particle variables
     initSuccess = initSuccess && Particle.variable("BOARD_TYPE",          BOARD_TYPE);
     initSuccess = initSuccess && Particle.variable("spNumPixels",         specPixels);
@@ -726,6 +1022,8 @@ void setup()
     initSuccess = initSuccess && Particle.variable("spNoGainSatVoltage",  noGainSatVoltage);
     initSuccess = initSuccess && Particle.variable("spMinBlackVoltage",   specMinBlackVoltage);
     initSuccess = initSuccess && Particle.variable("spPixelOffsetIdx",    specOffsetIdx);
+    initSuccess = initSuccess && Particle.variable("spLocalIP",           specLocalIP);
+    initSuccess = initSuccess && Particle.variable("spState",             specStateStr);
 
     char* encData = specEncData;
     int count = 1;
@@ -752,22 +1050,42 @@ void setup()
     initSuccess = initSuccess && Particle.function("spCalibrateSpectralResp", specCalibrateSpectralResponse);
     initSuccess = initSuccess && Particle.function("spSetSpectralRange",      specSetRange);
     initSuccess = initSuccess && Particle.function("spResetToDefaults",       specResetToDefaults);
+    initSuccess = initSuccess && Particle.function("spContinuous",            specContinuous);
 
     // connect
     if (!Particle.connected())
         Particle.connect();
     Particle.process();
+
+    // local frame transport is started in loop() once the IP is known
 }
 
 // Main event loop
-//    only use it for particle connection keep alive when spectrometer
-//    measurement is not running
+//    only use it for particle connection keep alive and local frame
+//    transport when spectrometer measurement is not running (continuous
+//    measurements run in the background)
 void loop(void)
 {
     // call for Photon process for manual system mode
-    if (!spec.isMeasuring())
+    if (!spec.isMeasuring() || spec.isContinuous())
+    {
         if (Particle.connected())
             Particle.process();
         else
             Particle.connect();
+
+        // keep local IP for frame transport up to date - the server is
+        // started again on the new address and the old client dropped
+        static IPAddress localIP;
+        if (WiFi.ready() && !(WiFi.localIP() == localIP))
+        {
+            localIP = WiFi.localIP();
+            String(localIP).toCharArray(specLocalIP, sizeof(specLocalIP));
+            frameClient.stop();
+            frameRequestLen = 0;
+            frameServer.begin();
+        }
+
+        processFrameRequests();
+    }
 }
@@ -60,6 +60,9 @@
 // External triggering action is optional so without it starting state
 // is Lead.
 //
+// In triggered continuous mode the timer is halted in Stop state after
+// each frame and trigger input interrupt restarts it from Lead state.
+//
 enum spec_state_t {
     SPEC_EXT_TRIG,
     SPEC_LEAD,
@@ -91,6 +94,29 @@ enum spec_state_t {
 // Current selection - use one of the above as needed
 #define SPEC_CLK_TICK_TIMER  SPEC_CLK_156KHZ
 
+// Clock tick used in ROI readout mode after the last pixel of interest is
+// read. No ADC reads are done at this point so the tick is only limited
+// by the timer interrupt duration (sensor allows up to 5MHz clock).
+#define SPEC_CLK_TAIL_TIMER  12   // ~417KHz
+
+// Default and maximum number of averaging ADC reads per sensor pixel
+// readout. Reads are only repeated while TRG pin is high so the number
+// of reads that fit depends on the clock above - at 156KHz only two.
+#define ADC_DEFAULT_READS    2
+#define ADC_MAX_READS        8
+
+// ADC readout mode - uncomment to read ADC via SPI1 RX DMA. In this mode
+// TRG interrupt only does ADC conversion and starts SPI transfer, DMA
+// deposits the samples into ring buffer and they are accumulated into
+// pixel data outside of interrupts while the sensor is read. There is
+// a single ADC read per TRG edge in this mode.
+//#define SPEC_ADC_DMA
+
+// Measurement processing mode - uncomment to use the original floating
+// point processing in getMeasurement() instead of fixed point one. This
+// is mainly useful to compare the two.
+//#define SPEC_FLOAT_MEASUREMENT
+
 // Macro to convert ticks to uSec and uSec to ticks
 #define ticksToUsec(x) ((x)*SPEC_CLK_TICK_TIMER/TIMER_US_FACTOR)
 #define uSecToTicks(x) ((x)*TIMER_US_FACTOR/SPEC_CLK_TICK_TIMER)
@@ -112,6 +138,7 @@ enum spec_state_t {
 #define LEAD_TICKS           64           // this includes INTEG_START_TICKS - anything greater than 38 seems OK
 #define TRAIL_TICKS          16           // anything greater than 2 seems OK
 #define ST_LEAD_TICKS        7            // ticks after ST goes high (on falling CLK) when integration really starts
+#define INTEG_EXTRA_TICKS    (ST_LEAD_TICKS-1+96) // sensor integrates longer than INTEG_TICKS - ST lead and 48 clocks after ST fall
 #define READ_TICKS           ((87 + SPEC_PIXELS)*TICKS_PER_PIXEL)
 #define TRG_CYCLES           (SPEC_PIXELS + 88)     // spec pixels + 88 cycles after ST goes low
 #define EXT_TRG_HIGH_TICKS   uSecToTicks(1000)      // duration of ext TRG pin high signal - 1mSec
@@ -140,10 +167,25 @@ static volatile uint32_t     extTRGCounter = 0;        // ext TRG cycles counter
 static volatile uint16_t     specReadCycleCounter = 0; // reading cycles counter
 static uint32_t*             specData = 0;             // pointer to current data for ADC reads
 static uint16_t*             specDataCounter = 0;      // pointer to current data for ADC reads counter
+static uint64_t*             specDataSumSq = 0;        // pointer to current data sum of squares
+static uint32_t*             specFrameData = 0;        // start of data accumulated for current frame
+static uint16_t*             specFrameCounts = 0;      // start of data counters for current frame
+static uint64_t*             specFrameSumSq = 0;       // start of data sum of squares for current frame
+static uint8_t               specADCReads = ADC_DEFAULT_READS; // max averaging ADC reads per pixel readout
+
+// readout window - TRG counter values are counting down so the window is
+// [specTRGReadLow, specTRGReadHigh) of counter values which corresponds to
+// [specROIStart, specROIStart+specROIPixels) of pixels
+static uint32_t              specROIStart = 0;         // first pixel read
+static uint32_t              specROIPixels = SPEC_PIXELS; // number of pixels read
+static uint32_t              specTRGReadHigh = SPEC_PIXELS; // TRG counter value to start reads below
+static uint32_t              specTRGReadLow = 0;       // TRG counter value to stop reads at
+static uint32_t              specFastTailTicks = 0;    // READ tick counter value to speed up clock at, 0 - no fast tail
 
 // spectrometer pins used by timer - direct hardware access, the fastest way
 // input pins
 uint16_t specPinTRG  = 0; __IO uint32_t* specPinTRG_IN = 0;  STM32_Pin_Info* specPinTRG_Info = 0;
+uint16_t specPinTrigIn = 0; STM32_Pin_Info* specPinTrigIn_Info = 0;
 // output pins - low, high, toggle masks and bit set/reset register
 uint32_t specPinCLK_L  = 0; uint32_t specPinCLK_H  = 0; uint32_t specPinCLK_TM  = 0; __IO uint32_t* specPinCLK_BR = 0;
 uint32_t specPinST_L   = 0; uint32_t specPinST_H   = 0; uint32_t specPinST_TM   = 0; __IO uint32_t* specPinST_BR = 0;
@@ -161,9 +203,44 @@ uint32_t extPinLight_L = 0;  uint32_t extPinLight_H = 0;  uint32_t extPinLight_T
 #define pinDefined(pin)       (pin##_BR) != 0
 
 // Static internal sensor readings arrays - these hold
-// aggregated sensor measurements and measurement counts
+// aggregated sensor measurements, measurement counts and
+// sums of squared readings (for noise estimation)
 static uint32_t data[SPEC_PIXELS];
 static uint16_t dataCounts[SPEC_PIXELS];
+static uint64_t dataSumSq[SPEC_PIXELS];
+
+// Continuous mode frames queue. Timer interrupt accumulates readings
+// directly into the head frame and moves the head on frame completion,
+// consumer pops frames from the tail and clears them on release. When the
+// queue is full the completed frame is held in the head and the following
+// frames are accumulated into the single measurement arrays and dropped
+// (sequence numbers still advance so the gaps are visible to the consumer).
+#define SPEC_FRAME_QUEUE_SIZE  3
+
+struct spec_frame_t {
+    uint32_t seq;                   // frame sequence number
+    uint32_t timeMs;                // frame completion time, millis()
+    uint32_t data[SPEC_PIXELS];     // aggregated sensor readings
+    uint16_t counts[SPEC_PIXELS];   // readings counts
+    uint64_t sumSq[SPEC_PIXELS];    // aggregated squared sensor readings
+};
+
+static spec_frame_t          specFrames[SPEC_FRAME_QUEUE_SIZE];
+static volatile bool         specContinuous = false;   // continuous mode is on
+static volatile uint8_t      specFrameHead = 0;        // frame being acquired
+static volatile uint8_t      specFrameTail = 0;        // oldest completed frame
+static volatile uint32_t     specFrameSeq = 0;         // next frame sequence number
+static volatile uint32_t     specFramesDropped = 0;    // frames dropped on full queue
+static volatile bool         specFrameDiscard = false; // frame being acquired is dropped
+static uint16_t              specFrameCycles = 1;      // read cycles per frame
+static volatile bool         specTriggered = false;    // frames are started by trigger input
+static volatile uint32_t     specTriggersMissed = 0;   // trigger edges during frame acquisition
+
+#ifdef SPEC_STATS
+// Acquisition statistics and CPU cycle counter value at the current frame start
+static spec_stats_t          specStats;
+static uint32_t              specFrameStartCycles = 0;
+#endif
 
 
 // ------------------------------
@@ -196,8 +273,9 @@ static const uint8_t GPIO_IRQn[] = {
 
 typedef void (*EXT_IRQ_Handler)(void);
 
-// existing IRQ handler
+// existing IRQ handlers
 EXT_IRQ_Handler sysIrqHandler = 0;
+EXT_IRQ_Handler sysTrigInIrqHandler = 0;
 
 // this is needed because wiring undefines SPIn definitions
 #define SPI_BASE ((SPI_TypeDef *) SPI1_BASE)
@@ -205,6 +283,18 @@ EXT_IRQ_Handler sysIrqHandler = 0;
 // SPI registers Masks
 #define CR1_CLEAR_MASK   ((uint16_t)0x3040)
 
+#ifdef SPEC_ADC_DMA
+#include "C12880MA_dma.h"
+
+// SPI1 RX is served by DMA2 stream 0 channel 3
+#define ADC_DMA_STREAM   DMA2_Stream0
+#define ADC_DMA_CHANNEL  DMA_Channel_3
+
+// ADC samples ring buffer filled by DMA and its router into pixel data
+static volatile uint16_t adcDmaBuf[ADC_DMA_BUF_SIZE];
+static adc_dma_router_t  adcDmaRouter;
+#endif
+
 // initialise AD (AD7980) and setup SPI
 inline void startADC(uint8_t adc_cnv_pin)
 {
@@ -234,7 +324,12 @@ inline void startADC(uint8_t adc_cnv_pin)
     // Clear BIDIMode, BIDIOE, RxONLY, SSM, SSI, LSBFirst, BR, MSTR, CPOL and CPHA bits
     tmpreg &= CR1_CLEAR_MASK;
 
+#ifdef SPEC_ADC_DMA
+    // full duplex - each dummy write clocks out exactly one sample
+    tmpreg |= SPI_Direction_2Lines_FullDuplex |
+#else
     tmpreg |= SPI_Direction_2Lines_RxOnly |
+#endif
               SPI_Mode_Master |
               SPI_DataSize_16b |
               SPI_BaudRatePrescaler_2 | // absolute max for SPI1 = 30Mhz (with APB2 at its allowed maximum 60Mhz)
@@ -251,41 +346,50 @@ inline void startADC(uint8_t adc_cnv_pin)
     // CRC polynomial
     SPI_BASE->CRCPR = 7;
 
+#ifdef SPEC_ADC_DMA
+    DMA_InitTypeDef dmaInit;
+
+    // setup circular DMA from SPI data register into the samples buffer
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+    DMA_DeInit(ADC_DMA_STREAM);
+    DMA_StructInit(&dmaInit);
+    dmaInit.DMA_Channel            = ADC_DMA_CHANNEL;
+    dmaInit.DMA_PeripheralBaseAddr = (uint32_t)(uintptr_t)&(SPI_BASE->DR);
+    dmaInit.DMA_Memory0BaseAddr    = (uint32_t)(uintptr_t)adcDmaBuf;
+    dmaInit.DMA_DIR                = DMA_DIR_PeripheralToMemory;
+    dmaInit.DMA_BufferSize         = ADC_DMA_BUF_SIZE;
+    dmaInit.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+    dmaInit.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+    dmaInit.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dmaInit.DMA_MemoryDataSize     = DMA_MemoryDataSize_HalfWord;
+    dmaInit.DMA_Mode               = DMA_Mode_Circular;
+    dmaInit.DMA_Priority           = DMA_Priority_VeryHigh;
+    DMA_Init(ADC_DMA_STREAM, &dmaInit);
+    DMA_Cmd(ADC_DMA_STREAM, ENABLE);
+
+    adcDmaRouterInit(adcDmaRouter, specROIPixels, ADC_DMA_BUF_SIZE);
+
+    // SPI RX requests DMA and stays enabled for the whole read
+    SPI_BASE->CR2 |= SPI_CR2_RXDMAEN;
+    SPI_BASE->CR1 |= SPI_CR1_SPE;
+#endif
+
     // set conversion pin low
     pinLow(adcPinCNV);
 }
 
 // force inlining
-inline void readADC(uint32_t* data, uint16_t* dataCounts) __attribute__((always_inline));
+inline void readADC(uint32_t* data, uint16_t* dataCounts, uint64_t* dataSumSq) __attribute__((always_inline));
 
 // Function to perform reading ADC7980.
-// This does up to two accumulated reads of the ADC
+// This does up to specADCReads accumulated reads of the ADC
 // where the state of the TRG pin is checked following
-// the second ADC conversion completion
-inline void readADC(uint32_t* data, uint16_t* dataCounts)
+// each ADC conversion completion
+inline void readADC(uint32_t* data, uint16_t* dataCounts, uint64_t* dataSumSq)
 {
-    // 1st read
-    // initiate conversion and wait for max conversion time
-    pinHigh(adcPinCNV);
-    System.ticksDelay(adcConvTimeTicks);
-    pinLow(adcPinCNV);
-
-    // SPI enable
-    SPI_BASE->CR1 |= SPI_CR1_SPE;
-
-    // Wait for SPI data reception
-    while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
-
-    // Read SPI received data
-    *data += SPI_BASE->DR;
-
-    // disable
-    SPI_BASE->CR1 &= (uint16_t)~((uint16_t)SPI_CR1_SPE);
-
-    // 2nd read
-    // initiate conversion and wait for max conversion time
-    if (pinRead(specPinTRG))
-    {
+    uint16_t reads = 0;
+    do {
+        // initiate conversion and wait for max conversion time
         pinHigh(adcPinCNV);
         System.ticksDelay(adcConvTimeTicks);
         pinLow(adcPinCNV);
@@ -294,25 +398,94 @@ inline void readADC(uint32_t* data, uint16_t* dataCounts)
         SPI_BASE->CR1 |= SPI_CR1_SPE;
 
         // Wait for SPI data reception
-        while (SPI_BASE->SR & SPI_I2S_FLAG_RXNE == 0) ;
+        while (!(SPI_BASE->SR & SPI_I2S_FLAG_RXNE)) ;
 
         // Read SPI received data
-        *data += SPI_BASE->DR;
+        uint32_t sample = SPI_BASE->DR;
+        *data += sample;
+        *dataSumSq += sample*sample;
 
         // disable
         SPI_BASE->CR1 &= (uint16_t)~((uint16_t)SPI_CR1_SPE);
 
-        // increase count for the second read
-        ++(*dataCounts);
-    }
+        ++reads;
+    } while (reads < specADCReads && pinRead(specPinTRG));
+
+    // increase count for all reads
+    *dataCounts += reads;
+}
+
+#ifdef SPEC_ADC_DMA
+// force inlining
+inline void startADCRead() __attribute__((always_inline));
+
+// Function to initiate ADC7980 read in DMA mode. It only does the
+// conversion and starts SPI transfer - the sample is deposited
+// into ring buffer by DMA
+inline void startADCRead()
+{
+    // initiate conversion and wait for max conversion time
+    pinHigh(adcPinCNV);
+    System.ticksDelay(adcConvTimeTicks);
+    pinLow(adcPinCNV);
+
+    // dummy write clocks the sample out
+    SPI_BASE->DR = 0;
+}
 
-    // increase count for the first read
-    ++(*dataCounts);
+// Current DMA write position in ADC samples ring buffer
+inline uint16_t adcDmaPos()
+{
+    return adcDmaWritePos(ADC_DMA_STREAM->NDTR, ADC_DMA_BUF_SIZE);
+}
+
+// Accumulate ADC samples received by DMA so far into current frame data,
+// at most maxSamples of them
+inline void routeADCSamples(uint32_t maxSamples = UINT32_MAX)
+{
+    adcDmaRoute(adcDmaRouter, adcDmaBuf, adcDmaPos(),
+                specFrameData+specROIStart, specFrameCounts+specROIStart,
+                specFrameSumSq+specROIStart, maxSamples);
+}
+#endif
+
+#ifdef SPEC_STATS
+// Account interrupt started at specified CPU cycle counter value
+// in the specified readout state
+inline void statsIsrDone(spec_isr_stats_t& isr, uint32_t startCycles, spec_state_t state)
+{
+    uint32_t cycles = DWT->CYCCNT - startCycles;
+
+    ++isr.count;
+    isr.cycles += cycles;
+    if (isr.minCycles > cycles)
+        isr.minCycles = cycles;
+    if (isr.maxCycles < cycles)
+        isr.maxCycles = cycles;
+    specStats.stateCycles[state] += cycles;
+}
+
+// Count pixels within readout window that got no ADC readings
+inline uint32_t statsMissedPixels(const uint16_t* counts)
+{
+    uint32_t missed = 0;
+    for (uint32_t i=specROIStart; i<specROIStart+specROIPixels; i++)
+        if (counts[i] == 0)
+            ++missed;
+
+    return missed;
 }
+#endif
 
 // deinitialise ADC SPI
 inline void endADC()
 {
+#ifdef SPEC_ADC_DMA
+    // stop DMA
+    DMA_Cmd(ADC_DMA_STREAM, DISABLE);
+    DMA_DeInit(ADC_DMA_STREAM);
+#endif
+
     // Enable SPI1 reset state
     RCC_APB2PeriphResetCmd(RCC_APB2Periph_SPI1, ENABLE);
     // Release SPI1 from reset state
@@ -323,21 +496,74 @@ inline void endADC()
 // --------------------------------------------------
 //   Timer and spectrometer clock handling routines
 // --------------------------------------------------
+// Queue completed continuous mode frame and start accumulating the next one.
+// Called from the timer interrupt at the end of the frame - the next frame
+// has been cleared on release by the consumer so only the pointers change.
+void nextContinuousFrame()
+{
+#ifdef SPEC_STATS
+    uint32_t cycles = DWT->CYCCNT;
+    specStats.frameCycles = cycles - specFrameStartCycles;
+    specFrameStartCycles = cycles;
+#endif
+
+    if (specFrameDiscard)
+    {
+        // frame acquired while the queue was full
+        ++specFrameSeq;
+        ++specFramesDropped;
+    }
+    else
+    {
+        spec_frame_t* frame = &specFrames[specFrameHead];
+        frame->seq = specFrameSeq++;
+        frame->timeMs = millis();
+    }
+
+    uint8_t nextHead = (specFrameHead+1) % SPEC_FRAME_QUEUE_SIZE;
+    specFrameDiscard = nextHead == specFrameTail;
+    if (specFrameDiscard)
+    {
+        // queue is full - hold completed frame and drop the next one
+        specFrameData = data;
+        specFrameCounts = dataCounts;
+        specFrameSumSq = dataSumSq;
+    }
+    else
+    {
+        specFrameHead = nextHead;
+        spec_frame_t* frame = &specFrames[specFrameHead];
+        specFrameData = frame->data;
+        specFrameCounts = frame->counts;
+        specFrameSumSq = frame->sumSq;
+    }
+}
+
 // TRG pin handling interrupt
 void spectroTRGInterrupt(void)
 {
     if ((EXTI->PR & specPinTRG) && (EXTI->IMR & specPinTRG))
     {
+#ifdef SPEC_STATS
+        uint32_t statsStartCycles = DWT->CYCCNT;
+#endif
         EXTI->PR = specPinTRG;
 
         // spec trigger counting is on
         if (specTRGCounter) {
             --specTRGCounter;
 
-            // we are on a reading phase
-            if (specTRGCounter < SPEC_PIXELS)
-                readADC(specData++, specDataCounter++);
+            // we are on a reading phase within readout window
+            if (specTRGCounter < specTRGReadHigh && specTRGCounter >= specTRGReadLow)
+#ifdef SPEC_ADC_DMA
+                startADCRead();
+#else
+                readADC(specData++, specDataCounter++, specDataSumSq++);
+#endif
         }
+#ifdef SPEC_STATS
+        statsIsrDone(specStats.trgIsr, statsStartCycles, specState);
+#endif
     }
 
     // call system interrupt
@@ -345,6 +571,41 @@ void spectroTRGInterrupt(void)
         sysIrqHandler();
 }
 
+// Trigger input interrupt - starts the next frame in triggered continuous
+// mode. The timer is restarted from zero so the first sensor clock follows
+// the trigger edge after exactly one timer period.
+void spectroTrigInInterrupt(void)
+{
+    if ((EXTI->PR & specPinTrigIn) && (EXTI->IMR & specPinTrigIn))
+    {
+        EXTI->PR = specPinTrigIn;
+
+        if (specContinuous && specState == SPEC_STOP) {
+            specData = specFrameData+specROIStart;
+            specDataCounter = specFrameCounts+specROIStart;
+            specDataSumSq = specFrameSumSq+specROIStart;
+            specReadCycleCounter = specFrameCycles;
+            specCLK = specPinCLK_H;
+            specST = specPinST_L;
+            specCounter = LEAD_TICKS;
+            specState = SPEC_LEAD;
+#ifdef SPEC_STATS
+            specFrameStartCycles = DWT->CYCCNT;
+#endif
+
+            // drop update which may be pending from the halted timer
+            TIM7->SR = (uint16_t)~TIM_IT_Update;
+            TIM7->CNT = 0;
+            TIM7->CR1 |= TIM_CR1_CEN;
+        } else
+            ++specTriggersMissed;
+    }
+
+    // call system interrupt
+    if (sysTrigInIrqHandler)
+        sysTrigInIrqHandler();
+}
+
 // Spectrometer timer interrupt call. A single cycle is controlled by a
 // state machine:
 //    Ext.Trigger -> Lead -> Integration -> Read -> Trail -> Stop
@@ -365,6 +626,11 @@ void spectroClockInterrupt(void)
         if (!timerOn)
             return;
 
+#ifdef SPEC_STATS
+        uint32_t statsStartCycles = DWT->CYCCNT;
+        spec_state_t statsState = specState;
+#endif
+
         // write CLK,ST and ext trigger immediately
         pinSet(specPinCLK, specCLK);
         pinSet(specPinST,  specST);
@@ -372,6 +638,13 @@ void spectroClockInterrupt(void)
         // toggle CLK
         pinValToggle(specCLK, specPinCLK);
 
+#ifdef SPEC_ADC_DMA
+        // there is no foreground routing in continuous mode - route a few
+        // samples on every tick to keep up with DMA
+        if (specContinuous)
+            routeADCSamples(ADC_DMA_ROUTE_CHUNK);
+#endif
+
         // state machine
         switch (specState) {
             case SPEC_EXT_TRIG:
@@ -407,6 +680,10 @@ void spectroClockInterrupt(void)
                     // bring ST down - initiate integration stop
                     specST = specPinST_L;
                 else if (specCounter==0) {
+#ifdef SPEC_ADC_DMA
+                    // samples of this read cycle start at the current DMA position
+                    adcDmaCycleStart(adcDmaRouter, adcDmaPos());
+#endif
                     // start TRG count
                     specTRGCounter = TRG_CYCLES;
                     specCounter = READ_TICKS;
@@ -417,19 +694,39 @@ void spectroClockInterrupt(void)
             case SPEC_READ:
                 --specCounter;
                 if (specCounter==0) {
+                    // restore normal clock in case the tail was sped up
+                    TIM7->ARR = SPEC_CLK_TICK_TIMER;
                     specCounter = TRAIL_TICKS;
                     specState = SPEC_TRAIL;
-                }
+                } else if (specCounter==specFastTailTicks)
+                    // all pixels of interest are read - speed up the tail
+                    TIM7->ARR = SPEC_CLK_TAIL_TIMER;
                 break;
 
             case SPEC_TRAIL:
                 --specCounter;
                 if (specCounter==0) {
                     --specReadCycleCounter;
+                    if (specContinuous) {
+#ifdef SPEC_ADC_DMA
+                        // samples the per tick routing did not keep up
+                        // with cannot go to the next frame
+                        if (specReadCycleCounter == 0 && adcDmaRouter.readPos != adcDmaPos())
+                            adcDmaDrop(adcDmaRouter, adcDmaPos());
+#endif
+                        // frame is done - queue it and start the next one
+                        // (in triggered mode stop and wait for the trigger)
+                        if (specReadCycleCounter == 0) {
+                            nextContinuousFrame();
+                            if (!specTriggered)
+                                specReadCycleCounter = specFrameCycles;
+                        }
+                    }
                     if (specReadCycleCounter > 0) {
                         // initialise data variables and start another cycle
-                        specData = data;
-                        specDataCounter = dataCounts;
+                        specData = specFrameData+specROIStart;
+                        specDataCounter = specFrameCounts+specROIStart;
+                        specDataSumSq = specFrameSumSq+specROIStart;
                         specCounter = LEAD_TICKS;
                         specState = SPEC_LEAD;
                     } else {
@@ -438,6 +735,11 @@ void spectroClockInterrupt(void)
                         // disable external light if defined
                         if (pinDefined(extPinLight))
                             pinLow(extPinLight);
+                        // halt the timer till the next trigger
+                        if (specTriggered) {
+                            pinLow(specPinCLK);
+                            TIM7->CR1 &= ~TIM_CR1_CEN;
+                        }
                     }
                 }
                 break;
@@ -447,9 +749,51 @@ void spectroClockInterrupt(void)
                 specCLK = specPinCLK_L;
                 break;
         }
+
+#ifdef SPEC_STATS
+        statsIsrDone(specStats.clkIsr, statsStartCycles, statsState);
+#endif
     }
 }
 
+// Setup sensor readout window. Only the pixels within the window are
+// converted by ADC. With fast tail the clock is sped up after the last
+// window pixel (plus 4 clock cycles required after the read) till the end
+// of Read state.
+void setupSpecReadout(int startIdx, int pixels, bool fastTail)
+{
+    specROIStart = startIdx;
+    specROIPixels = pixels;
+    specTRGReadHigh = SPEC_PIXELS - startIdx;
+    specTRGReadLow = SPEC_PIXELS - (startIdx + pixels);
+
+    uint32_t lastReadTicks = (87 + startIdx + pixels + 4)*TICKS_PER_PIXEL;
+    specFastTailTicks = fastTail && lastReadTicks < READ_TICKS ? READ_TICKS - lastReadTicks : 0;
+}
+
+// Single reading cycle duration in timer units
+inline uint32_t specCycleTime()
+{
+    return (INTEG_TICKS+LEAD_TICKS+READ_TICKS+TRAIL_TICKS) * SPEC_CLK_TICK_TIMER
+           - specFastTailTicks * (SPEC_CLK_TICK_TIMER-SPEC_CLK_TAIL_TIMER);
+}
+
+// Connect EXTI line of the pin source to the pin port
+void connectEXTILine(STM32_Pin_Info* pinInfo)
+{
+    uint8_t portNumber = 0;  // port A by default
+
+    // set the port number
+    if (pinInfo->gpio_peripheral == GPIOB)
+        portNumber = 1;
+    else if (pinInfo->gpio_peripheral == GPIOC)
+        portNumber = 2;
+    else if (pinInfo->gpio_peripheral == GPIOD)
+        portNumber = 3;
+
+    SYSCFG_EXTILineConfig(portNumber, pinInfo->gpio_pin_source);
+}
+
 // start active timer
 void startSpecTimer(bool doExtTriggering)
 {
@@ -471,6 +815,9 @@ void startSpecTimer(bool doExtTriggering)
         specState     = SPEC_EXT_TRIG;
         pinHigh(extPinTrig);
     }
+    else if (specTriggered)
+        // timer is started by trigger input interrupt
+        specState   = SPEC_STOP;
     else
     {
         specCounter = LEAD_TICKS;
@@ -505,24 +852,15 @@ void startSpecTimer(bool doExtTriggering)
     // enable timer
     TIM_TimeBaseInit(TIM7, &timerInit);
     TIM_ITConfig(TIM7, TIM_IT_Update, ENABLE);
-    TIM_Cmd(TIM7, ENABLE);
+    if (specState != SPEC_STOP)
+        TIM_Cmd(TIM7, ENABLE);
 
     // setup spec TRG pin interrupts
-    uint8_t trgPortNumber = 0;  // port A by default
-
     // clear pending EXTI interrupt flag for the TRG pin
     EXTI->PR = specPinTRG;
 
-    // set the port number
-    if (specPinTRG_Info->gpio_peripheral == GPIOB)
-        trgPortNumber = 1;
-    else if (specPinTRG_Info->gpio_peripheral == GPIOC)
-        trgPortNumber = 2;
-    else if (specPinTRG_Info->gpio_peripheral == GPIOD)
-        trgPortNumber = 3;
-
     // connect EXTI Line to TRG pin
-    SYSCFG_EXTILineConfig(trgPortNumber, specPinTRG_Info->gpio_pin_source);
+    connectEXTILine(specPinTRG_Info);
 
     // enable TRG pin interrupt
     EXTI->IMR  |= specPinTRG;    // enable interrupt
@@ -578,6 +916,46 @@ void stopSpecTimer()
     timerOn = false;
 }
 
+// enable trigger input interrupt
+void startTrigIn()
+{
+    NVIC_InitTypeDef nvicInit = {0};
+
+    specTriggersMissed = 0;
+
+    // clear pending and connect EXTI line to trigger input pin
+    EXTI->PR = specPinTrigIn;
+    connectEXTILine(specPinTrigIn_Info);
+
+    // enable trigger input pin interrupt on raising edge
+    EXTI->IMR  |= specPinTrigIn;
+    EXTI->RTSR |= specPinTrigIn;
+
+    nvicInit.NVIC_IRQChannel                   = GPIO_IRQn[specPinTrigIn_Info->gpio_pin_source];
+    nvicInit.NVIC_IRQChannelPreemptionPriority = 1;
+    nvicInit.NVIC_IRQChannelSubPriority        = 0;
+    nvicInit.NVIC_IRQChannelCmd                = ENABLE;
+    NVIC_Init(&nvicInit);
+}
+
+// disable trigger input interrupt
+void stopTrigIn()
+{
+    NVIC_InitTypeDef nvicInit = {0};
+
+    EXTI->IMR  &= ~specPinTrigIn;
+    EXTI->RTSR &= ~specPinTrigIn;
+    EXTI->PR = specPinTrigIn;
+
+    // disable NVIC IRQ line if it is not shared
+    if (sysTrigInIrqHandler == 0)
+    {
+        nvicInit.NVIC_IRQChannel    = GPIO_IRQn[specPinTrigIn_Info->gpio_pin_source];
+        nvicInit.NVIC_IRQChannelCmd = DISABLE;
+        NVIC_Init(&nvicInit);
+    }
+}
+
 
 // ---------------------------------------
 //   C12880MA class and related routines
@@ -586,7 +964,8 @@ void stopSpecTimer()
 // Constructor
 C12880MA::C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t spec_st,
                    uint8_t adc_ref_sel1, uint8_t adc_ref_sel2, uint8_t adc_cnv,
-                   uint8_t ext_trg, uint8_t ext_trg_ls, const double *defaultCalibration)
+                   uint8_t ext_trg, uint8_t ext_trg_ls, const double *defaultCalibration,
+                   uint8_t trg_in)
 {
     spec_eos_ = spec_eos;
     spec_trg_ = spec_trg;
@@ -597,6 +976,7 @@ C12880MA::C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t
     adc_ref_sel1_ = adc_ref_sel1;
     adc_ref_sel2_ = adc_ref_sel2;
     adc_cnv_ = adc_cnv;
+    trg_in_ = trg_in;
 
     calibration_[0] = calibration_[1] = calibration_[2] = 0;
     calibration_[3] = calibration_[4] = calibration_[5] = 0;
@@ -604,9 +984,19 @@ C12880MA::C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t
     rangeStartIdx_ = 0;
     rangePixels_ = SPEC_PIXELS;
     meas_ = blackLevels_ = normCoef_ = 0;
+    measCodes_ = measFixed_ = measFixedRaw_ = fixOffsets_ = fixGains_ = measNoise_ = 0;
+    measReadings_ = 0;
+    invalidateFixed();
+
+    memset(autoModels_, 0, sizeof(autoModels_));
+    autoIterations_ = 0;
+    autoTimeMs_ = 0;
+    autoPredicted_ = false;
 
     measuringData_ = false;
     applyBandPassCorrection_ = true;
+    roiReadout_ = false;
+    roiFastTail_ = false;
 
     timerOn = false;
     specState = SPEC_STOP;
@@ -675,6 +1065,8 @@ C12880MA::C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t
         setWavelengthCalibrationInternal(defaultCalibration);
     }
 
+    buildWavelengthTable();
+
     // initialise ranges
     int minWavelength, maxWavelength;
     getSensorRangeInternal(minWavelength, maxWavelength);
@@ -685,6 +1077,7 @@ C12880MA::C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t
     {
         blackLevels_[i] = minBlackLevelVoltage_;
         meas_[i] = 0.0;
+        measCodes_[i] = 0;
 
         // read spectral response normalisation
         EEPROM.get(EEPROM_NORM_COEF_ARRAY+(i+rangeStartIdx_)*sizeof(float),
@@ -722,6 +1115,8 @@ bool C12880MA::begin()
         pinMode(ext_trg_,  OUTPUT);
     if (ext_trg_ls_ != NO_PIN)
         pinMode(ext_trg_ls_, OUTPUT);
+    if (trg_in_ != NO_PIN)
+        pinMode(trg_in_, INPUT_PULLDOWN);
 
     // setup hardware and fixed pins
     STM32_Pin_Info* PIN_MAP = HAL_Pin_Map();
@@ -779,7 +1174,7 @@ bool C12880MA::begin()
     const unsigned TIM7Index = 71;
     uint8_t trgPinSource = specPinTRG_Info->gpio_pin_source;
     uint8_t trgISRIndex = GPIO_IRQn[trgPinSource] + 0x10;
-    uint32_t* isrs = (uint32_t*)(SCB->VTOR);
+    uint32_t* isrs = (uint32_t*)(uintptr_t)(SCB->VTOR);
 
     // disable interrupts
     int is = __get_PRIMASK();
@@ -788,17 +1183,40 @@ bool C12880MA::begin()
     // store the system interrupt if TRG pin ISR is shared across several pins
     if (GPIO_IRQn[trgPinSource] == EXTI9_5_IRQn ||
         GPIO_IRQn[trgPinSource] == EXTI15_10_IRQn)
-        sysIrqHandler = (EXT_IRQ_Handler)isrs[trgISRIndex];
+        sysIrqHandler = (EXT_IRQ_Handler)(uintptr_t)isrs[trgISRIndex];
 
     // override TIM7 and TRG pin interrupts
-    isrs[TIM7Index]   = (uint32_t)spectroClockInterrupt;
-    isrs[trgISRIndex] = (uint32_t)spectroTRGInterrupt;
+    isrs[TIM7Index]   = (uint32_t)(uintptr_t)spectroClockInterrupt;
+    isrs[trgISRIndex] = (uint32_t)(uintptr_t)spectroTRGInterrupt;
+
+    // trigger input pin interrupt - only if it does not share the
+    // interrupt with TRG pin, otherwise triggered mode is not available
+    if (trg_in_ != NO_PIN &&
+        GPIO_IRQn[PIN_MAP[trg_in_].gpio_pin_source] != GPIO_IRQn[trgPinSource])
+    {
+        specPinTrigIn_Info = &PIN_MAP[trg_in_];
+        specPinTrigIn      = PIN_MAP[trg_in_].gpio_pin;
+
+        uint8_t trgInPinSource = specPinTrigIn_Info->gpio_pin_source;
+        uint8_t trgInISRIndex = GPIO_IRQn[trgInPinSource] + 0x10;
+        if (GPIO_IRQn[trgInPinSource] == EXTI9_5_IRQn ||
+            GPIO_IRQn[trgInPinSource] == EXTI15_10_IRQn)
+            sysTrigInIrqHandler = (EXT_IRQ_Handler)(uintptr_t)isrs[trgInISRIndex];
+        isrs[trgInISRIndex] = (uint32_t)(uintptr_t)spectroTrigInInterrupt;
+    }
 
     // enable interrupts
     if ((is & 1) == 0) {
         __enable_irq();
     }
 
+#ifdef SPEC_STATS
+    // enable CPU cycle counter for instrumentation
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    resetStats();
+#endif
+
     // set defaults
     setAdcRefInternal(adcRef_);
 
@@ -917,7 +1335,9 @@ void C12880MA::setSensorRangeInternal(int& minWavelength, int& maxWavelength)
     {
         // deallocate existing arrays
         delete[] meas_;
+        delete[] measCodes_;
         meas_ = blackLevels_ = normCoef_ = 0;
+        measCodes_ = measFixed_ = measFixedRaw_ = fixOffsets_ = fixGains_ = measNoise_ = 0;
     }
 
     rangeStartIdx_ = rangeStartIdx;
@@ -928,7 +1348,16 @@ void C12880MA::setSensorRangeInternal(int& minWavelength, int& maxWavelength)
         meas_ = new float[3*rangePixels_];
         blackLevels_ = meas_ + rangePixels_;
         normCoef_ = blackLevels_ + rangePixels_;
+
+        measCodes_ = new int32_t[6*rangePixels_];
+        measFixed_ = measCodes_ + rangePixels_;
+        measFixedRaw_ = measFixed_ + rangePixels_;
+        fixOffsets_ = measFixedRaw_ + rangePixels_;
+        fixGains_ = fixOffsets_ + rangePixels_;
+        measNoise_ = fixGains_ + rangePixels_;
     }
+
+    invalidateFixed();
 }
 
 // Sets the spectrometer sensor range in nanometers. If the range is
@@ -970,9 +1399,11 @@ void C12880MA::setSensorRange(int minWavelength, int maxWavelength)
             normCoef_[i] = 1.0;
             blackLevels_[i] = minBlackLevelVoltage_;
             meas_[i] = 0.0;
+            measCodes_[i] = 0;
         }
 
         lastMeasADCRef_ = adcRef_;
+        invalidateFixed();
 
         for (int i=0; i<rangePixels_; i++)
             // write spectral response normalisation
@@ -1016,6 +1447,9 @@ bool C12880MA::setWavelengthCalibrationInternal(const double* wavelengthCal)
         EEPROM.put(EEPROM_CALIBRATION_COEF_6, calibration_[5]);
     }
 
+    if (changed)
+        buildWavelengthTable();
+
     return changed;
 }
 
@@ -1044,9 +1478,11 @@ void C12880MA::setWavelengthCalibration(const double* wavelengthCal)
             normCoef_[i] = 1.0;
             blackLevels_[i] = minBlackLevelVoltage_;
             meas_[i] = 0.0;
+            measCodes_[i] = 0;
         }
 
         lastMeasADCRef_ = adcRef_;
+        invalidateFixed();
 
         for (int i=0; i<rangePixels_; i++)
             // write spectral response normalisation
@@ -1130,26 +1566,60 @@ uint32_t C12880MA::getIntTime()
 // Convert aggregated readouts to voltage measurement floating point data
 // and return the max value
 float C12880MA::processMeasurement(float* measurement)
+{
+    return processMeasurement(measurement, data, dataCounts, dataSumSq);
+}
+
+// Convert specified aggregated readouts to voltage measurement floating
+// point data and return the max value. Readings are averaged in fixed point
+// (see C12880MA_fixed.h) so there is no division per pixel, for the main
+// measurement the averaged codes and their standard errors are also kept
+// for fixed point processing.
+float C12880MA::processMeasurement(float* measurement,
+                                   const uint32_t* readings,
+                                   const uint16_t* readingCounts,
+                                   const uint64_t* readingSumSq)
 {
     // Initialize arrays
     float maxVal = 0.0;
-    float adcRefVoltage = adcVoltages[adcRef_];
+    float codeToVoltage = adcVoltages[adcRef_]/((float)ADC_MAX_VALUE*(1<<FIX_CODE_BITS));
+    int32_t* codes = measurement == meas_ ? measCodes_ : 0;
+    uint16_t lastCount = 0;
+    uint64_t reciprocal = 0;
     for (int i=0; i<rangePixels_; i++)
     {
-        measurement[i] = 0.0;
+        // all pixels normally have the same count
+        uint16_t count = readingCounts[i+rangeStartIdx_];
+        if (count != lastCount)
+        {
+            lastCount = count;
+            reciprocal = fixReciprocal(count);
+        }
 
-        if (dataCounts[i])
-                measurement[i] =
-                    ((float)data[i+rangeStartIdx_]*adcRefVoltage) /
-                    ((float)dataCounts[i+rangeStartIdx_]*ADC_MAX_VALUE);
+        int32_t code = fixAverage(readings[i+rangeStartIdx_], reciprocal);
+        if (codes)
+        {
+            codes[i] = code;
+            measNoise_[i] = fixStdError(readings[i+rangeStartIdx_],
+                                        readingSumSq[i+rangeStartIdx_],
+                                        count);
+        }
+
+        measurement[i] = code*codeToVoltage;
 
         if (measurement[i] > maxVal)
             maxVal = measurement[i];
     }
 
-    // store ADC ref for this measurement
+    // store ADC ref and readings for this measurement
     if (measurement == meas_)
+    {
         lastMeasADCRef_ = adcRef_;
+        measReadings_ = lastCount;
+        measFixedValid_ = false;
+    }
+    else if (measurement == blackLevels_)
+        invalidateFixed();
 
     return maxVal;
 }
@@ -1201,6 +1671,10 @@ void C12880MA::takeAutoMeasurement(auto_measure_t autoType,
 
     measuringData_ = true;
 
+    uint32_t startMs = millis();
+    autoIterations_ = 0;
+    autoPredicted_ = false;
+
     // reset blacks to calibrated minimum
     if (doBlackReset)
         resetBlackLevels();
@@ -1221,6 +1695,7 @@ void C12880MA::takeAutoMeasurement(auto_measure_t autoType,
     INTEG_TICKS = MIN_INTEG_TIME_TICKS;
     readSpectrometer(0, false, doExtTriggering);
     float maxMeasuredVoltage = processMeasurement(meas_);
+    ++autoIterations_;
 
     // Initial setup now done and we have the shortest measurement in encompassing
     // saturation limits (if allowed). Check that it is less then maximum
@@ -1253,9 +1728,105 @@ void C12880MA::takeAutoMeasurement(auto_measure_t autoType,
     // Make sure saturation voltage is just below the absolute max
     satVoltage *= 0.99;
 
+    // predict the integration from the output model of the brightest pixel
+    // model is in sensor integration ticks so that the fixed part of the
+    // integration is not in the dark part
+    uint32_t maxIntTicks = uSecToTicks(MAX_INTEG_TIME_US);
+    uint32_t minSensorTicks = MIN_INTEG_TIME_TICKS+INTEG_EXTRA_TICKS;
+    uint32_t maxSensorTicks = maxIntTicks+INTEG_EXTRA_TICKS;
+    bool stillGoing = maxMeasuredVoltage < satVoltageLower;
+    if (stillGoing)
+    {
+        auto_model_t& model = autoModels_[adcRef_];
+        float target = (satVoltageLower+satVoltage)/2;
+        float minSignal = target*AUTO_MIN_SIGNAL_FRACTION;
+
+        // the brightest pixel is only known once the reading has signal
+        // well above the noise - lengthen the integration until it does
+        int peakIdx = 0;
+        float darkLevel = 0;
+        for (;;)
+        {
+            peakIdx = 0;
+            int minIdx = 0;
+            for (int i=1; i<rangePixels_; i++)
+            {
+                if (meas_[i] > meas_[peakIdx])
+                    peakIdx = i;
+                if (meas_[i] < meas_[minIdx])
+                    minIdx = i;
+            }
+
+            // without known dark part the darkest pixel stands for it
+            darkLevel = model.valid ? model.dark : meas_[minIdx];
+            if (meas_[peakIdx] - darkLevel >= minSignal
+                || INTEG_TICKS == maxIntTicks
+                || maxMeasuredVoltage >= satVoltageLower)
+                break;
+
+            INTEG_TICKS = INTEG_TICKS < maxIntTicks/AUTO_SEARCH_STEP
+                              ? INTEG_TICKS*AUTO_SEARCH_STEP
+                              : maxIntTicks;
+            readSpectrometer(0, false, doExtTriggering);
+            maxMeasuredVoltage = processMeasurement(meas_);
+            ++autoIterations_;
+        }
+        stillGoing = maxMeasuredVoltage < satVoltageLower || maxMeasuredVoltage >= satVoltage;
+
+        // with unknown dark part take second probe exposure to fit the
+        // model, saturated reading is left to the step loop
+        bool usable = stillGoing && maxMeasuredVoltage < satVoltage;
+        bool fitted = usable
+                      && autoFitSlope(model, INTEG_TICKS+INTEG_EXTRA_TICKS, meas_[peakIdx]);
+        if (usable && !fitted)
+        {
+            uint32_t probeTicks = INTEG_TICKS+INTEG_EXTRA_TICKS;
+            float probeValue = meas_[peakIdx];
+
+            // darkest pixel level is close enough for the probe - it only
+            // needs to be longer
+            auto_model_t probeModel = { darkLevel, (probeValue-darkLevel)/probeTicks, true };
+            INTEG_TICKS = (autoPredictTicks(probeModel,
+                                            target*AUTO_PROBE_FRACTION,
+                                            probeTicks<<1,
+                                            maxSensorTicks) - INTEG_EXTRA_TICKS) & ~1UL;
+            readSpectrometer(0, false, doExtTriggering);
+            maxMeasuredVoltage = processMeasurement(meas_);
+            ++autoIterations_;
+
+            fitted = autoFitModel(model, probeTicks, probeValue,
+                                  INTEG_TICKS+INTEG_EXTRA_TICKS, meas_[peakIdx]);
+            stillGoing = maxMeasuredVoltage < satVoltageLower || maxMeasuredVoltage >= satVoltage;
+        }
+
+        // up to two predicted readings - second one corrects the slope
+        for (int i=0; i<2 && fitted && stillGoing; i++)
+        {
+            INTEG_TICKS = (autoPredictTicks(model, target, minSensorTicks, maxSensorTicks)
+                           - INTEG_EXTRA_TICKS) & ~1UL;
+            readSpectrometer(0, false, doExtTriggering);
+            maxMeasuredVoltage = processMeasurement(meas_);
+            ++autoIterations_;
+
+            if (maxMeasuredVoltage >= satVoltageLower && maxMeasuredVoltage < satVoltage)
+                stillGoing = false;
+            else if (INTEG_TICKS == maxIntTicks && maxMeasuredVoltage < satVoltage)
+                stillGoing = false;
+            else if (!autoIsLinear(model, INTEG_TICKS+INTEG_EXTRA_TICKS, meas_[peakIdx]))
+            {
+                // dark part is likely to be off too
+                model.valid = false;
+                fitted = false;
+            }
+            else
+                fitted = autoFitSlope(model, INTEG_TICKS+INTEG_EXTRA_TICKS, meas_[peakIdx]);
+        }
+
+        autoPredicted_ = !stillGoing;
+    }
+
     // now go up the integration within the range until we maximise the exposure
     uint32_t intTicksStep = INTEG_TICKS;
-    bool stillGoing = maxMeasuredVoltage < satVoltageLower;
     while (stillGoing)
     {
         // determine increase or decrease of the integration
@@ -1281,6 +1852,7 @@ void C12880MA::takeAutoMeasurement(auto_measure_t autoType,
         // do new reading
         readSpectrometer(0, false, doExtTriggering);
         maxMeasuredVoltage = processMeasurement(meas_);
+        ++autoIterations_;
 
         // check exit conditions
         if (maxMeasuredVoltage >= satVoltageLower && maxMeasuredVoltage < satVoltage)
@@ -1297,10 +1869,12 @@ void C12880MA::takeAutoMeasurement(auto_measure_t autoType,
                 // revert last iteration if tipped over
                 INTEG_TICKS -= intTicksStep<<1;
                 readSpectrometer(0, false, doExtTriggering);
+                ++autoIterations_;
             }
         }
     }
 
+    autoTimeMs_ = millis() - startMs;
     measuringData_ = false;
 
     // save data that was established in EEPROM
@@ -1465,6 +2039,7 @@ void C12880MA::calibrateSpectralResponse(float lampTempK, bool useCurrentMeasure
     }
 
     measuringData_ = false;
+    invalidateFixed();
 
     for (int i=0; i<rangePixels_; i++)
         // write spectral response normalisation
@@ -1512,6 +2087,18 @@ void C12880MA::resetBlackLevels(float resetVoltage)
         resetVoltage = minBlackLevelVoltage_;
     for (int i=0; i<rangePixels_; i++)
         blackLevels_[i] = resetVoltage;
+
+    invalidateFixed();
+}
+
+// Setup sensor readout window for the next reading - either the whole
+// sensor or only the current range in ROI readout mode
+void C12880MA::setupReadout()
+{
+    if (roiReadout_)
+        setupSpecReadout(rangeStartIdx_, rangePixels_, roiFastTail_);
+    else
+        setupSpecReadout(0, SPEC_PIXELS, false);
 }
 
 // This routine to initiate and read spectrometer measurement data
@@ -1523,22 +2110,31 @@ void C12880MA::readSpectrometer(uint32_t timeUs,
     if (timerOn)
         return;
 
+#ifdef SPEC_STATS
+    uint32_t statsStartCycles = DWT->CYCCNT;
+#endif
+
+    setupReadout();
+
     // number of reading cycles to do
-    uint32_t readCycles =
-        (timeUs * TIMER_US_FACTOR) /
-            ((INTEG_TICKS+LEAD_TICKS+READ_TICKS+TRAIL_TICKS) * SPEC_CLK_TICK_TIMER);
+    uint32_t readCycles = (timeUs * TIMER_US_FACTOR) / specCycleTime();
 
     if (readCycles < 1)
         readCycles = 1;
-    if (readCycles<<1 > UINT16_MAX)
-        readCycles = UINT16_MAX>>1;
+    if (readCycles*specADCReads > UINT16_MAX)
+        readCycles = UINT16_MAX/specADCReads;
 
     // set read cycles counter
     specReadCycleCounter = readCycles;
 
     // initialise variables
-    specData = data;
-    specDataCounter = dataCounts;
+    specContinuous = false;
+    specFrameData = data;
+    specFrameCounts = dataCounts;
+    specFrameSumSq = dataSumSq;
+    specData = data+specROIStart;
+    specDataCounter = dataCounts+specROIStart;
+    specDataSumSq = dataSumSq+specROIStart;
 
     // init stats and data
     for (int i=0; i<SPEC_PIXELS; i++)
@@ -1546,6 +2142,7 @@ void C12880MA::readSpectrometer(uint32_t timeUs,
         // zero data
         data[i] = 0UL;
         dataCounts[i] = 0;
+        dataSumSq[i] = 0ULL;
     }
 
     // initialise light trigger pin if triggering is enabled
@@ -1565,17 +2162,194 @@ void C12880MA::readSpectrometer(uint32_t timeUs,
 
     // loop until stop
     while (specState != SPEC_STOP)
+#ifdef SPEC_ADC_DMA
+        routeADCSamples();
+#else
         ;
+#endif
 
     // stop the timer and cleanup
     stopSpecTimer();
+#ifdef SPEC_ADC_DMA
+    // wait for the last transfer and route the remaining samples
+    while (SPI_BASE->SR & SPI_I2S_FLAG_BSY) ;
+    routeADCSamples();
+#endif
+    endADC();
+
+#ifdef SPEC_STATS
+    specStats.readCycles = specStats.frameCycles = DWT->CYCCNT - statsStartCycles;
+    specStats.missedPixels = statsMissedPixels(dataCounts);
+#endif
+}
+
+// Start continuous free running measurements. The spectrometer is read
+// in a loop and each completed frame is queued to be retrieved by
+// popFrame(). The timeUs parameter is the frame time and has the same
+// meaning as in takeMeasurement().
+//
+// Returns false if the measurement is already in progress.
+bool C12880MA::startContinuous(uint32_t timeUs, bool triggered)
+{
+    // no action if timer is on or in measurement
+    if (timerOn || measuringData_)
+        return false;
+
+    // triggered mode needs trigger input
+    if (triggered && specPinTrigIn == 0)
+        return false;
+
+    measuringData_ = true;
+
+    setupReadout();
+
+    // number of reading cycles per frame
+    uint32_t readCycles = (timeUs * TIMER_US_FACTOR) / specCycleTime();
+
+    if (readCycles < 1)
+        readCycles = 1;
+    if (readCycles*specADCReads > UINT16_MAX)
+        readCycles = UINT16_MAX/specADCReads;
+
+    specFrameCycles = readCycles;
+    specReadCycleCounter = readCycles;
+
+    // reset frames queue
+    specFrameHead = specFrameTail = 0;
+    specFrameSeq = 0;
+    specFramesDropped = 0;
+    specFrameDiscard = false;
+    memset(specFrames, 0, sizeof(specFrames));
+    specFrameData = specFrames[0].data;
+    specFrameCounts = specFrames[0].counts;
+    specFrameSumSq = specFrames[0].sumSq;
+    specData = specFrameData+specROIStart;
+    specDataCounter = specFrameCounts+specROIStart;
+    specDataSumSq = specFrameSumSq+specROIStart;
+    specContinuous = true;
+    specTriggered = triggered;
+
+    // no light triggering in continuous mode
+    extPinLight_BR = 0;
+
+#ifdef SPEC_STATS
+    specFrameStartCycles = DWT->CYCCNT;
+#endif
+
+    // init ADC and initiate the timer
+    startADC(adc_cnv_);
+    startSpecTimer(false);
+    if (triggered)
+        startTrigIn();
+
+    return true;
+}
+
+// Stop continuous measurements. The frame being acquired is discarded,
+// already queued frames are still available via popFrame().
+void C12880MA::stopContinuous()
+{
+    if (!specContinuous)
+        return;
+
+    if (specTriggered)
+        stopTrigIn();
+    stopSpecTimer();
     endADC();
+
+    specContinuous = false;
+    specTriggered = false;
+    specState = SPEC_STOP;
+
+    measuringData_ = false;
 }
 
+// Retrieve the oldest queued continuous mode frame into the current
+// measurement so it is available via getMeasurement(). Returns frame
+// sequence number and completion time in milliseconds.
+//
+// Returns false if no frame is available.
+bool C12880MA::popFrame(uint32_t& frameSeq, uint32_t& frameTimeMs)
+{
+    if (specFrameTail == specFrameHead)
+        return false;
+
+    spec_frame_t* frame = &specFrames[specFrameTail];
+    frameSeq = frame->seq;
+    frameTimeMs = frame->timeMs;
+    processMeasurement(meas_, frame->data, frame->counts, frame->sumSq);
+#ifdef SPEC_STATS
+    specStats.missedPixels = statsMissedPixels(frame->counts);
+#endif
+
+    // clear the frame for reuse and release it
+    memset(frame->data, 0, sizeof(frame->data));
+    memset(frame->counts, 0, sizeof(frame->counts));
+    memset(frame->sumSq, 0, sizeof(frame->sumSq));
+    specFrameTail = (specFrameTail+1) % SPEC_FRAME_QUEUE_SIZE;
+
+    return true;
+}
+
+// Continuous mode status
+bool C12880MA::isContinuous()
+{
+    return specContinuous;
+}
+
+// Number of continuous mode frames dropped because the queue was full
+uint32_t C12880MA::getDroppedFrames()
+{
+    return specFramesDropped;
+}
+
+// Number of trigger input edges ignored because the frame was acquired
+uint32_t C12880MA::getMissedTriggers()
+{
+    return specTriggersMissed;
+}
+
+#ifdef SPEC_STATS
+// Get acquisition statistics - copied with interrupts disabled as the
+// timer interrupt may be updating them
+void C12880MA::getStats(spec_stats_t& stats)
+{
+    int is = __get_PRIMASK();
+    __disable_irq();
+
+    stats = specStats;
+
+    if ((is & 1) == 0)
+        __enable_irq();
+}
+
+// Reset acquisition statistics
+void C12880MA::resetStats()
+{
+    int is = __get_PRIMASK();
+    __disable_irq();
+
+    memset(&specStats, 0, sizeof(specStats));
+    specStats.clkIsr.minCycles = UINT32_MAX;
+    specStats.trgIsr.minCycles = UINT32_MAX;
+
+    if ((is & 1) == 0)
+        __enable_irq();
+}
+#endif
+
 // Enable/disable Stearns and Stearns (1988) bandpass correction
 void C12880MA::enableBandpassCorrection(bool enable)
 {
     applyBandPassCorrection_ = enable;
+    measFixedValid_ = false;
+}
+
+// Enable/disable region of interest readout
+void C12880MA::enableROIReadout(bool enable, bool fastTail)
+{
+    roiReadout_ = enable;
+    roiFastTail_ = enable && fastTail;
 }
 
 // Set the saturation voltage. This is used to in auto integration
@@ -1589,6 +2363,8 @@ void C12880MA::setSaturationVoltage(float satVoltage, bool storeInEeprom)
     else
         satVoltage_ = MIN_SAT_VOLTAGE;
 
+    invalidateFixed();
+
     if (storeInEeprom)
         EEPROM.put(EEPROM_SAT_VOLTAGE, satVoltage_);
 }
@@ -1626,6 +2402,10 @@ void C12880MA::measureSaturationVoltage()
     adc_ref_t savedAdcRef = getAdcReference();
     uint32_t savedIntTicks = INTEG_TICKS;
 
+    // saturation is detected across all sensor pixels
+    bool savedROIReadout = roiReadout_;
+    roiReadout_ = false;
+
     // set the 5V reference - that's the highest C12880MA will go
     setAdcRefInternal(ADC_5V);
 
@@ -1676,9 +2456,10 @@ void C12880MA::measureSaturationVoltage()
         setSaturationVoltage(getAveragedMax(maxVoltage, meas_));
     }
 
-    // restore ADC reference and integration
+    // restore ADC reference, integration and readout mode
     setAdcRefInternal(savedAdcRef);
     INTEG_TICKS = savedIntTicks;
+    roiReadout_ = savedROIReadout;
 
     measuringData_ = false;
 }
@@ -1754,6 +2535,7 @@ void C12880MA::setMeasurementType(measure_t measurementType, bool storeInEeprom)
         return;
 
     measurementType_ = measurementType;
+    invalidateFixed();
 
     if (storeInEeprom)
         EEPROM.put(EEPROM_MEASURE_TYPE_ADDR, measurementType_);
@@ -1794,10 +2576,98 @@ void C12880MA::setAdcReference(adc_ref_t ref, bool storeInEeprom)
     delay(200);
 }
 
+// Build fixed point per pixel black level offset and gain tables for
+// the last measurement ADC reference
+void C12880MA::buildFixedTables()
+{
+    double adcRefVoltage = adcVoltages[lastMeasADCRef_];
+    double voltageToCode = ADC_MAX_VALUE/adcRefVoltage;
+    double gain = adcRefVoltage/ADC_MAX_VALUE;
+    if (measurementType_ == MEASURE_ABSOLUTE)
+        gain /= satVoltage_;
+    else if (measurementType_ == MEASURE_RELATIVE)
+        gain /= adcRefVoltage;
+
+    fixParams_.minDiff = fixFromFloat(voltageToCode/ADC_MAX_VALUE, FIX_CODE_BITS);
+    fixParams_.satCode = fixFromFloat(voltageToCode*satVoltage_, FIX_CODE_BITS);
+    fixParams_.gain    = fixFromFloat(gain, FIX_GAIN_BITS);
+
+    for (int i=0; i<rangePixels_; i++)
+    {
+        fixOffsets_[i] = fixFromFloat(voltageToCode*blackLevels_[i], FIX_CODE_BITS);
+        fixGains_[i] = fixFromFloat(gain*normCoef_[i], FIX_GAIN_BITS);
+    }
+
+    fixTableADCRef_ = lastMeasADCRef_;
+    fixTableValid_ = true;
+    measFixedValid_ = false;
+}
+
+// Get measured data for specified pixel in fixed point
+int32_t C12880MA::getMeasurementFixed(uint16_t pixelIdx, bool normalise)
+{
+    if (pixelIdx >= rangePixels_)
+        return 0;
+
+    if (!fixTableValid_ || fixTableADCRef_ != lastMeasADCRef_)
+        buildFixedTables();
+
+    // process all pixels in one pass - with and without normalisation
+    if (!measFixedValid_)
+    {
+        fixParams_.bandpass = applyBandPassCorrection_;
+        fixProcess(measCodes_, fixOffsets_, fixGains_, fixParams_,
+                   true, rangePixels_, measFixed_, measFixedRaw_);
+        measFixedValid_ = true;
+    }
+
+    return normalise ? measFixed_[pixelIdx] : measFixedRaw_[pixelIdx];
+}
+
+// Get standard error of measured data for specified pixel in fixed point.
+// It is scaled as the measurement (bandpass correction is not applied).
+int32_t C12880MA::getNoiseFixed(uint16_t pixelIdx, bool normalise)
+{
+    if (pixelIdx >= rangePixels_)
+        return 0;
+
+    if (!fixTableValid_ || fixTableADCRef_ != lastMeasADCRef_)
+        buildFixedTables();
+
+    bool saturated = measCodes_[pixelIdx] > fixParams_.satCode;
+    int32_t gain = normalise && !saturated ? fixGains_[pixelIdx] : fixParams_.gain;
+
+    return (int32_t)(((int64_t)measNoise_[pixelIdx]*gain) >> FIX_SHIFT);
+}
+
+// Get standard error of measured data for specified pixel
+double C12880MA::getNoise(uint16_t pixelIdx, bool normalise)
+{
+    return getNoiseFixed(pixelIdx, normalise)*(1.0/FIX_ONE);
+}
+
+// Set maximum number of averaging ADC reads per pixel readout
+void C12880MA::setOversampling(uint8_t reads)
+{
+    if (reads < 1)
+        reads = 1;
+    else if (reads > ADC_MAX_READS)
+        reads = ADC_MAX_READS;
+
+    specADCReads = reads;
+}
+
+// Get maximum number of averaging ADC reads per pixel readout
+uint8_t C12880MA::getOversampling()
+{
+    return specADCReads;
+}
+
 // Get measured data for specified pixel
 // Note: Applying bandpass correction can go out of range
 double C12880MA::getMeasurement(uint16_t pixelIdx, bool normalise)
 {
+#ifdef SPEC_FLOAT_MEASUREMENT
     double data = meas_[pixelIdx];
 
     if (applyBandPassCorrection_)
@@ -1830,17 +2700,59 @@ double C12880MA::getMeasurement(uint16_t pixelIdx, bool normalise)
         data = 0;
 
     return data;
+#else
+    return getMeasurementFixed(pixelIdx, normalise)*(1.0/FIX_ONE);
+#endif
+}
+
+// Calculate the wavelength for specified sensor pixel index from
+// the calibration polynomial (in Horner form)
+double C12880MA::calcWavelength(int pixelIdx)
+{
+    // pixel number in formula start with 1
+    double p = pixelIdx+1;
+    return calibration_[0]
+           + p*(calibration_[1]
+           + p*(calibration_[2]
+           + p*(calibration_[3]
+           + p*(calibration_[4]
+           + p*calibration_[5]))));
+}
+
+// Build the wavelength table for all sensor pixels - this is done
+// once the calibration changes
+void C12880MA::buildWavelengthTable()
+{
+    for (int i=0; i<SPEC_PIXELS; i++)
+        wavelengths_[i] = calcWavelength(i);
 }
 
 // get the wavelength for specified pixel
 double C12880MA::getWavelength(uint16_t pixelNumber)
 {
-    // pixelNumber in formula start with 1
-    double p = pixelNumber+rangeStartIdx_+1;
-    return calibration_[0]
-           + (p*calibration_[1])
-           + (p*p*calibration_[2])
-           + (p*p*p*calibration_[3])
-           + (p*p*p*p*calibration_[4])
-           + (p*p*p*p*p*calibration_[5]);
+    int idx = pixelNumber+rangeStartIdx_;
+    return idx < SPEC_PIXELS ? wavelengths_[idx] : calcWavelength(idx);
+}
+
+// get the fractional pixel index for specified wavelength
+float C12880MA::getPixelIndex(float wavelength)
+{
+    // binary search for the segment containing the wavelength,
+    // wavelengths are increasing with pixel index
+    int lo = 0;
+    int hi = SPEC_PIXELS-1;
+    while (hi-lo > 1)
+    {
+        int mid = (lo+hi)/2;
+        if (wavelengths_[mid] <= wavelength)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // interpolate within the segment (extrapolate outside of the sensor)
+    float step = wavelengths_[hi]-wavelengths_[lo];
+    float pixel = step > 0 ? lo + (wavelength-wavelengths_[lo])/step : lo;
+
+    return pixel-rangeStartIdx_;
 }
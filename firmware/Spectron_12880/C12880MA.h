@@ -23,6 +23,8 @@
 #define _C12880MA_H_
 
 #include "application.h"
+#include "C12880MA_fixed.h"
+#include "C12880MA_auto.h"
 
 // No pin assigned
 #ifndef NO_PIN
@@ -75,6 +77,36 @@ enum auto_measure_t {
 #endif
 #define EEPROM_C12880_SIZE       80+(SPEC_PIXELS*4)
 
+// Acquisition instrumentation - uncomment to collect interrupt durations
+// and readout statistics using CPU cycle counter (DWT CYCCNT). When it is
+// commented out the instrumentation is compiled out completely.
+//#define SPEC_STATS
+
+#ifdef SPEC_STATS
+// Number of readout states the interrupt time is collected for
+// (Ext.Trigger, Lead, Integration, Read, Trail, Stop)
+#define SPEC_STATS_STATES  6
+
+// Interrupt duration statistics in CPU cycles
+struct spec_isr_stats_t {
+    uint32_t count;             // interrupts handled
+    uint32_t minCycles;         // shortest interrupt
+    uint32_t maxCycles;         // longest interrupt
+    uint64_t cycles;            // total time in interrupt
+};
+
+// Acquisition statistics since the last resetStats(). Durations are in
+// CPU cycles (System.ticksPerMicrosecond() cycles per microsecond).
+struct spec_stats_t {
+    spec_isr_stats_t clkIsr;    // timer (sensor clock) interrupt
+    spec_isr_stats_t trgIsr;    // TRG pin interrupt (includes nested timer interrupts)
+    uint64_t stateCycles[SPEC_STATS_STATES]; // interrupt time spent in each readout state
+    uint32_t missedPixels;      // pixels without readings in the last read or frame
+    uint32_t frameCycles;       // last frame duration
+    uint32_t readCycles;        // last sensor read duration (blocking for single measurement)
+};
+#endif
+
 // Spectrometer class
 //
 //    This class uses TIM7 timer interrupt as well as SPI so it affects their
@@ -100,10 +132,11 @@ class C12880MA {
 private:
     // pin definitions - ADC assumes use of the standard SPI pins
 	uint8_t spec_eos_, spec_trg_, spec_clk_, spec_st_, ext_trg_, ext_trg_ls_;
-    uint8_t adc_ref_sel1_, adc_ref_sel2_, adc_cnv_;
+    uint8_t adc_ref_sel1_, adc_ref_sel2_, adc_cnv_, trg_in_;
 
     // Variables
     double    calibration_[6];  // Hamamatsu calibration constants to provide wavelenghts
+    float     wavelengths_[SPEC_PIXELS]; // Wavelength of each sensor pixel from calibration
     int       rangeStartIdx_;   // Index of the first spectrometer pixel in a spectrometer range
     int       rangePixels_;     // Total pixels in a measured spectral range
     adc_ref_t adcRef_;          // ADC reference voltage
@@ -111,6 +144,8 @@ private:
     float     satVoltage_;      // Sensor saturation voltage
     bool      measuringData_;   // Is currently measuring
     bool      applyBandPassCorrection_; // Whether to apply bandpass correction
+    bool      roiReadout_;     // Only read pixels within sensor range
+    bool      roiFastTail_;    // Speed up sensor clock after the last range pixel
     float     minBlackLevelVoltage_;    // Stored single black level voltage - used as default
 
     float     *blackLevels_;   // Individual pixel black level measurement in volts
@@ -118,7 +153,25 @@ private:
     float     *meas_;          // Last measurement expressed in voltage with subtracted black
     adc_ref_t lastMeasADCRef_; // ADC reference used for last measurement
 
+    int32_t   *measCodes_;     // Last measurement as averaged ADC codes (fixed point)
+    int32_t   *measFixed_;     // Last measurement fully processed (fixed point)
+    int32_t   *measFixedRaw_;  // Last measurement processed without normalisation
+    int32_t   *fixOffsets_;    // Per pixel black level in ADC codes (fixed point)
+    int32_t   *fixGains_;      // Per pixel gain with normalisation (fixed point)
+    int32_t   *measNoise_;     // Last measurement standard error in ADC codes (fixed point)
+    uint16_t  measReadings_;   // ADC readings averaged per pixel in last measurement
+    fix_params_t fixParams_;   // Fixed point processing parameters
+    adc_ref_t fixTableADCRef_; // ADC reference the fixed point tables were built for
+    bool      fixTableValid_;  // Fixed point tables are up to date
+    bool      measFixedValid_; // Fixed point measurements are up to date
+
+    auto_model_t autoModels_[ADC_5V+1]; // Auto measurement output model per ADC reference
+    uint16_t  autoIterations_; // Sensor readings done by last auto measurement
+    uint32_t  autoTimeMs_;     // Time taken by last auto measurement
+    bool      autoPredicted_;  // Last auto measurement finished by model prediction
+
     // Low-level internal routines
+    void setupReadout();
     void readSpectrometer(uint32_t timeUs, bool doExtTriggering, bool doLightTriggering);
     void setAdcRefInternal(adc_ref_t adcRef);
     void setGainInternal(gain_t gain);
@@ -126,8 +179,14 @@ private:
     void setSensorRangeInternal(int& minWavelength, int& maxWavelength);
     void getSensorRangeInternal(int& minWavelength, int &maxWavelength);
     float processMeasurement(float* measurement);
+    float processMeasurement(float* measurement, const uint32_t* readings,
+                             const uint16_t* readingCounts, const uint64_t* readingSumSq);
     float getAveragedMax(float maxVal, float* measurement);
     bool setWavelengthCalibrationInternal(const double* wavelengthCal);
+    double calcWavelength(int pixelIdx);
+    void buildWavelengthTable();
+    void buildFixedTables();
+    void invalidateFixed() { fixTableValid_ = measFixedValid_ = false; }
 
 
 public:
@@ -144,9 +203,12 @@ public:
     //     ext_trg      - optional trigger pin for capture device (setting HIGH triggers external device)
     //     ext_trg_ls   - optional trigger pin for lightsource (setting HIGH triggers light source)
     //     calibration  - optional wavelength calibration factors (array of 6 doubles from Hamamatsu test sheet)
+    //     trg_in       - optional trigger input pin starting frames in triggered continuous mode
+    //                    (must not share EXTI interrupt with spec_trg)
     C12880MA(uint8_t spec_eos, uint8_t spec_trg, uint8_t spec_clk, uint8_t spec_st,
              uint8_t adc_ref_sel1, uint8_t adc_ref_sel2, uint8_t adc_cnv,
-             uint8_t ext_trg, uint8_t ext_trg_ls, const double *defaultCalibration);
+             uint8_t ext_trg, uint8_t ext_trg_ls, const double *defaultCalibration,
+             uint8_t trg_in = NO_PIN);
     ~C12880MA();
 
     // Setup methods and setters
@@ -206,6 +268,14 @@ public:
     // Enable/disable Stearns and Stearns (1988) bandpass correction
     void enableBandpassCorrection(bool enable);
 
+    // Enable/disable region of interest readout. When enabled only the
+    // pixels within current sensor range are converted by ADC and, with
+    // fastTail, sensor clock is sped up after the last range pixel is read.
+    // This shortens reading cycle so more cycles are averaged within the
+    // same measurement time. Pixels outside of the range are not measured
+    // in this mode.
+    void enableROIReadout(bool enable, bool fastTail = true);
+
     // Set the saturation voltage. This is used to in auto integration
     // mode of measurement. Passing values outside of range from Hamamatsu
     // spec will reset approprite value to the default one.
@@ -267,6 +337,11 @@ public:
     //        with established exposure parameters after this call to make
     //        measurement more precise.
     //
+    // The integration is predicted from short probe exposures using linear
+    // output model (see C12880MA_auto.h), usually taking one or two readings
+    // after the probes. Iterative search is only used if the sensor response
+    // does not follow the model.
+    //
     void takeAutoMeasurement(auto_measure_t autoType = AUTO_FOR_SET_REF,
                              bool doBlackReset = true,
                              bool doExtTriggering = false);
@@ -317,9 +392,56 @@ public:
     // levels are reset to calibrated minimum black (default behavior).
     void resetBlackLevels(float resetVoltage = -1.0);
 
+    // Start continuous free running measurements. Spectrometer is read in
+    // a loop (Lead -> Integration -> Read -> Trail) and every completed
+    // frame is placed into a small frames queue. The timeUs parameter is
+    // the frame time and has the same meaning as in takeMeasurement().
+    //
+    // In triggered mode each frame is started by the rising edge on the
+    // trigger input pin instead. The sensor clock is held between frames
+    // and restarts on the edge so the integration starts at fixed delay
+    // (lead time plus interrupt latency) after the trigger. Edges arriving
+    // while the frame is acquired are ignored and counted as missed.
+    //
+    // While running, all other measurement and setup calls are ignored.
+    // Returns false if measurement is already in progress or triggered
+    // mode is requested without usable trigger input pin.
+    bool startContinuous(uint32_t timeUs = 0, bool triggered = false);
+
+    // Stop continuous measurements. Already queued frames can still be
+    // retrieved after stopping.
+    void stopContinuous();
+
+    // Retrieve the oldest queued frame into the current measurement (so it
+    // is accessible via getMeasurement()) returning its sequence number and
+    // completion time in milliseconds. Gaps in sequence numbers indicate
+    // frames dropped because the queue was full.
+    //
+    // Returns false if there is no frame available.
+    bool popFrame(uint32_t& frameSeq, uint32_t& frameTimeMs);
+
     // Get measured data for specified pixel (normalised or as is)
     double getMeasurement(uint16_t pixelIdx, bool normalise=true);
 
+    // Get measured data for specified pixel in fixed point (value*FIX_ONE).
+    // All pixels are processed in one pass on the first call after the
+    // measurement and cached for subsequent calls.
+    int32_t getMeasurementFixed(uint16_t pixelIdx, bool normalise=true);
+
+    // Get standard error (noise estimate) of measured data for specified
+    // pixel, scaled as the measurement. It is calculated from the spread
+    // of all ADC readings averaged into the pixel value so it requires at
+    // least two readings per pixel.
+    double getNoise(uint16_t pixelIdx, bool normalise=true);
+    int32_t getNoiseFixed(uint16_t pixelIdx, bool normalise=true);
+
+    // Set maximum number of averaging ADC reads per pixel readout (1..8).
+    // Reads are repeated only while the sensor holds the pixel output so
+    // the actual number depends on the clock frequency. In DMA readout
+    // mode there is always a single read per pixel readout.
+    void setOversampling(uint8_t reads);
+    uint8_t getOversampling();
+
     // Get the read black voltage for specified pixel
     float getBlackLevelVoltage(uint16_t pixelIdx) { return blackLevels_[pixelIdx]; }
 
@@ -329,6 +451,11 @@ public:
     // Get the wavelength for specified pixel in nanometers
     double getWavelength(uint16_t pixel);
 
+    // Get the fractional pixel index for specified wavelength in nanometers.
+    // The index is relative to the current range start as for getWavelength()
+    // and is extrapolated if the wavelength is outside of the sensor range.
+    float getPixelIndex(float wavelength);
+
     // Attribute getters
     const double* getWavelengthCalibration() { return calibration_; }
     int getTotalPixels()                     { return rangePixels_; }
@@ -339,8 +466,22 @@ public:
     float getMinBlackVoltage()               { return minBlackLevelVoltage_; }
     bool isMeasuring()                       { return measuringData_; }
     bool isBandpassCorrected()               { return applyBandPassCorrection_; }
+    bool isROIReadout()                      { return roiReadout_; }
+    uint16_t getMeasurementReadings()        { return measReadings_; }
     uint32_t getIntTime();             // returns currently set integration time in uSec
     int32_t getExtTrgMeasDelay();      // returns currently set ext trigger delay in uSec
+    bool isContinuous();               // returns true if continuous mode is on
+    uint32_t getDroppedFrames();       // returns continuous mode frames dropped so far
+    uint32_t getMissedTriggers();      // returns trigger edges ignored in triggered mode so far
+    uint16_t getAutoIterations()             { return autoIterations_; }
+    uint32_t getAutoTimeMs()                 { return autoTimeMs_; }
+    bool isAutoPredicted()                   { return autoPredicted_; }
+
+#ifdef SPEC_STATS
+    // Acquisition statistics collected since the last reset
+    void getStats(spec_stats_t& stats);
+    void resetStats();
+#endif
 };
 
 #endif
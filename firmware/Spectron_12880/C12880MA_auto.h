@@ -0,0 +1,127 @@
+/*
+ *  C12880MA_auto.h - Predictive auto exposure model for C12880MA driver
+ *                    on Spectron board. This part is hardware independent
+ *                    (no Particle/STM32 headers) so it can be compiled
+ *                    and checked on the host as is.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_C12880MA_AUTO_H_)
+#define _C12880MA_AUTO_H_
+
+#include <stdint.h>
+
+// Sensor output of the brightest pixel is modelled as linear in
+// integration ticks:
+//
+//    V(t) = dark + slope*t
+//
+// The ticks are the whole sensor integration including the fixed part
+// the sensor adds to the set integration time - that part integrates
+// the light too, so it cannot be in the dark part. The dark part (offset
+// and dark current) depends on the ADC reference setup and changes
+// slowly so it is kept between measurements per ADC reference. The slope
+// depends on the light and is fitted from the probe exposures of each
+// auto measurement.
+
+// Maximum relative error between predicted and measured output for
+// the response to be considered linear
+#define AUTO_LINEAR_TOLERANCE   0.05f
+
+// Second probe targets this fraction of the target output - this keeps
+// probe short but far enough from the first one for a reliable fit
+#define AUTO_PROBE_FRACTION     0.3f
+
+// Signal above the dark part needed to fit the model, as fraction of the
+// target output - shorter readings are dominated by noise
+#define AUTO_MIN_SIGNAL_FRACTION 0.02f
+
+// Integration multiplier while looking for the reading with enough signal
+#define AUTO_SEARCH_STEP        16
+
+struct auto_model_t {
+    float dark;     // output at zero integration ticks, volts
+    float slope;    // output increase per integration tick, volts
+    bool  valid;    // dark part is known
+};
+
+// Fit the model from two exposures of the same pixel. Returns false
+// if the exposures do not allow the fit (no signal increase).
+inline bool autoFitModel(auto_model_t& model,
+                         uint32_t ticks0, float value0,
+                         uint32_t ticks1, float value1)
+{
+    if (ticks1 == ticks0 || value1 <= value0)
+        return false;
+
+    model.slope = (value1-value0)/((float)ticks1-(float)ticks0);
+    model.dark  = value0 - model.slope*ticks0;
+    model.valid = true;
+
+    return true;
+}
+
+// Fit only the slope from a single exposure using known dark part.
+// Returns false if there is no signal above dark part.
+inline bool autoFitSlope(auto_model_t& model, uint32_t ticks, float value)
+{
+    if (!model.valid || ticks == 0 || value <= model.dark)
+        return false;
+
+    model.slope = (value-model.dark)/ticks;
+
+    return true;
+}
+
+// Predicted output for specified integration ticks
+inline float autoPredict(const auto_model_t& model, uint32_t ticks)
+{
+    return model.dark + model.slope*ticks;
+}
+
+// Integration ticks to achieve target output clipped to limits
+inline uint32_t autoPredictTicks(const auto_model_t& model,
+                                 float target,
+                                 uint32_t minTicks,
+                                 uint32_t maxTicks)
+{
+    if (model.slope <= 0)
+        return maxTicks;
+
+    float ticks = (target-model.dark)/model.slope;
+    if (ticks <= (float)minTicks)
+        return minTicks;
+    if (ticks >= (float)maxTicks)
+        return maxTicks;
+
+    return (uint32_t)(ticks + 0.5f);
+}
+
+// Check if the measured output agrees with the model prediction
+inline bool autoIsLinear(const auto_model_t& model, uint32_t ticks, float value)
+{
+    float predicted = autoPredict(model, ticks);
+    float diff = value - predicted;
+    if (diff < 0)
+        diff = -diff;
+
+    return predicted > 0 && diff <= predicted*AUTO_LINEAR_TOLERANCE;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ *  C12880MA_dma.h - ADC DMA sample routing for C12880MA driver on
+ *                   Spectron board. This part is hardware independent
+ *                   (no Particle/STM32 headers) so it can be compiled
+ *                   and checked on the host as is.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_C12880MA_DMA_H_)
+#define _C12880MA_DMA_H_
+
+#include <stdint.h>
+
+// ADC DMA ring buffer size in samples. DMA runs in circular mode over
+// this buffer and samples are drained while the sensor is being read,
+// so it only needs to cover the samples arriving between two drains.
+// Two full frames of pixels is plenty.
+#ifndef ADC_DMA_BUF_SIZE
+#define ADC_DMA_BUF_SIZE  (2*SPEC_PIXELS)
+#endif
+
+// Max samples routed in a single timer interrupt in continuous mode.
+// Sensor produces one sample per two timer ticks so routing on every
+// tick keeps up with it while the interrupt stays short.
+#ifndef ADC_DMA_ROUTE_CHUNK
+#define ADC_DMA_ROUTE_CHUNK  2
+#endif
+
+// Read cycle starts the router has not reached yet - routing may lag
+// behind by a couple of cycles
+#define ADC_DMA_MARKS  4
+
+// Sample router state. Samples arrive in the ring buffer in pixel readout
+// order (one sample per TRG edge). The ring buffer position where each
+// read cycle starts is marked when the cycle begins and the pixel index
+// is reset when the router reaches it, so a missed or spurious TRG edge
+// only affects the cycle it happened in. Samples beyond the number of
+// pixels in a cycle are dropped.
+struct adc_dma_router_t {
+    uint16_t readPos;               // ring buffer position of the next sample to route
+    uint16_t pixelIdx;              // pixel the next sample belongs to
+    uint16_t pixels;                // pixels in a single frame
+    uint16_t bufSize;               // ring buffer size in samples
+    volatile uint16_t marks[ADC_DMA_MARKS]; // ring buffer positions of read cycle starts
+    volatile uint8_t  markHead;     // next mark to set
+    volatile uint8_t  markTail;     // next mark to reach
+    uint32_t dropped;               // samples not routed into pixel data
+};
+
+// Reset router to the start of the ring buffer and the first pixel
+inline void adcDmaRouterInit(adc_dma_router_t& router, uint16_t pixels, uint16_t bufSize)
+{
+    router.readPos  = 0;
+    router.pixelIdx = 0;
+    router.pixels   = pixels;
+    router.bufSize  = bufSize;
+    router.markHead = 0;
+    router.markTail = 0;
+    router.dropped  = 0;
+}
+
+// Convert DMA remaining transfers counter (NDTR) into the ring buffer
+// write position. In circular mode NDTR counts down from buffer size
+// and reloads when it reaches 0.
+inline uint16_t adcDmaWritePos(uint32_t remaining, uint16_t bufSize)
+{
+    return remaining == 0 || remaining >= bufSize ? 0 : bufSize - remaining;
+}
+
+// Mark the start of a read cycle - the next sample written at the current
+// DMA write position belongs to the first pixel. Called before the first
+// TRG edge of the cycle.
+inline void adcDmaCycleStart(adc_dma_router_t& router, uint16_t writePos)
+{
+    uint8_t next = (router.markHead+1) % ADC_DMA_MARKS;
+    if (next != router.markTail)
+    {
+        router.marks[router.markHead] = writePos;
+        router.markHead = next;
+    }
+}
+
+// Accumulate samples deposited into the ring buffer up to the write
+// position into pixel data, counts and sums of squares. At most maxSamples
+// are routed in one call. Returns number of routed samples.
+//
+// NOTE: this has to be called often enough for DMA not to lap the router -
+//       anything less than a ring buffer worth of samples between calls
+inline uint32_t adcDmaRoute(adc_dma_router_t& router,
+                            const volatile uint16_t* buf,
+                            uint16_t writePos,
+                            uint32_t* data,
+                            uint16_t* dataCounts,
+                            uint64_t* dataSumSq,
+                            uint32_t maxSamples = UINT32_MAX)
+{
+    uint32_t routed = 0;
+    while (router.readPos != writePos && routed < maxSamples)
+    {
+        // read cycles without samples have their marks at the same position
+        while (router.markTail != router.markHead
+               && router.readPos == router.marks[router.markTail])
+        {
+            router.pixelIdx = 0;
+            router.markTail = (router.markTail+1) % ADC_DMA_MARKS;
+        }
+
+        if (router.pixelIdx < router.pixels)
+        {
+            uint32_t sample = buf[router.readPos];
+            data[router.pixelIdx] += sample;
+            dataSumSq[router.pixelIdx] += sample*sample;
+            ++dataCounts[router.pixelIdx];
+            ++router.pixelIdx;
+        }
+        else
+            ++router.dropped;
+
+        if (++router.readPos == router.bufSize)
+            router.readPos = 0;
+
+        ++routed;
+    }
+
+    return routed;
+}
+
+// Skip samples and read cycle starts up to the write position without
+// routing them. Samples following them are dropped as well till the next
+// read cycle start. Returns number of skipped samples.
+inline uint32_t adcDmaDrop(adc_dma_router_t& router, uint16_t writePos)
+{
+    uint32_t skipped = writePos >= router.readPos
+                         ? writePos - router.readPos
+                         : router.bufSize - router.readPos + writePos;
+    router.readPos = writePos;
+    router.pixelIdx = router.pixels;
+    router.markTail = router.markHead;
+    router.dropped += skipped;
+
+    return skipped;
+}
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ *  C12880MA_fixed.h - Fixed point measurement processing for C12880MA
+ *                     driver on Spectron board. This part is hardware
+ *                     independent (no Particle/STM32 headers) so it can
+ *                     be compiled and checked on the host as is.
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_C12880MA_FIXED_H_)
+#define _C12880MA_FIXED_H_
+
+#include <stdint.h>
+
+// Photon Cortex-M3 has no FPU so every float/double operation is a
+// library call. Measurement processing is therefore done in integers:
+//
+//    code   - averaged ADC reading, Q8 (ADC codes * 256)
+//    offset - black level in the same units as code
+//    gain   - volts per code * measurement type scale * normalisation, Q40
+//    result - final value, Q16.16 (value * FIX_ONE)
+//
+// result = (bandpass(code) - offset) * gain >> (8 + 40 - 16)
+//
+// Compared to the floating point processing the result is within
+// 2^-15 absolute plus 1e-5 relative for normalisation coefficients
+// of 0.01 and above. Pixels within rounding distance of the black
+// level or saturation thresholds may be classified differently.
+#define FIX_CODE_BITS   8
+#define FIX_GAIN_BITS   40
+#define FIX_OUT_BITS    16
+#define FIX_ONE         (1L<<FIX_OUT_BITS)
+#define FIX_SHIFT       (FIX_CODE_BITS+FIX_GAIN_BITS-FIX_OUT_BITS)
+
+// Stearns and Stearns (1988) bandpass correction coefficients, Q20
+#define FIX_BP_BITS     20
+#define FIX_BP_CENTRE   1222640     // 1.166
+#define FIX_BP_EDGE     1135608     // 1.083
+#define FIX_BP_SIDE     87032       // 0.083
+
+// Parameters common for all pixels of a measurement
+struct fix_params_t {
+    int32_t minDiff;    // minimum code above black level to be non zero
+    int32_t satCode;    // saturation level code, no normalisation above it
+    int32_t gain;       // gain without normalisation
+    bool    bandpass;   // apply bandpass correction
+};
+
+// Convert floating point value into fixed point with specified fraction
+// bits rounding to nearest and clipping to int32 range. Only used when
+// building tables.
+inline int32_t fixFromFloat(double value, int bits)
+{
+    value = value*(double)(1LL<<bits) + (value < 0 ? -0.5 : 0.5);
+    if (value >= 2147483647.0)
+        return INT32_MAX;
+    if (value <= -2147483648.0)
+        return INT32_MIN;
+    return (int32_t)value;
+}
+
+// Reciprocal of readings count for averaging, Q32 rounded up so that
+// the exact multiples are not truncated
+inline uint64_t fixReciprocal(uint16_t count)
+{
+    return count ? ((1ULL<<32) + count - 1)/count : 0;
+}
+
+// Average readings sum into code using count reciprocal
+inline int32_t fixAverage(uint32_t sum, uint64_t reciprocal)
+{
+    return (int32_t)((sum*reciprocal) >> (32-FIX_CODE_BITS));
+}
+
+// Integer square root rounded down
+inline uint32_t fixSqrt(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ULL<<62;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit)
+    {
+        if (value >= result + bit)
+        {
+            value -= result + bit;
+            result = (result>>1) + bit;
+        }
+        else
+            result >>= 1;
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
+
+// Standard error of averaged code from readings sum and sum of squares,
+// in the same units as code. Sums are exact integers so the variance is
+// computed without loss:
+//
+//    variance = (sumSq - sum*sum/count) / (count-1)
+//    error    = sqrt(variance/count)
+//
+// 16 bit readings keep sum*sum within 64 bits for up to 65535 readings
+// and the scaled variance below 2^62.
+inline int32_t fixStdError(uint32_t sum, uint64_t sumSq, uint16_t count)
+{
+    if (count < 2)
+        return 0;
+
+    uint64_t sumSqDev = sumSq - ((uint64_t)sum*sum)/count;
+    uint64_t variance = (sumSqDev << (2*FIX_CODE_BITS))/((uint32_t)count*(count-1));
+
+    return (int32_t)fixSqrt(variance);
+}
+
+// Process codes of all pixels into final results in a single pass using
+// per pixel offset and gain tables. Without normalisation (or for the
+// saturated pixels) the common gain is used instead of the table one.
+// If given, rawResults also receive the results without normalisation
+// from the same pass.
+inline void fixProcess(const int32_t* codes,
+                       const int32_t* offsets,
+                       const int32_t* gains,
+                       const fix_params_t& params,
+                       bool normalise,
+                       int pixels,
+                       int32_t* results,
+                       int32_t* rawResults = 0)
+{
+    for (int i=0; i<pixels; i++)
+    {
+        int32_t code = codes[i];
+
+        if (params.bandpass && pixels > 1)
+        {
+            int64_t bp;
+            if (i == 0)
+                bp = (int64_t)FIX_BP_EDGE*code - (int64_t)FIX_BP_SIDE*codes[i+1];
+            else if (i == pixels-1)
+                bp = (int64_t)FIX_BP_EDGE*code - (int64_t)FIX_BP_SIDE*codes[i-1];
+            else
+                bp = (int64_t)FIX_BP_CENTRE*code
+                     - (int64_t)FIX_BP_SIDE*(codes[i-1] + codes[i+1]);
+            code = (int32_t)((bp + (1L<<(FIX_BP_BITS-1))) >> FIX_BP_BITS);
+        }
+
+        if (code > offsets[i] + params.minDiff)
+        {
+            int64_t diff = code - offsets[i];
+            int32_t gain = normalise && code <= params.satCode ? gains[i] : params.gain;
+            results[i] = (int32_t)((diff*gain) >> FIX_SHIFT);
+            if (rawResults)
+                rawResults[i] = (int32_t)((diff*params.gain) >> FIX_SHIFT);
+        }
+        else
+        {
+            results[i] = 0;
+            if (rawResults)
+                rawResults[i] = 0;
+        }
+    }
+}
+
+#endif
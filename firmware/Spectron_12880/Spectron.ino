@@ -26,6 +26,7 @@ SYSTEM_MODE(MANUAL);
 #define EEPROM_C12880_BASE_ADDR  0
 
 #include "C12880MA.h"
+#include "rng_hal.h"
 
 #define ADC_REF_SEL_1  A1
 #define ADC_REF_SEL_2  A0
@@ -39,7 +40,8 @@ SYSTEM_MODE(MANUAL);
 #define SDA            D0
 #define SCL            D1
 
-// External measurement trigger pin - not used currently
+// External measurement trigger pin - starts frames in triggered
+// continuous mode (e.g. motor board trigger output)
 #define TRG_IN         A2
 
 // Light source could be triggered externally or from the spectral
@@ -69,6 +71,17 @@ SYSTEM_MODE(MANUAL);
 
 #define ENC_RESULT_STR_SIZE (((SPEC_PIXELS)*sizeof(float)*4/3)+16)
 
+// Local binary frame transport - TCP port and packet identification
+#define FRAME_SERVER_PORT   5880
+#define FRAME_MAGIC         0x46435053  // "SPCF" in little endian
+#define FRAME_VERSION       1
+
+// Size of device state snapshot JSON string
+#define STATE_STR_SIZE      384
+
+// Size of acquisition statistics string
+#define STATS_STR_SIZE      256
+
 // Board type identifier
 static String BOARD_TYPE = "SPEC2_SPECTROMETER";
 
@@ -88,7 +101,8 @@ C12880MA spec(EOS_3V,
               ADC_CNV,
               TRG_CAMERA,
               TRG_LIGHT_SRC,
-              FACTORY_CALIBRATION);
+              FACTORY_CALIBRATION,
+              TRG_IN);
 
 // Particle exposed variables
 int        specPixels = SPEC_PIXELS;
@@ -101,6 +115,13 @@ double     specMinBlackVoltage;
 uint32_t   specIntegTime;
 int32_t    specExtTrigDelay;
 char       specEncData[ENC_RESULT_STR_SIZE]; // Base64 encoded floats
+char       specLocalIP[16];                  // local IP address for frame transport
+char       specStateStr[STATE_STR_SIZE];     // JSON snapshot of the state above
+char       specAutoStats[32];                // last auto measurement "<readings>,<timeMs>,<predicted>"
+uint32_t   specStateVersion;                 // bumped when the snapshot changes
+#ifdef SPEC_STATS
+char       specStatsStr[STATS_STR_SIZE];     // acquisition statistics, see updateStats()
+#endif
 
 // maximum size for string variable data in Particle
 const int  maxVarSize = 620;
@@ -111,13 +132,42 @@ static bool initSuccess = true;
 // re-entry prevention
 static bool measuring = false;
 
+// last measurement sequence number and time
+static uint32_t measurementSeq = 0;
+static uint32_t measurementTimeMs = 0;
+
+#ifdef SPEC_STATS
+// last cloud function handling times in CPU cycles
+static uint32_t measureCycles = 0;
+static uint32_t getDataCycles = 0;
+#endif
+
 // Auxiliary functions
 enum encode_t {
     ET_MEASUREMENT   = 0,
     ET_BLACK_LEVELS  = 1,
-    ET_NORMALISATION = 3
+    ET_NORMALISATION = 3,
+    ET_NOISE         = 4
 };
 
+// Get single pixel value of the requested data type
+inline float getPixelValue(encode_t encodeType, int pixelIdx, bool normalise)
+{
+    switch (encodeType)
+    {
+        case ET_BLACK_LEVELS:
+            return spec.getBlackLevelVoltage(pixelIdx);
+        case ET_NORMALISATION:
+            return spec.getNormalisationCoef(pixelIdx);
+        case ET_NOISE:
+            return spec.getNoiseFixed(pixelIdx, normalise)*(1.0f/FIX_ONE);
+        case ET_MEASUREMENT:
+        default:
+            // fixed point value avoids double precision conversion
+            return spec.getMeasurementFixed(pixelIdx, normalise)*(1.0f/FIX_ONE);
+    }
+}
+
 // Encode measurement result in Base64
 void encodeMeasurement(encode_t encodeType, bool normalise=true)
 {
@@ -138,18 +188,7 @@ void encodeMeasurement(encode_t encodeType, bool normalise=true)
     {
         // read the next float
         if ((inCnt&3) == 0)
-            switch (encodeType)
-            {
-                case ET_MEASUREMENT:
-                    floatVal = spec.getMeasurement(inCnt>>2, normalise);
-                    break;
-                case ET_BLACK_LEVELS:
-                    floatVal = spec.getBlackLevelVoltage(inCnt>>2);
-                    break;
-                case ET_NORMALISATION:
-                    floatVal = spec.getNormalisationCoef(inCnt>>2);
-                    break;
-            }
+            floatVal = getPixelValue(encodeType, inCnt>>2, normalise);
 
         value = (value<<8) + data[inCnt&3];
         ++inCnt;
@@ -180,6 +219,280 @@ void encodeMeasurement(encode_t encodeType, bool normalise=true)
         *encData++ = '=';
 }
 
+// Local binary frame transport
+//
+// Frame server accepts TCP connections on FRAME_SERVER_PORT and answers
+// each request line with a single binary packet: frame_header_t followed
+// by the payload of header.pixels values. All fields are little endian.
+//
+// Request line format:
+//    <data type>[,U16] - data type as for spGetData, or FRAME to get the
+//                        next continuous mode frame (frames queued before
+//                        STOP are still returned); U16 requests 16 bit
+//                        payload (value = raw * scale), float32 otherwise
+//
+// If the data is not available the packet has no payload and 0 pixels.
+enum frame_format_t {
+    FF_FLOAT32 = 0,
+    FF_UINT16  = 1
+};
+
+struct __attribute__((packed)) frame_header_t {
+    uint32_t magic;         // FRAME_MAGIC
+    uint16_t version;       // FRAME_VERSION
+    uint16_t headerSize;    // size of this header
+    uint32_t payloadSize;   // payload size in bytes following the header
+    uint32_t seq;           // measurement or continuous frame sequence number
+    uint32_t timeMs;        // measurement completion time, millis()
+    uint32_t integTimeUs;   // integration time
+    uint8_t  dataType;      // 0 - measurement, 1 - black levels, 2 - normalisation, 3 - noise
+    uint8_t  format;        // frame_format_t
+    uint8_t  adcRef;        // ADC reference
+    uint8_t  gain;          // gain (0 if not supported)
+    uint8_t  measType;      // measurement type
+    uint8_t  reserved1;
+    uint16_t pixels;        // number of values in payload
+    uint16_t pixelOffset;   // index of the first pixel in the sensor range
+    uint16_t readings;      // ADC readings averaged per pixel value
+    float    scale;         // multiplier for FF_UINT16 values
+};
+
+// frame packet buffer - word aligned to build float payload in place
+static uint32_t frameBuf[(sizeof(frame_header_t)+SPEC_PIXELS*sizeof(float)+3)/4];
+
+static TCPServer frameServer(FRAME_SERVER_PORT);
+static TCPClient frameClient;
+static char      frameRequest[32];
+static int       frameRequestLen = 0;
+
+// Build frame packet in frameBuf and return its size
+int buildFramePacket(encode_t encodeType,
+                     bool normalise,
+                     frame_format_t format,
+                     uint32_t seq,
+                     uint32_t timeMs)
+{
+    frame_header_t* header = (frame_header_t*)frameBuf;
+    float* values = (float*)((uint8_t*)frameBuf + sizeof(frame_header_t));
+    uint16_t pixels = spec.getTotalPixels();
+
+    memset(header, 0, sizeof(frame_header_t));
+    header->magic       = FRAME_MAGIC;
+    header->version     = FRAME_VERSION;
+    header->headerSize  = sizeof(frame_header_t);
+    header->seq         = seq;
+    header->timeMs      = timeMs;
+    header->integTimeUs = spec.getIntTime();
+    header->dataType    = encodeType == ET_BLACK_LEVELS ? 1 :
+                          encodeType == ET_NORMALISATION ? 2 :
+                          encodeType == ET_NOISE ? 3 : 0;
+    header->format      = format;
+    header->adcRef      = spec.getAdcReference();
+    header->gain        = 0;
+    header->measType    = spec.getMeasurementType();
+    header->pixels      = pixels;
+    header->pixelOffset = spec.getStartPixelIdx();
+    header->readings    = spec.getMeasurementReadings();
+    header->scale       = 1.0;
+
+    // single pass over the data
+    float maxVal = 0.0;
+    for (int i=0; i<pixels; i++)
+    {
+        values[i] = getPixelValue(encodeType, i, normalise);
+        if (values[i] > maxVal)
+            maxVal = values[i];
+    }
+
+    if (format == FF_UINT16)
+    {
+        // convert in place - 16 bit value i only overwrites
+        // float values that were already converted
+        uint16_t* scaled = (uint16_t*)values;
+        float toScaled = maxVal > 0.0 ? UINT16_MAX/maxVal : 0.0;
+        for (int i=0; i<pixels; i++)
+            scaled[i] = values[i] > 0.0 ? (uint16_t)(values[i]*toScaled + 0.5) : 0;
+        header->scale = maxVal > 0.0 ? maxVal/UINT16_MAX : 1.0;
+        header->payloadSize = pixels*sizeof(uint16_t);
+    }
+    else
+        header->payloadSize = pixels*sizeof(float);
+
+    return sizeof(frame_header_t) + header->payloadSize;
+}
+
+// Serve single frame request line
+void serveFrameRequest(String paramStr)
+{
+    paramStr.trim().toUpperCase();
+
+    frame_format_t format = FF_FLOAT32;
+    if (paramStr.endsWith(",U16"))
+    {
+        format = FF_UINT16;
+        paramStr = paramStr.substring(0, paramStr.length()-4);
+    }
+
+    // get data type
+    bool valid = true;
+    bool normalise = true;
+    encode_t encType = ET_MEASUREMENT;
+    uint32_t seq = measurementSeq;
+    uint32_t timeMs = measurementTimeMs;
+    if (paramStr == "FRAME")
+    {
+        valid = spec.popFrame(seq, timeMs);
+#ifdef SPEC_STATS
+        if (valid)
+            updateStats();
+#endif
+    }
+    else if (paramStr == "BLACK_LEVELS")
+        encType = ET_BLACK_LEVELS;
+    else if (paramStr == "NORMALISATION")
+        encType = ET_NORMALISATION;
+    else if (paramStr == "MEASUREMENT")
+        normalise = false;
+    else if (paramStr == "NOISE")
+    {
+        encType = ET_NOISE;
+        normalise = false;
+    }
+    else if (paramStr == "NOISE_NORMALISED")
+        encType = ET_NOISE;
+    else if (paramStr != "MEAS_NORMALISED")
+        valid = false;
+
+    int size = sizeof(frame_header_t);
+    if (valid)
+        size = buildFramePacket(encType, normalise, format, seq, timeMs);
+    else
+    {
+        // no data - empty packet
+        frame_header_t* header = (frame_header_t*)frameBuf;
+        memset(header, 0, sizeof(frame_header_t));
+        header->magic      = FRAME_MAGIC;
+        header->version    = FRAME_VERSION;
+        header->headerSize = sizeof(frame_header_t);
+        header->scale      = 1.0;
+    }
+
+    // short write means the client has gone or does not read - it is
+    // dropped so that the host sees closed transport, not a cut frame
+    if (frameClient.write((const uint8_t*)frameBuf, size) != (size_t)size)
+    {
+        frameClient.stop();
+        frameRequestLen = 0;
+    }
+}
+
+// Process local frame transport connection and requests
+void processFrameRequests()
+{
+    if (!frameClient.connected())
+    {
+        frameClient = frameServer.available();
+        frameRequestLen = 0;
+        return;
+    }
+
+    while (frameClient.available() > 0)
+    {
+        char ch = frameClient.read();
+        if (ch == '\n')
+        {
+            frameRequest[frameRequestLen] = 0;
+            frameRequestLen = 0;
+            serveFrameRequest(frameRequest);
+        }
+        else if (ch != '\r' && frameRequestLen < (int)sizeof(frameRequest)-1)
+            frameRequest[frameRequestLen++] = ch;
+    }
+}
+
+// Rebuild device state snapshot from the Particle variables. This lets the
+// host read the complete state in a single request instead of a request per
+// variable. Snapshot is a JSON object with the following fields:
+//    v    - state version, only changes when any of the fields below change
+//    adc  - ADC reference
+//    mt   - measurement type
+//    it   - integration time in uSec
+//    trg  - external trigger to measurement delay in uSec (-1 if off)
+//    sat  - saturation voltage
+//    mbv  - minimal black level voltage
+//    px   - number of pixels in the current range
+//    off  - index of the first pixel in the current range
+//    roi  - 1 if only the pixels within the range are read
+//    os   - maximum number of averaging ADC reads per pixel
+//    cal  - wavelength calibration coefficients
+void updateState()
+{
+    static char lastState[STATE_STR_SIZE];
+    char state[STATE_STR_SIZE];
+
+    snprintf(state, sizeof(state),
+             "\"adc\":%d,\"mt\":%d,\"it\":%lu,\"trg\":%ld,"
+             "\"sat\":[%.6G],\"mbv\":%.6G,\"px\":%d,\"off\":%d,\"roi\":%d,\"os\":%d,\"cal\":[%s]",
+             specAdcRef,
+             specMeasureType,
+             (unsigned long)specIntegTime,
+             (long)specExtTrigDelay,
+             specSatVoltage,
+             specMinBlackVoltage,
+             specPixels,
+             specOffsetIdx,
+             spec.isROIReadout() ? 1 : 0,
+             spec.getOversampling(),
+             specCalibrationStr);
+
+    // only bump version if something has changed
+    if (strcmp(state, lastState) == 0)
+        return;
+
+    strcpy(lastState, state);
+    ++specStateVersion;
+    snprintf(specStateStr, sizeof(specStateStr), "{\"v\":%lu,%s}",
+             (unsigned long)specStateVersion, lastState);
+}
+
+#ifdef SPEC_STATS
+// Rebuild acquisition statistics string. These are collected since the
+// last measurement or continuous mode start. Comma separated values:
+//    clock interrupt count, min, mean and max duration in uSec
+//    TRG interrupt count, min, mean and max duration in uSec
+//    pixels without readings in the last read or frame
+//    last frame and sensor read duration in uSec
+//    last spMeasure and spGetData handling time in uSec
+//    interrupt time in each readout state in uSec (Ext.Trigger, Lead,
+//    Integration, Read, Trail, Stop)
+void updateStats()
+{
+    spec_stats_t stats;
+    spec.getStats(stats);
+
+    const spec_isr_stats_t* isrs[] = { &stats.clkIsr, &stats.trgIsr };
+    double cyclesPerUs = System.ticksPerMicrosecond();
+    int len = 0;
+    for (int i=0; i<2; i++)
+        len += snprintf(specStatsStr+len, sizeof(specStatsStr)-len, "%lu,%.2f,%.2f,%.2f,",
+                        (unsigned long)isrs[i]->count,
+                        isrs[i]->count ? isrs[i]->minCycles/cyclesPerUs : 0.0,
+                        isrs[i]->count ? isrs[i]->cycles/cyclesPerUs/isrs[i]->count : 0.0,
+                        isrs[i]->maxCycles/cyclesPerUs);
+
+    len += snprintf(specStatsStr+len, sizeof(specStatsStr)-len, "%lu,%lu,%lu,%lu,%lu",
+                    (unsigned long)stats.missedPixels,
+                    (unsigned long)(stats.frameCycles/cyclesPerUs),
+                    (unsigned long)(stats.readCycles/cyclesPerUs),
+                    (unsigned long)(measureCycles/cyclesPerUs),
+                    (unsigned long)(getDataCycles/cyclesPerUs));
+
+    for (int i=0; i<SPEC_STATS_STATES; i++)
+        len += snprintf(specStatsStr+len, sizeof(specStatsStr)-len, ",%lu",
+                        (unsigned long)(stats.stateCycles[i]/cyclesPerUs));
+}
+#endif
+
 // Cloud functions
 
 // Gets the requested pixel array data into spLastMeasN variables. Format of
@@ -190,6 +503,10 @@ void encodeMeasurement(encode_t encodeType, bool normalise=true)
 //                        black levels only applied
 //    MEAS_NORMALISED   - results of the measurement with current
 //                        black levels and normalisation applied
+//    NOISE             - standard error of the measurement results
+//                        (as MEASUREMENT)
+//    NOISE_NORMALISED  - standard error of the measurement results
+//                        (as MEAS_NORMALISED)
 //
 int specGetData(String paramStr)
 {
@@ -199,6 +516,10 @@ int specGetData(String paramStr)
     // set measurement mode - preventing reentry
     measuring = true;
 
+#ifdef SPEC_STATS
+    uint32_t startCycles = System.ticks();
+#endif
+
     // get data type
     bool normalise = true;
     paramStr.trim().toUpperCase();
@@ -209,12 +530,27 @@ int specGetData(String paramStr)
         encType = ET_NORMALISATION;
     else if (paramStr == "MEASUREMENT")
         normalise = false;
+    else if (paramStr == "NOISE")
+    {
+        encType = ET_NOISE;
+        normalise = false;
+    }
+    else if (paramStr == "NOISE_NORMALISED")
+        encType = ET_NOISE;
     else if (paramStr != "MEAS_NORMALISED")
+    {
+        measuring = false;
         return -1;
+    }
 
     // encode data
     encodeMeasurement(encType, normalise);
 
+#ifdef SPEC_STATS
+    getDataCycles = System.ticks() - startCycles;
+    updateStats();
+#endif
+
     // reset measurement mode
     measuring = false;
 
@@ -264,6 +600,8 @@ int specSetWavelengthCalibration(String paramStr)
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
 
+    updateState();
+
     return 0;
 }
 
@@ -295,6 +633,9 @@ int specResetToDefaults(String paramStr)
                    calibration[4],
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
+
+    updateState();
+
     return 0;
 }
 
@@ -307,6 +648,10 @@ int specResetToDefaults(String paramStr)
 //                      that bound will not be amended.
 //    DEFAULT         - Sets to sensor default range (according to specification)
 //    MAX             - Sets to sensor maximum range (all available pixels)
+//    ROI             - Only read pixels within the range, this shortens
+//                      readings and allows more averaging for the same
+//                      measurement time
+//    FULL            - Read all sensor pixels (default)
 //
 int specSetRange(String paramStr)
 {
@@ -321,6 +666,10 @@ int specSetRange(String paramStr)
         spec.setSensorRange(-1, -1);
     else if (paramStr.equals("MAX"))
         spec.setSensorRange(1, 20000);  // use very large range
+    else if (paramStr.equals("ROI"))
+        spec.enableROIReadout(true);
+    else if (paramStr.equals("FULL"))
+        spec.enableROIReadout(false);
     else
     {
         // range was explicitly supplied
@@ -337,6 +686,8 @@ int specSetRange(String paramStr)
     specPixels    = spec.getTotalPixels();
     specOffsetIdx = spec.getStartPixelIdx();
 
+    updateState();
+
     return 0;
 }
 
@@ -365,6 +716,8 @@ int specSetTriggerMeasurementDelay(String paramStr)
     // update Particle variable
     specExtTrigDelay = spec.getExtTrgMeasDelay();
 
+    updateState();
+
     return 0;
 }
 
@@ -386,6 +739,8 @@ int specSetADCRef(String paramStr)
     // update Particle variable
     specAdcRef = spec.getAdcReference();
 
+    updateState();
+
     return adcRef==spec.getAdcReference() ? 0 : -1;
 }
 
@@ -405,9 +760,15 @@ int specSetMeasurementType(String paramStr)
     // update Particle variable
     specMeasureType = spec.getMeasurementType();
 
+    updateState();
+
     return 0;
 }
 
+// Sets integration time and optionally ADC oversampling. Format of the
+// parameter string:
+//    <time>[,<reads>]  - integration time in uSec followed by optional
+//                        maximum number of averaging ADC reads per pixel
 int specSetIntegrationTime(String intTimeStr)
 {
     if (spec.isMeasuring())
@@ -421,9 +782,19 @@ int specSetIntegrationTime(String intTimeStr)
 
     spec.setIntTime(intTime);
 
+    int sepIdx = intTimeStr.indexOf(',');
+    if (sepIdx > 0)
+    {
+        int reads = intTimeStr.substring(sepIdx+1).trim().toInt();
+        if (reads > 0)
+            spec.setOversampling(reads);
+    }
+
     // update Particle variable
     specIntegTime = spec.getIntTime();
 
+    updateState();
+
     return 0;
 }
 
@@ -444,6 +815,11 @@ int specMeasure(String paramStr)
     // set measurement mode - preventing reentry
     measuring = true;
 
+#ifdef SPEC_STATS
+    uint32_t startCycles = System.ticks();
+    spec.resetStats();
+#endif
+
     // get reading time
     paramStr.trim().toUpperCase();
     bool doExtTrg = paramStr.endsWith(",TRG");
@@ -464,6 +840,10 @@ int specMeasure(String paramStr)
         // update Particle variable
         specAdcRef    = spec.getAdcReference();
         specIntegTime = spec.getIntTime();
+        snprintf(specAutoStats, sizeof(specAutoStats), "%u,%lu,%d",
+                 spec.getAutoIterations(),
+                 (unsigned long)spec.getAutoTimeMs(),
+                 spec.isAutoPredicted() ? 1 : 0);
     }
     else
     {
@@ -478,12 +858,22 @@ int specMeasure(String paramStr)
         spec.takeMeasurement(measTimeUs, doExtTrg);
     }
 
+    ++measurementSeq;
+    measurementTimeMs = millis();
+
     // transfer measurement as Base64 data to series of string variables
     encodeMeasurement(ET_MEASUREMENT);
 
+#ifdef SPEC_STATS
+    measureCycles = System.ticks() - startCycles;
+    updateStats();
+#endif
+
     // reset measurement mode
     measuring = false;
 
+    updateState();
+
     return 0;
 }
 
@@ -550,6 +940,8 @@ int specSetSaturationVoltage(String paramStr)
     // update Particle variable
     specSatVoltage = spec.getSatVoltage();
 
+    updateState();
+
     return 0;
 }
 
@@ -574,6 +966,8 @@ int specSetMinBlack(String paramStr)
     // update variable
     specMinBlackVoltage = spec.getMinBlackVoltage();
 
+    updateState();
+
     return 0;
 }
 
@@ -630,11 +1024,49 @@ int specCalibrateSpectralResponse(String paramStr)
     return 0;
 }
 
+// Start or stop continuous measurements. Frames are retrieved via local
+// frame transport. Format of the parameter string:
+//    <time>      - frame time in uSec (if 0 uses current integration)
+//    <time>,TRG  - as above but each frame is started by TRG_IN rising edge
+//    STOP        - stop continuous measurements
+int specContinuous(String paramStr)
+{
+    paramStr.trim().toUpperCase();
+
+    if (paramStr.equals("STOP"))
+    {
+        spec.stopContinuous();
+        return 0;
+    }
+
+    if (measuring || spec.isMeasuring())
+        return -1;
+
+    bool triggered = false;
+    if (paramStr.endsWith(",TRG"))
+    {
+        triggered = true;
+        paramStr = paramStr.substring(0, paramStr.length()-4);
+    }
+
+    int32_t frameTimeUs = paramStr.toInt();
+    if (frameTimeUs < 0)
+        return -1;
+
+#ifdef SPEC_STATS
+    spec.resetStats();
+#endif
+
+    return spec.startContinuous(frameTimeUs, triggered) ? 0 : -1;
+}
+
 // main firmware initialisation
 void setup()
 {
     // initialise variables
     memset(specEncData, 0, sizeof(specEncData));
+    memset(specLocalIP, 0, sizeof(specLocalIP));
+    memset(specAutoStats, 0, sizeof(specAutoStats));
 
     pinMode(TRG_CAMERA, OUTPUT);
     pinMode(TRG_LIGHT_SRC,  OUTPUT);
@@ -663,6 +1095,11 @@ void setup()
                    calibration[5]).toCharArray(specCalibrationStr,
                                                sizeof(specCalibrationStr));
 
+    // initial state snapshot - start version from a random number so the
+    // host does not mistake state after restart for already seen one
+    specStateVersion = HAL_RNG_GetRandomNumber();
+    updateState();
+
     // register Particle variables
     initSuccess = initSuccess && Particle.variable("BOARD_TYPE",          BOARD_TYPE);
     initSuccess = initSuccess && Particle.variable("spNumPixels",         specPixels);
@@ -674,6 +1111,12 @@ void setup()
     initSuccess = initSuccess && Particle.variable("spSaturationVoltage", specSatVoltage);
     initSuccess = initSuccess && Particle.variable("spMinBlackVoltage",   specMinBlackVoltage);
     initSuccess = initSuccess && Particle.variable("spPixelOffsetIdx",    specOffsetIdx);
+    initSuccess = initSuccess && Particle.variable("spLocalIP",           specLocalIP);
+    initSuccess = initSuccess && Particle.variable("spState",             specStateStr);
+    initSuccess = initSuccess && Particle.variable("spAutoStats",         specAutoStats);
+#ifdef SPEC_STATS
+    initSuccess = initSuccess && Particle.variable("spStats",             specStatsStr);
+#endif
 
     char* encData = specEncData;
     int count = 1;
@@ -699,22 +1142,42 @@ void setup()
     initSuccess = initSuccess && Particle.function("spCalibrateSpectralResp", specCalibrateSpectralResponse);
     initSuccess = initSuccess && Particle.function("spSetSpectralRange",      specSetRange);
     initSuccess = initSuccess && Particle.function("spResetToDefaults",       specResetToDefaults);
+    initSuccess = initSuccess && Particle.function("spContinuous",            specContinuous);
 
     // connect
     if (!Particle.connected())
         Particle.connect();
     Particle.process();
+
+    // local frame transport is started in loop() once the IP is known
 }
 
 // Main event loop
-//    only use it for particle connection keep alive when spectrometer
-//    measurement is not running
+//    only use it for particle connection keep alive and local frame
+//    transport when spectrometer measurement is not running (continuous
+//    measurements run in the background)
 void loop(void)
 {
     // call for Photon process for manual system mode
-    if (!spec.isMeasuring())
+    if (!spec.isMeasuring() || spec.isContinuous())
+    {
         if (Particle.connected())
             Particle.process();
         else
             Particle.connect();
+
+        // keep local IP for frame transport up to date - the server is
+        // started again on the new address and the old client dropped
+        static IPAddress localIP;
+        if (WiFi.ready() && !(WiFi.localIP() == localIP))
+        {
+            localIP = WiFi.localIP();
+            String(localIP).toCharArray(specLocalIP, sizeof(specLocalIP));
+            frameClient.stop();
+            frameRequestLen = 0;
+            frameServer.begin();
+        }
+
+        processFrameRequests();
+    }
 }
@@ -0,0 +1,174 @@
+/*
+ *  test_auto.cpp - Host test of C12880MA auto measurement integration
+ *                  prediction, the model helpers on their own and the
+ *                  driver on the simulator with linear and non-linear
+ *                  sensor response
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "sim_hardware.h"
+#include "C12880MA.h"
+#include "test_check.h"
+
+// Board pins as in Spectron.ino
+#define ADC_REF_SEL_1  A1
+#define ADC_REF_SEL_2  A0
+#define ADC_CNV        DAC
+#define TRG_CAMERA     D2
+#define TRG_3V         D3
+#define EOS_3V         D4
+#define CLK_3V         D5
+#define ST_3V          D6
+#define TRG_IN         A2
+
+// Fit, prediction and linearity check of the output model
+static void testModel()
+{
+    auto_model_t model = { 0, 0, false };
+
+    CHECK(!autoFitSlope(model, 100, 1.0f));
+    CHECK(!autoFitModel(model, 100, 1.0f, 100, 2.0f));
+    CHECK(!autoFitModel(model, 100, 1.0f, 200, 0.9f));
+
+    // V(t) = 0.5 + 0.01*t
+    CHECK(autoFitModel(model, 100, 1.5f, 300, 3.5f));
+    CHECK(model.valid);
+    CHECK(fabs(model.dark - 0.5f) < 1e-5f);
+    CHECK(fabs(model.slope - 0.01f) < 1e-7f);
+    CHECK(fabs(autoPredict(model, 200) - 2.5f) < 1e-5f);
+    CHECK(autoPredictTicks(model, 4.0f, 10, 1000) == 350);
+    CHECK(autoPredictTicks(model, 4.0f, 10, 300) == 300);
+    CHECK(autoPredictTicks(model, 0.55f, 10, 1000) == 10);
+
+    CHECK(autoIsLinear(model, 350, 4.0f*(1+AUTO_LINEAR_TOLERANCE*0.9f)));
+    CHECK(!autoIsLinear(model, 350, 4.0f*(1+AUTO_LINEAR_TOLERANCE*1.1f)));
+    CHECK(!autoIsLinear(model, 350, 4.0f*(1-AUTO_LINEAR_TOLERANCE*1.1f)));
+
+    // slope refit keeps the dark part
+    CHECK(autoFitSlope(model, 100, 2.5f));
+    CHECK(fabs(model.slope - 0.02f) < 1e-7f);
+    CHECK(fabs(model.dark - 0.5f) < 1e-5f);
+    CHECK(!autoFitSlope(model, 100, 0.4f));
+
+    // no slope predicts the longest integration
+    model.slope = 0;
+    CHECK(autoPredictTicks(model, 4.0f, 10, 1000) == 1000);
+}
+
+// Peak sensor output voltage of the last measurement
+static float peakVoltage(C12880MA& spec)
+{
+    float peak = 0;
+    for (int i=0; i<spec.getTotalPixels(); i++)
+    {
+        float value = spec.getMeasurement(i, false) + spec.getBlackLevelVoltage(i);
+        if (peak < value)
+            peak = value;
+    }
+
+    return peak;
+}
+
+static bool reachedTarget(C12880MA& spec)
+{
+    float peak = peakVoltage(spec);
+    float satVoltage = spec.getSatVoltage();
+    bool reached = peak >= satVoltage*0.97f && peak < satVoltage*0.995f;
+    if (!reached)
+        printf("peak %.4f V outside of target for saturation %.4f V\n", peak, satVoltage);
+
+    return reached;
+}
+
+// Auto measurement for the light of specified intensity - sensor output
+// rate at 560nm in volts per second
+static void autoMeasurement(C12880MA& spec, SimSensor& sensor, double lightRate)
+{
+    sensor.setSpectrum([lightRate](double wavelength) {
+        double response = exp(-pow((wavelength-600.0)/250.0, 2));
+        return lightRate*response*SimSensor::blackbody(wavelength, 2856);
+    });
+    spec.takeAutoMeasurement(AUTO_ALL_MAX_RANGE);
+}
+
+static void testDriver()
+{
+    SimSensor sensor(SimSensor::C12880MAConfig());
+    sim_pins_t pins = { CLK_3V, ST_3V, TRG_3V, ADC_REF_SEL_1, ADC_REF_SEL_2, NO_PIN };
+    C12880MA spec(EOS_3V, TRG_3V, CLK_3V, ST_3V, ADC_REF_SEL_1, ADC_REF_SEL_2,
+                  ADC_CNV, TRG_CAMERA, NO_PIN, sensor.config().calibration, TRG_IN);
+    SimHardware::get().connect(&sensor, pins);
+
+    spec.begin();
+    spec.setMeasurementType(MEASURE_VOLTAGE, false);
+    spec.enableBandpassCorrection(false);
+
+    // linear sensor - dark part is not known yet, the probe exposure is
+    // taken so the target is reached with the third reading
+    autoMeasurement(spec, sensor, 100.0);
+    printf("linear, first: %u readings, predicted %d, integ %lu us\n",
+           spec.getAutoIterations(), spec.isAutoPredicted(), (unsigned long)spec.getIntTime());
+    CHECK(spec.isAutoPredicted());
+    CHECK(spec.getAutoIterations() <= 3);
+    CHECK(reachedTarget(spec));
+
+    // with dark part known only the slope is fitted - from the shortest
+    // reading if it has enough signal, so bright light is on target with
+    // the second reading, otherwise one longer reading is taken first
+    static const double lightRates[] = { 2500.0, 250.0, 40.0 };
+    for (int i=0; i<3; i++)
+    {
+        autoMeasurement(spec, sensor, lightRates[i]);
+        printf("linear, light %.0f: %u readings, predicted %d, integ %lu us\n",
+               lightRates[i], spec.getAutoIterations(), spec.isAutoPredicted(),
+               (unsigned long)spec.getIntTime());
+        CHECK(spec.isAutoPredicted());
+        CHECK(spec.getAutoIterations() <= (i == 0 ? 2 : 3));
+        CHECK(reachedTarget(spec));
+    }
+
+    // compressing sensor - output falls short of the prediction from the
+    // low level readings, the linearity check fails and the step loop
+    // finishes the measurement
+    sensor.setResponse([](double signal) { return signal/(1 + signal/10); });
+    autoMeasurement(spec, sensor, 100.0);
+    printf("non-linear: %u readings, predicted %d, integ %lu us\n",
+           spec.getAutoIterations(), spec.isAutoPredicted(), (unsigned long)spec.getIntTime());
+    CHECK(!spec.isAutoPredicted());
+    CHECK(spec.getAutoIterations() > 3);
+    CHECK(reachedTarget(spec));
+
+    // back to linear - the model dark part was dropped with the failed
+    // check, so the probe exposure is taken again
+    sensor.setResponse(sim_response_t());
+    autoMeasurement(spec, sensor, 100.0);
+    printf("linear again: %u readings, predicted %d\n",
+           spec.getAutoIterations(), spec.isAutoPredicted());
+    CHECK(spec.isAutoPredicted());
+    CHECK(spec.getAutoIterations() <= 3);
+    CHECK(reachedTarget(spec));
+}
+
+int main()
+{
+    testModel();
+    testDriver();
+
+    return testResult("test_auto");
+}
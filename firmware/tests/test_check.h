@@ -0,0 +1,49 @@
+/*
+ *  test_check.h - Minimal checks for host tests of Spectron firmware parts
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if !defined(_TEST_CHECK_H_)
+#define _TEST_CHECK_H_
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+// Report failed condition and carry on with the test
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++testFailures; \
+        } \
+    } while (0)
+
+// Test program exit code - non zero if any check failed
+inline int testResult(const char* name)
+{
+    if (testFailures)
+        printf("%s: %d check(s) failed\n", name, testFailures);
+    else
+        printf("%s: passed\n", name);
+
+    return testFailures ? 1 : 0;
+}
+
+#endif
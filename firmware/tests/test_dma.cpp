@@ -0,0 +1,260 @@
+/*
+ *  test_dma.cpp - Host test of C12880MA ADC DMA sample routing
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "C12880MA_dma.h"
+#include "test_check.h"
+
+#include <string.h>
+
+#define PIXELS    8
+#define BUF_SIZE  20
+
+// Circular DMA stream depositing samples into the ring buffer
+struct test_dma_t {
+    volatile uint16_t buf[BUF_SIZE];
+    uint32_t ndtr;
+
+    test_dma_t() : ndtr(BUF_SIZE) { memset((void*)buf, 0, sizeof(buf)); }
+
+    void write(uint16_t sample)
+    {
+        buf[BUF_SIZE - ndtr] = sample;
+        if (--ndtr == 0)
+            ndtr = BUF_SIZE;
+    }
+
+    uint16_t pos() { return adcDmaWritePos(ndtr, BUF_SIZE); }
+};
+
+// Pixel data the router accumulates into
+struct test_frame_t {
+    uint32_t data[PIXELS];
+    uint16_t counts[PIXELS];
+    uint64_t sumSq[PIXELS];
+
+    test_frame_t() { clear(); }
+
+    void clear()
+    {
+        memset(data, 0, sizeof(data));
+        memset(counts, 0, sizeof(counts));
+        memset(sumSq, 0, sizeof(sumSq));
+    }
+};
+
+// Sample value of the pixel in the read cycle
+static uint16_t sampleValue(int cycle, int pixel)
+{
+    return 1000*(cycle+1) + pixel;
+}
+
+// Read cycle as seen by DMA - the cycle start is marked and one sample is
+// written per TRG edge except for the skipped pixel, extra adds spurious
+// samples at the end
+static void readCycle(test_dma_t& dma, adc_dma_router_t& router, int cycle,
+                      int skipPixel = -1, int extra = 0)
+{
+    adcDmaCycleStart(router, dma.pos());
+    for (int i=0; i<PIXELS; i++)
+        if (i != skipPixel)
+            dma.write(sampleValue(cycle, i));
+    for (int i=0; i<extra; i++)
+        dma.write(1);
+}
+
+static uint32_t route(test_dma_t& dma, adc_dma_router_t& router, test_frame_t& frame,
+                      uint32_t maxSamples = UINT32_MAX)
+{
+    return adcDmaRoute(router, dma.buf, dma.pos(), frame.data, frame.counts, frame.sumSq, maxSamples);
+}
+
+static void testWritePos()
+{
+    CHECK(adcDmaWritePos(BUF_SIZE, BUF_SIZE) == 0);
+    CHECK(adcDmaWritePos(0, BUF_SIZE) == 0);
+    CHECK(adcDmaWritePos(1, BUF_SIZE) == BUF_SIZE-1);
+    CHECK(adcDmaWritePos(5, BUF_SIZE) == BUF_SIZE-5);
+}
+
+// Consecutive frames wrap the ring buffer - every frame is routed right
+// after its read cycle
+static void testRingWrap()
+{
+    test_dma_t dma;
+    adc_dma_router_t router;
+    adcDmaRouterInit(router, PIXELS, BUF_SIZE);
+
+    for (int cycle=0; cycle<5; cycle++)
+    {
+        test_frame_t frame;
+        readCycle(dma, router, cycle);
+        CHECK(route(dma, router, frame) == PIXELS);
+        for (int i=0; i<PIXELS; i++)
+        {
+            CHECK(frame.data[i] == sampleValue(cycle, i));
+            CHECK(frame.counts[i] == 1);
+            CHECK(frame.sumSq[i] == (uint64_t)sampleValue(cycle, i)*sampleValue(cycle, i));
+        }
+    }
+    CHECK(router.readPos == dma.pos());
+    CHECK(router.dropped == 0);
+}
+
+// Routing in bounded chunks while DMA keeps writing
+static void testChunks()
+{
+    test_dma_t dma;
+    adc_dma_router_t router;
+    adcDmaRouterInit(router, PIXELS, BUF_SIZE);
+    test_frame_t frame;
+
+    for (int cycle=0; cycle<3; cycle++)
+    {
+        adcDmaCycleStart(router, dma.pos());
+        for (int i=0; i<PIXELS; i++)
+        {
+            dma.write(sampleValue(0, i));
+            CHECK(route(dma, router, frame, 2) <= 2);
+        }
+    }
+    while (route(dma, router, frame, 2))
+        ;
+
+    for (int i=0; i<PIXELS; i++)
+    {
+        CHECK(frame.counts[i] == 3);
+        CHECK(frame.data[i] == 3u*sampleValue(0, i));
+    }
+    CHECK(router.dropped == 0);
+}
+
+// Several read cycles accumulate into the same frame, routing lags behind
+// the cycles and catches up across cycle starts
+static void testMultipleCycles()
+{
+    test_dma_t dma;
+    adc_dma_router_t router;
+    adcDmaRouterInit(router, PIXELS, BUF_SIZE);
+    test_frame_t frame;
+
+    readCycle(dma, router, 0);
+    CHECK(route(dma, router, frame, PIXELS/2) == PIXELS/2);
+    readCycle(dma, router, 1);
+    CHECK(route(dma, router, frame) == PIXELS + PIXELS/2);
+    readCycle(dma, router, 2);
+    CHECK(route(dma, router, frame) == PIXELS);
+
+    for (int i=0; i<PIXELS; i++)
+    {
+        CHECK(frame.counts[i] == 3);
+        CHECK(frame.data[i] == (uint32_t)sampleValue(0, i) + sampleValue(1, i) + sampleValue(2, i));
+    }
+    CHECK(router.dropped == 0);
+}
+
+// Missed or spurious TRG edge only affects its own cycle
+static void testMissedEdges()
+{
+    test_dma_t dma;
+    adc_dma_router_t router;
+    adcDmaRouterInit(router, PIXELS, BUF_SIZE);
+
+    // missed edge - following samples shift by one pixel in this cycle
+    test_frame_t frame;
+    readCycle(dma, router, 0, 3);
+    CHECK(route(dma, router, frame) == PIXELS-1);
+    CHECK(frame.counts[PIXELS-1] == 0);
+    CHECK(frame.data[3] == sampleValue(0, 4));
+
+    // next cycle is aligned again
+    frame.clear();
+    readCycle(dma, router, 1);
+    CHECK(route(dma, router, frame) == PIXELS);
+    for (int i=0; i<PIXELS; i++)
+    {
+        CHECK(frame.counts[i] == 1);
+        CHECK(frame.data[i] == sampleValue(1, i));
+    }
+
+    // spurious edges - extra samples are dropped
+    frame.clear();
+    readCycle(dma, router, 2, -1, 2);
+    CHECK(route(dma, router, frame) == PIXELS+2);
+    CHECK(router.dropped == 2);
+    for (int i=0; i<PIXELS; i++)
+        CHECK(frame.data[i] == sampleValue(2, i));
+
+    // both in cycles which are routed together
+    frame.clear();
+    readCycle(dma, router, 3, 0, 1);
+    readCycle(dma, router, 4, 5);
+    CHECK(route(dma, router, frame) == 2*PIXELS-1);
+    CHECK(router.dropped == 2);
+    CHECK(frame.data[0] == (uint32_t)sampleValue(3, 1) + sampleValue(4, 0));
+    CHECK(frame.data[5] == (uint32_t)sampleValue(3, 6) + sampleValue(4, 6));
+    CHECK(frame.counts[PIXELS-1] == 1);
+
+    // no edges at all - the cycle start is at the router position
+    frame.clear();
+    adcDmaCycleStart(router, dma.pos());
+    CHECK(route(dma, router, frame) == 0);
+    readCycle(dma, router, 5);
+    CHECK(route(dma, router, frame) == PIXELS);
+    for (int i=0; i<PIXELS; i++)
+        CHECK(frame.data[i] == sampleValue(5, i));
+}
+
+// Samples left at the frame end are skipped and do not leak into the next frame
+static void testDrop()
+{
+    test_dma_t dma;
+    adc_dma_router_t router;
+    adcDmaRouterInit(router, PIXELS, BUF_SIZE);
+    test_frame_t frame;
+
+    readCycle(dma, router, 0);
+    CHECK(route(dma, router, frame, 5) == 5);
+    CHECK(adcDmaDrop(router, dma.pos()) == PIXELS-5);
+    CHECK(router.dropped == PIXELS-5);
+
+    // stray sample before the next cycle is dropped too
+    dma.write(1);
+    frame.clear();
+    readCycle(dma, router, 1);
+    CHECK(route(dma, router, frame) == PIXELS+1);
+    CHECK(router.dropped == PIXELS-5+1);
+    for (int i=0; i<PIXELS; i++)
+        CHECK(frame.data[i] == sampleValue(1, i));
+
+    CHECK(adcDmaDrop(router, dma.pos()) == 0);
+}
+
+int main()
+{
+    testWritePos();
+    testRingWrap();
+    testChunks();
+    testMultipleCycles();
+    testMissedEdges();
+    testDrop();
+
+    return testResult("test_dma");
+}
@@ -0,0 +1,300 @@
+/*
+ *  test_fixed.cpp - Host test of C12880MA fixed point measurement
+ *                   processing against the floating point formula
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "C12880MA_fixed.h"
+#include "test_check.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Driver constants and measurement types as in C12880MA
+#define PIXELS          288
+#define ADC_MAX_VALUE   UINT16_MAX
+#define READINGS        4
+
+enum measure_t {
+    MEASURE_RELATIVE = 0,
+    MEASURE_VOLTAGE  = 1,
+    MEASURE_ABSOLUTE = 2
+};
+
+static const float adcVoltages[] = { 2.5, 3.0, 4.096, 5.0 };
+
+// Measurement state of the driver - float data as kept by C12880MA and
+// the fixed point tables built from it as in buildFixedTables()
+struct test_meas_t {
+    int      adcRef;
+    int      measType;
+    float    satVoltage;
+    bool     bandpass;
+
+    float    meas[PIXELS];
+    float    blackLevels[PIXELS];
+    float    normCoef[PIXELS];
+    int32_t  codes[PIXELS];
+
+    fix_params_t params;
+    int32_t  offsets[PIXELS];
+    int32_t  gains[PIXELS];
+
+    void buildTables()
+    {
+        double adcRefVoltage = adcVoltages[adcRef];
+        double voltageToCode = ADC_MAX_VALUE/adcRefVoltage;
+        double gain = adcRefVoltage/ADC_MAX_VALUE;
+        if (measType == MEASURE_ABSOLUTE)
+            gain /= satVoltage;
+        else if (measType == MEASURE_RELATIVE)
+            gain /= adcRefVoltage;
+
+        params.minDiff  = fixFromFloat(voltageToCode/ADC_MAX_VALUE, FIX_CODE_BITS);
+        params.satCode  = fixFromFloat(voltageToCode*satVoltage, FIX_CODE_BITS);
+        params.gain     = fixFromFloat(gain, FIX_GAIN_BITS);
+        params.bandpass = bandpass;
+
+        for (int i=0; i<PIXELS; i++)
+        {
+            offsets[i] = fixFromFloat(voltageToCode*blackLevels[i], FIX_CODE_BITS);
+            gains[i] = fixFromFloat(gain*normCoef[i], FIX_GAIN_BITS);
+        }
+    }
+
+    // floating point getMeasurement() (SPEC_FLOAT_MEASUREMENT build),
+    // returns false if the pixel is within rounding distance of black
+    // level or saturation threshold where classification may differ
+    bool reference(int i, bool normalise, double& result)
+    {
+        double data = meas[i];
+        if (bandpass)
+        {
+            if (i == 0)
+                data = 1.083*data - 0.083*meas[i+1];
+            else if (i == PIXELS-1)
+                data = 1.083*data - 0.083*meas[i-1];
+            else
+                data = 1.166*data - 0.083*meas[i-1] - 0.083*meas[i+1];
+        }
+
+        double adcRefVoltage = adcVoltages[adcRef];
+        double margin = 4*adcRefVoltage/ADC_MAX_VALUE;
+        double blackThreshold = blackLevels[i]+(1.0/ADC_MAX_VALUE);
+        if (fabs(data - blackThreshold) < margin || fabs(data - satVoltage) < margin)
+            return false;
+
+        bool saturated = data > satVoltage;
+        if (data > blackThreshold)
+        {
+            data -= blackLevels[i];
+            if (measType == MEASURE_ABSOLUTE)
+                data /= satVoltage;
+            else if (measType == MEASURE_RELATIVE)
+                data /= adcRefVoltage;
+
+            if (normalise && !saturated)
+                data *= normCoef[i];
+        }
+        else
+            data = 0;
+
+        result = data;
+        return true;
+    }
+};
+
+static double randomUnit()
+{
+    return rand()/(double)RAND_MAX;
+}
+
+// Readings of a frame as processMeasurement() averages them - spread over
+// the full ADC range with black level pixels and saturated pixels
+static void makeFrame(test_meas_t& m)
+{
+    float codeToVoltage = adcVoltages[m.adcRef]/((float)ADC_MAX_VALUE*(1<<FIX_CODE_BITS));
+    uint64_t reciprocal = fixReciprocal(READINGS);
+
+    for (int i=0; i<PIXELS; i++)
+    {
+        m.blackLevels[i] = 0.05 + 0.25*randomUnit();
+        m.normCoef[i] = 0.01 + 9.99*randomUnit()*randomUnit();
+
+        uint32_t sum = 0;
+        for (int r=0; r<READINGS; r++)
+            sum += (uint32_t)(ADC_MAX_VALUE*randomUnit());
+        if (i%16 == 3)
+            sum = READINGS*(uint32_t)(ADC_MAX_VALUE*m.blackLevels[i]/adcVoltages[m.adcRef]);
+        else if (i%16 == 7)
+            sum = READINGS*ADC_MAX_VALUE;
+
+        m.codes[i] = fixAverage(sum, reciprocal);
+        m.meas[i] = m.codes[i]*codeToVoltage;
+    }
+}
+
+// Every measurement type, ADC reference, bandpass and normalisation
+// combination is within the documented error of the float formula
+static void testProcess()
+{
+    static const float satVoltages[] = { 4.1, 4.5 };
+    int32_t results[PIXELS];
+    int compared = 0;
+
+    srand(12880);
+    for (int type=MEASURE_RELATIVE; type<=MEASURE_ABSOLUTE; type++)
+    for (int ref=0; ref<4; ref++)
+    for (int sat=0; sat<2; sat++)
+    for (int bp=0; bp<2; bp++)
+    {
+        test_meas_t m;
+        m.adcRef = ref;
+        m.measType = type;
+        m.satVoltage = satVoltages[sat];
+        m.bandpass = bp;
+        makeFrame(m);
+        m.buildTables();
+
+        for (int norm=0; norm<2; norm++)
+        {
+            fixProcess(m.codes, m.offsets, m.gains, m.params, norm, PIXELS, results);
+
+            for (int i=0; i<PIXELS; i++)
+            {
+                double expected;
+                if (!m.reference(i, norm, expected))
+                    continue;
+
+                double value = results[i]*(1.0/FIX_ONE);
+                double error = fabs(value - expected);
+                double bound = 1.0/(1<<15) + 1e-5*fabs(expected);
+                if (error > bound)
+                {
+                    printf("type %d ref %d sat %.1f bp %d norm %d pixel %d: %.7f expected %.7f\n",
+                           type, ref, m.satVoltage, bp, norm, i, value, expected);
+                    CHECK(error <= bound);
+                }
+                ++compared;
+            }
+        }
+    }
+
+    // most pixels are away from the thresholds
+    CHECK(compared > 3*4*2*2*2*PIXELS*9/10);
+}
+
+// Results without normalisation from the normalised pass are the same as
+// the ones from a separate pass
+static void testRawResults()
+{
+    int32_t results[PIXELS], rawResults[PIXELS], expected[PIXELS];
+
+    srand(2);
+    for (int bp=0; bp<2; bp++)
+    {
+        test_meas_t m;
+        m.adcRef = 2;
+        m.measType = MEASURE_ABSOLUTE;
+        m.satVoltage = 4.1;
+        m.bandpass = bp;
+        makeFrame(m);
+        m.buildTables();
+
+        fixProcess(m.codes, m.offsets, m.gains, m.params, false, PIXELS, expected);
+        fixProcess(m.codes, m.offsets, m.gains, m.params, true, PIXELS, results, rawResults);
+        CHECK(memcmp(rawResults, expected, sizeof(expected)) == 0);
+
+        fixProcess(m.codes, m.offsets, m.gains, m.params, true, PIXELS, expected);
+        CHECK(memcmp(results, expected, sizeof(expected)) == 0);
+    }
+}
+
+// Pixels at or below black level are zero, saturated ones are not
+// normalised
+static void testThresholds()
+{
+    test_meas_t m;
+    srand(1);
+    m.adcRef = 3;
+    m.measType = MEASURE_VOLTAGE;
+    m.satVoltage = 4.1;
+    m.bandpass = false;
+    makeFrame(m);
+    for (int i=0; i<PIXELS; i++)
+        m.normCoef[i] = 2.0;
+    m.buildTables();
+
+    int32_t results[PIXELS];
+    fixProcess(m.codes, m.offsets, m.gains, m.params, true, PIXELS, results);
+
+    for (int i=3; i<PIXELS; i+=16)
+        CHECK(results[i] == 0);
+    for (int i=7; i<PIXELS; i+=16)
+    {
+        double expected = (5.0 - m.blackLevels[i])*FIX_ONE;
+        CHECK(fabs(results[i] - expected) < 4);
+    }
+}
+
+// Averaging is exact for whole multiples and standard error matches
+// the sample formula
+static void testAverage()
+{
+    for (uint16_t count=1; count<=64; count++)
+    {
+        uint64_t reciprocal = fixReciprocal(count);
+        CHECK(fixAverage(count*12345u, reciprocal) == 12345<<FIX_CODE_BITS);
+        CHECK(fixAverage(count*(uint32_t)ADC_MAX_VALUE, reciprocal) == ADC_MAX_VALUE<<FIX_CODE_BITS);
+    }
+
+    for (uint32_t v=0; v<100000; v+=7)
+    {
+        uint32_t root = fixSqrt(v);
+        CHECK((uint64_t)root*root <= v && (uint64_t)(root+1)*(root+1) > v);
+    }
+
+    static const uint16_t readings[] = { 1000, 1010, 990, 1004, 996, 1000 };
+    uint32_t sum = 0;
+    uint64_t sumSq = 0;
+    double mean = 0;
+    for (int i=0; i<6; i++)
+    {
+        sum += readings[i];
+        sumSq += (uint64_t)readings[i]*readings[i];
+        mean += readings[i]/6.0;
+    }
+    double variance = 0;
+    for (int i=0; i<6; i++)
+        variance += (readings[i] - mean)*(readings[i] - mean)/5.0;
+    double expected = sqrt(variance/6)*(1<<FIX_CODE_BITS);
+    CHECK(fabs(fixStdError(sum, sumSq, 6) - expected) <= 1);
+    CHECK(fixStdError(sum, sumSq, 1) == 0);
+}
+
+int main()
+{
+    testProcess();
+    testRawResults();
+    testThresholds();
+    testAverage();
+
+    return testResult("test_fixed");
+}
@@ -0,0 +1,148 @@
+/*
+ *  test_ramp.cpp - Host test of DRV8884 acceleration ramp table and the
+ *                  timer periods the interrupt takes from it during a move
+ *
+ *  Copyright 2019 Alexey Danilchenko, Iliah Borg
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "DRV8884_ramp.h"
+#include "test_check.h"
+
+#include <vector>
+
+// Timer setup as in DRV8884.cpp - 10us units
+#define UNITS_PER_SEC   100000UL
+#define MIN_PERIOD      10
+
+// Timer periods of every tick of a move as drvClockInterrupt() sets
+// them - the first one from the table start, the rest after each tick
+static std::vector<uint16_t> movePeriods(const drv_ramp_t& ramp, int32_t steps)
+{
+    int32_t total = steps*2;
+    std::vector<uint16_t> periods;
+    periods.push_back(ramp.period[0]);
+    for (int32_t left=total-1; left>0; left--)
+        periods.push_back(drvRampPeriod(ramp, total-left, left));
+
+    return periods;
+}
+
+// Table follows the constant acceleration formula and ends at max speed
+static void testBuild()
+{
+    drv_ramp_t ramp;
+
+    CHECK(drvRampBuild(ramp, UNITS_PER_SEC, 100, 1000, 0, MIN_PERIOD) == 0);
+    CHECK(drvRampBuild(ramp, UNITS_PER_SEC, 0, 1000, 2000, MIN_PERIOD) == 0);
+    CHECK(drvRampBuild(ramp, UNITS_PER_SEC, 1000, 1000, 2000, MIN_PERIOD) == 0);
+    CHECK(ramp.len == 0);
+
+    // 100 to 1000 steps/s at 20000 steps/s^2 takes (1000^2-100^2)/40000
+    // steps
+    uint16_t len = drvRampBuild(ramp, UNITS_PER_SEC, 100, 1000, 20000, MIN_PERIOD);
+    CHECK(len == ramp.len);
+    CHECK(len == 26);
+    CHECK(ramp.period[0] == 500);
+    CHECK(ramp.period[len-1] == 50);
+    for (int n=0; n<len-1; n++)
+    {
+        double expected = UNITS_PER_SEC/(2*sqrt(100.0*100.0 + 2*20000.0*n));
+        CHECK(fabs(ramp.period[n] - expected) <= 0.5);
+        CHECK(ramp.period[n] >= ramp.period[n+1]);
+    }
+}
+
+// Max speed above what the timer can do is limited by the shortest period
+static void testMinPeriod()
+{
+    drv_ramp_t ramp;
+    uint16_t len = drvRampBuild(ramp, UNITS_PER_SEC, 500, 20000, 200000, MIN_PERIOD);
+    CHECK(len > 1 && len < DRV_RAMP_SIZE);
+    CHECK(ramp.period[len-1] == MIN_PERIOD);
+    for (int n=0; n<len; n++)
+        CHECK(ramp.period[n] >= MIN_PERIOD);
+
+    std::vector<uint16_t> periods = movePeriods(ramp, 1000);
+    for (size_t i=0; i<periods.size(); i++)
+        CHECK(periods[i] >= MIN_PERIOD);
+}
+
+// Acceleration too slow to reach max speed within the table stops at
+// its last entry and the move cruises at that speed
+static void testExhausted()
+{
+    drv_ramp_t ramp;
+    uint16_t len = drvRampBuild(ramp, UNITS_PER_SEC, 100, 5000, 1000, MIN_PERIOD);
+    CHECK(len == DRV_RAMP_SIZE);
+    CHECK(ramp.period[len-1] > UNITS_PER_SEC/(2*5000));
+
+    int32_t steps = 3*DRV_RAMP_SIZE;
+    std::vector<uint16_t> periods = movePeriods(ramp, steps);
+    for (int32_t i=2*DRV_RAMP_SIZE; i<2*(steps-DRV_RAMP_SIZE); i++)
+        CHECK(periods[i] == ramp.period[len-1]);
+}
+
+// Both ticks of a step have the same period, deceleration mirrors
+// acceleration and the move reaches max speed only if it is long enough
+static void testMove()
+{
+    drv_ramp_t ramp;
+    uint16_t len = drvRampBuild(ramp, UNITS_PER_SEC, 100, 1000, 20000, MIN_PERIOD);
+
+    static const int32_t moves[] = { 1, 2, 5, 25, 26, 51, 52, 53, 200 };
+    for (size_t m=0; m<sizeof(moves)/sizeof(moves[0]); m++)
+    {
+        int32_t steps = moves[m];
+        std::vector<uint16_t> periods = movePeriods(ramp, steps);
+        int32_t total = (int32_t)periods.size();
+        CHECK(total == 2*steps);
+
+        uint16_t shortest = periods[0];
+        for (int32_t i=0; i<total; i++)
+        {
+            CHECK(periods[i] == periods[total-1-i]);
+            if (i%2 == 0)
+                CHECK(periods[i] == periods[i+1]);
+            if (i > 0 && i < total/2)
+                CHECK(periods[i] <= periods[i-1]);
+            if (shortest > periods[i])
+                shortest = periods[i];
+        }
+
+        // triangular profile of short moves peaks at the middle step
+        uint16_t peak = ramp.period[(steps-1)/2 < len ? (steps-1)/2 : len-1];
+        if (shortest != peak)
+            printf("move of %d steps: shortest period %u, expected %u\n",
+                   (int)steps, shortest, peak);
+        CHECK(shortest == peak);
+        if (steps < 2*len-1)
+            CHECK(shortest > ramp.period[len-1]);
+        else
+            CHECK(shortest == ramp.period[len-1]);
+    }
+}
+
+int main()
+{
+    testBuild();
+    testMinPeriod();
+    testExhausted();
+    testMove();
+
+    return testResult("test_ramp");
+}
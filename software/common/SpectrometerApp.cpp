@@ -24,14 +24,21 @@
 #include <QStyle>
 #include <QStyleFactory>
 #include <QString>
+#include <QScreen>
+#include <QDateTime>
+#include <QFileDialog>
 
 #include <math.h>
+#include <string.h>
 
 #include "SpectrometerApp.h"
-#include "spectron_cct.h"
+#include "spectron_export.h"
 
 #define APP_VERSION " v1.2"
 
+// IES TM-30-18 colour evaluation samples reflectances
+#define TM30_SAMPLES_FILE "tm30_ces.csv"
+
 #define MAIN_TITLE APP_NAME APP_VERSION
 
 #define STATE_SECTION "Saved State"
@@ -56,23 +63,426 @@ Q_IMPORT_PLUGIN (QWindowsIntegrationPlugin);
 //    static data
 // --------------------------------------------------------
 
+// continuous frames polling interval
+#define FRAME_POLL_MS 10
+
+// frames posted to the UI and not shown yet before new frames are skipped
+#define MAX_QUEUED_FRAMES 2
+
+// chart redraw interval if display refresh rate is not known
+#define DEFAULT_REDRAW_MS 16
+
 // --------------------------------------------------------
 //    helper functions
 // --------------------------------------------------------
 
+// --------------------------------------------------------
+//    SpectrometerWorker class
+// --------------------------------------------------------
+SpectrometerWorker::SpectrometerWorker()
+    : QObject(), m_spectron(0), m_frameTimer(0),
+      m_framesQueued(0), m_framesDropped(0)
+{
+}
+
+SpectrometerWorker::~SpectrometerWorker()
+{
+    delete m_spectron;
+}
+
+// called in the worker thread when it is started - the device and its
+// frame transport socket have to be created in the thread using them
+void SpectrometerWorker::init()
+{
+    m_spectron = new SpectronDevice();
+
+    m_frameTimer = new QTimer(this);
+    m_frameTimer->setInterval(FRAME_POLL_MS);
+    connect(m_frameTimer, SIGNAL(timeout()), this, SLOT(pollFrame()));
+
+    // TM-30 indices are calculated if the colour evaluation samples are
+    // next to the application
+    m_colour.loadTM30Samples(QCoreApplication::applicationDirPath() + "/" TM30_SAMPLES_FILE);
+}
+
+// called in the worker thread as the last command, stops the thread
+void SpectrometerWorker::shutdown()
+{
+    if (m_frameTimer->isActive())
+    {
+        m_frameTimer->stop();
+        m_spectron->stopContinuous();
+    }
+
+    delete m_spectron;
+    m_spectron = 0;
+
+    // replies of the last requests are deleted here - their deferred
+    // deletes would otherwise move with the manager to the main thread
+    // whose event loop may have already finished
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+
+    // hand network access back to the main thread
+    ParticleAPI::instance().moveToThread(QCoreApplication::instance()->thread());
+    thread()->quit();
+}
+
+void SpectrometerWorker::done(int command, bool success, const QString& error)
+{
+    TSpectronSettings settings;
+    settings.connected = m_spectron->isConnected();
+    settings.supportsGain = m_spectron->supportsGain();
+    settings.adcRef = m_spectron->getADCReference();
+    settings.gain = m_spectron->getGain();
+    settings.measType = m_spectron->getMeasureType();
+    settings.integTime = m_spectron->getIntegTime();
+    settings.satVoltage[SpectronDevice::NO_GAIN] = m_spectron->getSatVoltage(SpectronDevice::NO_GAIN);
+    settings.satVoltage[SpectronDevice::HIGH_GAIN] = m_spectron->getSatVoltage(SpectronDevice::HIGH_GAIN);
+    settings.minBlackVoltage = m_spectron->getMinBlackVoltage();
+    settings.minWavelength = m_spectron->getMinWavelength();
+    settings.maxWavelength = m_spectron->getMaxWavelength();
+    settings.applySpectralCorrection = m_spectron->applySpectralCorrections();
+
+    if (command != SpectrometerWorker::CMD_EXPORT)
+        m_averager.reset();
+
+    emit settingsChanged(settings);
+    emit commandDone(command, success,
+                     success ? QString()
+                             : !error.isEmpty() ? error
+                                                : ParticleAPI::instance().getLastError());
+}
+
+void SpectrometerWorker::postData(int dataType, bool doColourData, bool continuous)
+{
+    bool average = continuous && m_averager.getFrames() > 1;
+    if (average)
+        m_averager.addFrame(m_spectron->getLastMeasurements());
+
+    if (continuous && m_framesQueued.load() >= MAX_QUEUED_FRAMES)
+    {
+        m_framesDropped.ref();
+        return;
+    }
+
+    TSpectronData data;
+    data.dataType = dataType;
+    data.continuous = continuous;
+    data.seq = m_spectron->getLastFrameSeq();
+    data.wavelengths = m_spectron->getWavelengths();
+    data.hasColour = false;
+    memset(&data.colour, 0, sizeof(data.colour));
+
+    if (average)
+    {
+        data.values = m_averager.getMean();
+        data.averaged = m_averager.count();
+        m_averager.getSNR(data.snr);
+
+        data.maxValue = 0;
+        for (int i=0; i<data.values.size(); i++)
+            if (data.maxValue < data.values.at(i))
+                data.maxValue = data.values.at(i);
+    }
+    else
+    {
+        data.values = m_spectron->getLastMeasurements();
+        data.maxValue = m_spectron->getMaxLastMeasuredValue();
+        data.averaged = 1;
+    }
+
+    // colour metrics - tables follow the device wavelengths
+    if (doColourData)
+    {
+        m_colour.update(*m_spectron);
+        data.hasColour = m_colour.calculate(data.values, data.colour);
+    }
+
+    m_framesQueued.ref();
+    emit dataReady(data);
+}
+
+bool SpectrometerWorker::setIntegrationTime(int integTimeUs)
+{
+    // 0 keeps currently set time
+    if (integTimeUs <= 0 || integTimeUs == m_spectron->getIntegTime())
+        return true;
+
+    return m_spectron->setIntegrationTime(integTimeUs);
+}
+
+void SpectrometerWorker::login(const QString& user, const QString& password)
+{
+    bool success = false;
+
+    // login with user/password - get non expiring auth token.
+    ParticleAPI& api = ParticleAPI::instance();
+    if (api.login(user, password, 0))
+    {
+        TParticleDeviceList devices;
+        if (api.getAllMatchingDevices(devices, QString(""), true)
+            && !devices.empty())
+        {
+            // iterate the connected device list and find internal
+            // devices for spectrometer
+            TParticleDeviceList::iterator it = devices.begin();
+            while (it != devices.end() && !success)
+            {
+                if (it->refresh())
+                {
+                    QString boardType = it->getVariableValue("BOARD_TYPE").toString();
+                    if (boardType == QString("SPEC2_SPECTROMETER"))
+                    {
+                        // spectrometer device
+                        *m_spectron = *it;
+                        success = m_spectron->refresh();
+                        // use local frame transport if the board is reachable
+                        if (success)
+                            m_spectron->openLocalTransport();
+                    }
+                }
+                ++it;
+            }
+        }
+    }
+
+    done(SpectrometerWorker::CMD_LOGIN, success);
+}
+
+void SpectrometerWorker::setADCRef(int adcRef)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->setADCReference((SpectronDevice::TAdcRef)adcRef);
+    done(SpectrometerWorker::CMD_SETTINGS, success);
+}
+
+void SpectrometerWorker::setGain(int gain)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->setGain((SpectronDevice::TGain)gain);
+    done(SpectrometerWorker::CMD_SETTINGS, success);
+}
+
+void SpectrometerWorker::setMeasureType(int measType)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->setMeasureType((SpectronDevice::TMeasType)measType);
+    done(SpectrometerWorker::CMD_SETTINGS, success);
+}
+
+void SpectrometerWorker::setSpectralRespCorrection(bool enable)
+{
+    m_spectron->setSpectralRespCorrection(enable);
+    done(SpectrometerWorker::CMD_SETTINGS, true);
+}
+
+void SpectrometerWorker::setSpectralRange(int rangeType, int minWavelength, int maxWavelength)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->setSpectralRange((SpectronDevice::TRangeType)rangeType,
+                                                   minWavelength,
+                                                   maxWavelength);
+    done(SpectrometerWorker::CMD_RANGE, success);
+}
+
+void SpectrometerWorker::measure(int integTimeUs, int measureTimeUs, int autoType)
+{
+    bool success = false;
+    if (m_spectron->isConnected())
+    {
+        if (autoType < 0)
+        {
+            setIntegrationTime(integTimeUs);
+            success = m_spectron->measure(measureTimeUs);
+        }
+        else
+            success = m_spectron->measureAuto((SpectronDevice::TAutoType)autoType);
+
+        if (success)
+            postData(SpectronDevice::ET_MEASUREMENT, true);
+    }
+
+    done(SpectrometerWorker::CMD_MEASURE, success);
+}
+
+void SpectrometerWorker::measureBlack(int integTimeUs, int measureTimeUs)
+{
+    bool success = false;
+    if (m_spectron->isConnected())
+    {
+        setIntegrationTime(integTimeUs);
+        success = m_spectron->measureBlack(measureTimeUs);
+        if (success && m_spectron->getSpectrometerData(SpectronDevice::ET_MEASUREMENT))
+            postData(SpectronDevice::ET_MEASUREMENT, true);
+    }
+
+    done(SpectrometerWorker::CMD_MEASURE_BLACK, success);
+}
+
+void SpectrometerWorker::measureSaturation()
+{
+    bool success = m_spectron->isConnected() && m_spectron->measureSaturation();
+    done(SpectrometerWorker::CMD_SATURATION, success);
+}
+
+void SpectrometerWorker::setMinBlack()
+{
+    bool success = m_spectron->isConnected() && m_spectron->setMinBlack();
+    done(SpectrometerWorker::CMD_MIN_BLACK, success);
+}
+
+// 0 lamp temperature resets the calibration
+void SpectrometerWorker::calibrateSpectralResponse(double lampTempK)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->calibrateSpectralResponse(lampTempK);
+    if (success && lampTempK > 0)
+        postData(SpectronDevice::ET_NORMALISATION, false);
+
+    done(SpectrometerWorker::CMD_CALIBRATE, success);
+}
+
+void SpectrometerWorker::getData(int dataType, bool doColourData)
+{
+    bool success = m_spectron->isConnected()
+                   && m_spectron->getSpectrometerData((SpectronDevice::TDataType)dataType);
+    if (success)
+        postData(dataType, doColourData);
+
+    done(SpectrometerWorker::CMD_GET_DATA, success);
+}
+
+void SpectrometerWorker::startContinuous(int integTimeUs, int frameTimeUs)
+{
+    bool success = m_spectron->isConnected()
+                   && setIntegrationTime(integTimeUs)
+                   && m_spectron->startContinuous(frameTimeUs);
+    if (success)
+        m_frameTimer->start();
+
+    done(SpectrometerWorker::CMD_CONTINUOUS, success);
+}
+
+void SpectrometerWorker::stopContinuous()
+{
+    bool success = true;
+    if (m_frameTimer->isActive())
+    {
+        m_frameTimer->stop();
+        success = m_spectron->stopContinuous();
+    }
+
+    done(SpectrometerWorker::CMD_CONTINUOUS, success);
+}
+
+// number of continuous frames to average, 1 disables averaging
+void SpectrometerWorker::setAveraging(int frames)
+{
+    m_averager.setFrames(frames);
+    done(SpectrometerWorker::CMD_SETTINGS, true);
+}
+
+// Last measurement is written first, followed by black levels and
+// normalisation read from the board into a separate vector, so the last
+// measurement and its noise are kept as they are. In continuous mode only
+// the measurement (or the average shown) is written, so the frames are
+// not disturbed.
+void SpectrometerWorker::exportData(const QString& fileName, int format, bool compress)
+{
+    if (!m_spectron->isConnected())
+    {
+        done(SpectrometerWorker::CMD_EXPORT, false);
+        return;
+    }
+
+    SpectronExportWriter writer;
+    if (!writer.open(fileName,
+                     (SpectronExportWriter::TFormat)format,
+                     m_spectron->getWavelengths(),
+                     compress))
+    {
+        done(SpectrometerWorker::CMD_EXPORT, false, writer.getLastError());
+        return;
+    }
+
+    TDatasetRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = m_spectron->getLastFrameSeq();
+    record.integTimeUs = m_spectron->getIntegTime();
+    record.adcRef = m_spectron->getADCReference();
+    record.gain = m_spectron->getGain();
+    record.measType = m_spectron->getMeasureType();
+    record.dataType = SpectronDevice::ET_MEASUREMENT;
+    record.timeMs = QDateTime::currentMSecsSinceEpoch();
+
+    bool continuous = m_frameTimer->isActive();
+    const TDoubleVec& measurement = continuous && m_averager.count() > 1
+                                        ? m_averager.getMean()
+                                        : m_spectron->getLastMeasurements();
+    bool success = true;
+    if (!measurement.isEmpty())
+        success = writer.writeFrame(record, measurement);
+
+    if (success && !continuous)
+    {
+        SpectronDevice::TDataType dataTypes[] = {
+            SpectronDevice::ET_BLACK_LEVELS,
+            SpectronDevice::ET_NORMALISATION
+        };
+        // read separately so the last measurement and its noise stay
+        TDoubleVec data;
+        for (int i=0; i<2 && success; i++)
+        {
+            success = m_spectron->getSpectrometerData(dataTypes[i], data);
+            if (success)
+            {
+                record.dataType = dataTypes[i];
+                success = writer.writeFrame(record, data);
+            }
+        }
+    }
+
+    success = writer.close() && success;
+    done(SpectrometerWorker::CMD_EXPORT, success, writer.getLastError());
+}
+
+// one frame per timer tick, so the queued commands are not held back
+// by the frames
+void SpectrometerWorker::pollFrame()
+{
+    if (m_spectron->readFrame())
+        postData(SpectronDevice::ET_MEASUREMENT, true, true);
+}
+
 // --------------------------------------------------------
 //    SpectrometerApp class
 // --------------------------------------------------------
 SpectrometerApp::SpectrometerApp(QWidget *parent, Qt::WindowFlags flags)
     : QMainWindow(parent, flags), overrideCursorSet(false),
-      m_spectron(), m_pAPI(ParticleAPI::instance()), m_specSeries(0),
+      m_worker(0), m_maxValue(0), m_csvValid(false), m_live(false),
+      m_pointsIdx(0), m_pendingCommands(0),
+      m_lastCommandSuccess(false), m_waitLoop(0), m_specSeries(0),
       m_axisX(0), m_axisY(0), ignoreUiUpdates(false)
 {
     ui.setupUi(this);
 
     // initial setup
-    ui.chkbApplySpResp->setCheckState(
-        m_spectron.applySpectralCorrections() ? Qt::Checked : Qt::Unchecked);
+    memset(&m_settings, 0, sizeof(m_settings));
+    m_settings.applySpectralCorrection = true;
+    ui.chkbApplySpResp->setCheckState(Qt::Checked);
+
+    // acquisition worker - it owns the device and all the network
+    // access happens in its thread
+    qRegisterMetaType<TSpectronSettings>("TSpectronSettings");
+    qRegisterMetaType<TSpectronData>("TSpectronData");
+    m_worker = new SpectrometerWorker();
+    m_worker->moveToThread(&m_workerThread);
+    ParticleAPI::instance().moveToThread(&m_workerThread);
+    connect(&m_workerThread, SIGNAL(started()), m_worker, SLOT(init()));
+    connect(m_worker, SIGNAL(settingsChanged(TSpectronSettings)), this, SLOT(settingsChanged(TSpectronSettings)));
+    connect(m_worker, SIGNAL(dataReady(TSpectronData)), this, SLOT(showData(TSpectronData)));
+    connect(m_worker, SIGNAL(commandDone(int,bool,QString)), this, SLOT(commandDone(int,bool,QString)));
+    m_workerThread.start();
 
     // buttons
     connect(ui.btnLogin, SIGNAL(clicked()), this, SLOT(login()));
@@ -84,6 +494,7 @@ SpectrometerApp::SpectrometerApp(QWidget *parent, Qt::WindowFlags flags)
     connect(ui.btnResetSpectralCal, SIGNAL(clicked()), this, SLOT(resetSpectralResponse()));
     connect(ui.btnCalcT, SIGNAL(clicked()), this, SLOT(calculateLampTemperature()));
     connect(ui.btnSetRange, SIGNAL(clicked()), this, SLOT(setSpectralRange()));
+    connect(ui.btnSaveCSV, SIGNAL(clicked()), this, SLOT(saveCSV()));
 
     // comboboxes
     connect(ui.cboxAdcRef, SIGNAL(currentIndexChanged(int)), this, SLOT(setADCRef(int)));
@@ -95,6 +506,20 @@ SpectrometerApp::SpectrometerApp(QWidget *parent, Qt::WindowFlags flags)
 
     // checkboxes
     connect(ui.chkbApplySpResp, SIGNAL(stateChanged(int)), this, SLOT(applySpectralResponseChanged(int)));
+    connect(ui.chkbLive, SIGNAL(stateChanged(int)), this, SLOT(setLive(int)));
+    connect(ui.CSV, SIGNAL(toggled(bool)), this, SLOT(csvToggled(bool)));
+
+    // spinboxes
+    connect(ui.spbAverage, SIGNAL(valueChanged(int)), this, SLOT(setAveraging(int)));
+
+    // chart is redrawn at most once per display refresh
+    int redrawMs = DEFAULT_REDRAW_MS;
+    if (QGuiApplication::primaryScreen()
+        && QGuiApplication::primaryScreen()->refreshRate() > 1)
+        redrawMs = 1000/QGuiApplication::primaryScreen()->refreshRate();
+    m_redrawTimer.setSingleShot(true);
+    m_redrawTimer.setInterval(redrawMs);
+    connect(&m_redrawTimer, SIGNAL(timeout()), this, SLOT(redrawChart()));
 
     // tab changes
     connect(ui.tabs, SIGNAL(currentChanged(int)), this, SLOT(tabChanged(int)));
@@ -124,27 +549,169 @@ SpectrometerApp::SpectrometerApp(QWidget *parent, Qt::WindowFlags flags)
 
 SpectrometerApp::~SpectrometerApp()
 {
+    // commands issued before are completed first
+    QMetaObject::invokeMethod(m_worker, "shutdown");
+    m_workerThread.wait();
+    delete m_worker;
 }
+
+// command is about to be issued to the worker - UI stays responsive
+// with busy cursor until all the issued commands are done
+void SpectrometerApp::commandIssued()
+{
+    ++m_pendingCommands;
+    setOverrideCursor(QCursor(Qt::BusyCursor));
+}
+
+// wait for all the issued commands, returns the result of the last one
+bool SpectrometerApp::waitCommands()
+{
+    QEventLoop loop;
+    m_waitLoop = &loop;
+    while (m_pendingCommands > 0)
+        loop.exec();
+    m_waitLoop = 0;
+
+    return m_lastCommandSuccess;
+}
+
+void SpectrometerApp::commandDone(int command, bool success, const QString& error)
+{
+    m_lastCommandSuccess = success;
+    if (m_pendingCommands > 0 && --m_pendingCommands == 0)
+    {
+        restoreOverrideCursor();
+        if (m_waitLoop)
+            m_waitLoop->quit();
+    }
+
+    // live mode failed to start
+    if (!success && command == SpectrometerWorker::CMD_CONTINUOUS && m_live)
+    {
+        m_live = false;
+        ignoreUiUpdates = true;
+        ui.chkbLive->setCheckState(Qt::Unchecked);
+        ignoreUiUpdates = false;
+        ui.btnMeasure->setEnabled(true);
+        ui.btnMeasureBlack->setEnabled(true);
+        ui.cboxMeasType->setEnabled(true);
+        ui.txtCSV->setPlainText(tr("Live mode requires local connection to the spectrometer\n")+error);
+        return;
+    }
+
+    if (!success && command == SpectrometerWorker::CMD_EXPORT)
+    {
+        showMessage(tr("Save"), tr("Saving measurement failed"), error);
+        return;
+    }
+
+    if (!success &&
+        (command == SpectrometerWorker::CMD_LOGIN
+         || command == SpectrometerWorker::CMD_MEASURE
+         || command == SpectrometerWorker::CMD_MEASURE_BLACK))
+        ui.txtCSV->setPlainText(error);
+}
+
+void SpectrometerApp::settingsChanged(const TSpectronSettings& settings)
+{
+    bool connecting = settings.connected && !m_settings.connected;
+    TSpectronSettings prev = m_settings;
+    m_settings = settings;
+
+    if (!m_settings.connected)
+        return;
+
+    // update only the widgets for changed values, so the edited
+    // and not yet applied values are not overwritten
+    ignoreUiUpdates = true;
+    if (connecting || prev.adcRef != m_settings.adcRef)
+        ui.cboxAdcRef->setCurrentIndex(m_settings.adcRef);
+    if (connecting || prev.measType != m_settings.measType)
+        ui.cboxMeasResultType->setCurrentIndex(m_settings.measType);
+    if (connecting || prev.gain != m_settings.gain)
+        ui.cboxGain->setCurrentIndex(m_settings.gain);
+    if (connecting || prev.integTime != m_settings.integTime)
+    {
+        if (ui.cboxUnits->currentIndex() == 1)
+            ui.spbIntegration->setValue(m_settings.integTime/1000);
+        else
+            ui.spbIntegration->setValue(m_settings.integTime);
+    }
+    if (connecting)
+        updateConnected();
+    ignoreUiUpdates = false;
+
+    updateWidgets();
+    if (connecting
+        || prev.minWavelength != m_settings.minWavelength
+        || prev.maxWavelength != m_settings.maxWavelength)
+        updateRanges();
+    if (connecting
+        || prev.gain != m_settings.gain
+        || prev.measType != m_settings.measType)
+        updateAxis();
+
+    // load the data for current tab or start live mode if it was
+    // selected before connecting
+    if (connecting)
+    {
+        tabChanged(ui.tabs->currentIndex());
+        if (m_live)
+            setLive(Qt::Checked);
+    }
+}
+
+void SpectrometerApp::updateConnected()
+{
+    ui.chkbApplySpResp->setCheckState(
+        m_settings.applySpectralCorrection ? Qt::Checked : Qt::Unchecked);
+    if (m_settings.supportsGain)
+    {
+        ui.lblGain->setEnabled(true);
+        ui.cboxGain->setEnabled(true);
+        ui.lblHGStxt->setEnabled(true);
+        ui.lblHGSval->setEnabled(true);
+        ui.lblMeasureTime->setEnabled(false);
+        ui.spbMeasureTime->setEnabled(false);
+        ui.lblSpectrometer->setText("Spectrometer: Hamamatsu C12666MA  ");
+    }
+    else
+    {
+        ui.lblGain->setEnabled(false);
+        ui.cboxGain->setEnabled(false);
+        ui.lblHGStxt->setEnabled(false);
+        ui.lblHGSval->setEnabled(false);
+        ui.lblMeasureTime->setEnabled(true);
+        ui.spbMeasureTime->setEnabled(true);
+        ui.lblSpectrometer->setText("Spectrometer: Hamamatsu C12880MA  ");
+    }
+}
+
 void SpectrometerApp::updateAxis()
 {
-    double maxVal = ceil(105*m_spectron.getMaxLastMeasuredValue())/100;
+    double maxVal = ceil(105*m_maxValue)/100;
     int ticks = 11;
     
     if (maxVal==0.0)
     {
         maxVal = 1.0;
-        if (m_spectron.getMeasureType() == SpectronDevice::MEASURE_VOLTAGE)
+        if (m_settings.measType == SpectronDevice::MEASURE_VOLTAGE)
         {
-            maxVal = ceil(m_spectron.getSatVoltage()/0.5)*0.5;
+            maxVal = ceil(m_settings.satVoltage[m_settings.gain]/0.5)*0.5;
             ticks = maxVal/0.25 + 1;
         }
     }
 
+    // in live mode the axis is kept while the values are within
+    // its upper half, so it does not jump with every frame
+    if (m_live && maxVal <= m_axisY->max() && maxVal > m_axisY->max()/2)
+        return;
+
     if (m_axisY->max() != maxVal)
     {
         m_specSeries->clear();
-        m_specSeries->append(m_spectron.getMinWavelength(),0);
-        m_specSeries->append(m_spectron.getMaxWavelength(),0);
+        m_specSeries->append(m_settings.minWavelength,0);
+        m_specSeries->append(m_settings.maxWavelength,0);
         m_axisY->setRange(0, maxVal);
         m_axisY->setTickCount(ticks);
     }
@@ -156,29 +723,29 @@ void SpectrometerApp::updateWidgets()
 
     setWindowTitle(title);
 
-    if (!m_spectron.isConnected())
+    if (!m_settings.connected)
         return;
 
-    if (m_spectron.supportsGain())
+    if (m_settings.supportsGain)
         ui.lblHGSval->setText(
             QString("%1 V").arg(
-                m_spectron.getSatVoltage(SpectronDevice::HIGH_GAIN), 0, 'f', 2));
+                m_settings.satVoltage[SpectronDevice::HIGH_GAIN], 0, 'f', 2));
     ui.lblNGSval->setText(
         QString("%1 V").arg(
-            m_spectron.getSatVoltage(SpectronDevice::NO_GAIN), 0, 'f', 2));
+            m_settings.satVoltage[SpectronDevice::NO_GAIN], 0, 'f', 2));
     ui.lblMinBval->setText(
         QString("%1 V").arg(
-            m_spectron.getMinBlackVoltage(), 0, 'f', 2));
+            m_settings.minBlackVoltage, 0, 'f', 2));
 }
 
 void SpectrometerApp::updateRanges()
 {
-    if (!m_spectron.isConnected())
+    if (!m_settings.connected)
         return;
 
     // update ranges
-    int minWv = m_spectron.getMinWavelength();
-    int maxWv = m_spectron.getMaxWavelength();
+    int minWv = m_settings.minWavelength;
+    int maxWv = m_settings.maxWavelength;
     minWv = ((minWv+3)/5)*5;  // round up to nearest 5
     maxWv = (maxWv/5)*5;        // round down to nearest 5
     ui.lblRange->setText(QString("Spectral Range: %1 - %2 nm").arg(minWv).arg(maxWv));
@@ -192,29 +759,20 @@ void SpectrometerApp::updateRanges()
 
 void SpectrometerApp::setADCRef(int idx)
 {
-    if (ignoreUiUpdates)
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-
-    if (m_spectron.isConnected())
-        m_spectron.setADCReference((SpectronDevice::TAdcRef)idx);
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "setADCRef", Q_ARG(int, idx));
 }
 
 void SpectrometerApp::setGain(int idx)
 {
-    if (ignoreUiUpdates)
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
-    {
-        m_spectron.setGain((SpectronDevice::TGain)idx);
-        updateAxis();
-    }
-
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "setGain", Q_ARG(int, idx));
 }
 
 void SpectrometerApp::setUnits(int idx)
@@ -222,28 +780,20 @@ void SpectrometerApp::setUnits(int idx)
     if (ignoreUiUpdates)
         return;
 
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
+    if (m_settings.connected)
         if (ui.cboxUnits->currentIndex() == 1)
-            ui.spbIntegration->setValue(m_spectron.getIntegTime()/1000);
+            ui.spbIntegration->setValue(m_settings.integTime/1000);
         else
-            ui.spbIntegration->setValue(m_spectron.getIntegTime());
-    restoreOverrideCursor();
+            ui.spbIntegration->setValue(m_settings.integTime);
 }
 
 void SpectrometerApp::setMeasResultType(int idx)
 {
-    if (ignoreUiUpdates)
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
-    {
-        m_spectron.setMeasureType((SpectronDevice::TMeasType)idx);
-        updateAxis();
-    }
-
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "setMeasureType", Q_ARG(int, idx));
 }
 
 void SpectrometerApp::setMeasType(int idx)
@@ -256,7 +806,7 @@ void SpectrometerApp::setMeasType(int idx)
     ui.lblIntegration->setEnabled(intEnable);
     ui.spbIntegration->setEnabled(intEnable);
     
-    if (!m_spectron.supportsGain())
+    if (!m_settings.supportsGain)
     {
         ui.lblMeasureTime->setEnabled(intEnable);
         ui.spbMeasureTime->setEnabled(intEnable);
@@ -265,181 +815,86 @@ void SpectrometerApp::setMeasType(int idx)
 
 void SpectrometerApp::tabChanged(int idx)
 {
-    setOverrideCursor(QCursor(Qt::WaitCursor));
+    if (!m_settings.connected)
+        return;
+
+    // load up the normalisation or measurement data
+    commandIssued();
     if (idx == 1)
-    {
-        // load up the normalisation data
-        if (m_spectron.isConnected() &&
-            m_spectron.getSpectrometerData(SpectronDevice::ET_NORMALISATION))
-            readMeasurement(false);
-    }
+        QMetaObject::invokeMethod(m_worker, "getData",
+                                  Q_ARG(int, SpectronDevice::ET_NORMALISATION),
+                                  Q_ARG(bool, false));
     else
-    {
-        // load up the measurement data
-        if (m_spectron.isConnected() &&
-            m_spectron.getSpectrometerData(SpectronDevice::ET_MEASUREMENT))
-            readMeasurement(true);
-    }
-    restoreOverrideCursor();
+        QMetaObject::invokeMethod(m_worker, "getData",
+                                  Q_ARG(int, SpectronDevice::ET_MEASUREMENT),
+                                  Q_ARG(bool, true));
 }
 
 void SpectrometerApp::login()
 {
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    // login with user/password - get non expiring auth token.
-    if (m_pAPI.login(ui.edtUser->text(), ui.edtPwd->text(), 0))
-    {
-        TParticleDeviceList devices;
-        if (m_pAPI.getAllMatchingDevices(devices, QString(""), true)
-            && !devices.empty())
-        {
-            // iterate the connected device list and find internal
-            // devices for spectrometer
-            TParticleDeviceList::iterator it = devices.begin();
-            while (it != devices.end())
-            {
-                if (it->refresh())
-                {
-                    QString boardType = it->getVariableValue("BOARD_TYPE").toString();
-                    if (boardType == QString("SPEC2_SPECTROMETER"))
-                    {
-                        // spectrometer device
-                        m_spectron = *it;
-                        m_spectron.refresh();
-                        ignoreUiUpdates = true;
-                        ui.cboxAdcRef->setCurrentIndex(m_spectron.getADCReference());
-                        ui.cboxMeasResultType->setCurrentIndex(m_spectron.getMeasureType());
-                        if (m_spectron.supportsGain())
-                        {
-                            ui.lblGain->setEnabled(true);
-                            ui.cboxGain->setEnabled(true);
-                            ui.lblHGStxt->setEnabled(true);
-                            ui.lblHGSval->setEnabled(true);
-                            ui.cboxGain->setCurrentIndex(m_spectron.getGain());
-                            ui.lblMeasureTime->setEnabled(false);
-                            ui.spbMeasureTime->setEnabled(false);
-                            ui.lblSpectrometer->setText("Spectrometer: Hamamatsu C12666MA  ");
-                        }
-                        else
-                        {
-                            ui.lblGain->setEnabled(false);
-                            ui.cboxGain->setEnabled(false);
-                            ui.lblHGStxt->setEnabled(false);
-                            ui.lblHGSval->setEnabled(false);
-                            ui.lblMeasureTime->setEnabled(true);
-                            ui.spbMeasureTime->setEnabled(true);
-                            ui.lblSpectrometer->setText("Spectrometer: Hamamatsu C12880MA  ");
-                        }
-                        if (ui.cboxUnits->currentIndex() == 1)
-                            ui.spbIntegration->setValue(m_spectron.getIntegTime()/1000);
-                        else
-                            ui.spbIntegration->setValue(m_spectron.getIntegTime());
-
-                        // update data
-                        updateWidgets();
-                        updateRanges();
-                        tabChanged(ui.tabs->currentIndex());
-
-                        ignoreUiUpdates = false;
-                    }
-                }
-                ++it;
-            }
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "login",
+                              Q_ARG(QString, ui.edtUser->text()),
+                              Q_ARG(QString, ui.edtPwd->text()));
+}
 
-        }
+// integration time in microseconds to set if it was changed in the UI,
+// 0 otherwise
+int SpectrometerApp::getIntegTimeChange()
+{
+    int integTime = ui.spbIntegration->value();
+    int setIntegTime = m_settings.integTime;
+
+    if (ui.cboxUnits->currentIndex() == 1)
+    {
+        integTime *= 1000;
+        setIntegTime /= 1000;
     }
-    else
-        ui.txtCSV->setPlainText(m_pAPI.getLastError());
 
-    restoreOverrideCursor();
+    return setIntegTime != ui.spbIntegration->value() ? integTime : 0;
 }
 
 void SpectrometerApp::measure()
 {
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
-    {
-        if (ui.cboxMeasType->currentIndex() == 0)
-        {
-            int integTime = ui.spbIntegration->value();
-            int setIntegTime = m_spectron.getIntegTime();
-
-            if (ui.cboxUnits->currentIndex() == 1)
-            {
-                integTime *= 1000;
-                setIntegTime /= 1000;
-            }
-
-            // set integration time if changed
-            if (setIntegTime != ui.spbIntegration->value())
-                m_spectron.setIntegrationTime(integTime);
-
-            int measureTime = 0;
-            if (!m_spectron.supportsGain())
-                measureTime = ui.spbMeasureTime->value()*1000;
+    if (!m_settings.connected)
+        return;
 
-           if (m_spectron.measure(measureTime))
-                readMeasurement(true);
-            else
-                ui.txtCSV->setPlainText(m_pAPI.getLastError());
-        }
-        else
-        {
-            if (m_spectron.measureAuto(
-                  (SpectronDevice::TAutoType)(ui.cboxMeasType->currentIndex()-1)))
-            {
-                ui.cboxAdcRef->setCurrentIndex(m_spectron.getADCReference());
-                ui.cboxGain->setCurrentIndex(m_spectron.getGain());
-                if (ui.cboxUnits->currentIndex() == 1)
-                    ui.spbIntegration->setValue(m_spectron.getIntegTime()/1000);
-                else
-                    ui.spbIntegration->setValue(m_spectron.getIntegTime());
-                readMeasurement(true);
-            }
-            else
-                ui.txtCSV->setPlainText(m_pAPI.getLastError());
-        }
+    int integTime = 0;
+    int measureTime = 0;
+    int autoType = ui.cboxMeasType->currentIndex()-1;
+    if (autoType < 0)
+    {
+        integTime = getIntegTimeChange();
+        if (!m_settings.supportsGain)
+            measureTime = ui.spbMeasureTime->value()*1000;
     }
 
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "measure",
+                              Q_ARG(int, integTime),
+                              Q_ARG(int, measureTime),
+                              Q_ARG(int, autoType));
 }
 
 void SpectrometerApp::measureBlack()
 {
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
-    {
-        int integTime = ui.spbIntegration->value();
-        int setIntegTime = m_spectron.getIntegTime();
-
-        if (ui.cboxUnits->currentIndex() == 1)
-        {
-            integTime *= 1000;
-            setIntegTime /= 1000;
-        }
-
-        if (setIntegTime != ui.spbIntegration->value())
-            m_spectron.setIntegrationTime(integTime);
-
-        int measureTime = 0;
-        if (!m_spectron.supportsGain())
-            measureTime = ui.spbMeasureTime->value()*1000;
+    if (!m_settings.connected)
+        return;
 
-       if (m_spectron.measureBlack(measureTime))
-       {
-            m_spectron.getSpectrometerData(SpectronDevice::ET_MEASUREMENT);
-            readMeasurement(true);
-        }
-        else
-            ui.txtCSV->setPlainText(m_pAPI.getLastError());
-    }
+    int integTime = getIntegTimeChange();
+    int measureTime = 0;
+    if (!m_settings.supportsGain)
+        measureTime = ui.spbMeasureTime->value()*1000;
 
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "measureBlack",
+                              Q_ARG(int, integTime),
+                              Q_ARG(int, measureTime));
 }
 
 void SpectrometerApp::measureSaturation()
 {
-    if (ignoreUiUpdates || !m_spectron.isConnected())
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
     int dlgRes = showMessage(
@@ -453,16 +908,14 @@ void SpectrometerApp::measureSaturation()
 
     if (dlgRes == QMessageBox::Ok)
     {
-        setOverrideCursor(QCursor(Qt::WaitCursor));
-        m_spectron.measureSaturation();
-        restoreOverrideCursor();
-        updateWidgets();
+        commandIssued();
+        QMetaObject::invokeMethod(m_worker, "measureSaturation");
     }
 }
 
 void SpectrometerApp::measureMinBlack()
 {
-    if (ignoreUiUpdates || !m_spectron.isConnected())
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
     int dlgRes = showMessage(
@@ -476,16 +929,14 @@ void SpectrometerApp::measureMinBlack()
 
     if (dlgRes == QMessageBox::Ok)
     {
-        setOverrideCursor(QCursor(Qt::WaitCursor));
-        m_spectron.setMinBlack();
-        restoreOverrideCursor();
-        updateWidgets();
+        commandIssued();
+        QMetaObject::invokeMethod(m_worker, "setMinBlack");
     }
 }
 
 void SpectrometerApp::resetSpectralResponse()
 {
-    if (ignoreUiUpdates || !m_spectron.isConnected())
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
     int dlgRes = showMessage(
@@ -499,14 +950,13 @@ void SpectrometerApp::resetSpectralResponse()
     if (dlgRes == QMessageBox::Cancel)
         return;
 
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    m_spectron.calibrateSpectralResponse(0.0);
-    restoreOverrideCursor();
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "calibrateSpectralResponse", Q_ARG(double, 0.0));
 }
 
 void SpectrometerApp::calibrateSpectralResponse()
 {
-    if (ignoreUiUpdates || !m_spectron.isConnected())
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
     double lampT = ui.spbT->value();
@@ -530,10 +980,12 @@ void SpectrometerApp::calibrateSpectralResponse()
         return;
 
     // step 1 - establish measurement parameters
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    bool success = m_spectron.measureAuto(SpectronDevice::AUTO_ALL_MAX_RANGE);
-    restoreOverrideCursor();
-    if (!success)
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "measure",
+                              Q_ARG(int, 0),
+                              Q_ARG(int, 0),
+                              Q_ARG(int, SpectronDevice::AUTO_ALL_MAX_RANGE));
+    if (!waitCommands())
     {
         showMessage(tr("Error"), tr("Auto measurement failed!"));
         return;
@@ -552,25 +1004,22 @@ void SpectrometerApp::calibrateSpectralResponse()
         return;
 
     // step 2 - measure black levels
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    success = m_spectron.measureBlack();
-    restoreOverrideCursor();
-    if (!success)
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "measureBlack", Q_ARG(int, 0), Q_ARG(int, 0));
+    if (!waitCommands())
     {
         showMessage(tr("Error"), tr("Black measurement failed!"));
         return;
     }
 
     // step 3 - calculate normalisation
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    success = m_spectron.calibrateSpectralResponse(lampT);
-    restoreOverrideCursor();
-    if (!success)
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "calibrateSpectralResponse", Q_ARG(double, lampT));
+    if (!waitCommands())
     {
         showMessage(tr("Error"), tr("Normalisation failed!"));
         return;
     }
-    readMeasurement(false);
 }
 
 void SpectrometerApp::calculateLampTemperature()
@@ -603,16 +1052,22 @@ void SpectrometerApp::applySpectralResponseChanged(int state)
     if (ignoreUiUpdates)
         return;
 
-    m_spectron.setSpectralRespCorrection(state==Qt::Checked);
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "setSpectralRespCorrection",
+                              Q_ARG(bool, state==Qt::Checked));
 
-    if (m_spectron.isConnected() &&
-        m_spectron.getSpectrometerData(SpectronDevice::ET_MEASUREMENT))
-        readMeasurement(state==Qt::Checked);
+    if (m_settings.connected)
+    {
+        commandIssued();
+        QMetaObject::invokeMethod(m_worker, "getData",
+                                  Q_ARG(int, SpectronDevice::ET_MEASUREMENT),
+                                  Q_ARG(bool, state==Qt::Checked));
+    }
 }
 
 void SpectrometerApp::setSpectralRange()
 {
-    if (ignoreUiUpdates || !m_spectron.isConnected())
+    if (ignoreUiUpdates || !m_settings.connected)
         return;
 
     int dlgRes = showMessage(
@@ -625,13 +1080,11 @@ void SpectrometerApp::setSpectralRange()
 
     if (dlgRes == QMessageBox::Ok)
     {
-        setOverrideCursor(QCursor(Qt::WaitCursor));
-        m_spectron.setSpectralRange(
-            (SpectronDevice::TRangeType)ui.cbxSpRangeType->currentIndex(), 
-            ui.spbMinWv->value(), 
-            ui.spbMaxWv->value());
-        restoreOverrideCursor();
-        updateRanges();
+        commandIssued();
+        QMetaObject::invokeMethod(m_worker, "setSpectralRange",
+                                  Q_ARG(int, ui.cbxSpRangeType->currentIndex()),
+                                  Q_ARG(int, ui.spbMinWv->value()),
+                                  Q_ARG(int, ui.spbMaxWv->value()));
     }
 }
 
@@ -643,56 +1096,169 @@ void SpectrometerApp::spectralRespTypeChanged(int idx)
 
 void SpectrometerApp::saveCSV()
 {
+    QString filter;
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        tr("Save measurement"),
+        QString(),
+        tr("CSV (*.csv);;CSV gzip compressed (*.csv.gz);;JSON (*.json);;JSON gzip compressed (*.json.gz)"),
+        &filter);
+    if (fileName.isEmpty())
+        return;
+
+    // format is selected by the filter
+    bool compress = filter.contains(".gz");
+    bool json = filter.contains(".json");
+    QString ext = QString(json ? ".json" : ".csv") + (compress ? ".gz" : "");
+    if (!fileName.endsWith(ext, Qt::CaseInsensitive))
+        fileName += ext;
+
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "exportData",
+                              Q_ARG(QString, fileName),
+                              Q_ARG(int, json ? SpectronExportWriter::EF_JSON
+                                              : SpectronExportWriter::EF_CSV),
+                              Q_ARG(bool, compress));
 }
 
-void SpectrometerApp::readMeasurement(bool doColourData, bool csvOnly)
+void SpectrometerApp::setLive(int state)
 {
-    setOverrideCursor(QCursor(Qt::WaitCursor));
-    if (m_spectron.isConnected())
+    if (ignoreUiUpdates)
+        return;
+
+    m_live = state==Qt::Checked;
+    ui.btnMeasure->setEnabled(!m_live);
+    ui.btnMeasureBlack->setEnabled(!m_live);
+    ui.cboxMeasType->setEnabled(!m_live);
+
+    if (!m_settings.connected)
+        return;
+
+    commandIssued();
+    if (m_live)
+        QMetaObject::invokeMethod(m_worker, "startContinuous",
+                                  Q_ARG(int, getIntegTimeChange()),
+                                  Q_ARG(int, 0));
+    else
     {
-        updateAxis();
-        
-        // populate last measurement
-        if (!csvOnly)
-            m_specSeries->clear();
-        QString csv = "Wavelength,Measurement\n";
-        double maxVal = 0, minVal = 1;
-        int maxIdx = 0;
-        for (int i=0; i<m_spectron.totalPixels(); i++)
-        {
-            csv.append(QString("%1,%2\n").arg(m_spectron.getWavelength(i)).arg(m_spectron.getLastMeasurement(i)));
-            if (m_spectron.getLastMeasurement(i) > maxVal)
-            {
-                maxVal = m_spectron.getLastMeasurement(i);
-                maxIdx = i;
-            }
-            else if (m_spectron.getLastMeasurement(i) < minVal)
-                minVal = m_spectron.getLastMeasurement(i);
-            if (!csvOnly)
-                m_specSeries->append(m_spectron.getWavelength(i), m_spectron.getLastMeasurement(i));
-        }
-        if (!csvOnly)
+        QMetaObject::invokeMethod(m_worker, "stopContinuous");
+        updateCSV();
+    }
+}
+
+void SpectrometerApp::setAveraging(int frames)
+{
+    if (ignoreUiUpdates)
+        return;
+
+    commandIssued();
+    QMetaObject::invokeMethod(m_worker, "setAveraging", Q_ARG(int, frames));
+}
+
+void SpectrometerApp::csvToggled(bool on)
+{
+    ui.txtCSV->setVisible(on);
+    if (on && !m_live)
+        updateCSV();
+}
+
+void SpectrometerApp::showData(const TSpectronData& data)
+{
+    m_worker->frameShown();
+    if (!m_settings.connected)
+        return;
+
+    // frames arriving faster than the display refresh replace each other
+    m_lastData = data;
+    m_csvValid = false;
+    if (!m_redrawTimer.isActive())
+        m_redrawTimer.start();
+}
+
+void SpectrometerApp::redrawChart()
+{
+    const TSpectronData& data = m_lastData;
+
+    m_maxValue = data.maxValue;
+    updateAxis();
+
+    // populate last measurement
+    QVector<QPointF>& points = m_points[m_pointsIdx];
+    m_pointsIdx ^= 1;
+    double maxVal = 0;
+    int maxIdx = 0;
+    int pixels = qMin(data.values.size(), data.wavelengths.size());
+    points.resize(pixels);
+    QPointF* point = points.data();
+    for (int i=0; i<pixels; i++, point++)
+    {
+        point->setX(data.wavelengths.at(i));
+        point->setY(data.values.at(i));
+        if (data.values.at(i) > maxVal)
         {
-            double CCT = 0, x = 0, y = 0;
-            
-            ui.lblMaxValue->setText(QString("%1 at %2 nm    ")
-                .arg(maxVal, 0, 'F', 4)
-                .arg(m_spectron.getWavelength(maxIdx), 0, 'F', 2));
-
-            // calculate and set CCT, x and y
-            if (doColourData)
-                calculateColourParam(m_spectron, CCT, x, y);
-            ui.lblCCT->setText(QString("%1 K    ").arg(CCT, 0, 'F', 0));
-            ui.lblX->setText(QString("%1    ").arg(x, 0, 'F', 6));
-            ui.lblY->setText(QString("%1    ").arg(y, 0, 'F', 6));
+            maxVal = data.values.at(i);
+            maxIdx = i;
         }
-
-        ui.txtCSV->setPlainText(csv);
     }
+    m_specSeries->replace(points);
+
+    ui.lblMaxValue->setText(QString("%1 at %2 nm    ")
+        .arg(maxVal, 0, 'F', 4)
+        .arg(pixels ? data.wavelengths.at(maxIdx) : 0.0, 0, 'F', 2));
+
+    // colour metrics are calculated by the worker, CRI is not defined
+    // too far from Planckian locus
+    const TColourMetrics& colour = data.colour;
+    ui.lblCCT->setText(QString("%1 K    ").arg(colour.CCT, 0, 'F', 0));
+    ui.lblX->setText(QString("%1    ").arg(colour.x, 0, 'F', 6));
+    ui.lblY->setText(QString("%1    ").arg(colour.y, 0, 'F', 6));
+    ui.lblDuv->setText(QString("%1    ").arg(colour.Duv, 0, 'F', 4));
+    if (data.hasColour && colour.criValid)
+        ui.lblRa->setText(QString("%1 (R9 %2)    ").arg(colour.Ra, 0, 'F', 0)
+                                                 .arg(colour.R[8], 0, 'F', 0));
+    else
+        ui.lblRa->setText("-    ");
+    if (data.hasColour && colour.tm30Valid)
+        ui.lblTM30->setText(QString("%1 / %2    ").arg(colour.Rf, 0, 'F', 0)
+                                                  .arg(colour.Rg, 0, 'F', 0));
+    else
+        ui.lblTM30->setText("-    ");
 
-    restoreOverrideCursor();
+    // CSV list is not updated while live
+    if (!m_live)
+        updateCSV();
 }
 
+// CSV list of the last data - only built when the list is shown
+void SpectrometerApp::updateCSV()
+{
+    if (m_csvValid || !ui.CSV->isChecked())
+        return;
+
+    const TSpectronData& data = m_lastData;
+    int pixels = qMin(data.values.size(), data.wavelengths.size());
+    QString csv;
+    if (data.snr.size() >= pixels && !data.snr.isEmpty())
+    {
+        // averaged frames - add SNR of each pixel
+        csv = QString("Wavelength,Measurement (%1 frames),SNR\n").arg(data.averaged);
+        csv.reserve(csv.size() + pixels*36);
+        for (int i=0; i<pixels; i++)
+            csv.append(QString("%1,%2,%3\n").arg(data.wavelengths.at(i))
+                                             .arg(data.values.at(i))
+                                             .arg(data.snr.at(i), 0, 'F', 1));
+    }
+    else
+    {
+        csv = "Wavelength,Measurement\n";
+        csv.reserve(csv.size() + pixels*24);
+        for (int i=0; i<pixels; i++)
+            csv.append(QString("%1,%2\n").arg(data.wavelengths.at(i)).arg(data.values.at(i)));
+    }
+
+    ui.txtCSV->setPlainText(csv);
+    m_csvValid = true;
+}
 
 void SpectrometerApp::closeEvent(QCloseEvent *event)
 {
@@ -25,9 +25,15 @@
 #include <QMessageBox>
 #include <QLabel>
 #include <QString>
+#include <QThread>
+#include <QTimer>
+#include <QEventLoop>
+#include <QAtomicInt>
 #include <QtCharts>
 
 #include "spectron_api.h"
+#include "spectron_average.h"
+#include "spectron_colour.h"
 
 #include "ui_SpectrometerApp.h"
 
@@ -35,6 +41,135 @@
 
 using namespace QtCharts;
 
+// --------------------------------------------------------
+//    Data passed from acquisition worker to the UI
+// --------------------------------------------------------
+
+// Snapshot of the spectrometer settings
+struct TSpectronSettings
+{
+    bool    connected;
+    bool    supportsGain;
+    int     adcRef;
+    int     gain;
+    int     measType;
+    int     integTime;
+    double  satVoltage[2];
+    double  minBlackVoltage;
+    double  minWavelength;
+    double  maxWavelength;
+    bool    applySpectralCorrection;
+};
+
+// Spectrum read from the spectrometer - wavelengths and values are
+// implicitly shared copies of the device data
+struct TSpectronData
+{
+    int         dataType;     // SpectronDevice::TDataType
+    bool        continuous;   // continuous measurement frame
+    quint32     seq;          // frame sequence number
+    TDoubleVec  wavelengths;
+    TDoubleVec  values;
+    double      maxValue;
+    int         averaged;     // frames averaged into values
+    TDoubleVec  snr;          // per pixel SNR of averaged frames
+    bool        hasColour;    // colour metrics are calculated
+    TColourMetrics colour;
+};
+
+Q_DECLARE_METATYPE(TSpectronSettings)
+Q_DECLARE_METATYPE(TSpectronData)
+
+// --------------------------------------------------------
+//    SpectrometerWorker class
+// --------------------------------------------------------
+//
+// Acquisition worker - owns the spectrometer device and runs in its own
+// thread, so the blocking cloud and frame transport calls do not freeze
+// the UI. Commands are slots invoked through queued connections and are
+// executed one after another in the order they were issued. Each command
+// ends with commandDone() and settingsChanged(), spectra are posted with
+// dataReady().
+//
+// In continuous mode the frames are polled between commands. A frame is
+// skipped if the UI has not shown two previous frames yet, so a slow UI
+// does not build up a backlog of queued frames. With averaging set, every
+// frame goes into the rolling average and the UI gets the mean of the last
+// frames instead - skipped frames are still averaged. The average restarts
+// with any command as it may change the measurement.
+//
+class SpectrometerWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum TCommand {
+        CMD_LOGIN          = 0,
+        CMD_SETTINGS       = 1,
+        CMD_MEASURE        = 2,
+        CMD_MEASURE_BLACK  = 3,
+        CMD_SATURATION     = 4,
+        CMD_MIN_BLACK      = 5,
+        CMD_CALIBRATE      = 6,
+        CMD_RANGE          = 7,
+        CMD_GET_DATA       = 8,
+        CMD_CONTINUOUS     = 9,
+        CMD_EXPORT         = 10
+    };
+
+    SpectrometerWorker();
+    ~SpectrometerWorker();
+
+    // called by the UI from its thread when a frame is shown
+    void frameShown()               { m_framesQueued.deref(); }
+    int  getFramesDropped()         { return m_framesDropped.load(); }
+
+public slots:
+    void init();
+    void shutdown();
+
+    void login(const QString& user, const QString& password);
+    void setADCRef(int adcRef);
+    void setGain(int gain);
+    void setMeasureType(int measType);
+    void setSpectralRespCorrection(bool enable);
+    void setSpectralRange(int rangeType, int minWavelength, int maxWavelength);
+    // autoType is SpectronDevice::TAutoType or -1 for manual measurement
+    void measure(int integTimeUs, int measureTimeUs, int autoType);
+    void measureBlack(int integTimeUs, int measureTimeUs);
+    void measureSaturation();
+    void setMinBlack();
+    void calibrateSpectralResponse(double lampTempK);
+    void getData(int dataType, bool doColourData);
+    void startContinuous(int integTimeUs, int frameTimeUs);
+    void stopContinuous();
+    void setAveraging(int frames);
+    // format is SpectronExportWriter::TFormat
+    void exportData(const QString& fileName, int format, bool compress);
+
+signals:
+    void settingsChanged(const TSpectronSettings& settings);
+    void dataReady(const TSpectronData& data);
+    void commandDone(int command, bool success, const QString& error);
+
+private slots:
+    void pollFrame();
+
+private:
+    // error is taken from ParticleAPI if not given
+    void done(int command, bool success, const QString& error = QString());
+    void postData(int dataType, bool doColourData, bool continuous = false);
+    bool setIntegrationTime(int integTimeUs);
+
+    // members
+    SpectronDevice* m_spectron;
+    QTimer*         m_frameTimer;
+    QAtomicInt      m_framesQueued;
+    QAtomicInt      m_framesDropped;
+    FrameAverager   m_averager;
+    ColourMetrics   m_colour;
+};
+
 // --------------------------------------------------------
 //    SpectrometerApp class
 // --------------------------------------------------------
@@ -45,8 +180,26 @@ class SpectrometerApp : public QMainWindow
     // member variables
     Ui::SpectrometerApp ui;
 
-    SpectronDevice m_spectron;
-    ParticleAPI& m_pAPI;
+    SpectrometerWorker* m_worker;
+    QThread m_workerThread;
+    TSpectronSettings m_settings;
+    double m_maxValue;
+
+    // last data received, it is drawn at most once per display refresh
+    TSpectronData m_lastData;
+    QTimer m_redrawTimer;
+    bool m_csvValid;
+    bool m_live;
+
+    // chart points - two buffers are swapped, so the one not held by
+    // the chart series can be refilled without reallocation
+    QVector<QPointF> m_points[2];
+    int m_pointsIdx;
+
+    // worker commands issued and not done yet
+    int m_pendingCommands;
+    bool m_lastCommandSuccess;
+    QEventLoop* m_waitLoop;
 
     QLineSeries* m_specSeries;
     QValueAxis* m_axisX;
@@ -90,11 +243,16 @@ private:
         }
     }
 
+    void commandIssued();
+    bool waitCommands();
+
     void updateAxis();
     void updateStats();
     void updateWidgets();
     void updateRanges();
-    void readMeasurement(bool doColourData, bool csvOnly=false);
+    void updateConnected();
+    void updateCSV();
+    int  getIntegTimeChange();
     
 private slots:
 
@@ -106,6 +264,9 @@ private slots:
     void tabChanged(int idx);
     void spectralRespTypeChanged(int idx);
     void applySpectralResponseChanged(int state);
+    void setLive(int state);
+    void setAveraging(int frames);
+    void csvToggled(bool on);
 
     void login();
     void measure();
@@ -117,6 +278,12 @@ private slots:
     void calculateLampTemperature();
     void setSpectralRange();
     void saveCSV();
+
+    // acquisition worker results
+    void settingsChanged(const TSpectronSettings& settings);
+    void showData(const TSpectronData& data);
+    void redrawChart();
+    void commandDone(int command, bool success, const QString& error);
 };
 
 #endif // SPECTROMETER_APP_H
@@ -47,6 +47,8 @@ ParticleAPI& ParticleAPI::instance()
 }
 
 ParticleAPI::ParticleAPI()
+    : m_apiUrl(c_particleApiUrl),
+      m_networkTimeoutMs(120000)   // 2 mins
 {
     m_manager = new QNetworkAccessManager();
 }
@@ -175,85 +177,116 @@ bool ParticleAPI::getAllMatchingDevices(TParticleDeviceList &devices, QString st
 
 bool ParticleAPI::syncSend(QNetworkReply *reply, QByteArray& resultData)
 {
-    // timeout - 2 mins
-    const qint64 networkTimeoutMs = 120000;
+    QList<QByteArray> results;
+    bool success = syncWaitAll(QList<QNetworkReply*>() << reply, results);
+    resultData = results.first();
 
+    return success;
+}
+
+bool ParticleAPI::syncWaitAll(const QList<QNetworkReply*>& replies, QList<QByteArray>& results)
+{
     bool success = true;
 
+    // single timeout for the whole batch
     QTimer timer;
-    timer.setInterval(networkTimeoutMs);
-	timer.setSingleShot(true);
+    timer.setInterval(m_networkTimeoutMs);
+    timer.setSingleShot(true);
 
     QEventLoop loop;
-    QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
-	QObject::connect(&timer, SIGNAL(timeout()), reply, SLOT(abort()));
+    QObject::connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+    foreach (QNetworkReply *reply, replies)
+        QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
 
-	timer.start();
-    loop.exec();
-    timer.stop();
-
-    if (reply->isFinished() && reply->error() == QNetworkReply::NoError)
+    // wait until all of the replies are done or timer runs out
+    timer.start();
+    for (;;)
     {
-        resultData = reply->readAll();
+        bool allFinished = true;
+        foreach (QNetworkReply *reply, replies)
+            if (!reply->isFinished())
+                allFinished = false;
+
+        if (allFinished || !timer.isActive())
+            break;
+
+        loop.exec();
     }
-    else
+    timer.stop();
+
+    results.clear();
+    foreach (QNetworkReply *reply, replies)
     {
-        success = false;
-        // check for timeouts
-        if (reply->error() == QNetworkReply::OperationCanceledError)
-            m_LastErrorStr = "The connection to the remote server timed out";
+        if (!reply->isFinished())
+            reply->abort();
+
+        if (reply->error() == QNetworkReply::NoError)
+        {
+            results.append(reply->readAll());
+        }
         else
-            m_LastErrorStr = reply->errorString();
-    }
+        {
+            success = false;
+            results.append(QByteArray());
+            // check for timeouts
+            if (reply->error() == QNetworkReply::OperationCanceledError)
+                m_LastErrorStr = "The connection to the remote server timed out";
+            else
+                m_LastErrorStr = reply->errorString();
+        }
 
-    reply->deleteLater();
+        reply->deleteLater();
+    }
 
     return success;
 }
 
-bool ParticleAPI::get(const QUrl &relPath, QByteArray& resultData)
+QUrl ParticleAPI::makeUrl(const QUrl &relPath)
 {
-    m_LastErrorStr.clear();
-
-    QUrl url = QUrl(c_particleApiUrl).resolved(relPath);
+    QUrl url = QUrl(m_apiUrl).resolved(relPath);
     if (!m_authToken.isEmpty())
         url.setQuery(QString("access_token=%1").arg(m_authToken));
 
-    QNetworkRequest request(url);
+    return url;
+}
+
+QNetworkReply* ParticleAPI::getAsync(const QUrl &relPath)
+{
+    QNetworkRequest request(makeUrl(relPath));
     setRawHeaders(&request);
 
-    QNetworkReply *reply = m_manager->get(request);
+    return m_manager->get(request);
+}
 
-    // we are only interested in synchronous calls
-    return syncSend(reply, resultData);
+QNetworkReply* ParticleAPI::postAsync(const QUrl &relPath, const QUrlQuery &qryData, bool setAuthentication)
+{
+    QNetworkRequest request(makeUrl(relPath));
+    setRawHeaders(&request, setAuthentication);
+
+    return m_manager->post(request, qryData.toString(QUrl::FullyEncoded).toUtf8());
 }
 
-bool ParticleAPI::post(const QUrl &relPath, const QUrlQuery &qryData, QByteArray& resultData, bool setAuthentication)
+bool ParticleAPI::get(const QUrl &relPath, QByteArray& resultData)
 {
     m_LastErrorStr.clear();
 
-    QUrl url = QUrl(c_particleApiUrl).resolved(relPath);
-    if (!m_authToken.isEmpty())
-        url.setQuery(QString("access_token=%1").arg(m_authToken));
-
-    QNetworkRequest request(url);
-    setRawHeaders(&request, setAuthentication);
+    // we are only interested in synchronous calls
+    return syncSend(getAsync(relPath), resultData);
+}
 
-    QNetworkReply *reply = m_manager->post(request, qryData.toString(QUrl::FullyEncoded).toUtf8());
+bool ParticleAPI::post(const QUrl &relPath, const QUrlQuery &qryData, QByteArray& resultData, bool setAuthentication)
+{
+    m_LastErrorStr.clear();
 
     // we are only interested in synchronous calls
-    return syncSend(reply, resultData);
+    return syncSend(postAsync(relPath, qryData, setAuthentication), resultData);
 }
 
 bool ParticleAPI::put(const QUrl &relPath, const QUrlQuery &qryData, QByteArray& resultData)
 {
     m_LastErrorStr.clear();
 
-    QUrl url = QUrl(c_particleApiUrl).resolved(relPath);
-    if (!m_authToken.isEmpty())
-        url.setQuery(QString("access_token=%1").arg(m_authToken));
-
-    QNetworkRequest request(url);
+    QNetworkRequest request(makeUrl(relPath));
     setRawHeaders(&request);
 
     QNetworkReply *reply = m_manager->put(request, qryData.toString(QUrl::FullyEncoded).toUtf8());
@@ -286,90 +319,160 @@ ParticleDevice::~ParticleDevice()
 {
 }
 
-// read variable value from device
-QJsonValue ParticleDevice::getVariableValue(const QString& variable)
+QJsonValue ParticleDevice::parseVariableValue(const QByteArray& resultData)
 {
     QJsonValue result;
 
-    if (!variable.isEmpty() 
-        && (m_variables.contains(variable) || !m_dataValid))
+    m_lastResponse += "\n";
+    m_lastResponse += resultData;
+    // process data
+    QJsonParseError parseError;
+    QJsonDocument reply = QJsonDocument::fromJson(resultData, &parseError);
+    if (parseError.error == QJsonParseError::NoError
+        && reply.isObject())
     {
-        QByteArray resultData;
-        QUrl varPath = QString("%1/%2/%3/%4").arg(m_API.c_particleApiVersion)
-                                             .arg(m_API.c_particleApiDevices)
-                                             .arg(m_deviceID)
-                                             .arg(variable);
-        if (m_API.get(varPath, resultData))
-        {
-            m_lastResponse += "\n";
-            m_lastResponse += resultData;
-            // process data
-            QJsonParseError parseError;
-            QJsonDocument reply = QJsonDocument::fromJson(resultData, &parseError);
-            if (parseError.error == QJsonParseError::NoError
-                && reply.isObject())
-            {
-                QJsonObject varData = reply.object();
+        QJsonObject varData = reply.object();
 
-                result = varData["result"];
-            }
-            else
-            {
-                // error - invalid reply
-            }
-        }
-        else
-        {
-            // report an error
-        }
+        result = varData["result"];
+    }
+    else
+    {
+        // error - invalid reply
     }
 
     return result;
 }
 
-// call a function on a device
-int ParticleDevice::callFunction(const QString& function, const QString& arg)
+int ParticleDevice::parseFunctionResult(const QByteArray& resultData)
 {
     int result = -1;
 
-    if (!function.isEmpty() 
-        && (m_functions.contains(function) || !m_dataValid))
+    m_lastResponse = resultData;
+    // process data
+    QJsonParseError parseError;
+    QJsonDocument reply = QJsonDocument::fromJson(resultData, &parseError);
+    if (parseError.error == QJsonParseError::NoError
+        && reply.isObject())
     {
-        QByteArray resultData;
-        QUrlQuery  qryData;
-        QUrl funcPath = QString("%1/%2/%3/%4").arg(m_API.c_particleApiVersion)
-                                              .arg(m_API.c_particleApiDevices)
-                                              .arg(m_deviceID)
-                                              .arg(function);
-        qryData.addQueryItem("arg", arg);
-                                              
-        if (m_API.post(funcPath, qryData, resultData))
-        {
-            m_lastResponse = resultData;
-            // process data
-            QJsonParseError parseError;
-            QJsonDocument reply = QJsonDocument::fromJson(resultData, &parseError);
-            if (parseError.error == QJsonParseError::NoError
-                && reply.isObject())
-            {
-                QJsonObject fResult = reply.object();
+        QJsonObject fResult = reply.object();
 
-                result = fResult["return_value"].toInt(-1);
-            }
-            else
-            {
-                // error - invalid reply
-            }
-        }
-        else
+        result = fResult["return_value"].toInt(-1);
+    }
+    else
+    {
+        // error - invalid reply
+    }
+
+    return result;
+}
+
+// start reading variable value from device
+QNetworkReply* ParticleDevice::getVariableValueAsync(const QString& variable)
+{
+    if (variable.isEmpty()
+        || (!m_variables.contains(variable) && m_dataValid))
+        return NULL;
+
+    QUrl varPath = QString("%1/%2/%3/%4").arg(m_API.c_particleApiVersion)
+                                         .arg(m_API.c_particleApiDevices)
+                                         .arg(m_deviceID)
+                                         .arg(variable);
+    return m_API.getAsync(varPath);
+}
+
+// wait for variable value read to complete and get the value
+QJsonValue ParticleDevice::getVariableValueResult(QNetworkReply* reply)
+{
+    QJsonValue result;
+
+    QByteArray resultData;
+    if (reply && m_API.syncSend(reply, resultData))
+        result = parseVariableValue(resultData);
+
+    return result;
+}
+
+// read variable value from device
+QJsonValue ParticleDevice::getVariableValue(const QString& variable)
+{
+    m_API.m_LastErrorStr.clear();
+
+    return getVariableValueResult(getVariableValueAsync(variable));
+}
+
+// read several variables from device in parallel
+bool ParticleDevice::getVariableValues(const TStringList& variables, TVarValues& values)
+{
+    m_API.m_LastErrorStr.clear();
+
+    // issue all requests first
+    TStringList            requested;
+    QList<QNetworkReply*>  replies;
+    foreach (const QString& variable, variables)
+    {
+        QNetworkReply *reply = getVariableValueAsync(variable);
+        if (reply)
         {
-            // report an error
+            requested.append(variable);
+            replies.append(reply);
         }
     }
 
+    QList<QByteArray> results;
+    bool success = m_API.syncWaitAll(replies, results);
+
+    for (int i=0; i<requested.size(); i++)
+    {
+        if (results.at(i).isEmpty())
+            continue;
+
+        QJsonValue value = parseVariableValue(results.at(i));
+        if (value.isUndefined())
+            success = false;
+        else
+            values.insert(requested.at(i), value);
+    }
+
+    return success && requested.size() == variables.size();
+}
+
+// start function call on a device
+QNetworkReply* ParticleDevice::callFunctionAsync(const QString& function, const QString& arg)
+{
+    if (function.isEmpty()
+        || (!m_functions.contains(function) && m_dataValid))
+        return NULL;
+
+    QUrlQuery  qryData;
+    QUrl funcPath = QString("%1/%2/%3/%4").arg(m_API.c_particleApiVersion)
+                                          .arg(m_API.c_particleApiDevices)
+                                          .arg(m_deviceID)
+                                          .arg(function);
+    qryData.addQueryItem("arg", arg);
+
+    return m_API.postAsync(funcPath, qryData);
+}
+
+// wait for function call to complete and get its return value
+int ParticleDevice::callFunctionResult(QNetworkReply* reply)
+{
+    int result = -1;
+
+    QByteArray resultData;
+    if (reply && m_API.syncSend(reply, resultData))
+        result = parseFunctionResult(resultData);
+
     return result;
 }
 
+// call a function on a device
+int ParticleDevice::callFunction(const QString& function, const QString& arg)
+{
+    m_API.m_LastErrorStr.clear();
+
+    return callFunctionResult(callFunctionAsync(function, arg));
+}
+
 // refresh device data, functions and variables
 bool ParticleDevice::refresh()
 {
@@ -30,6 +30,7 @@
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <QNetworkAccessManager>
+#include <QThread>
 
 // typdefs for easier handling of sized structures
 typedef unsigned char byte;
@@ -49,8 +50,13 @@ typedef QList<ParticleDevice> TParticleDeviceList;
 //
 // This exists in only one instance and holds the single instance of
 // QNetworkAccessManager. The ParticleDevice class is declared as a friend
-// to access protected get(), post() and put(). All communications are
-// synchronous for simplicity and block for configurable timeout.
+// to access protected get(), post() and put(). These are synchronous for
+// simplicity and block for configurable timeout.
+//
+// Asynchronous getAsync() and postAsync() only issue the request and return
+// the reply which emits finished() when done. Several requests issued this
+// way run in parallel (QNetworkAccessManager keeps up to 6 keep-alive
+// connections per host) and can be collected with syncWaitAll().
 //
 // Prior to get list of devices, login must be performed to obtain access
 // token for the API.
@@ -78,6 +84,18 @@ public:
     QString& getLastError() { return m_LastErrorStr; }
     QString& getAuthToken() { return m_authToken; }
     bool isLoggedIn() {return !m_authToken.isEmpty(); }
+
+    // override API base URL (i.e. to point to local mock server)
+    void setApiUrl(const QString& apiUrl) { m_apiUrl = apiUrl; }
+    QString& getApiUrl() { return m_apiUrl; }
+
+    // timeout for a single request or a batch waited with syncWaitAll()
+    void setNetworkTimeout(int timeoutMs) { m_networkTimeoutMs = timeoutMs; }
+    int getNetworkTimeout() { return m_networkTimeoutMs; }
+
+    // all the requests have to be made from the thread the network access
+    // manager lives in - by default the one which first called instance()
+    void moveToThread(QThread* thread) { m_manager->moveToThread(thread); }
     ~ParticleAPI();
 
 protected:
@@ -86,18 +104,29 @@ protected:
     bool put(const QUrl &relPath, const QUrlQuery &qryData, QByteArray& resultData);
     bool refreshConnectedDeviceList();
 
+    // asynchronous requests - the reply has to be passed to syncSend()
+    // or syncWaitAll() to collect the result and dispose of it
+    QNetworkReply* getAsync(const QUrl &relPath);
+    QNetworkReply* postAsync(const QUrl &relPath, const QUrlQuery &qryData, bool setAuthentication = false);
+
 private:
     ParticleAPI();
 
+    QUrl makeUrl(const QUrl &relPath);
     void setRawHeaders(QNetworkRequest *request, bool setAuthentication = false);
     bool syncSend(QNetworkReply *reply, QByteArray& resultData);
+    // wait for all replies within single timeout, results are in the same
+    // order as replies (empty for failed ones), returns true if all succeeded
+    bool syncWaitAll(const QList<QNetworkReply*>& replies, QList<QByteArray>& results);
 
     // members
     QNetworkAccessManager *m_manager;
+    QString m_apiUrl;
     QString m_authToken;
     QString m_authUser;
     QString m_authPassword;
     QString m_LastErrorStr;
+    int     m_networkTimeoutMs;
 
     // constants
     static const QString c_particleApiUrl;
@@ -134,6 +163,7 @@ public:
     typedef QMap<QString, TVarType> TVarMap;
     typedef QSet<QString>           TStringSet;
     typedef QList<QString>          TStringList;
+    typedef QMap<QString, QJsonValue> TVarValues;
 
     ParticleDevice();
     ParticleDevice(const QString& deviceID);
@@ -156,15 +186,30 @@ public:
     // read variable value from device
     QJsonValue getVariableValue(const QString& variable);
 
+    // read several variables from device in parallel - values for the
+    // variables that failed to read are not populated
+    bool getVariableValues(const TStringList& variables, TVarValues& values);
+
     // call a function on a device
     int callFunction(const QString& function, const QString& arg);
 
+    // asynchronous variable read and function call - return reply (or NULL
+    // if variable/function is not available) which emits finished() when
+    // done; it has to be passed to the matching result call to get the value
+    QNetworkReply* getVariableValueAsync(const QString& variable);
+    QJsonValue getVariableValueResult(QNetworkReply* reply);
+    QNetworkReply* callFunctionAsync(const QString& function, const QString& arg);
+    int callFunctionResult(QNetworkReply* reply);
+
     // actually retrieves the data and populates the class
     virtual bool refresh();
 
     QString& getLastResponse() { return m_lastResponse; }
 
 private:
+    QJsonValue parseVariableValue(const QByteArray& resultData);
+    int parseFunctionResult(const QByteArray& resultData);
+
     // members
     ParticleAPI&  m_API;
     QString       m_deviceID;
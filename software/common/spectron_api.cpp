@@ -28,8 +28,10 @@
 #include <QJsonDocument>
 #include <QJsonParseError>
 #include <QString>
+#include <QStringList>
 #include <QThread>
 #include <QByteArray>
+#include <algorithm>
 
 // --------------------------------------
 //     Spectron Device implementation
@@ -89,7 +91,10 @@ SpectronDevice::SpectronDevice()
       m_adcRef(ADC_2_5V), m_gain(NO_GAIN), m_totalPixels(256),
       m_measType(MEASURE_RELATIVE), m_integTime(0), m_extTrgDelay(0),
       m_maxLastMeasuredValue(0.0), m_minVlackVoltage(0.0),
-      m_applySpectralCorrection(true), m_pixelOffsetIdx(0)
+      m_applySpectralCorrection(true), m_pixelOffsetIdx(0),
+      m_lastFrameSeq(0), m_lastFrameTimeMs(0), m_stateVersion(-1),
+      m_autoReadings(0), m_autoTimeMs(0), m_oversampling(0), m_measReadings(0),
+      m_wavelengthsVersion(0)
 {
     for (int i=0; i<6; i++)
         m_specCalibration[i] = 0.0;
@@ -116,8 +121,19 @@ SpectronDevice& SpectronDevice::operator=(ParticleDevice& device)
     m_minVlackVoltage = 0.0;
     m_applySpectralCorrection = true;
     m_pixelOffsetIdx = 0;
+    m_lastFrameSeq = 0;
+    m_lastFrameTimeMs = 0;
+    m_stateVersion = -1;
+    m_autoReadings = 0;
+    m_autoTimeMs = 0;
+    m_oversampling = 0;
+    m_measReadings = 0;
+    m_lastNoise.clear();
+    m_frameClient.close();
     for (int i=0; i<6; i++)
         m_specCalibration[i] = 0.0;
+    m_wavelengths.clear();
+    ++m_wavelengthsVersion;
     m_satVoltage[0] = m_satVoltage[1] = 5.0;
 
     return *this;
@@ -131,31 +147,49 @@ bool SpectronDevice::refresh()
     if (!isConnected())
         return false;
 
-    m_adcRef = (TAdcRef)getVariableValue("spADCRef").toInt();
-    m_minVlackVoltage = getVariableValue("spMinBlackVoltage").toDouble();
+    // use state snapshot if the board supports it
+    if (hasVariable("spState") && refreshState(true))
+        return true;
+
+    // read all state variables in one parallel batch
+    TStringList vars;
+    vars << "spADCRef" << "spMinBlackVoltage" << "spNumPixels" << "spPixelOffsetIdx"
+         << "spIntegrationTime" << "spTrigMeasureDelay" << "spMeasurementType";
+    if (hasVariable("spGain"))
+        vars << "spGain" << "spNoGainSatVoltage" << "spHighGainSatVoltage";
+    else
+        vars << "spSaturationVoltage";
+    if (m_specCalibration[0] == 0.0)
+        vars << "spWavelenCalibration";
+
+    TVarValues values;
+    getVariableValues(vars, values);
+
+    m_adcRef = (TAdcRef)values.value("spADCRef").toInt();
+    m_minVlackVoltage = values.value("spMinBlackVoltage").toDouble();
     if (hasVariable("spGain"))
     {
-        m_gain = (TGain)getVariableValue("spGain").toInt();
-        m_satVoltage[NO_GAIN] = getVariableValue("spNoGainSatVoltage").toDouble();
-        m_satVoltage[HIGH_GAIN] = getVariableValue("spHighGainSatVoltage").toDouble();
+        m_gain = (TGain)values.value("spGain").toInt();
+        m_satVoltage[NO_GAIN] = values.value("spNoGainSatVoltage").toDouble();
+        m_satVoltage[HIGH_GAIN] = values.value("spHighGainSatVoltage").toDouble();
         m_supportsGain = true;
     }
     else
     {
         m_gain = NO_GAIN;
-        m_satVoltage[NO_GAIN] = getVariableValue("spSaturationVoltage").toDouble();
+        m_satVoltage[NO_GAIN] = values.value("spSaturationVoltage").toDouble();
         m_supportsGain = false;
     }
-    m_totalPixels = getVariableValue("spNumPixels").toInt();
-    m_pixelOffsetIdx = getVariableValue("spPixelOffsetIdx").toInt();
-    m_integTime = getVariableValue("spIntegrationTime").toInt();
-    m_extTrgDelay = getVariableValue("spTrigMeasureDelay").toInt();
-    m_measType = (TMeasType)getVariableValue("spMeasurementType").toInt();
+    m_totalPixels = values.value("spNumPixels").toInt();
+    m_pixelOffsetIdx = values.value("spPixelOffsetIdx").toInt();
+    m_integTime = values.value("spIntegrationTime").toInt();
+    m_extTrgDelay = values.value("spTrigMeasureDelay").toInt();
+    m_measType = (TMeasType)values.value("spMeasurementType").toInt();
 
     // translate calibration array if have not read it yet
     if (m_specCalibration[0] == 0.0)
     {
-        QString calArr = QString("[%1]").arg(getVariableValue("spWavelenCalibration").toString());
+        QString calArr = QString("[%1]").arg(values.value("spWavelenCalibration").toString());
         QJsonParseError parseError;
         QJsonDocument jsonDoc = QJsonDocument::fromJson(calArr.toUtf8(), &parseError);
         if (parseError.error == QJsonParseError::NoError
@@ -167,9 +201,54 @@ bool SpectronDevice::refresh()
                     m_specCalibration[i] = cal.at(i).toDouble();
         }
     }
+    updateWavelengths();
 	return true;
 }
 
+bool SpectronDevice::refreshState(bool force)
+{
+    QString stateStr = getVariableValue("spState").toString();
+
+    QJsonParseError parseError;
+    QJsonDocument jsonDoc = QJsonDocument::fromJson(stateStr.toUtf8(), &parseError);
+    if (parseError.error != QJsonParseError::NoError
+        || !jsonDoc.isObject())
+        return false;
+
+    QJsonObject state = jsonDoc.object();
+    if (!state.contains("v"))
+        return false;
+
+    // skip unchanged state
+    qint64 version = (qint64)state["v"].toDouble();
+    if (!force && version == m_stateVersion)
+        return true;
+
+    m_adcRef = (TAdcRef)state["adc"].toInt();
+    m_minVlackVoltage = state["mbv"].toDouble();
+    m_supportsGain = state.contains("gain");
+    m_gain = m_supportsGain ? (TGain)state["gain"].toInt() : NO_GAIN;
+    QJsonArray sat = state["sat"].toArray();
+    for (int i=0; i<sat.size() && i<2; i++)
+        m_satVoltage[i] = sat.at(i).toDouble();
+    m_totalPixels = state["px"].toInt();
+    m_pixelOffsetIdx = state["off"].toInt();
+    m_integTime = state["it"].toInt();
+    m_extTrgDelay = state["trg"].toInt();
+    m_measType = (TMeasType)state["mt"].toInt();
+    m_oversampling = state["os"].toInt();
+
+    QJsonArray cal = state["cal"].toArray();
+    if (cal.size() == 6)
+        for (int i=0; i<6; i++)
+            m_specCalibration[i] = cal.at(i).toDouble();
+
+    m_stateVersion = version;
+    updateWavelengths();
+
+    return true;
+}
+
 bool SpectronDevice::setTriggerMeasurementDelay(int delayUs)
 {
     if (delayUs < 0)
@@ -209,16 +288,20 @@ bool SpectronDevice::setMeasureType(TMeasType measType)
     return callFunction("spSetMeasurementType", param) != -1;
 }
 
-bool SpectronDevice::setIntegrationTime(int integrationTimeUs)
+bool SpectronDevice::setIntegrationTime(int integrationTimeUs, int oversampling)
 {
     if (integrationTimeUs <= 0)
         return true;
 
     QString param;
     param.setNum(integrationTimeUs);
+    if (oversampling > 0)
+        param.append(",").append(QString().setNum(oversampling));
     if (callFunction("spSetIntegrationTime", param) == -1)
         return false;
     m_integTime = getVariableValue("spIntegrationTime").toInt();
+    if (oversampling > 0)
+        m_oversampling = oversampling;
 
     return true;
 }
@@ -249,14 +332,19 @@ bool SpectronDevice::calibrateSpectralResponse(double lampTempK, bool useLastMea
         param.append(",MEASURE");
     if (callFunction("spCalibrateSpectralResp", param) != -1)
     {
-        getData();
-        success = true;
+        if (hasLocalTransport())
+            success = getSpectrometerData(ET_NORMALISATION);
+        else
+        {
+            getData();
+            success = true;
+        }
     }
 
     return success;
 }
 
-bool SpectronDevice::measure(int measTimeUs, bool doExtTrigger)
+bool SpectronDevice::measure(int measTimeUs, bool doExtTrigger, bool readData)
 {
     bool success = false;
 
@@ -266,15 +354,22 @@ bool SpectronDevice::measure(int measTimeUs, bool doExtTrigger)
     if (doExtTrigger)
         param.append(",TRG");
     if (callFunction("spMeasure", param) != -1)
+        success = readData ? readMeasurement() : true;
+
+    return success;
+}
+
+// spMeasure stages normalised results in the cloud variables so they
+// can be read directly
+bool SpectronDevice::readMeasurement()
+{
+    if (m_applySpectralCorrection && !hasLocalTransport())
     {
-        success = true;
-        if (m_applySpectralCorrection)
-            getData();
-        else
-            success = getSpectrometerData(ET_MEASUREMENT);
+        getData();
+        return true;
     }
 
-    return success;
+    return getSpectrometerData(ET_MEASUREMENT);
 }
 
 bool SpectronDevice::measureBlack(int measTimeUs, bool refreshLastMeasurement)
@@ -324,17 +419,28 @@ bool SpectronDevice::measureAuto(TAutoType autoType)
 
     if (callFunction("spMeasure", param) != -1)
     {
-        success = true;
-        if (m_applySpectralCorrection)
-            getData();
-        else
-            success = getSpectrometerData(ET_MEASUREMENT);
+        success = readMeasurement();
 
         // refresh variables
-        m_adcRef = (TAdcRef)getVariableValue("spADCRef").toInt();
+        TStringList vars;
+        vars << "spADCRef" << "spIntegrationTime";
         if (m_supportsGain)
-            m_gain = (TGain)getVariableValue("spGain").toInt();
-        m_integTime = getVariableValue("spIntegrationTime").toInt();
+            vars << "spGain";
+        if (hasVariable("spAutoStats"))
+            vars << "spAutoStats";
+
+        TVarValues values;
+        getVariableValues(vars, values);
+
+        m_adcRef = (TAdcRef)values.value("spADCRef").toInt();
+        if (m_supportsGain)
+            m_gain = (TGain)values.value("spGain").toInt();
+        m_integTime = values.value("spIntegrationTime").toInt();
+
+        // auto measurement statistics - "<readings>,<timeMs>,<predicted>"
+        QStringList autoStats = values.value("spAutoStats").toString().split(',');
+        m_autoReadings = autoStats.size() == 3 ? autoStats.at(0).toInt() : 0;
+        m_autoTimeMs = autoStats.size() == 3 ? autoStats.at(1).toInt() : 0;
     }
 
     return success;
@@ -358,7 +464,9 @@ bool SpectronDevice::setSpectralRange(TRangeType rangeType, int minWavelength, i
     // retrieve new range parameters and clear measurement
     m_totalPixels = getVariableValue("spNumPixels").toInt();
     m_pixelOffsetIdx = getVariableValue("spPixelOffsetIdx").toInt();
+    updateWavelengths();
     m_lastMeasurement.clear();
+    m_lastNoise.clear();
 
     return true;
 }
@@ -372,41 +480,201 @@ bool SpectronDevice::resetToDefaults()
     {
         success = refresh();
         m_lastMeasurement.clear();
+        m_lastNoise.clear();
     }
 
     return success;
 }
 
-// get the pixel data from spectrometer  - measurement, black levels or normalisation
+// get the pixel data from spectrometer  - measurement, black levels,
+// normalisation or noise (the latter is kept separately from the others)
 bool SpectronDevice::getSpectrometerData(TDataType dataType)
 {
     bool success = false;
+    QString param = dataRequest(dataType);
+
+    // local transport does not need the data staged in cloud variables
+    if (hasLocalTransport())
+        return getFrame(param, dataType);
 
-    QString param;
-    if (dataType == ET_BLACK_LEVELS)
-        param = "BLACK_LEVELS";
-    else if (dataType == ET_NORMALISATION)
-        param = "NORMALISATION";
-    else if (m_applySpectralCorrection)
-        param = "MEAS_NORMALISED";
-    else
-        param = "MEASUREMENT";
     if (callFunction("spGetData", param) != -1)
     {
-        getData();
+        getData(dataType);
         success = true;
     }
 
     return success;
 }
 
+// get the pixel data from spectrometer into supplied vector - last
+// measurement and its noise are kept
+bool SpectronDevice::getSpectrometerData(TDataType dataType, TDoubleVec& data)
+{
+    QString param = dataRequest(dataType);
+
+    if (hasLocalTransport())
+    {
+        TFrameHeader header;
+        double maxValue = 0.0;
+        return m_frameClient.request(param, header, data, maxValue);
+    }
+
+    if (callFunction("spGetData", param) == -1)
+        return false;
+
+    readDataVars(data);
+    return true;
+}
+
+// data request parameter for the data type
+QString SpectronDevice::dataRequest(TDataType dataType)
+{
+    if (dataType == ET_BLACK_LEVELS)
+        return "BLACK_LEVELS";
+    else if (dataType == ET_NORMALISATION)
+        return "NORMALISATION";
+    else if (dataType == ET_NOISE)
+        return m_applySpectralCorrection ? "NOISE_NORMALISED" : "NOISE";
+    else if (m_applySpectralCorrection)
+        return "MEAS_NORMALISED";
+
+    return "MEASUREMENT";
+}
+
+// reads the data staged by spGetData, returns maximum value
+double SpectronDevice::readDataVars(TDoubleVec& data)
+{
+    // data is split over 3 variables - read them in parallel
+    TStringList vars;
+    vars << "spData1" << "spData2" << "spData3";
+    TVarValues values;
+    getVariableValues(vars, values);
+
+    QByteArray buf = values.value("spData1").toString().toUtf8();
+    buf.append(values.value("spData2").toString().toUtf8());
+    buf.append(values.value("spData3").toString().toUtf8());
+
+    return translateFloatArray(buf, data, m_totalPixels);
+}
+
 // gets the measurement data
-void SpectronDevice::getData()
+void SpectronDevice::getData(TDataType dataType)
+{
+    if (dataType == ET_NOISE)
+        readDataVars(m_lastNoise);
+    else
+    {
+        // noise of the previous measurement is no longer valid
+        m_lastNoise.clear();
+        m_maxLastMeasuredValue = readDataVars(m_lastMeasurement);
+    }
+}
+
+// gets the data over local frame transport
+bool SpectronDevice::getFrame(const QString& request, TDataType dataType)
+{
+    TFrameHeader header;
+    TDoubleVec values;
+    double maxValue = 0.0;
+
+    if (!m_frameClient.request(request, header, values, maxValue))
+        return false;
+
+    m_measReadings = header.readings;
+    if (dataType == ET_NOISE)
+    {
+        m_lastNoise = values;
+        return true;
+    }
+
+    m_lastNoise.clear();
+    m_lastMeasurement = values;
+    m_maxLastMeasuredValue = maxValue;
+    m_lastFrameSeq = header.seq;
+    m_lastFrameTimeMs = header.timeMs;
+
+    return true;
+}
+
+// read acquisition timing statistics, these are only available
+// if the board firmware is built with SPEC_STATS
+bool SpectronDevice::getStats(TAcqStats& stats)
+{
+    if (!hasVariable("spStats"))
+        return false;
+
+    QStringList values = getVariableValue("spStats").toString().split(',');
+    if (values.size() != 19)
+        return false;
+
+    TAcqStats::TIsrStats* isrs[] = { &stats.clkIsr, &stats.trgIsr };
+    int idx = 0;
+    for (int i=0; i<2; i++)
+    {
+        isrs[i]->count  = values.at(idx++).toUInt();
+        isrs[i]->minUs  = values.at(idx++).toDouble();
+        isrs[i]->meanUs = values.at(idx++).toDouble();
+        isrs[i]->maxUs  = values.at(idx++).toDouble();
+    }
+
+    stats.missedPixels = values.at(idx++).toUInt();
+    stats.frameUs = values.at(idx++).toUInt();
+    stats.readUs = values.at(idx++).toUInt();
+    stats.measureUs = values.at(idx++).toUInt();
+    stats.getDataUs = values.at(idx++).toUInt();
+    for (int i=0; i<6; i++)
+        stats.stateUs[i] = values.at(idx++).toUInt();
+
+    return true;
+}
+
+// open local frame transport to the board
+bool SpectronDevice::openLocalTransport(const QString& host, quint16 port)
+{
+    QString frameHost = host;
+    if (frameHost.isEmpty())
+    {
+        if (!hasVariable("spLocalIP"))
+            return false;
+        frameHost = getVariableValue("spLocalIP").toString();
+    }
+
+    if (frameHost.isEmpty())
+        return false;
+
+    return m_frameClient.open(frameHost, port);
+}
+
+// start continuous measurements with given frame time
+bool SpectronDevice::startContinuous(int frameTimeUs, bool triggered)
 {
-    QByteArray lastMeas = getVariableValue("spData1").toString().toUtf8();
-    lastMeas.append(getVariableValue("spData2").toString().toUtf8());
-    lastMeas.append(getVariableValue("spData3").toString().toUtf8());
-    m_maxLastMeasuredValue = translateFloatArray(lastMeas, m_lastMeasurement, m_totalPixels);
+    if (!hasFunction("spContinuous") || !hasLocalTransport())
+        return false;
+
+    QString param;
+    param.setNum(frameTimeUs > 0 ? frameTimeUs : 0);
+    if (triggered)
+        param += ",TRG";
+    return callFunction("spContinuous", param) != -1;
+}
+
+// stop continuous measurements
+bool SpectronDevice::stopContinuous()
+{
+    if (!hasFunction("spContinuous"))
+        return false;
+
+    return callFunction("spContinuous", "STOP") != -1;
+}
+
+// read the next continuous measurements frame - returns false if
+// there is no new frame available yet
+bool SpectronDevice::readFrame()
+{
+    if (!hasLocalTransport())
+        return false;
+
+    return getFrame("FRAME");
 }
 
 // get bandpass corrected (or not) measurement result
@@ -419,6 +687,17 @@ double SpectronDevice::getLastMeasurement(int pixelNum)
     return m_lastMeasurement.at(pixelNum);
 }
 
+// get standard error of the measurement result - requires noise data
+// to be retrieved with getSpectrometerData(ET_NOISE) after measurement
+double SpectronDevice::getLastNoise(int pixelNum)
+{
+    if (pixelNum >= m_lastNoise.size()
+        || m_lastNoise.size() == 0)
+        return 0.0;
+
+    return m_lastNoise.at(pixelNum);
+}
+
 double SpectronDevice::getMinWavelength()
 {
     return m_totalPixels && m_specCalibration[0]!=0.0
@@ -433,16 +712,56 @@ double SpectronDevice::getMaxWavelength()
                 : 850;
 }
 
+// calculate the wavelength for specified sensor pixel
+// from calibration polynomial (in Horner form)
+static inline double calcWavelength(const double* cal, int sensorPixelIdx)
+{
+    // pixel number in formula start with 1
+    double p = sensorPixelIdx + 1;
+    return cal[0] + p*(cal[1] + p*(cal[2] + p*(cal[3] + p*(cal[4] + p*cal[5]))));
+}
+
+// rebuild wavelength table for the current range - called when
+// calibration or range changes
+void SpectronDevice::updateWavelengths()
+{
+    TDoubleVec wavelengths(m_totalPixels > 0 ? m_totalPixels : 0);
+    for (int i=0; i<wavelengths.size(); i++)
+        wavelengths[i] = calcWavelength(m_specCalibration, i + m_pixelOffsetIdx);
+
+    // version changes only with calibration or range so that tables
+    // derived from wavelengths are rebuilt only when needed
+    if (wavelengths != m_wavelengths)
+    {
+        m_wavelengths = wavelengths;
+        ++m_wavelengthsVersion;
+    }
+}
+
 // get the wavelength for specified pixel
 double SpectronDevice::getWavelength(int pixelNum)
 {
-    // pixelNumber in formula start with 1
-    double p = pixelNum + m_pixelOffsetIdx + 1;
-    return m_specCalibration[0]
-           + (p*m_specCalibration[1])
-           + (p*p*m_specCalibration[2])
-           + (p*p*p*m_specCalibration[3])
-           + (p*p*p*p*m_specCalibration[4])
-           + (p*p*p*p*p*m_specCalibration[5]);
+    if (pixelNum >= 0 && pixelNum < m_wavelengths.size())
+        return m_wavelengths.at(pixelNum);
+
+    return calcWavelength(m_specCalibration, pixelNum + m_pixelOffsetIdx);
+}
+
+// get the fractional pixel index for specified wavelength, the index
+// is extrapolated if wavelength is outside of the range
+double SpectronDevice::getPixelIndex(double wavelength)
+{
+    if (m_wavelengths.size() < 2)
+        return 0.0;
+
+    // find the segment containing the wavelength
+    TDoubleVec::const_iterator it = std::upper_bound(m_wavelengths.constBegin()+1,
+                                                     m_wavelengths.constEnd()-1,
+                                                     wavelength);
+    int hi = it - m_wavelengths.constBegin();
+    int lo = hi - 1;
+
+    double step = m_wavelengths.at(hi) - m_wavelengths.at(lo);
+    return step > 0 ? lo + (wavelength - m_wavelengths.at(lo))/step : lo;
 }
 
@@ -25,8 +25,28 @@
 
 #include <QVector>
 #include "particle_api.h"
+#include "spectron_frame.h"
 
-typedef QVector<double> TDoubleVec;
+// Acquisition timing statistics reported by the board firmware built
+// with SPEC_STATS, all times are in microseconds
+struct TAcqStats
+{
+    struct TIsrStats {
+        quint32 count;        // number of interrupts handled
+        double  minUs;        // shortest interrupt handling
+        double  meanUs;       // average interrupt handling
+        double  maxUs;        // longest interrupt handling
+    };
+
+    TIsrStats clkIsr;         // sensor clock timer interrupt
+    TIsrStats trgIsr;         // TRG pin (ADC readout) interrupt
+    quint32 missedPixels;     // pixels in range with no ADC readings in the last frame
+    quint32 frameUs;          // last reading cycle or continuous frame duration
+    quint32 readUs;           // last measurement duration
+    quint32 measureUs;        // last spMeasure function handling
+    quint32 getDataUs;        // last spGetData function handling
+    quint32 stateUs[6];       // interrupt time spent in each sensor clock state
+};
 
 //
 // Class that provides access to Spectron board over Particle cloud.
@@ -34,6 +54,10 @@ typedef QVector<double> TDoubleVec;
 // This uses ParticleAPI classes and expects them to be connected
 // and logged in.
 //
+// Pixel data can optionally be transferred over local binary frame
+// transport (TCP connection to the board on the same network) instead
+// of the cloud variables. Control calls still go through the cloud.
+//
 class SpectronDevice: public ParticleDevice
 {
 public:
@@ -69,7 +93,8 @@ public:
     enum TDataType {
         ET_MEASUREMENT   = 0,    // results of the last measurement
         ET_BLACK_LEVELS  = 1,    // black level voltages
-        ET_NORMALISATION = 2     // normalisation coefficients
+        ET_NORMALISATION = 2,    // normalisation coefficients
+        ET_NOISE         = 3     // standard error of the last measurement results
     };
 
     enum TRangeType {
@@ -87,62 +112,112 @@ public:
 
     // refreshes he class from remote location
     bool refresh();
+    // refreshes state from the board state snapshot in single request,
+    // parsing is skipped if state version has not changed unless forced
+    bool refreshState(bool force = false);
 
     // various actions on a sensor board
     bool setTriggerMeasurementDelay(int delayUs);
     bool setGain(TGain gain);
     bool setADCReference(TAdcRef adcRef);
     bool setMeasureType(TMeasType measType);
-    bool setIntegrationTime(int integrationTimeUs);
+    bool setIntegrationTime(int integrationTimeUs, int oversampling = 0);
     bool setMinBlack(double blackLevelVoltage = -1.0);
     bool calibrateSpectralResponse(double lampTempK, bool useLastMeasurement = true);
-    bool measure(int integrationTime=0, bool doExtTrigger = false);
+    bool measure(int integrationTime=0, bool doExtTrigger = false, bool readData = true);
     bool measureBlack(int integrationTime = 0, bool refreshLastMeasurement = false);
     bool measureSaturation();
     bool measureAuto(TAutoType autoType);
     bool getSpectrometerData(TDataType dataType);
+    // reads the data into supplied vector, last measurement is kept
+    bool getSpectrometerData(TDataType dataType, TDoubleVec& data);
+    // reads results of the last measurement when measure() is called
+    // without reading data
+    bool readMeasurement();
     bool setSpectralRange(TRangeType rangeType, int minWavelength=-1, int maxWavelength=-1);
     bool resetToDefaults();
+    bool getStats(TAcqStats& stats);
     void setSpectralRespCorrection(bool enable) {  m_applySpectralCorrection = enable; }
 
+    // local frame transport - if host is not specified the board
+    // reported local IP address is used
+    bool openLocalTransport(const QString& host = QString(), quint16 port = c_frameServerPort);
+    void closeLocalTransport()   { m_frameClient.close(); }
+    bool hasLocalTransport()     { return m_frameClient.isOpen(); }
+
+    // continuous measurements - frames are read over local frame transport,
+    // in triggered mode each frame is started by the board trigger input
+    bool startContinuous(int frameTimeUs = 0, bool triggered = false);
+    bool stopContinuous();
+    bool readFrame();
+
     // getters
     double getMinWavelength();
     double getMaxWavelength();
     double getWavelength(int pixelNum);
+    double getPixelIndex(double wavelength);
     double getLastMeasurement(int pixelNum);
+    double getLastNoise(int pixelNum);
+    const TDoubleVec& getWavelengths()      { return m_wavelengths; }
+    const TDoubleVec& getLastMeasurements() { return m_lastMeasurement; }
 
     int          totalPixels()              { return m_totalPixels; }
+    int          getPixelOffset()           { return m_pixelOffsetIdx; }
+    const double* getSpecCalibration()      { return m_specCalibration; }
     bool         supportsGain()             { return m_supportsGain; }
     TGain        getGain()                  { return m_gain; }
     TAdcRef      getADCReference()          { return m_adcRef; }
     TMeasType    getMeasureType()           { return m_measType; }
     int          getIntegTime()             { return m_integTime; }
+    int          getOversampling()          { return m_oversampling; }
+    int          getMeasurementReadings()   { return m_measReadings; }
     int          getExtTrgDelay()           { return m_extTrgDelay; }
     double       getSatVoltage()            { return m_satVoltage[m_gain]; }
     double       getSatVoltage(TGain gain)  { return m_satVoltage[gain]; }
     double       getMinBlackVoltage()       { return m_minVlackVoltage; }
     double       getMaxLastMeasuredValue()  { return m_maxLastMeasuredValue; }
     bool         applySpectralCorrections() { return m_applySpectralCorrection; }
+    quint32      getLastFrameSeq()          { return m_lastFrameSeq; }
+    quint32      getLastFrameTimeMs()       { return m_lastFrameTimeMs; }
+    qint64       getStateVersion()          { return m_stateVersion; }
+    int          getWavelengthsVersion()    { return m_wavelengthsVersion; }
+    int          getAutoReadings()          { return m_autoReadings; }
+    int          getAutoTimeMs()            { return m_autoTimeMs; }
 
 private:
     // private functions
-    void getData();
+    void getData(TDataType dataType = ET_MEASUREMENT);
+    double readDataVars(TDoubleVec& data);
+    QString dataRequest(TDataType dataType);
+    void updateWavelengths();
+    bool getFrame(const QString& request, TDataType dataType = ET_MEASUREMENT);
 
     // members
     double          m_specCalibration[6];
+    TDoubleVec      m_wavelengths;
+    int             m_wavelengthsVersion;
     double          m_satVoltage[2];
     double          m_minVlackVoltage;
     TAdcRef         m_adcRef;
     TGain           m_gain;
     TMeasType       m_measType;
     int             m_integTime;
+    int             m_oversampling;
     int             m_extTrgDelay;
     TDoubleVec      m_lastMeasurement;
+    TDoubleVec      m_lastNoise;
+    int             m_measReadings;
     double          m_maxLastMeasuredValue;
     bool            m_supportsGain;
     int             m_totalPixels;
     int             m_pixelOffsetIdx;
     bool            m_applySpectralCorrection;
+    SpectronFrameClient m_frameClient;
+    quint32         m_lastFrameSeq;
+    quint32         m_lastFrameTimeMs;
+    qint64          m_stateVersion;
+    int             m_autoReadings;
+    int             m_autoTimeMs;
 };
 
 #endif // SPECTRON_API_H
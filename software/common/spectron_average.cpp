@@ -0,0 +1,170 @@
+/*
+ *  spectron_average.cpp - Frame averaging and rolling statistics of spectral
+ *                         measurements from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_average.h"
+
+#include <math.h>
+
+FrameAverager::FrameAverager(int frames)
+    : m_frames(frames > 0 ? frames : 1), m_pixels(0), m_count(0), m_next(0)
+{
+}
+
+void FrameAverager::setFrames(int frames)
+{
+    m_frames = frames > 0 ? frames : 1;
+    m_pixels = 0;
+    reset();
+}
+
+void FrameAverager::reset()
+{
+    m_count = 0;
+    m_next = 0;
+    m_mean.fill(0.0, m_pixels);
+    m_m2.fill(0.0, m_pixels);
+}
+
+void FrameAverager::addFrame(const TDoubleVec& values)
+{
+    int pixels = values.size();
+    if (pixels != m_pixels)
+    {
+        m_pixels = pixels;
+        m_ring.fill(0.0, m_frames*pixels);
+        reset();
+    }
+
+    const double* in = values.constData();
+    double* row = m_ring.data() + m_next*pixels;
+    double* mean = m_mean.data();
+    double* m2 = m_m2.data();
+
+    if (m_count < m_frames)
+    {
+        // window is filling up - plain Welford update
+        ++m_count;
+        for (int i=0; i<pixels; i++)
+        {
+            double delta = in[i] - mean[i];
+            mean[i] += delta/m_count;
+            m2[i] += delta*(in[i] - mean[i]);
+            row[i] = in[i];
+        }
+    }
+    else
+    {
+        // oldest value in the row is replaced
+        for (int i=0; i<pixels; i++)
+        {
+            double delta = in[i] - row[i];
+            double newMean = mean[i] + delta/m_frames;
+            m2[i] += delta*(in[i] - newMean + row[i] - mean[i]);
+            if (m2[i] < 0)
+                m2[i] = 0;
+            mean[i] = newMean;
+            row[i] = in[i];
+        }
+    }
+
+    if (++m_next == m_frames)
+    {
+        m_next = 0;
+        if (m_count == m_frames && m_frames > 1)
+            recalculate();
+    }
+}
+
+// exact mean and sums of squares from the frames in the ring
+void FrameAverager::recalculate()
+{
+    double* mean = m_mean.data();
+    double* m2 = m_m2.data();
+    const double* ring = m_ring.constData();
+
+    for (int i=0; i<m_pixels; i++)
+    {
+        double sum = 0;
+        for (int f=0; f<m_count; f++)
+            sum += ring[f*m_pixels + i];
+        mean[i] = sum/m_count;
+
+        double sumSq = 0;
+        for (int f=0; f<m_count; f++)
+        {
+            double d = ring[f*m_pixels + i] - mean[i];
+            sumSq += d*d;
+        }
+        m2[i] = sumSq;
+    }
+}
+
+void FrameAverager::getVariance(TDoubleVec& variance) const
+{
+    variance.resize(m_pixels);
+    double* out = variance.data();
+    const double* m2 = m_m2.constData();
+    for (int i=0; i<m_pixels; i++)
+        out[i] = m_count > 1 ? m2[i]/(m_count-1) : 0.0;
+}
+
+void FrameAverager::getMinMax(TDoubleVec& minValues, TDoubleVec& maxValues) const
+{
+    minValues.resize(m_pixels);
+    maxValues.resize(m_pixels);
+    if (!m_count)
+    {
+        minValues.fill(0.0);
+        maxValues.fill(0.0);
+        return;
+    }
+
+    double* minOut = minValues.data();
+    double* maxOut = maxValues.data();
+    const double* ring = m_ring.constData();
+    for (int i=0; i<m_pixels; i++)
+        minOut[i] = maxOut[i] = ring[i];
+    for (int f=1; f<m_count; f++)
+    {
+        const double* row = ring + f*m_pixels;
+        for (int i=0; i<m_pixels; i++)
+        {
+            if (row[i] < minOut[i])
+                minOut[i] = row[i];
+            else if (row[i] > maxOut[i])
+                maxOut[i] = row[i];
+        }
+    }
+}
+
+void FrameAverager::getSNR(TDoubleVec& snr) const
+{
+    snr.resize(m_pixels);
+    double* out = snr.data();
+    const double* mean = m_mean.constData();
+    const double* m2 = m_m2.constData();
+    for (int i=0; i<m_pixels; i++)
+    {
+        double stdDev = m_count > 1 ? sqrt(m2[i]/(m_count-1)) : 0.0;
+        out[i] = stdDev > 0 ? mean[i]/stdDev : 0.0;
+    }
+}
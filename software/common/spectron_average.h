@@ -0,0 +1,81 @@
+/*
+ *  spectron_average.h - Frame averaging and rolling statistics of spectral
+ *                       measurements from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_AVERAGE_H
+#define SPECTRON_AVERAGE_H
+
+#include "spectron_frame.h"
+
+//
+// Rolling statistics of the last N frames for each pixel - the board can
+// run short exposures continuously while the host averages them.
+//
+// Frames are kept in a ring buffer allocated once for the window size and
+// number of pixels. Mean and variance are updated with each frame (sliding
+// window form of Welford's algorithm) and are recalculated from the ring
+// once per window cycle, so rounding errors do not accumulate. Min/max and
+// SNR are calculated on request into caller provided vectors.
+//
+class FrameAverager
+{
+public:
+    FrameAverager(int frames = 1);
+
+    // window size in frames, statistics are restarted
+    void setFrames(int frames);
+    int  getFrames() const                  { return m_frames; }
+
+    // restart statistics, i.e. when measurement settings change
+    void reset();
+
+    // add frame to the window replacing the oldest one when the window is
+    // full, statistics are restarted if number of pixels has changed
+    void addFrame(const TDoubleVec& values);
+
+    int count() const                       { return m_count; }
+    int pixels() const                      { return m_pixels; }
+
+    // mean of the frames in the window
+    const TDoubleVec& getMean() const       { return m_mean; }
+
+    // sample variance, zeros with less than 2 frames
+    void getVariance(TDoubleVec& variance) const;
+
+    void getMinMax(TDoubleVec& minValues, TDoubleVec& maxValues) const;
+
+    // mean divided by standard deviation, 0 where there is no variation
+    void getSNR(TDoubleVec& snr) const;
+
+private:
+    void recalculate();
+
+    // members
+    int         m_frames;
+    int         m_pixels;
+    int         m_count;    // frames in the window
+    int         m_next;     // ring row for the next frame
+    TDoubleVec  m_ring;     // m_frames rows of m_pixels values
+    TDoubleVec  m_mean;
+    TDoubleVec  m_m2;       // sums of squared differences from the mean
+};
+
+#endif // SPECTRON_AVERAGE_H
@@ -142,28 +142,109 @@ double zFunc_1931(double wavelength)
 }
 
 // -----------------------------------------------------------
-//  Processing Spectron spectra and calculating CCT, x and y
+//  CIE 1931 weighting matrix
 // -----------------------------------------------------------
-void calculateColourParam(SpectronDevice& spectron, double &CCT, double &x, double &y)
+CieWeights::CieWeights()
+    : m_device(NULL), m_version(0)
 {
-    if (!spectron.isConnected())
+}
+
+void CieWeights::update(SpectronDevice& spectron)
+{
+    if (m_device == &spectron && m_version == spectron.getWavelengthsVersion())
         return;
 
-    double xyz[3] = { 0, 0, 0 };
-    for (int i=0; i<spectron.totalPixels(); i++)
+    m_device = &spectron;
+    m_version = spectron.getWavelengthsVersion();
+
+    const TDoubleVec& wavelengths = spectron.getWavelengths();
+    int pixels = wavelengths.size();
+    for (int c=0; c<3; c++)
+        m_weights[c].fill(0.0, pixels);
+    if (pixels < 2)
+        return;
+
+    for (int i=0; i<pixels; i++)
     {
-        double dLamda=0;
+        // half of the distance between neighbouring pixels on each side
+        double dLamda = 0;
         if (i==0)
-            dLamda = (spectron.getWavelength(i+1)-spectron.getWavelength(i))/2;
-        else if (i==spectron.totalPixels()-1)
-            dLamda = (spectron.getWavelength(i)-spectron.getWavelength(i-1))/2;
+            dLamda = (wavelengths.at(i+1)-wavelengths.at(i))/2;
+        else if (i==pixels-1)
+            dLamda = (wavelengths.at(i)-wavelengths.at(i-1))/2;
         else
-            dLamda = (spectron.getWavelength(i+1)-spectron.getWavelength(i-1))/2;
-        double curWavelength = spectron.getWavelength(i);
-        xyz[0] += spectron.getLastMeasurement(i)*xFunc_1931(curWavelength)*dLamda;
-        xyz[1] += spectron.getLastMeasurement(i)*yFunc_1931(curWavelength)*dLamda;
-        xyz[2] += spectron.getLastMeasurement(i)*zFunc_1931(curWavelength)*dLamda;
+            dLamda = (wavelengths.at(i+1)-wavelengths.at(i-1))/2;
+
+        double curWavelength = wavelengths.at(i);
+        m_weights[0][i] = xFunc_1931(curWavelength)*dLamda;
+        m_weights[1][i] = yFunc_1931(curWavelength)*dLamda;
+        m_weights[2][i] = zFunc_1931(curWavelength)*dLamda;
     }
+}
+
+// Each sum is split into even and odd pixel sums - independent pairs of
+// multiply-adds that compilers map to two lane SIMD operations without
+// relaxed floating point rules
+void CieWeights::calculateXYZ(const TDoubleVec& spectrum, double* xyz) const
+{
+    int pixels = qMin(spectrum.size(), size());
+    const double* s = spectrum.constData();
+    const double* wx = m_weights[0].constData();
+    const double* wy = m_weights[1].constData();
+    const double* wz = m_weights[2].constData();
+
+    double x[2] = { 0, 0 }, y[2] = { 0, 0 }, z[2] = { 0, 0 };
+    int i = 0;
+    for (; i+1<pixels; i+=2)
+    {
+        x[0] += s[i]*wx[i];
+        x[1] += s[i+1]*wx[i+1];
+        y[0] += s[i]*wy[i];
+        y[1] += s[i+1]*wy[i+1];
+        z[0] += s[i]*wz[i];
+        z[1] += s[i+1]*wz[i+1];
+    }
+    if (i < pixels)
+    {
+        x[0] += s[i]*wx[i];
+        y[0] += s[i]*wy[i];
+        z[0] += s[i]*wz[i];
+    }
+
+    xyz[0] = x[0]+x[1];
+    xyz[1] = y[0]+y[1];
+    xyz[2] = z[0]+z[1];
+}
+
+// -----------------------------------------------------------
+//  Processing Spectron spectra and calculating CCT, x and y
+// -----------------------------------------------------------
+void calculateXYZ(SpectronDevice& spectron, CieWeights& weights, double* xyz)
+{
+    calculateXYZ(spectron, weights, spectron.getLastMeasurements(), xyz);
+}
+
+void calculateXYZ(SpectronDevice& spectron, CieWeights& weights,
+                  const TDoubleVec& spectrum, double* xyz)
+{
+    weights.update(spectron);
+    weights.calculateXYZ(spectrum, xyz);
+}
+
+void calculateColourParam(SpectronDevice& spectron, CieWeights& weights,
+                          double &CCT, double &x, double &y)
+{
+    calculateColourParam(spectron, weights, spectron.getLastMeasurements(), CCT, x, y);
+}
+
+void calculateColourParam(SpectronDevice& spectron, CieWeights& weights,
+                          const TDoubleVec& spectrum, double &CCT, double &x, double &y)
+{
+    if (!spectron.isConnected())
+        return;
+
+    double xyz[3] = { 0, 0, 0 };
+    calculateXYZ(spectron, weights, spectrum, xyz);
 
     double sumXYZ = xyz[0]+xyz[1]+xyz[2];
     
@@ -20,6 +20,8 @@
  *  MA 02110-1301, USA.
  */
 
+#ifndef SPECTRON_CCT_H
+#define SPECTRON_CCT_H
 
 #include "spectron_api.h"
 
@@ -28,4 +30,43 @@ double xFunc_1931(double wavelength);
 double yFunc_1931(double wavelength);
 double zFunc_1931(double wavelength);
 
-void calculateColourParam(SpectronDevice& spectron, double &CCT, double &x, double &y);
+// CIE 1931 weighting matrix for device pixels - colour matching function
+// values at each pixel wavelength multiplied by the pixel wavelength
+// interval. XYZ of a spectrum are then three dot products. Weights are
+// rebuilt only when the device wavelengths (calibration or range) change.
+class CieWeights
+{
+public:
+    CieWeights();
+
+    // rebuild weights if the device or its wavelengths have changed
+    void update(SpectronDevice& spectron);
+
+    // XYZ of the spectrum sampled at device pixels
+    void calculateXYZ(const TDoubleVec& spectrum, double* xyz) const;
+
+    int size() const                        { return m_weights[0].size(); }
+    const TDoubleVec& getWeights(int idx) const { return m_weights[idx]; }
+
+private:
+    SpectronDevice* m_device;
+    int             m_version;
+    TDoubleVec      m_weights[3];   // X, Y and Z weights
+};
+
+// The weights are kept by the caller (one per device) and updated from
+// the device wavelengths on each call
+
+// XYZ of the last measurement
+void calculateXYZ(SpectronDevice& spectron, CieWeights& weights, double* xyz);
+
+// XYZ of the spectrum sampled at device pixels (i.e. averaged frames)
+void calculateXYZ(SpectronDevice& spectron, CieWeights& weights,
+                  const TDoubleVec& spectrum, double* xyz);
+
+void calculateColourParam(SpectronDevice& spectron, CieWeights& weights,
+                          double &CCT, double &x, double &y);
+void calculateColourParam(SpectronDevice& spectron, CieWeights& weights,
+                          const TDoubleVec& spectrum, double &CCT, double &x, double &y);
+
+#endif // SPECTRON_CCT_H
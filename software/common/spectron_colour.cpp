@@ -0,0 +1,873 @@
+/*
+ *  spectron_colour.cpp - Colour metrics of spectral measurements from
+ *                        Hamamatsu sensors - CIE 1931 and 1964 observers,
+ *                        CCT and Duv, CIE 13.3 colour rendering index and
+ *                        IES TM-30-18 fidelity and gamut indices.
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_colour.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ---------------------------------------------------------------------------
+//  Standard tables in 5nm (10nm for daylight components) steps from 380 to
+//  780nm as published by CIE (CIE 15:2004, CIE 13.3-1995)
+// ---------------------------------------------------------------------------
+#define TABLE_MIN_WAVELENGTH  380
+#define TABLE_5NM_SIZE        81
+#define TABLE_10NM_SIZE       41
+
+// CIE 1931 2 degree standard observer
+static const double cmf1931[TABLE_5NM_SIZE][3] = {
+    {0.001368,0.000039,0.006450}, {0.002236,0.000064,0.010550}, {0.004243,0.000120,0.020050},
+    {0.007650,0.000217,0.036210}, {0.014310,0.000396,0.067850}, {0.023190,0.000640,0.110200},
+    {0.043510,0.001210,0.207400}, {0.077630,0.002180,0.371300}, {0.134380,0.004000,0.645600},
+    {0.214770,0.007300,1.039050}, {0.283900,0.011600,1.385600}, {0.328500,0.016840,1.622960},
+    {0.348280,0.023000,1.747060}, {0.348060,0.029800,1.782600}, {0.336200,0.038000,1.772110},
+    {0.318700,0.048000,1.744100}, {0.290800,0.060000,1.669200}, {0.251100,0.073900,1.528100},
+    {0.195360,0.090980,1.287640}, {0.142100,0.112600,1.041900}, {0.095640,0.139020,0.812950},
+    {0.057950,0.169300,0.616200}, {0.032010,0.208020,0.465180}, {0.014700,0.258600,0.353300},
+    {0.004900,0.323000,0.272000}, {0.002400,0.407300,0.212300}, {0.009300,0.503000,0.158200},
+    {0.029100,0.608200,0.111700}, {0.063270,0.710000,0.078250}, {0.109600,0.793200,0.057250},
+    {0.165500,0.862000,0.042160}, {0.225750,0.914850,0.029840}, {0.290400,0.954000,0.020300},
+    {0.359700,0.980300,0.013400}, {0.433450,0.994950,0.008750}, {0.512050,1.000000,0.005750},
+    {0.594500,0.995000,0.003900}, {0.678400,0.978600,0.002750}, {0.762100,0.952000,0.002100},
+    {0.842500,0.915400,0.001800}, {0.916300,0.870000,0.001650}, {0.978600,0.816300,0.001400},
+    {1.026300,0.757000,0.001100}, {1.056700,0.694900,0.001000}, {1.062200,0.631000,0.000800},
+    {1.045600,0.566800,0.000600}, {1.002600,0.503000,0.000340}, {0.938400,0.441200,0.000240},
+    {0.854450,0.381000,0.000190}, {0.751400,0.321000,0.000100}, {0.642400,0.265000,0.000050},
+    {0.541900,0.217000,0.000030}, {0.447900,0.175000,0.000020}, {0.360800,0.138200,0.000010},
+    {0.283500,0.107000,0.000000}, {0.218700,0.081600,0.000000}, {0.164900,0.061000,0.000000},
+    {0.121200,0.044580,0.000000}, {0.087400,0.032000,0.000000}, {0.063600,0.023200,0.000000},
+    {0.046770,0.017000,0.000000}, {0.032900,0.011920,0.000000}, {0.022700,0.008210,0.000000},
+    {0.015840,0.005723,0.000000}, {0.011359,0.004102,0.000000}, {0.008111,0.002929,0.000000},
+    {0.005790,0.002091,0.000000}, {0.004109,0.001484,0.000000}, {0.002899,0.001047,0.000000},
+    {0.002049,0.000740,0.000000}, {0.001440,0.000520,0.000000}, {0.001000,0.000361,0.000000},
+    {0.000690,0.000249,0.000000}, {0.000476,0.000172,0.000000}, {0.000332,0.000120,0.000000},
+    {0.000235,0.000085,0.000000}, {0.000166,0.000060,0.000000}, {0.000117,0.000042,0.000000},
+    {0.000083,0.000030,0.000000}, {0.000059,0.000021,0.000000}, {0.000042,0.000015,0.000000}
+};
+
+// CIE 1964 10 degree standard observer
+static const double cmf1964[TABLE_5NM_SIZE][3] = {
+    {0.000160,0.000017,0.000705}, {0.000662,0.000072,0.002928}, {0.002362,0.000253,0.010482},
+    {0.007242,0.000769,0.032344}, {0.019110,0.002004,0.086011}, {0.043400,0.004509,0.197120},
+    {0.084736,0.008756,0.389366}, {0.140638,0.014456,0.656760}, {0.204492,0.021391,0.972542},
+    {0.264737,0.029497,1.282500}, {0.314679,0.038676,1.553480}, {0.357719,0.049602,1.798500},
+    {0.383734,0.062077,1.967280}, {0.386726,0.074704,2.027300}, {0.370702,0.089456,1.994800},
+    {0.342957,0.106256,1.900700}, {0.302273,0.128201,1.745370}, {0.254085,0.152761,1.554900},
+    {0.195618,0.185190,1.317560}, {0.132349,0.219940,1.030200}, {0.080507,0.253589,0.772125},
+    {0.041072,0.297665,0.570060}, {0.016172,0.339133,0.415254}, {0.005132,0.395379,0.302356},
+    {0.003816,0.460777,0.218502}, {0.015444,0.531360,0.159249}, {0.037465,0.606741,0.112044},
+    {0.071358,0.685660,0.082248}, {0.117749,0.761757,0.060709}, {0.172953,0.823330,0.043050},
+    {0.236491,0.875211,0.030451}, {0.304213,0.923810,0.020584}, {0.376772,0.961988,0.013676},
+    {0.451584,0.982200,0.007918}, {0.529826,0.991761,0.003988}, {0.616053,0.999110,0.001091},
+    {0.705224,0.997340,0.000000}, {0.793832,0.982380,0.000000}, {0.878655,0.955552,0.000000},
+    {0.951162,0.915175,0.000000}, {1.014160,0.868934,0.000000}, {1.074300,0.825623,0.000000},
+    {1.118520,0.777405,0.000000}, {1.134300,0.720353,0.000000}, {1.123990,0.658341,0.000000},
+    {1.089100,0.593878,0.000000}, {1.030480,0.527963,0.000000}, {0.950740,0.461834,0.000000},
+    {0.856297,0.398057,0.000000}, {0.754930,0.339554,0.000000}, {0.647467,0.283493,0.000000},
+    {0.535110,0.228254,0.000000}, {0.431567,0.179828,0.000000}, {0.343690,0.140211,0.000000},
+    {0.268329,0.107633,0.000000}, {0.204300,0.081187,0.000000}, {0.152568,0.060281,0.000000},
+    {0.112210,0.044096,0.000000}, {0.081261,0.031800,0.000000}, {0.057930,0.022602,0.000000},
+    {0.040851,0.015905,0.000000}, {0.028623,0.011130,0.000000}, {0.019941,0.007749,0.000000},
+    {0.013842,0.005375,0.000000}, {0.009577,0.003718,0.000000}, {0.006605,0.002565,0.000000},
+    {0.004553,0.001768,0.000000}, {0.003145,0.001222,0.000000}, {0.002175,0.000846,0.000000},
+    {0.001506,0.000586,0.000000}, {0.001045,0.000407,0.000000}, {0.000727,0.000284,0.000000},
+    {0.000508,0.000199,0.000000}, {0.000356,0.000140,0.000000}, {0.000251,0.000098,0.000000},
+    {0.000178,0.000070,0.000000}, {0.000126,0.000050,0.000000}, {0.000090,0.000036,0.000000},
+    {0.000065,0.000025,0.000000}, {0.000046,0.000018,0.000000}, {0.000033,0.000013,0.000000}
+};
+
+// CIE daylight components S0, S1 and S2 (10nm steps, linearly interpolated)
+static const double daylightS[TABLE_10NM_SIZE][3] = {
+    { 63.4, 38.5,  3.0}, { 65.8, 35.0,  1.2}, { 94.8, 43.4, -1.1}, {104.8, 46.3, -0.5},
+    {105.9, 43.9, -0.7}, { 96.8, 37.1, -1.2}, {113.9, 36.7, -2.6}, {125.6, 35.9, -2.9},
+    {125.5, 32.6, -2.8}, {121.3, 27.9, -2.6}, {121.3, 24.3, -2.6}, {113.5, 20.1, -1.8},
+    {113.1, 16.2, -1.5}, {110.8, 13.2, -1.3}, {106.5,  8.6, -1.2}, {108.8,  6.1, -1.0},
+    {105.3,  4.2, -0.5}, {104.4,  1.9, -0.3}, {100.0,  0.0,  0.0}, { 96.0, -1.6,  0.2},
+    { 95.1, -3.5,  0.5}, { 89.1, -3.5,  2.1}, { 90.5, -5.8,  3.2}, { 90.3, -7.2,  4.1},
+    { 88.4, -8.6,  4.7}, { 84.0, -9.5,  5.1}, { 85.1,-10.9,  6.7}, { 81.9,-10.7,  7.3},
+    { 82.6,-12.0,  8.6}, { 84.9,-14.0,  9.8}, { 81.3,-13.6, 10.2}, { 71.9,-12.0,  8.3},
+    { 74.3,-13.3,  9.6}, { 76.4,-12.9,  8.5}, { 63.3,-10.6,  7.0}, { 71.7,-11.6,  7.6},
+    { 77.0,-12.2,  8.0}, { 65.2,-10.2,  6.7}, { 47.7, -7.8,  5.2}, { 68.6,-11.2,  7.4},
+    { 65.0,-10.4,  6.8}
+};
+
+// CIE 13.3 test colour samples TCS01-TCS14 spectral radiance factors
+static const double tcs[TABLE_5NM_SIZE][CIE_TCS_COUNT] = {
+    {0.219,0.070,0.065,0.074,0.295,0.151,0.378,0.104,0.066,0.050,0.111,0.120,0.104,0.036},
+    {0.239,0.079,0.068,0.083,0.306,0.203,0.459,0.129,0.062,0.054,0.121,0.103,0.127,0.036},
+    {0.252,0.089,0.070,0.093,0.310,0.265,0.524,0.170,0.058,0.059,0.127,0.090,0.161,0.037},
+    {0.256,0.101,0.072,0.105,0.312,0.339,0.546,0.240,0.055,0.063,0.129,0.082,0.211,0.038},
+    {0.256,0.111,0.073,0.116,0.313,0.410,0.551,0.319,0.052,0.066,0.127,0.076,0.264,0.039},
+    {0.254,0.116,0.073,0.121,0.315,0.464,0.555,0.416,0.052,0.067,0.121,0.068,0.313,0.039},
+    {0.252,0.118,0.074,0.124,0.319,0.492,0.559,0.462,0.051,0.068,0.116,0.064,0.341,0.040},
+    {0.248,0.120,0.074,0.126,0.322,0.508,0.560,0.482,0.050,0.069,0.112,0.065,0.352,0.041},
+    {0.244,0.121,0.074,0.128,0.326,0.517,0.561,0.490,0.050,0.069,0.108,0.075,0.359,0.042},
+    {0.240,0.122,0.073,0.131,0.330,0.524,0.558,0.488,0.049,0.070,0.105,0.093,0.361,0.042},
+    {0.237,0.122,0.073,0.135,0.334,0.531,0.556,0.482,0.048,0.072,0.104,0.123,0.364,0.043},
+    {0.232,0.122,0.073,0.139,0.339,0.538,0.551,0.473,0.047,0.073,0.104,0.160,0.365,0.044},
+    {0.230,0.123,0.073,0.144,0.346,0.544,0.544,0.462,0.046,0.076,0.105,0.207,0.367,0.044},
+    {0.226,0.124,0.073,0.151,0.352,0.551,0.535,0.450,0.044,0.078,0.106,0.256,0.369,0.045},
+    {0.225,0.127,0.074,0.161,0.360,0.556,0.522,0.439,0.042,0.083,0.110,0.300,0.372,0.047},
+    {0.222,0.128,0.075,0.172,0.369,0.556,0.506,0.426,0.041,0.088,0.115,0.331,0.374,0.048},
+    {0.220,0.131,0.077,0.186,0.381,0.554,0.488,0.413,0.038,0.095,0.123,0.346,0.376,0.050},
+    {0.218,0.134,0.080,0.205,0.394,0.549,0.469,0.397,0.035,0.103,0.134,0.347,0.379,0.052},
+    {0.216,0.138,0.085,0.229,0.403,0.541,0.448,0.382,0.033,0.113,0.148,0.341,0.384,0.055},
+    {0.214,0.143,0.094,0.254,0.410,0.531,0.429,0.366,0.031,0.125,0.167,0.328,0.389,0.057},
+    {0.214,0.150,0.109,0.281,0.415,0.519,0.408,0.352,0.030,0.142,0.192,0.307,0.397,0.062},
+    {0.214,0.159,0.126,0.308,0.418,0.504,0.385,0.337,0.029,0.162,0.219,0.282,0.405,0.067},
+    {0.216,0.174,0.148,0.332,0.419,0.488,0.363,0.325,0.028,0.189,0.252,0.257,0.416,0.075},
+    {0.218,0.190,0.172,0.352,0.417,0.469,0.341,0.310,0.028,0.219,0.291,0.230,0.429,0.083},
+    {0.223,0.207,0.198,0.370,0.413,0.450,0.324,0.299,0.028,0.262,0.325,0.204,0.443,0.092},
+    {0.225,0.225,0.221,0.383,0.409,0.431,0.311,0.289,0.029,0.305,0.347,0.178,0.454,0.100},
+    {0.226,0.242,0.241,0.390,0.403,0.414,0.301,0.283,0.030,0.365,0.356,0.154,0.461,0.108},
+    {0.226,0.253,0.260,0.394,0.396,0.395,0.291,0.276,0.030,0.416,0.353,0.129,0.466,0.121},
+    {0.225,0.260,0.278,0.395,0.389,0.377,0.283,0.270,0.031,0.465,0.346,0.109,0.469,0.133},
+    {0.225,0.264,0.302,0.392,0.381,0.358,0.273,0.262,0.031,0.509,0.333,0.090,0.471,0.142},
+    {0.227,0.267,0.339,0.385,0.372,0.341,0.265,0.256,0.032,0.546,0.314,0.075,0.474,0.150},
+    {0.230,0.269,0.370,0.377,0.363,0.325,0.260,0.251,0.032,0.581,0.294,0.062,0.476,0.154},
+    {0.236,0.272,0.392,0.367,0.353,0.309,0.257,0.250,0.033,0.610,0.271,0.051,0.483,0.155},
+    {0.245,0.276,0.399,0.354,0.342,0.293,0.257,0.251,0.034,0.634,0.248,0.041,0.490,0.152},
+    {0.253,0.282,0.400,0.341,0.331,0.279,0.259,0.254,0.035,0.653,0.227,0.035,0.506,0.147},
+    {0.262,0.289,0.393,0.327,0.320,0.265,0.260,0.258,0.037,0.666,0.206,0.029,0.526,0.140},
+    {0.272,0.299,0.380,0.312,0.308,0.253,0.260,0.264,0.041,0.678,0.188,0.025,0.553,0.133},
+    {0.283,0.309,0.365,0.296,0.296,0.241,0.258,0.269,0.044,0.687,0.170,0.022,0.582,0.125},
+    {0.298,0.322,0.349,0.280,0.284,0.234,0.256,0.272,0.048,0.693,0.153,0.019,0.618,0.118},
+    {0.318,0.329,0.332,0.263,0.271,0.227,0.254,0.274,0.052,0.698,0.138,0.017,0.651,0.112},
+    {0.341,0.335,0.315,0.247,0.260,0.225,0.254,0.278,0.060,0.701,0.125,0.017,0.680,0.106},
+    {0.367,0.339,0.299,0.229,0.247,0.222,0.254,0.284,0.076,0.704,0.114,0.017,0.701,0.101},
+    {0.390,0.341,0.285,0.214,0.232,0.221,0.259,0.295,0.102,0.705,0.106,0.016,0.717,0.098},
+    {0.409,0.341,0.272,0.198,0.220,0.220,0.270,0.316,0.136,0.705,0.100,0.016,0.729,0.095},
+    {0.424,0.342,0.264,0.185,0.210,0.220,0.284,0.348,0.190,0.706,0.096,0.016,0.736,0.093},
+    {0.435,0.342,0.257,0.175,0.200,0.220,0.302,0.384,0.256,0.707,0.092,0.016,0.742,0.090},
+    {0.442,0.342,0.252,0.169,0.194,0.220,0.324,0.434,0.336,0.707,0.090,0.016,0.745,0.089},
+    {0.448,0.341,0.247,0.164,0.189,0.220,0.344,0.482,0.418,0.707,0.087,0.016,0.747,0.087},
+    {0.450,0.341,0.241,0.160,0.185,0.223,0.362,0.528,0.505,0.708,0.085,0.018,0.748,0.086},
+    {0.451,0.339,0.235,0.156,0.183,0.227,0.377,0.567,0.581,0.708,0.082,0.018,0.748,0.085},
+    {0.451,0.339,0.229,0.154,0.180,0.233,0.389,0.601,0.641,0.710,0.080,0.018,0.748,0.084},
+    {0.451,0.338,0.224,0.152,0.177,0.239,0.400,0.628,0.682,0.711,0.079,0.018,0.748,0.083},
+    {0.451,0.338,0.220,0.151,0.176,0.244,0.410,0.644,0.717,0.712,0.078,0.018,0.748,0.083},
+    {0.451,0.337,0.217,0.149,0.175,0.251,0.420,0.655,0.740,0.714,0.078,0.018,0.748,0.082},
+    {0.451,0.336,0.216,0.148,0.175,0.258,0.429,0.667,0.758,0.716,0.078,0.019,0.748,0.081},
+    {0.451,0.335,0.216,0.148,0.175,0.263,0.438,0.671,0.770,0.718,0.078,0.020,0.748,0.080},
+    {0.451,0.334,0.219,0.148,0.175,0.268,0.445,0.677,0.781,0.720,0.081,0.023,0.747,0.079},
+    {0.451,0.332,0.224,0.149,0.177,0.273,0.452,0.678,0.790,0.722,0.083,0.024,0.747,0.078},
+    {0.451,0.332,0.230,0.151,0.180,0.278,0.457,0.678,0.797,0.725,0.088,0.026,0.747,0.077},
+    {0.451,0.331,0.238,0.154,0.183,0.281,0.462,0.679,0.803,0.729,0.093,0.030,0.747,0.076},
+    {0.451,0.331,0.251,0.158,0.186,0.283,0.466,0.680,0.809,0.731,0.102,0.035,0.747,0.075},
+    {0.451,0.331,0.269,0.162,0.189,0.286,0.468,0.680,0.814,0.735,0.112,0.043,0.747,0.075},
+    {0.451,0.332,0.288,0.165,0.192,0.291,0.470,0.682,0.819,0.739,0.125,0.056,0.747,0.074},
+    {0.451,0.332,0.312,0.168,0.195,0.296,0.473,0.682,0.824,0.742,0.141,0.074,0.746,0.074},
+    {0.451,0.332,0.340,0.170,0.199,0.302,0.477,0.683,0.828,0.746,0.161,0.097,0.746,0.073},
+    {0.451,0.332,0.366,0.171,0.200,0.313,0.483,0.685,0.830,0.748,0.182,0.128,0.746,0.073},
+    {0.450,0.332,0.390,0.170,0.199,0.325,0.489,0.688,0.831,0.749,0.203,0.166,0.745,0.073},
+    {0.450,0.331,0.414,0.168,0.198,0.338,0.496,0.690,0.833,0.751,0.223,0.210,0.744,0.073},
+    {0.450,0.331,0.435,0.166,0.196,0.351,0.503,0.693,0.835,0.753,0.242,0.257,0.743,0.073},
+    {0.450,0.331,0.457,0.165,0.195,0.364,0.511,0.696,0.836,0.754,0.257,0.305,0.744,0.073},
+    {0.450,0.330,0.479,0.164,0.195,0.376,0.518,0.698,0.836,0.755,0.270,0.354,0.745,0.073},
+    {0.450,0.329,0.498,0.164,0.195,0.389,0.525,0.699,0.837,0.755,0.282,0.401,0.748,0.074},
+    {0.449,0.328,0.517,0.165,0.196,0.401,0.532,0.700,0.838,0.755,0.292,0.446,0.750,0.074},
+    {0.449,0.328,0.536,0.168,0.197,0.413,0.539,0.700,0.839,0.755,0.302,0.485,0.750,0.075},
+    {0.449,0.327,0.553,0.172,0.200,0.425,0.546,0.701,0.839,0.756,0.310,0.520,0.749,0.076},
+    {0.448,0.326,0.570,0.177,0.203,0.436,0.553,0.702,0.840,0.757,0.318,0.551,0.749,0.078},
+    {0.448,0.325,0.586,0.183,0.207,0.447,0.559,0.704,0.840,0.757,0.323,0.577,0.748,0.080},
+    {0.448,0.323,0.601,0.190,0.212,0.457,0.565,0.705,0.840,0.758,0.327,0.599,0.748,0.082},
+    {0.447,0.322,0.615,0.195,0.215,0.467,0.570,0.706,0.841,0.759,0.331,0.619,0.747,0.083},
+    {0.447,0.322,0.628,0.199,0.218,0.477,0.577,0.707,0.841,0.759,0.334,0.634,0.747,0.085},
+    {0.447,0.320,0.637,0.203,0.220,0.487,0.584,0.708,0.842,0.760,0.337,0.646,0.746,0.087}
+};
+
+// ---------------------------------------------------------------------------
+//  1nm tables - interpolated from 5nm tables with Sprague interpolation as
+//  recommended by CIE 167:2005, built once on the first use
+// ---------------------------------------------------------------------------
+
+// Planckian locus table - CIE 1960 uv in 1% temperature steps
+#define LOCUS_MIN_TEMP      1000.0
+#define LOCUS_TEMP_STEP     1.01
+#define LOCUS_SIZE          464     // up to ~100000K
+
+// second radiation constant, m*K
+#define PLANCK_C2           1.4388e-2
+
+// Interpolate table column of TABLE_5NM_SIZE values with the given stride
+// into CIE_CMF_SIZE values in 1nm steps
+static void spragueInterpolate(const double* table, int stride, double* out, int outStride)
+{
+    // two extra points at each end
+    double p[TABLE_5NM_SIZE+4];
+    for (int i=0; i<TABLE_5NM_SIZE; i++)
+        p[i+2] = table[i*stride];
+
+    const double* s = p+2;
+    const double* e = p+TABLE_5NM_SIZE+1;
+    p[1] = (508*s[0] - 540*s[1] + 488*s[2] - 367*s[3] + 144*s[4] - 24*s[5])/209;
+    p[0] = (884*s[0] - 1960*s[1] + 3033*s[2] - 2648*s[3] + 1080*s[4] - 180*s[5])/209;
+    p[TABLE_5NM_SIZE+2] = (508*e[0] - 540*e[-1] + 488*e[-2] - 367*e[-3] + 144*e[-4] - 24*e[-5])/209;
+    p[TABLE_5NM_SIZE+3] = (884*e[0] - 1960*e[-1] + 3033*e[-2] - 2648*e[-3] + 1080*e[-4] - 180*e[-5])/209;
+
+    for (int i=0; i<TABLE_5NM_SIZE-1; i++)
+    {
+        const double* q = p+i;
+        double a1 = (2*q[0] - 16*q[1] + 16*q[3] - 2*q[4])/24;
+        double a2 = (-q[0] + 16*q[1] - 30*q[2] + 16*q[3] - q[4])/24;
+        double a3 = (-9*q[0] + 39*q[1] - 70*q[2] + 66*q[3] - 33*q[4] + 7*q[5])/24;
+        double a4 = (13*q[0] - 64*q[1] + 126*q[2] - 124*q[3] + 61*q[4] - 12*q[5])/24;
+        double a5 = (-5*q[0] + 25*q[1] - 50*q[2] + 50*q[3] - 25*q[4] + 5*q[5])/24;
+        for (int j=0; j<5; j++)
+        {
+            double x = j/5.0;
+            out[(i*5+j)*outStride] = q[2] + x*(a1 + x*(a2 + x*(a3 + x*(a4 + x*a5))));
+        }
+    }
+    out[(CIE_CMF_SIZE-1)*outStride] = table[(TABLE_5NM_SIZE-1)*stride];
+}
+
+struct TColourTables
+{
+    double cmf[2][CIE_CMF_SIZE][3];
+    double tcs[CIE_CMF_SIZE][CIE_TCS_COUNT];
+    double locus[LOCUS_SIZE][2];
+
+    TColourTables()
+    {
+        for (int c=0; c<3; c++)
+        {
+            spragueInterpolate(&cmf1931[0][c], 3, &cmf[CIE_1931_2DEG][0][c], 3);
+            spragueInterpolate(&cmf1964[0][c], 3, &cmf[CIE_1964_10DEG][0][c], 3);
+        }
+        for (int s=0; s<CIE_TCS_COUNT; s++)
+            spragueInterpolate(&::tcs[0][s], CIE_TCS_COUNT, &tcs[0][s], CIE_TCS_COUNT);
+
+        // Sprague polynomials may overshoot slightly below zero near the
+        // ends of the colour matching functions
+        for (int o=0; o<2; o++)
+            for (int i=0; i<CIE_CMF_SIZE; i++)
+                for (int c=0; c<3; c++)
+                    if (cmf[o][i][c] < 0)
+                        cmf[o][i][c] = 0;
+
+        double temp = LOCUS_MIN_TEMP;
+        for (int i=0; i<LOCUS_SIZE; i++, temp *= LOCUS_TEMP_STEP)
+            planckUV(temp, locus[i]);
+    }
+
+    // CIE 1960 uv of Planckian radiator
+    void planckUV(double tempK, double* uv) const
+    {
+        double xyz[3] = { 0, 0, 0 };
+        for (int i=0; i<CIE_CMF_SIZE; i++)
+        {
+            double s = planckRadiation(CIE_CMF_MIN_WAVELENGTH+i, tempK);
+            for (int c=0; c<3; c++)
+                xyz[c] += s*cmf[CIE_1931_2DEG][i][c];
+        }
+
+        double d = xyz[0] + 15*xyz[1] + 3*xyz[2];
+        uv[0] = 4*xyz[0]/d;
+        uv[1] = 6*xyz[1]/d;
+    }
+};
+
+static const TColourTables& colourTables()
+{
+    static TColourTables tables;
+    return tables;
+}
+
+// ---------------------------------------------------------------------------
+//  Helper functions
+// ---------------------------------------------------------------------------
+bool cieColourMatch(TObserver observer, double wavelength, double* xyz)
+{
+    xyz[0] = xyz[1] = xyz[2] = 0;
+    double pos = wavelength - CIE_CMF_MIN_WAVELENGTH;
+    if (pos < 0 || pos > CIE_CMF_SIZE-1)
+        return false;
+
+    const TColourTables& tables = colourTables();
+    int idx = (int)pos;
+    if (idx >= CIE_CMF_SIZE-1)
+        idx = CIE_CMF_SIZE-2;
+    double frac = pos - idx;
+    for (int c=0; c<3; c++)
+        xyz[c] = tables.cmf[observer][idx][c]*(1-frac) + tables.cmf[observer][idx+1][c]*frac;
+
+    return true;
+}
+
+double planckRadiation(double wavelength, double tempK)
+{
+    // relative to 560nm to keep values in reasonable range
+    double lambda = wavelength*1e-9;
+    double lambda0 = 560e-9;
+    return pow(lambda0/lambda, 5)*(exp(PLANCK_C2/(lambda0*tempK)) - 1)/(exp(PLANCK_C2/(lambda*tempK)) - 1);
+}
+
+// linear interpolation of the table column at the position in table steps,
+// clamped to table ends
+static double interpolate(const double* table, int stride, int size, double pos)
+{
+    if (pos <= 0)
+        return table[0];
+    if (pos >= size-1)
+        return table[(size-1)*stride];
+
+    int idx = (int)pos;
+    double frac = pos - idx;
+    return table[idx*stride]*(1-frac) + table[(idx+1)*stride]*frac;
+}
+
+// Dot product split into even and odd sums - see CieWeights
+static double dotProduct(const double* a, const double* b, int size)
+{
+    double sum[2] = { 0, 0 };
+    int i = 0;
+    for (; i+1<size; i+=2)
+    {
+        sum[0] += a[i]*b[i];
+        sum[1] += a[i+1]*b[i+1];
+    }
+    if (i < size)
+        sum[0] += a[i]*b[i];
+
+    return sum[0]+sum[1];
+}
+
+static void xyzToUV(const double* xyz, double& u, double& v)
+{
+    double d = xyz[0] + 15*xyz[1] + 3*xyz[2];
+    u = d > 0 ? 4*xyz[0]/d : 0;
+    v = d > 0 ? 6*xyz[1]/d : 0;
+}
+
+// CCT and Duv - nearest point of Planckian locus table refined by fitting
+// a parabola to distances of the neighbouring points (Ohno 2014), then
+// Duv is calculated against the exact locus point
+static void calculateCCT(double u, double v, double& CCT, double& Duv)
+{
+    const TColourTables& tables = colourTables();
+
+    int nearest = 0;
+    double minDist = 1e10;
+    for (int i=0; i<LOCUS_SIZE; i++)
+    {
+        double du = u - tables.locus[i][0];
+        double dv = v - tables.locus[i][1];
+        double dist = du*du + dv*dv;
+        if (dist < minDist)
+        {
+            minDist = dist;
+            nearest = i;
+        }
+    }
+    if (nearest == 0)
+        nearest = 1;
+    else if (nearest == LOCUS_SIZE-1)
+        nearest = LOCUS_SIZE-2;
+
+    // parabola through distances at three temperatures
+    double t[3], d[3];
+    for (int i=0; i<3; i++)
+    {
+        int idx = nearest-1+i;
+        t[i] = LOCUS_MIN_TEMP*pow(LOCUS_TEMP_STEP, idx);
+        d[i] = sqrt(pow(u - tables.locus[idx][0], 2) + pow(v - tables.locus[idx][1], 2));
+    }
+    double d01 = (d[1]-d[0])/(t[1]-t[0]);
+    double d12 = (d[2]-d[1])/(t[2]-t[1]);
+    double a = (d12-d01)/(t[2]-t[0]);
+    double b = d01 - a*(t[0]+t[1]);
+    CCT = a > 0 ? -b/(2*a) : t[1];
+    if (CCT < t[0] || CCT > t[2])
+        CCT = t[1];
+
+    double uv[2];
+    tables.planckUV(CCT, uv);
+    Duv = sqrt(pow(u - uv[0], 2) + pow(v - uv[1], 2));
+    if (v < uv[1])
+        Duv = -Duv;
+}
+
+// ---------------------------------------------------------------------------
+//  CIECAM02 and CAM02-UCS for TM-30 - D65 independent, complete adaptation
+// ---------------------------------------------------------------------------
+struct TCam02
+{
+    double FL, n, Nbb, Ncb, z, c, Nc;
+    double Dw[3];       // adaptation factors for each cone response
+    double Aw;
+
+    // viewing conditions - white point, adapting luminance, background
+    // relative luminance and degree of adaptation (negative to calculate)
+    TCam02(const double* xyzw, double LA, double Yb, double D)
+    {
+        // average surround
+        double F = 1.0;
+        c = 0.69;
+        Nc = 1.0;
+
+        if (D < 0)
+            D = F*(1 - exp((-LA-42)/92)/3.6);
+
+        double k = 1/(5*LA+1);
+        double k4 = k*k*k*k;
+        FL = 0.2*k4*5*LA + 0.1*(1-k4)*(1-k4)*pow(5*LA, 1.0/3);
+        n = Yb/xyzw[1];
+        Nbb = Ncb = 0.725*pow(1/n, 0.2);
+        z = 1.48 + sqrt(n);
+
+        double rgbw[3];
+        cat02(xyzw, rgbw);
+        for (int i=0; i<3; i++)
+            Dw[i] = xyzw[1]*D/rgbw[i] + 1 - D;
+
+        double aw[3];
+        adapt(rgbw, aw);
+        Aw = (2*aw[0] + aw[1] + aw[2]/20 - 0.305)*Nbb;
+    }
+
+    static void cat02(const double* xyz, double* rgb)
+    {
+        rgb[0] =  0.7328*xyz[0] + 0.4296*xyz[1] - 0.1624*xyz[2];
+        rgb[1] = -0.7036*xyz[0] + 1.6975*xyz[1] + 0.0061*xyz[2];
+        rgb[2] =  0.0030*xyz[0] + 0.0136*xyz[1] + 0.9834*xyz[2];
+    }
+
+    // chromatic adaptation, conversion to Hunt-Pointer-Estevez space and
+    // post-adaptation compression of CAT02 rgb
+    void adapt(const double* rgb, double* ra) const
+    {
+        double rgbc[3], xyzc[3], lms[3];
+        for (int i=0; i<3; i++)
+            rgbc[i] = Dw[i]*rgb[i];
+
+        // inverse CAT02 then HPE
+        xyzc[0] =  1.096124*rgbc[0] - 0.278869*rgbc[1] + 0.182745*rgbc[2];
+        xyzc[1] =  0.454369*rgbc[0] + 0.473533*rgbc[1] + 0.072098*rgbc[2];
+        xyzc[2] = -0.009628*rgbc[0] - 0.005698*rgbc[1] + 1.015326*rgbc[2];
+        lms[0] =  0.38971*xyzc[0] + 0.68898*xyzc[1] - 0.07868*xyzc[2];
+        lms[1] = -0.22981*xyzc[0] + 1.18340*xyzc[1] + 0.04641*xyzc[2];
+        lms[2] =  xyzc[2];
+
+        for (int i=0; i<3; i++)
+        {
+            double p = pow(FL*fabs(lms[i])/100, 0.42);
+            ra[i] = (lms[i] < 0 ? -400 : 400)*p/(27.13 + p) + 0.1;
+        }
+    }
+
+    // lightness J, chroma C, colourfulness M and hue angle h in degrees
+    void appearance(const double* xyz, double& J, double& C, double& M, double& h) const
+    {
+        double rgb[3], ra[3];
+        cat02(xyz, rgb);
+        adapt(rgb, ra);
+
+        double a = ra[0] - 12*ra[1]/11 + ra[2]/11;
+        double b = (ra[0] + ra[1] - 2*ra[2])/9;
+        h = atan2(b, a)*180/M_PI;
+        if (h < 0)
+            h += 360;
+
+        double et = (cos(h*M_PI/180 + 2) + 3.8)/4;
+        double A = (2*ra[0] + ra[1] + ra[2]/20 - 0.305)*Nbb;
+        J = A > 0 ? 100*pow(A/Aw, c*z) : 0;
+
+        double t = 50000.0/13*Nc*Ncb*et*sqrt(a*a + b*b)/(ra[0] + ra[1] + 21*ra[2]/20);
+        C = pow(t, 0.9)*sqrt(J/100)*pow(1.64 - pow(0.29, n), 0.73);
+        M = C*pow(FL, 0.25);
+    }
+
+    // CAM02-UCS J', a', b'
+    void ucs(const double* xyz, double* jab) const
+    {
+        double J, C, M, h;
+        appearance(xyz, J, C, M, h);
+
+        double Mp = log(1 + 0.0228*M)/0.0228;
+        jab[0] = 1.7*J/(1 + 0.007*J);
+        jab[1] = Mp*cos(h*M_PI/180);
+        jab[2] = Mp*sin(h*M_PI/180);
+    }
+};
+
+// ---------------------------------------------------------------------------
+//  ColourMetrics
+// ---------------------------------------------------------------------------
+ColourMetrics::ColourMetrics()
+    : m_device(NULL), m_version(0), m_pixels(0), m_cesCount(0)
+{
+}
+
+bool ColourMetrics::loadTM30Samples(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    TDoubleVec wavelengths;
+    QList<TDoubleVec> columns;
+    QTextStream stream(&file);
+    while (!stream.atEnd())
+    {
+        QStringList values = stream.readLine().split(',');
+        bool ok = false;
+        double wavelength = values.at(0).trimmed().toDouble(&ok);
+        if (!ok)
+            continue;
+        if (columns.isEmpty())
+            for (int i=1; i<values.size(); i++)
+                columns << TDoubleVec();
+        if (values.size()-1 != columns.size()
+            || (!wavelengths.isEmpty() && wavelength <= wavelengths.last()))
+            return false;
+
+        wavelengths << wavelength;
+        for (int i=1; i<values.size(); i++)
+            columns[i-1] << values.at(i).trimmed().toDouble();
+    }
+
+    if (wavelengths.size() < 2 || columns.isEmpty())
+        return false;
+
+    m_cesWavelengths = wavelengths;
+    m_cesReflectance.clear();
+    for (int i=0; i<columns.size(); i++)
+        m_cesReflectance << columns.at(i);
+    m_cesCount = columns.size();
+
+    // force pixel tables rebuild
+    m_device = NULL;
+
+    return true;
+}
+
+void ColourMetrics::update(SpectronDevice& spectron)
+{
+    if (m_device == &spectron && m_version == spectron.getWavelengthsVersion())
+        return;
+
+    m_device = &spectron;
+    m_version = spectron.getWavelengthsVersion();
+    m_wavelengths = spectron.getWavelengths();
+    buildTables();
+}
+
+void ColourMetrics::setWavelengths(const TDoubleVec& wavelengths)
+{
+    m_device = NULL;
+    m_wavelengths = wavelengths;
+    buildTables();
+}
+
+// Resample colour matching functions, samples and daylight components
+// into device pixels
+void ColourMetrics::buildTables()
+{
+    const TColourTables& tables = colourTables();
+    int pixels = m_pixels = m_wavelengths.size();
+
+    m_tcsWeights.fill(0.0, (1+CIE_TCS_COUNT)*3*pixels);
+    m_cesWeights.fill(0.0, (1+m_cesCount)*3*pixels);
+    m_daylight.fill(0.0, 3*pixels);
+    if (pixels < 2)
+        return;
+
+    for (int i=0; i<pixels; i++)
+    {
+        double wavelength = m_wavelengths.at(i);
+        double dLamda = 0;
+        if (i==0)
+            dLamda = (m_wavelengths.at(i+1)-wavelength)/2;
+        else if (i==pixels-1)
+            dLamda = (wavelength-m_wavelengths.at(i-1))/2;
+        else
+            dLamda = (m_wavelengths.at(i+1)-m_wavelengths.at(i-1))/2;
+
+        double cmf2[3], cmf10[3];
+        if (!cieColourMatch(CIE_1931_2DEG, wavelength, cmf2))
+            continue;
+        cieColourMatch(CIE_1964_10DEG, wavelength, cmf10);
+
+        // white is the first row triple, then samples
+        double pos = wavelength - CIE_CMF_MIN_WAVELENGTH;
+        for (int c=0; c<3; c++)
+        {
+            m_tcsWeights[c*pixels + i] = cmf2[c]*dLamda;
+            for (int s=0; s<CIE_TCS_COUNT; s++)
+                m_tcsWeights[((s+1)*3 + c)*pixels + i] =
+                    cmf2[c]*dLamda*interpolate(&tables.tcs[0][s], CIE_TCS_COUNT, CIE_CMF_SIZE, pos);
+
+            m_cesWeights[c*pixels + i] = cmf10[c]*dLamda;
+        }
+
+        if (m_cesCount)
+        {
+            int cesSize = m_cesWavelengths.size();
+            double cesPos = (wavelength - m_cesWavelengths.first())
+                            /(m_cesWavelengths.last() - m_cesWavelengths.first())*(cesSize-1);
+            for (int s=0; s<m_cesCount; s++)
+            {
+                double r = interpolate(m_cesReflectance.constData() + s*cesSize, 1, cesSize, cesPos);
+                for (int c=0; c<3; c++)
+                    m_cesWeights[((s+1)*3 + c)*pixels + i] = cmf10[c]*dLamda*r;
+            }
+        }
+
+        for (int c=0; c<3; c++)
+            m_daylight[c*pixels + i] = interpolate(&daylightS[0][c], 3, TABLE_10NM_SIZE,
+                                                   (wavelength - TABLE_MIN_WAVELENGTH)/10);
+    }
+}
+
+// Reference illuminant at device pixels - Planckian radiator below 5000K
+// and CIE daylight above for CRI. TM-30 blends both between 4000K and
+// 5000K at equal luminous flux.
+void ColourMetrics::referenceSpectrum(double cct, bool tm30, TDoubleVec& reference)
+{
+    int pixels = m_pixels;
+    reference.resize(pixels);
+
+    double planckWeight = cct < 5000 ? 1 : 0;
+    if (tm30)
+        planckWeight = cct <= 4000 ? 1 : (cct >= 5000 ? 0 : (5000-cct)/1000);
+
+    double* ref = reference.data();
+    for (int i=0; i<pixels; i++)
+        ref[i] = 0;
+
+    if (planckWeight > 0)
+    {
+        m_planckRef.resize(pixels);
+        double* planck = m_planckRef.data();
+        for (int i=0; i<pixels; i++)
+            planck[i] = planckRadiation(m_wavelengths.at(i), cct);
+        double Y = dotProduct(planck, m_tcsWeights.constData() + pixels, pixels);
+        for (int i=0; i<pixels && Y > 0; i++)
+            ref[i] += planckWeight*planck[i]/Y;
+    }
+
+    if (planckWeight < 1)
+    {
+        // CIE daylight chromaticity
+        double t = cct < 4000 ? 4000 : (cct > 25000 ? 25000 : cct);
+        double xD = t <= 7000
+            ? -4.6070e9/(t*t*t) + 2.9678e6/(t*t) + 0.09911e3/t + 0.244063
+            : -2.0064e9/(t*t*t) + 1.9018e6/(t*t) + 0.24748e3/t + 0.237040;
+        double yD = -3.0*xD*xD + 2.87*xD - 0.275;
+        double M = 0.0241 + 0.2562*xD - 0.7341*yD;
+        double M1 = (-1.3515 - 1.7703*xD + 5.9114*yD)/M;
+        double M2 = (0.0300 - 31.4424*xD + 30.0717*yD)/M;
+
+        m_daylightRef.resize(pixels);
+        double* daylight = m_daylightRef.data();
+        for (int i=0; i<pixels; i++)
+            daylight[i] = m_daylight.at(i) + M1*m_daylight.at(pixels+i) + M2*m_daylight.at(2*pixels+i);
+        double Y = dotProduct(daylight, m_tcsWeights.constData() + pixels, pixels);
+        for (int i=0; i<pixels && Y > 0; i++)
+            ref[i] += (1-planckWeight)*daylight[i]/Y;
+    }
+}
+
+// XYZ of white and samples lit by the spectrum - triples for white first
+// and then each sample
+void ColourMetrics::sampleColours(const TDoubleVec& spectrum, const TDoubleVec& weights,
+                                  int samples, TDoubleVec& xyz)
+{
+    xyz.resize((samples+1)*3);
+    for (int i=0; i<xyz.size(); i++)
+        xyz[i] = dotProduct(spectrum.constData(), weights.constData() + i*m_pixels, m_pixels);
+}
+
+// CIE 13.3 - von Kries adaptation in CIE 1960 UCS and colour differences
+// in CIE 1964 U*V*W*
+void ColourMetrics::calculateCRI(const TDoubleVec& spectrum, TColourMetrics& metrics)
+{
+    referenceSpectrum(metrics.CCT, false, m_reference);
+    sampleColours(spectrum, m_tcsWeights, CIE_TCS_COUNT, m_testXYZ);
+    sampleColours(m_reference, m_tcsWeights, CIE_TCS_COUNT, m_refXYZ);
+
+    double uk, vk, ur, vr;
+    xyzToUV(m_testXYZ.constData(), uk, vk);
+    xyzToUV(m_refXYZ.constData(), ur, vr);
+
+    double ck = (4 - uk - 10*vk)/vk, dk = (1.708*vk + 0.404 - 1.481*uk)/vk;
+    double cr = (4 - ur - 10*vr)/vr, dr = (1.708*vr + 0.404 - 1.481*ur)/vr;
+    double testScale = 100/m_testXYZ.at(1);
+    double refScale = 100/m_refXYZ.at(1);
+
+    metrics.Ra = 0;
+    for (int s=0; s<CIE_TCS_COUNT; s++)
+    {
+        const double* test = m_testXYZ.constData() + (s+1)*3;
+        const double* ref = m_refXYZ.constData() + (s+1)*3;
+
+        // sample under test source adapted to the reference
+        double u, v;
+        xyzToUV(test, u, v);
+        double c = (4 - u - 10*v)/v, d = (1.708*v + 0.404 - 1.481*u)/v;
+        double denom = 16.518 + 1.481*(cr/ck)*c - (dr/dk)*d;
+        double uka = (10.872 + 0.404*(cr/ck)*c - 4*(dr/dk)*d)/denom;
+        double vka = 5.520/denom;
+
+        double Wk = 25*pow(test[1]*testScale, 1.0/3) - 17;
+        double Uk = 13*Wk*(uka - ur);
+        double Vk = 13*Wk*(vka - vr);
+
+        double uri, vri;
+        xyzToUV(ref, uri, vri);
+        double Wr = 25*pow(ref[1]*refScale, 1.0/3) - 17;
+        double Ur = 13*Wr*(uri - ur);
+        double Vr = 13*Wr*(vri - vr);
+
+        double dE = sqrt((Uk-Ur)*(Uk-Ur) + (Vk-Vr)*(Vk-Vr) + (Wk-Wr)*(Wk-Wr));
+        metrics.R[s] = 100 - 4.6*dE;
+        if (s < 8)
+            metrics.Ra += metrics.R[s]/8;
+    }
+
+    metrics.criValid = fabs(metrics.Duv) < 5.4e-3;
+}
+
+// IES TM-30-18 - CAM02-UCS colour differences of the colour evaluation
+// samples for fidelity and 16 hue bins averages for gamut
+void ColourMetrics::calculateTM30(const TDoubleVec& spectrum, TColourMetrics& metrics)
+{
+    const int bins = 16;
+
+    referenceSpectrum(metrics.CCT, true, m_reference);
+    sampleColours(spectrum, m_cesWeights, m_cesCount, m_testXYZ);
+    sampleColours(m_reference, m_cesWeights, m_cesCount, m_refXYZ);
+
+    // normalise to Y = 100 of white
+    double testScale = 100/m_testXYZ.at(1);
+    double refScale = 100/m_refXYZ.at(1);
+    for (int i=0; i<m_testXYZ.size(); i++)
+    {
+        m_testXYZ[i] *= testScale;
+        m_refXYZ[i] *= refScale;
+    }
+
+    TCam02 testCam(m_testXYZ.constData(), 100, 20, 1);
+    TCam02 refCam(m_refXYZ.constData(), 100, 20, 1);
+
+    double sumDE = 0;
+    double testBins[bins][2], refBins[bins][2];
+    int binCount[bins];
+    memset(testBins, 0, sizeof(testBins));
+    memset(refBins, 0, sizeof(refBins));
+    memset(binCount, 0, sizeof(binCount));
+    for (int s=1; s<=m_cesCount; s++)
+    {
+        double test[3], ref[3];
+        testCam.ucs(m_testXYZ.constData() + s*3, test);
+        refCam.ucs(m_refXYZ.constData() + s*3, ref);
+
+        sumDE += sqrt(pow(test[0]-ref[0], 2) + pow(test[1]-ref[1], 2) + pow(test[2]-ref[2], 2));
+
+        // hue bin is chosen by reference hue
+        double h = atan2(ref[2], ref[1]);
+        if (h < 0)
+            h += 2*M_PI;
+        int bin = (int)(h/(2*M_PI)*bins);
+        if (bin >= bins)
+            bin = bins-1;
+        testBins[bin][0] += test[1];
+        testBins[bin][1] += test[2];
+        refBins[bin][0] += ref[1];
+        refBins[bin][1] += ref[2];
+        ++binCount[bin];
+    }
+
+    metrics.Rf = 10*log(exp((100 - 6.73*sumDE/m_cesCount)/10) + 1);
+
+    // gamut areas of polygons through the average colours of non empty
+    // bins, closed from the last bin back to the first
+    int used[bins];
+    int usedCount = 0;
+    for (int b=0; b<bins; b++)
+        if (binCount[b])
+            used[usedCount++] = b;
+
+    double testArea = 0, refArea = 0;
+    for (int i=0; i<usedCount; i++)
+    {
+        int prev = used[i];
+        int bin = used[(i+1) % usedCount];
+        testArea += (testBins[prev][0]*testBins[bin][1] - testBins[bin][0]*testBins[prev][1])
+                    /(binCount[prev]*binCount[bin]);
+        refArea += (refBins[prev][0]*refBins[bin][1] - refBins[bin][0]*refBins[prev][1])
+                   /(binCount[prev]*binCount[bin]);
+    }
+
+    metrics.Rg = refArea != 0 ? 100*testArea/refArea : 0;
+    metrics.tm30Valid = true;
+}
+
+bool ColourMetrics::calculate(const TDoubleVec& spectrum, TColourMetrics& metrics)
+{
+    memset(&metrics, 0, sizeof(metrics));
+    if (m_pixels < 2 || spectrum.size() < m_pixels)
+        return false;
+
+    // source white
+    sampleColours(spectrum, m_tcsWeights, 0, m_testXYZ);
+    double sum = m_testXYZ.at(0) + m_testXYZ.at(1) + m_testXYZ.at(2);
+    if (sum <= 0 || m_testXYZ.at(1) <= 0)
+        return false;
+
+    for (int c=0; c<3; c++)
+        metrics.XYZ[c] = m_testXYZ.at(c);
+    metrics.x = metrics.XYZ[0]/sum;
+    metrics.y = metrics.XYZ[1]/sum;
+    xyzToUV(metrics.XYZ, metrics.u, metrics.v);
+    calculateCCT(metrics.u, metrics.v, metrics.CCT, metrics.Duv);
+
+    sampleColours(spectrum, m_cesWeights, 0, m_testXYZ);
+    sum = m_testXYZ.at(0) + m_testXYZ.at(1) + m_testXYZ.at(2);
+    if (sum > 0)
+    {
+        metrics.x10 = m_testXYZ.at(0)/sum;
+        metrics.y10 = m_testXYZ.at(1)/sum;
+    }
+
+    calculateCRI(spectrum, metrics);
+    if (m_cesCount)
+        calculateTM30(spectrum, metrics);
+
+    return true;
+}
+
+bool ColourMetrics::calculate(SpectronDevice& spectron, TColourMetrics& metrics)
+{
+    update(spectron);
+    return calculate(spectron.getLastMeasurements(), metrics);
+}
@@ -0,0 +1,138 @@
+/*
+ *  spectron_colour.h - Colour metrics of spectral measurements from
+ *                      Hamamatsu sensors - CIE 1931 and 1964 observers,
+ *                      CCT and Duv, CIE 13.3 colour rendering index and
+ *                      IES TM-30-18 fidelity and gamut indices.
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_COLOUR_H
+#define SPECTRON_COLOUR_H
+
+#include <QString>
+#include "spectron_api.h"
+
+// Standard observers
+enum TObserver {
+    CIE_1931_2DEG  = 0,
+    CIE_1964_10DEG = 1
+};
+
+// Tabulated colour matching functions range and step (1nm)
+#define CIE_CMF_MIN_WAVELENGTH  380
+#define CIE_CMF_MAX_WAVELENGTH  780
+#define CIE_CMF_SIZE            (CIE_CMF_MAX_WAVELENGTH-CIE_CMF_MIN_WAVELENGTH+1)
+
+// CIE 13.3 test colour samples
+#define CIE_TCS_COUNT           14
+
+// Colour matching functions x,y,z values at the wavelength, linearly
+// interpolated between 1nm table values. Returns false (and zeros) outside
+// of the table range.
+bool cieColourMatch(TObserver observer, double wavelength, double* xyz);
+
+// Planckian radiator relative spectral power at the wavelength in nm
+double planckRadiation(double wavelength, double tempK);
+
+// Colour metrics of a spectrum
+struct TColourMetrics
+{
+    double XYZ[3];            // CIE 1931 tristimulus values
+    double x, y;              // CIE 1931 chromaticity
+    double x10, y10;          // CIE 1964 chromaticity
+    double u, v;              // CIE 1960 UCS chromaticity
+    double CCT;               // correlated colour temperature, K
+    double Duv;               // distance from Planckian locus in CIE 1960 UCS, positive above
+    double Ra;                // CIE 13.3 general colour rendering index
+    double R[CIE_TCS_COUNT];  // special colour rendering indices R1..R14 (R9 is R[8])
+    bool   criValid;          // Duv is within 5.4E-3 as CIE 13.3 requires
+    double Rf;                // IES TM-30-18 fidelity index
+    double Rg;                // IES TM-30-18 gamut index
+    bool   tm30Valid;         // TM-30 samples are loaded and indices are calculated
+};
+
+//
+// Colour metrics engine. Colour matching functions and colour sample
+// reflectances are resampled once into device pixel space as weights
+// (including pixel wavelength intervals), so tristimulus values of the
+// test source and every sample under it or under the reference illuminant
+// are dot products with the spectrum. The tables are rebuilt only when the
+// device wavelengths (calibration or range) change.
+//
+// The CRI samples are built in. TM-30 requires the 99 colour evaluation
+// samples loaded from CSV file (as distributed with IES TM-30-18).
+//
+class ColourMetrics
+{
+public:
+    ColourMetrics();
+
+    // Load TM-30 colour evaluation samples reflectances. CSV lines are
+    // wavelength in nm followed by sample reflectances, lines not starting
+    // with a number are skipped.
+    bool loadTM30Samples(const QString& fileName);
+    int  tm30Samples() const                { return m_cesCount; }
+
+    // rebuild pixel space tables if the device or its wavelengths have changed
+    void update(SpectronDevice& spectron);
+
+    // build pixel space tables for the wavelengths of spectra not coming
+    // from a device
+    void setWavelengths(const TDoubleVec& wavelengths);
+
+    // metrics of the spectrum sampled at device pixels - update() must
+    // be called first, returns false for empty spectrum
+    bool calculate(const TDoubleVec& spectrum, TColourMetrics& metrics);
+
+    // metrics of the last measurement of the device
+    bool calculate(SpectronDevice& spectron, TColourMetrics& metrics);
+
+private:
+    void buildTables();
+    void referenceSpectrum(double cct, bool tm30, TDoubleVec& reference);
+    void sampleColours(const TDoubleVec& spectrum, const TDoubleVec& weights,
+                       int samples, TDoubleVec& xyz);
+    void calculateCRI(const TDoubleVec& spectrum, TColourMetrics& metrics);
+    void calculateTM30(const TDoubleVec& spectrum, TColourMetrics& metrics);
+
+    // members
+    SpectronDevice* m_device;
+    int             m_version;
+    TDoubleVec      m_wavelengths;
+    int             m_pixels;
+
+    // pixel space tables, rows of m_pixels values
+    TDoubleVec      m_tcsWeights;    // CIE 1931 x,y,z for white and each CRI sample
+    TDoubleVec      m_cesWeights;    // CIE 1964 x,y,z for white and each TM-30 sample
+    TDoubleVec      m_daylight;      // CIE daylight S0, S1 and S2 components
+
+    // TM-30 samples as loaded
+    TDoubleVec      m_cesWavelengths;
+    TDoubleVec      m_cesReflectance; // sample rows of m_cesWavelengths size
+    int             m_cesCount;
+
+    // per frame work buffers
+    TDoubleVec      m_reference;
+    TDoubleVec      m_planckRef;
+    TDoubleVec      m_daylightRef;
+    TDoubleVec      m_testXYZ;
+    TDoubleVec      m_refXYZ;
+};
+
+#endif // SPECTRON_COLOUR_H
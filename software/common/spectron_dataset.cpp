@@ -0,0 +1,366 @@
+/*
+ *  spectron_dataset.cpp - Binary spectral dataset files for measurements
+ *                         from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_dataset.h"
+#include "spectron_export.h"
+
+#include <QSysInfo>
+#include <QDateTime>
+#include <string.h>
+
+// file identification
+static const quint32 c_datasetMagic   = 0x44435053;   // "SPCD"
+static const quint16 c_datasetVersion = 1;
+
+// structures are used directly over the file data
+Q_STATIC_ASSERT(sizeof(TDatasetHeader) == 120);
+Q_STATIC_ASSERT(sizeof(TDatasetRecord) == 32);
+
+static inline int recordSize(int pixels)
+{
+    return sizeof(TDatasetRecord) + ((pixels*sizeof(float) + 7) & ~7);
+}
+
+// header is valid for the file of given size
+static bool validHeader(const TDatasetHeader& header, qint64 fileSize)
+{
+    return header.magic == c_datasetMagic
+           && header.version == c_datasetVersion
+           && header.headerSize >= sizeof(TDatasetHeader) + header.pixels*sizeof(double)
+           && header.recordSize >= sizeof(TDatasetRecord) + header.pixels*sizeof(float)
+           && header.headerSize % 8 == 0
+           && header.recordSize % 8 == 0
+           && fileSize >= header.headerSize;
+}
+
+// ---------------------------
+//     Dataset writer
+// ---------------------------
+
+SpectronDatasetWriter::SpectronDatasetWriter()
+    : m_pixels(0), m_recordSize(0), m_frames(0)
+{
+}
+
+SpectronDatasetWriter::~SpectronDatasetWriter()
+{
+    close();
+}
+
+bool SpectronDatasetWriter::open(const QString& fileName, SpectronDevice& device, bool append)
+{
+    close();
+    m_lastErrorStr.clear();
+
+    if (QSysInfo::ByteOrder != QSysInfo::LittleEndian)
+    {
+        m_lastErrorStr = "Datasets are only supported on little endian hosts";
+        return false;
+    }
+
+    m_file.setFileName(fileName);
+    int pixels = device.getWavelengths().size();
+
+    if (append && m_file.exists() && m_file.size() > 0)
+    {
+        if (!m_file.open(QIODevice::ReadWrite))
+        {
+            m_lastErrorStr = m_file.errorString();
+            return false;
+        }
+
+        TDatasetHeader header;
+        if (m_file.read((char*)&header, sizeof(header)) != sizeof(header)
+            || !validHeader(header, m_file.size()))
+        {
+            m_lastErrorStr = "Not a dataset file";
+            m_file.close();
+            return false;
+        }
+        if (header.pixels != pixels)
+        {
+            m_lastErrorStr = "Dataset has different number of pixels";
+            m_file.close();
+            return false;
+        }
+
+        // drop incomplete record of the interrupted writer
+        m_pixels = pixels;
+        m_recordSize = header.recordSize;
+        m_frames = (m_file.size() - header.headerSize)/m_recordSize;
+        qint64 end = header.headerSize + (qint64)m_frames*m_recordSize;
+        if (!m_file.resize(end) || !m_file.seek(end))
+        {
+            m_lastErrorStr = m_file.errorString();
+            m_file.close();
+            return false;
+        }
+    }
+    else
+    {
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            m_lastErrorStr = m_file.errorString();
+            return false;
+        }
+
+        TDatasetHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = c_datasetMagic;
+        header.version = c_datasetVersion;
+        header.pixels = pixels;
+        header.headerSize = sizeof(header) + pixels*sizeof(double);
+        header.recordSize = recordSize(pixels);
+        header.createdMs = QDateTime::currentMSecsSinceEpoch();
+        memcpy(header.specCalibration, device.getSpecCalibration(), sizeof(header.specCalibration));
+        header.minWavelength = device.getMinWavelength();
+        header.maxWavelength = device.getMaxWavelength();
+        header.satVoltage[0] = device.getSatVoltage(SpectronDevice::NO_GAIN);
+        header.satVoltage[1] = device.getSatVoltage(SpectronDevice::HIGH_GAIN);
+        header.minBlackVoltage = device.getMinBlackVoltage();
+        header.pixelOffset = device.getPixelOffset();
+        header.supportsGain = device.supportsGain();
+        header.adcRef = device.getADCReference();
+        header.gain = device.getGain();
+        header.measType = device.getMeasureType();
+        header.spectralCorrection = device.applySpectralCorrections();
+
+        QByteArray data((const char*)&header, sizeof(header));
+        data.append((const char*)device.getWavelengths().constData(), pixels*sizeof(double));
+        if (m_file.write(data) != data.size() || !m_file.flush())
+        {
+            m_lastErrorStr = m_file.errorString();
+            m_file.close();
+            return false;
+        }
+
+        m_pixels = pixels;
+        m_recordSize = header.recordSize;
+        m_frames = 0;
+    }
+
+    // record buffer is reused for all frames, padding stays zero
+    m_record.fill(0, m_recordSize);
+
+    return true;
+}
+
+void SpectronDatasetWriter::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+    m_frames = 0;
+}
+
+bool SpectronDatasetWriter::append(SpectronDevice& device, int position, int integTimeUs)
+{
+    TDatasetRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = device.getLastFrameSeq();
+    record.integTimeUs = integTimeUs > 0 ? integTimeUs : device.getIntegTime();
+    record.position = position;
+    record.adcRef = device.getADCReference();
+    record.gain = device.getGain();
+    record.measType = device.getMeasureType();
+    record.dataType = SpectronDevice::ET_MEASUREMENT;
+    record.timeMs = QDateTime::currentMSecsSinceEpoch();
+
+    return append(record, device.getLastMeasurements());
+}
+
+bool SpectronDatasetWriter::append(const TDatasetRecord& record, const TDoubleVec& values)
+{
+    if (!m_file.isOpen())
+    {
+        m_lastErrorStr = "Dataset is not open";
+        return false;
+    }
+    if (values.size() != m_pixels)
+    {
+        m_lastErrorStr = "Frame has different number of pixels";
+        return false;
+    }
+
+    char* data = m_record.data();
+    TDatasetRecord* rec = (TDatasetRecord*)data;
+    float* out = (float*)(rec + 1);
+    const double* in = values.constData();
+
+    *rec = record;
+    float maxValue = 0;
+    for (int i=0; i<m_pixels; i++)
+    {
+        out[i] = (float)in[i];
+        if (maxValue < out[i])
+            maxValue = out[i];
+    }
+    rec->maxValue = maxValue;
+
+    // flush each frame so that it is kept if the scan is interrupted
+    if (m_file.write(m_record) != m_record.size() || !m_file.flush())
+    {
+        m_lastErrorStr = m_file.errorString();
+        return false;
+    }
+
+    ++m_frames;
+    return true;
+}
+
+// ---------------------------
+//     Dataset reader
+// ---------------------------
+
+SpectronDatasetReader::SpectronDatasetReader()
+    : m_data(NULL), m_headerSize(0), m_recordSize(0), m_frames(0)
+{
+}
+
+SpectronDatasetReader::~SpectronDatasetReader()
+{
+    close();
+}
+
+bool SpectronDatasetReader::open(const QString& fileName)
+{
+    close();
+    m_lastErrorStr.clear();
+
+    if (QSysInfo::ByteOrder != QSysInfo::LittleEndian)
+    {
+        m_lastErrorStr = "Datasets are only supported on little endian hosts";
+        return false;
+    }
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        m_lastErrorStr = m_file.errorString();
+        return false;
+    }
+
+    if (!map())
+    {
+        m_file.close();
+        return false;
+    }
+
+    return true;
+}
+
+void SpectronDatasetReader::close()
+{
+    if (m_data)
+        m_file.unmap(m_data);
+    m_data = NULL;
+    m_frames = 0;
+
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+bool SpectronDatasetReader::refresh()
+{
+    if (!m_file.isOpen())
+        return false;
+
+    if (m_data)
+        m_file.unmap(m_data);
+    m_data = NULL;
+
+    return map();
+}
+
+bool SpectronDatasetReader::map()
+{
+    qint64 size = m_file.size();
+    if (size < (qint64)sizeof(TDatasetHeader))
+    {
+        m_lastErrorStr = "Not a dataset file";
+        return false;
+    }
+
+    m_data = m_file.map(0, size);
+    if (!m_data)
+    {
+        m_lastErrorStr = m_file.errorString();
+        return false;
+    }
+
+    if (!validHeader(header(), size))
+    {
+        m_lastErrorStr = "Not a dataset file";
+        m_file.unmap(m_data);
+        m_data = NULL;
+        return false;
+    }
+
+    // trailing incomplete record is still being written
+    m_headerSize = header().headerSize;
+    m_recordSize = header().recordSize;
+    m_frames = (size - m_headerSize)/m_recordSize;
+
+    return true;
+}
+
+bool SpectronDatasetReader::saveCSV(const QString& fileName, bool compress)
+{
+    return save(fileName, SpectronExportWriter::EF_CSV, compress);
+}
+
+bool SpectronDatasetReader::saveJSON(const QString& fileName, bool compress)
+{
+    return save(fileName, SpectronExportWriter::EF_JSON, compress);
+}
+
+bool SpectronDatasetReader::save(const QString& fileName, int format, bool compress)
+{
+    if (!m_data)
+    {
+        m_lastErrorStr = "Dataset is not open";
+        return false;
+    }
+
+    TDoubleVec wavelengthVec(pixels());
+    memcpy(wavelengthVec.data(), wavelengths(), pixels()*sizeof(double));
+
+    SpectronExportWriter writer;
+    bool success = writer.open(fileName,
+                               (SpectronExportWriter::TFormat)format,
+                               wavelengthVec,
+                               compress);
+
+    // frame values are written straight from the mapped file
+    qint64 createdMs = header().createdMs;
+    for (int f=0; f<m_frames && success; f++)
+    {
+        TDatasetRecord rec = record(f);
+        rec.timeMs -= createdMs;
+        success = writer.writeFrame(rec, values(f));
+    }
+
+    success = writer.close() && success;
+    if (!success)
+        m_lastErrorStr = writer.getLastError();
+
+    return success;
+}
@@ -0,0 +1,167 @@
+/*
+ *  spectron_dataset.h - Binary spectral dataset files for measurements
+ *                       from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_DATASET_H
+#define SPECTRON_DATASET_H
+
+#include <QFile>
+#include <QString>
+#include "spectron_api.h"
+
+//
+// Dataset file layout (little endian):
+//
+//   TDatasetHeader
+//   double wavelengths[pixels]
+//   records - each is TDatasetRecord followed by float values[pixels]
+//             padded to recordSize (multiple of 8 bytes)
+//
+// The structures have natural alignment and are used directly over the
+// memory mapped file, so the record is reached by its index without any
+// parsing. Frame count is not stored - it is the number of complete
+// records in the file, so the file stays valid if the writer is stopped
+// at any point and can be read while it is being appended.
+//
+
+// File header - device settings when the dataset was created
+struct TDatasetHeader
+{
+    quint32 magic;                  // "SPCD"
+    quint16 version;
+    quint16 pixels;                 // values in each record
+    quint32 headerSize;             // offset of the first record
+    quint32 recordSize;             // record stride
+    qint64  createdMs;              // creation time since epoch
+    double  specCalibration[6];     // wavelength polynomial coefficients
+    double  minWavelength;
+    double  maxWavelength;
+    double  satVoltage[2];          // sensor saturation voltage without/with gain
+    double  minBlackVoltage;
+    quint16 pixelOffset;            // index of the first pixel in sensor range
+    quint8  supportsGain;
+    quint8  adcRef;                 // SpectronDevice::TAdcRef
+    quint8  gain;                   // SpectronDevice::TGain
+    quint8  measType;               // SpectronDevice::TMeasType
+    quint8  spectralCorrection;     // spectral response correction applied
+    quint8  reserved;
+};
+
+// Frame record metadata - pixel values follow
+struct TDatasetRecord
+{
+    quint32 seq;                    // frame sequence number
+    quint32 integTimeUs;            // integration time
+    qint32  position;               // monochromator position, 0 if not scanning
+    quint8  adcRef;                 // SpectronDevice::TAdcRef
+    quint8  gain;                   // SpectronDevice::TGain
+    quint8  measType;               // SpectronDevice::TMeasType
+    quint8  dataType;               // SpectronDevice::TDataType
+    qint64  timeMs;                 // frame time since epoch
+    float   maxValue;
+    quint32 reserved;
+};
+
+//
+// Creates dataset file or appends frames to existing one. Each frame is
+// written with a single call and flushed, so the complete frames are kept
+// if the scan is interrupted.
+//
+class SpectronDatasetWriter
+{
+public:
+    SpectronDatasetWriter();
+    ~SpectronDatasetWriter();
+
+    // create the file with header from the current device settings, or
+    // append to existing dataset which must have the same number of pixels
+    bool open(const QString& fileName, SpectronDevice& device, bool append = false);
+    void close();
+    bool isOpen()                   { return m_file.isOpen(); }
+
+    // append the last measurement of the device, integTimeUs 0 takes
+    // integration time from the device
+    bool append(SpectronDevice& device, int position = 0, int integTimeUs = 0);
+    // append frame with explicit metadata, maxValue is calculated
+    bool append(const TDatasetRecord& record, const TDoubleVec& values);
+
+    int frames()                    { return m_frames; }
+    QString& getLastError()         { return m_lastErrorStr; }
+
+private:
+    // members
+    QFile       m_file;
+    int         m_pixels;
+    int         m_recordSize;
+    int         m_frames;
+    QByteArray  m_record;
+    QString     m_lastErrorStr;
+};
+
+//
+// Reads dataset file through memory mapping - header, wavelengths and
+// records point straight into the mapped file and are valid until the
+// reader is closed or refreshed.
+//
+class SpectronDatasetReader
+{
+public:
+    SpectronDatasetReader();
+    ~SpectronDatasetReader();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen()                   { return m_data != NULL; }
+
+    // map the file again to pick up frames appended since it was opened
+    bool refresh();
+
+    const TDatasetHeader& header()  { return *(const TDatasetHeader*)m_data; }
+    const double* wavelengths()     { return (const double*)(m_data + sizeof(TDatasetHeader)); }
+    int pixels()                    { return header().pixels; }
+    int frames()                    { return m_frames; }
+
+    const TDatasetRecord& record(int frame)
+        { return *(const TDatasetRecord*)(m_data + m_headerSize + (qint64)frame*m_recordSize); }
+    const float* values(int frame)
+        { return (const float*)(&record(frame) + 1); }
+
+    // convert to CSV or JSON (spectron_export.h) one frame at a time,
+    // frame times are written since dataset creation
+    bool saveCSV(const QString& fileName, bool compress = false);
+    bool saveJSON(const QString& fileName, bool compress = false);
+
+    QString& getLastError()         { return m_lastErrorStr; }
+
+private:
+    bool map();
+    bool save(const QString& fileName, int format, bool compress);
+
+    // members
+    QFile       m_file;
+    uchar*      m_data;
+    qint64      m_headerSize;
+    qint64      m_recordSize;
+    int         m_frames;
+    QString     m_lastErrorStr;
+};
+
+#endif // SPECTRON_DATASET_H
@@ -0,0 +1,408 @@
+/*
+ *  spectron_export.cpp - Streaming CSV and JSON export of measurements
+ *                        from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_export.h"
+
+#include <QtEndian>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// output buffer size - also the size of compressed gzip members
+static const int c_bufferSize = 256*1024;
+// space reserved for a single formatted number
+static const int c_numberSize = 32;
+// values above this are written in exponent form
+static const double c_maxFixed = 1e12;
+// qCompress() compression level
+static const int c_compressLevel = 6;
+
+// column names for SpectronDevice::TDataType
+static const char* c_dataTypeNames[] = {
+    "measurement", "black", "normalisation", "noise"
+};
+
+// ---------------------------
+//     gzip helpers
+// ---------------------------
+
+// CRC-32 as used by gzip (polynomial 0xEDB88320)
+static quint32 crc32(const uchar* data, int size)
+{
+    static quint32 table[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (quint32 i=0; i<256; i++)
+        {
+            quint32 c = i;
+            for (int k=0; k<8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+
+    quint32 crc = 0xFFFFFFFF;
+    for (int i=0; i<size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+// gzip member for the data - qCompress() output is 4 byte length and
+// zlib stream, which is 2 byte header, raw deflate data and 4 byte adler32
+static QByteArray gzipMember(const char* data, int size)
+{
+    QByteArray zlib = qCompress((const uchar*)data, size, c_compressLevel);
+    if (zlib.size() < 10)
+        return QByteArray();
+
+    static const char header[10] = {
+        '\x1f', '\x8b',             // magic
+        8,                          // deflate
+        0,                          // no flags
+        0, 0, 0, 0,                 // no modification time
+        0,                          // no extra flags
+        '\xff'                      // unknown OS
+    };
+
+    uchar trailer[8];
+    qToLittleEndian<quint32>(crc32((const uchar*)data, size), trailer);
+    qToLittleEndian<quint32>(size, trailer+4);
+
+    QByteArray member;
+    member.reserve(zlib.size() + 12);
+    member.append(header, sizeof(header));
+    member.append(zlib.constData()+6, zlib.size()-10);
+    member.append((const char*)trailer, sizeof(trailer));
+
+    return member;
+}
+
+// ---------------------------
+//     Export writer
+// ---------------------------
+
+SpectronExportWriter::SpectronExportWriter()
+    : m_format(EF_CSV), m_compress(false), m_pixels(0), m_frames(0),
+      m_decimals(6), m_scale(1000000), m_used(0), m_failed(false)
+{
+}
+
+SpectronExportWriter::~SpectronExportWriter()
+{
+    close();
+}
+
+void SpectronExportWriter::setDecimals(int decimals)
+{
+    m_decimals = qBound(0, decimals, 6);
+    m_scale = 1;
+    for (int i=0; i<m_decimals; i++)
+        m_scale *= 10;
+}
+
+bool SpectronExportWriter::open(const QString& fileName,
+                                TFormat format,
+                                const TDoubleVec& wavelengths,
+                                bool compress)
+{
+    close();
+    m_lastErrorStr.clear();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        m_lastErrorStr = m_file.errorString();
+        return false;
+    }
+
+    m_format = format;
+    m_compress = compress;
+    m_pixels = wavelengths.size();
+    m_frames = 0;
+    m_failed = false;
+    m_buffer.resize(c_bufferSize);
+    m_used = 0;
+
+    if (m_format == EF_JSON)
+    {
+        put("{\"wavelengths\":[");
+        for (int i=0; i<m_pixels; i++)
+        {
+            if (i)
+                put(',');
+            putDouble(wavelengths.at(i));
+        }
+        put("],\n\"frames\":[");
+    }
+    else
+    {
+        put("type,seq,position,integration_us,adc_ref,gain,meas_type,time_ms");
+        for (int i=0; i<m_pixels; i++)
+        {
+            put(',');
+            putDouble(wavelengths.at(i));
+        }
+        put('\n');
+    }
+
+    return !m_failed;
+}
+
+bool SpectronExportWriter::close()
+{
+    if (!m_file.isOpen())
+        return !m_failed;
+
+    if (m_format == EF_JSON)
+        put("\n]}\n");
+    writeBuffer();
+
+    if (!m_failed && !m_file.flush())
+    {
+        m_lastErrorStr = m_file.errorString();
+        m_failed = true;
+    }
+    m_file.close();
+    m_buffer.clear();
+
+    return !m_failed;
+}
+
+bool SpectronExportWriter::writeFrame(const TDatasetRecord& record, const TDoubleVec& values)
+{
+    if (values.size() != m_pixels)
+    {
+        m_lastErrorStr = "Frame has different number of pixels";
+        return false;
+    }
+
+    return writeValues(record, values.constData());
+}
+
+bool SpectronExportWriter::writeFrame(const TDatasetRecord& record, const float* values)
+{
+    return writeValues(record, values);
+}
+
+template <typename T>
+bool SpectronExportWriter::writeValues(const TDatasetRecord& record, const T* values)
+{
+    if (!m_file.isOpen())
+    {
+        m_lastErrorStr = "Export file is not open";
+        return false;
+    }
+
+    const char* typeName = record.dataType < (int)(sizeof(c_dataTypeNames)/sizeof(c_dataTypeNames[0]))
+                               ? c_dataTypeNames[record.dataType]
+                               : "unknown";
+
+    if (m_format == EF_JSON)
+    {
+        put(m_frames ? ",\n{\"type\":\"" : "\n{\"type\":\"");
+        put(typeName);
+        put("\",\"seq\":");
+        putInt(record.seq);
+        put(",\"position\":");
+        putInt(record.position);
+        put(",\"integration_us\":");
+        putInt(record.integTimeUs);
+        put(",\"adc_ref\":");
+        putInt(record.adcRef);
+        put(",\"gain\":");
+        putInt(record.gain);
+        put(",\"meas_type\":");
+        putInt(record.measType);
+        put(",\"time_ms\":");
+        putInt(record.timeMs);
+        put(",\"values\":[");
+        for (int i=0; i<m_pixels; i++)
+        {
+            if (i)
+                put(',');
+            putDouble(values[i]);
+        }
+        put("]}");
+    }
+    else
+    {
+        put(typeName);
+        put(',');
+        putInt(record.seq);
+        put(',');
+        putInt(record.position);
+        put(',');
+        putInt(record.integTimeUs);
+        put(',');
+        putInt(record.adcRef);
+        put(',');
+        putInt(record.gain);
+        put(',');
+        putInt(record.measType);
+        put(',');
+        putInt(record.timeMs);
+        for (int i=0; i<m_pixels; i++)
+        {
+            put(',');
+            putDouble(values[i]);
+        }
+        put('\n');
+    }
+
+    ++m_frames;
+    return !m_failed;
+}
+
+// ---------------------------
+//     Formatting
+// ---------------------------
+
+void SpectronExportWriter::reserve(int size)
+{
+    if (m_used + size > m_buffer.size())
+        writeBuffer();
+}
+
+void SpectronExportWriter::put(char c)
+{
+    reserve(1);
+    m_buffer.data()[m_used++] = c;
+}
+
+void SpectronExportWriter::put(const char* str)
+{
+    int len = strlen(str);
+    reserve(len);
+    memcpy(m_buffer.data()+m_used, str, len);
+    m_used += len;
+}
+
+void SpectronExportWriter::putInt(qint64 value)
+{
+    reserve(c_numberSize);
+    char* out = m_buffer.data()+m_used;
+
+    quint64 absValue = value < 0 ? -(quint64)value : value;
+    if (value < 0)
+        *out++ = '-';
+
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = '0' + absValue%10;
+        absValue /= 10;
+    } while (absValue);
+    while (count)
+        *out++ = digits[--count];
+
+    m_used = out - m_buffer.data();
+}
+
+// fixed point with trailing zeros removed - value is scaled and rounded
+// to integer once, so the digits are produced with integer arithmetic
+void SpectronExportWriter::putDouble(double value)
+{
+    reserve(c_numberSize);
+    char* out = m_buffer.data()+m_used;
+
+    // not a number or infinity - empty CSV field, null in JSON
+    if (value != value || value - value != 0)
+    {
+        if (m_format == EF_JSON)
+        {
+            memcpy(out, "null", 4);
+            m_used += 4;
+        }
+        return;
+    }
+
+    if (fabs(value) >= c_maxFixed)
+    {
+        m_used += qsnprintf(out, c_numberSize, "%.6g", value);
+        return;
+    }
+
+    qint64 scaled = qRound64(fabs(value)*m_scale);
+    if (value < 0 && scaled)
+        *out++ = '-';
+
+    qint64 intPart = scaled/m_scale;
+    qint64 fraction = scaled%m_scale;
+
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = '0' + intPart%10;
+        intPart /= 10;
+    } while (intPart);
+    while (count)
+        *out++ = digits[--count];
+
+    if (fraction)
+    {
+        *out++ = '.';
+        int decimals = m_decimals;
+        while (fraction%10 == 0)
+        {
+            fraction /= 10;
+            --decimals;
+        }
+        for (int i=decimals-1; i>=0; i--)
+        {
+            out[i] = '0' + fraction%10;
+            fraction /= 10;
+        }
+        out += decimals;
+    }
+
+    m_used = out - m_buffer.data();
+}
+
+// write out the buffer, compressed as a separate gzip member if needed
+void SpectronExportWriter::writeBuffer()
+{
+    if (m_used == 0)
+        return;
+
+    if (!m_failed)
+    {
+        bool success;
+        if (m_compress)
+        {
+            QByteArray member = gzipMember(m_buffer.constData(), m_used);
+            success = !member.isEmpty() && m_file.write(member) == member.size();
+        }
+        else
+            success = m_file.write(m_buffer.constData(), m_used) == m_used;
+
+        if (!success)
+        {
+            m_lastErrorStr = m_file.errorString();
+            m_failed = true;
+        }
+    }
+
+    m_used = 0;
+}
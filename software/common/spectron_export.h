@@ -0,0 +1,102 @@
+/*
+ *  spectron_export.h - Streaming CSV and JSON export of measurements
+ *                      from Hamamatsu sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_EXPORT_H
+#define SPECTRON_EXPORT_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include "spectron_dataset.h"
+
+//
+// Writes frames (measurements, black levels, normalisation coefficients)
+// to CSV or JSON file as they come. Text is formatted straight into a
+// fixed size buffer which is written out when full, so the memory used
+// does not depend on the number of frames.
+//
+// CSV has one line per frame with frame metadata followed by the pixel
+// values, the first line has column names and pixel wavelengths. JSON
+// is an object with "wavelengths" array and "frames" array of objects
+// with the same metadata and "values" array.
+//
+// Values are written in fixed point with set number of decimals and
+// trailing zeros removed. Compressed output is gzip - each full buffer
+// is compressed with qCompress() and written as a separate gzip member,
+// gzip readers handle such files as one stream.
+//
+class SpectronExportWriter
+{
+public:
+    enum TFormat {
+        EF_CSV  = 0,
+        EF_JSON = 1
+    };
+
+    SpectronExportWriter();
+    ~SpectronExportWriter();
+
+    // digits after decimal point (0..6) for values and wavelengths
+    void setDecimals(int decimals);
+
+    bool open(const QString& fileName,
+              TFormat format,
+              const TDoubleVec& wavelengths,
+              bool compress = false);
+    // finish and close the file, returns false if any write has failed
+    bool close();
+    bool isOpen()                   { return m_file.isOpen(); }
+
+    // record supplies frame metadata, values must have the same number
+    // of pixels as wavelengths
+    bool writeFrame(const TDatasetRecord& record, const TDoubleVec& values);
+    bool writeFrame(const TDatasetRecord& record, const float* values);
+
+    int frames()                    { return m_frames; }
+    QString& getLastError()         { return m_lastErrorStr; }
+
+private:
+    template <typename T>
+    bool writeValues(const TDatasetRecord& record, const T* values);
+
+    void put(char c);
+    void put(const char* str);
+    void putInt(qint64 value);
+    void putDouble(double value);
+    void reserve(int size);
+    void writeBuffer();
+
+    // members
+    QFile       m_file;
+    TFormat     m_format;
+    bool        m_compress;
+    int         m_pixels;
+    int         m_frames;
+    int         m_decimals;
+    qint64      m_scale;        // 10^m_decimals
+    QByteArray  m_buffer;
+    int         m_used;
+    bool        m_failed;
+    QString     m_lastErrorStr;
+};
+
+#endif // SPECTRON_EXPORT_H
@@ -0,0 +1,204 @@
+/*
+ *  spectron_frame.cpp - Local binary frame transport for Spectron boards
+ *                       with Hamamatsu Micro Spectrometer sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_frame.h"
+
+#include <QtEndian>
+#include <string.h>
+
+// packet identification - must match board firmware
+static const quint32 c_frameMagic      = 0x46435053;   // "SPCF"
+static const quint16 c_frameVersion    = 1;
+static const int     c_frameHeaderSize = 40;
+
+// ---------------------------
+//     Frame packet parsing
+// ---------------------------
+
+int parseFramePacket(const QByteArray& buf,
+                     TFrameHeader& header,
+                     TDoubleVec& values,
+                     double& maxValue)
+{
+    if (buf.size() < 8)
+        return 0;
+
+    const uchar* data = (const uchar*)buf.constData();
+    if (qFromLittleEndian<quint32>(data) != c_frameMagic
+        || qFromLittleEndian<quint16>(data+4) != c_frameVersion)
+        return -1;
+
+    int headerSize = qFromLittleEndian<quint16>(data+6);
+    if (headerSize < c_frameHeaderSize)
+        return -1;
+    if (buf.size() < headerSize)
+        return 0;
+
+    quint32 payloadSize = qFromLittleEndian<quint32>(data+8);
+    if (buf.size() < headerSize + (qint64)payloadSize)
+        return 0;
+
+    header.seq         = qFromLittleEndian<quint32>(data+12);
+    header.timeMs      = qFromLittleEndian<quint32>(data+16);
+    header.integTimeUs = qFromLittleEndian<quint32>(data+20);
+    header.dataType    = data[24];
+    header.format      = data[25];
+    header.adcRef      = data[26];
+    header.gain        = data[27];
+    header.measType    = data[28];
+    header.pixels      = qFromLittleEndian<quint16>(data+30);
+    header.pixelOffset = qFromLittleEndian<quint16>(data+32);
+    header.readings    = qFromLittleEndian<quint16>(data+34);
+    quint32 scaleBits  = qFromLittleEndian<quint32>(data+36);
+    memcpy(&header.scale, &scaleBits, sizeof(float));
+
+    // validate payload against declared format
+    int valueSize = header.format == TFrameHeader::FF_UINT16 ? 2 : 4;
+    if (header.format > TFrameHeader::FF_UINT16
+        || payloadSize != (quint32)header.pixels*valueSize)
+        return -1;
+
+    // empty packet - no data on the board side
+    if (header.pixels == 0)
+        return headerSize;
+
+    const uchar* payload = data + headerSize;
+    values.resize(header.pixels);
+    maxValue = 0.0;
+    for (int i=0; i<header.pixels; i++)
+    {
+        double value;
+        if (header.format == TFrameHeader::FF_UINT16)
+            value = qFromLittleEndian<quint16>(payload+i*2)*(double)header.scale;
+        else
+        {
+            quint32 bits = qFromLittleEndian<quint32>(payload+i*4);
+            float fValue;
+            memcpy(&fValue, &bits, sizeof(float));
+            value = fValue;
+        }
+        values[i] = value;
+        if (maxValue < value)
+            maxValue = value;
+    }
+
+    return headerSize + payloadSize;
+}
+
+// ------------------------------------------
+//     Spectron frame client implementation
+// ------------------------------------------
+
+SpectronFrameClient::SpectronFrameClient()
+    : m_timeoutMs(5000)
+{
+}
+
+SpectronFrameClient::~SpectronFrameClient()
+{
+    close();
+}
+
+bool SpectronFrameClient::open(const QString& host, quint16 port, int timeoutMs)
+{
+    close();
+
+    m_timeoutMs = timeoutMs;
+    m_socket.connectToHost(host, port);
+    if (!m_socket.waitForConnected(m_timeoutMs))
+    {
+        m_lastErrorStr = m_socket.errorString();
+        m_socket.abort();
+        return false;
+    }
+
+    // frames are small and latency bound
+    m_socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+    return true;
+}
+
+void SpectronFrameClient::close()
+{
+    if (m_socket.state() != QAbstractSocket::UnconnectedState)
+        m_socket.abort();
+    m_buffer.clear();
+}
+
+bool SpectronFrameClient::isOpen()
+{
+    return m_socket.state() == QAbstractSocket::ConnectedState;
+}
+
+bool SpectronFrameClient::request(const QString& request,
+                                  TFrameHeader& header,
+                                  TDoubleVec& values,
+                                  double& maxValue)
+{
+    if (!isOpen())
+    {
+        m_lastErrorStr = "Frame transport is not connected";
+        return false;
+    }
+
+    // drop anything left from previous requests
+    m_buffer.clear();
+    m_socket.readAll();
+
+    m_socket.write(request.toLatin1().append('\n'));
+    if (!m_socket.waitForBytesWritten(m_timeoutMs))
+    {
+        m_lastErrorStr = m_socket.errorString();
+        close();
+        return false;
+    }
+
+    // read until complete packet arrives
+    int result = 0;
+    while ((result = parseFramePacket(m_buffer, header, values, maxValue)) == 0)
+    {
+        if (!m_socket.waitForReadyRead(m_timeoutMs))
+        {
+            m_lastErrorStr = m_socket.errorString();
+            close();
+            return false;
+        }
+        m_buffer.append(m_socket.readAll());
+    }
+
+    if (result < 0)
+    {
+        m_lastErrorStr = "Invalid frame packet received";
+        close();
+        return false;
+    }
+
+    m_buffer.remove(0, result);
+
+    if (header.pixels == 0)
+    {
+        m_lastErrorStr = "No frame data available";
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ *  spectron_frame.h - Local binary frame transport for Spectron boards
+ *                     with Hamamatsu Micro Spectrometer sensors
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_FRAME_H
+#define SPECTRON_FRAME_H
+
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+#include <QTcpSocket>
+
+typedef QVector<double> TDoubleVec;
+
+// Default frame server TCP port on the board
+const quint16 c_frameServerPort = 5880;
+
+// Frame packet header - this mirrors frame_header_t in board firmware
+// (little endian, 40 bytes on the wire)
+struct TFrameHeader
+{
+    enum TFormat {
+        FF_FLOAT32 = 0,   // float32 values
+        FF_UINT16  = 1    // uint16 values to be multiplied by scale
+    };
+
+    quint32 seq;          // measurement or continuous frame sequence number
+    quint32 timeMs;       // measurement completion time on the board
+    quint32 integTimeUs;  // integration time
+    quint8  dataType;     // SpectronDevice::TDataType
+    quint8  format;       // TFormat
+    quint8  adcRef;       // ADC reference
+    quint8  gain;         // gain (0 if not supported)
+    quint8  measType;     // measurement type
+    quint16 pixels;       // number of values in payload
+    quint16 pixelOffset;  // index of the first pixel in sensor range
+    quint16 readings;     // ADC readings averaged per pixel value (0 if not reported)
+    float   scale;        // multiplier for FF_UINT16 values
+};
+
+// Parse frame packet from the start of the buffer. Returns the size of
+// the packet consumed, 0 if the buffer does not have complete packet
+// yet or -1 if the data is not a valid packet.
+int parseFramePacket(const QByteArray& buf,
+                     TFrameHeader& header,
+                     TDoubleVec& values,
+                     double& maxValue);
+
+//
+// Client for the board frame server. Each request is a line sent to
+// the board and answered by a single frame packet. Calls are synchronous
+// and block for configurable timeout, the connection is kept open
+// between requests.
+//
+class SpectronFrameClient
+{
+public:
+    SpectronFrameClient();
+    ~SpectronFrameClient();
+
+    bool open(const QString& host, quint16 port = c_frameServerPort, int timeoutMs = 5000);
+    void close();
+    bool isOpen();
+
+    // Send request and wait for frame packet. Request is a data type as
+    // for spGetData or FRAME, optionally followed by ",U16" for 16 bit
+    // payload. Returns false on error or if frame has no data.
+    bool request(const QString& request,
+                 TFrameHeader& header,
+                 TDoubleVec& values,
+                 double& maxValue);
+
+    QString& getLastError() { return m_lastErrorStr; }
+
+private:
+    QTcpSocket  m_socket;
+    QByteArray  m_buffer;
+    QString     m_lastErrorStr;
+    int         m_timeoutMs;
+};
+
+#endif // SPECTRON_FRAME_H
@@ -0,0 +1,524 @@
+/*
+ *  spectron_scan.cpp - Monochromator wavelength sweep with Spectron
+ *                      spectrometer, motor and light source boards
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include "spectron_scan.h"
+
+#include <QTimer>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <string.h>
+
+// motor board function moving to absolute position
+static const QString c_motorMoveFunction = "drvMoveToPos";
+// motor board variable set while the move is in progress
+static const QString c_motorRunningVar = "drvRunning";
+// motor board motion queue function
+static const QString c_motorQueueFunction = "drvQueue";
+// motor state polling interval
+static const int c_motorPollMs = 50;
+// default longest motor move between steps
+static const int c_motorTimeoutMs = 30000;
+// frame polling interval in triggered mode
+static const int c_framePollMs = 10;
+
+ScanEngine::ScanEngine(SpectronDevice& spectrometer, ParticleDevice& motor)
+    : m_spectrometer(spectrometer),
+      m_motor(motor),
+      m_light(NULL),
+      m_lightSettleMs(0),
+      m_motorTimeoutMs(c_motorTimeoutMs),
+      m_pipelined(true),
+      m_outputFormat(OF_CSV)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ScanEngine::~ScanEngine()
+{
+}
+
+void ScanEngine::setLightSource(ParticleDevice* light, const QString& function, int settleMs)
+{
+    m_light = light;
+    m_lightFunction = function;
+    m_lightSettleMs = settleMs > 0 ? settleMs : 0;
+}
+
+TScanPlan ScanEngine::makeSweep(int fromPos, int toPos, int step, int integTimeUs)
+{
+    TScanPlan plan;
+
+    step = qAbs(step);
+    if (step == 0)
+        step = 1;
+    if (toPos < fromPos)
+        step = -step;
+
+    for (int pos = fromPos; step > 0 ? pos <= toPos : pos >= toPos; pos += step)
+    {
+        TScanStep scanStep;
+        scanStep.position = pos;
+        scanStep.integTimeUs = integTimeUs;
+        plan << scanStep;
+    }
+
+    return plan;
+}
+
+// ---------------------------
+//     Board calls
+// ---------------------------
+
+// issue motor move - motor board function returns as soon as the move
+// is started (older firmware returns when the move is done)
+QNetworkReply* ScanEngine::startMove(const TScanStep& step, const TScanStep* prevStep)
+{
+    if (prevStep && prevStep->position == step.position)
+        return NULL;
+
+    return m_motor.callFunctionAsync(c_motorMoveFunction, QString::number(step.position));
+}
+
+QNetworkReply* ScanEngine::startLight(const TScanStep& step, const TScanStep* prevStep)
+{
+    if (!m_light || step.lightArg.isEmpty()
+        || (prevStep && prevStep->lightArg == step.lightArg))
+        return NULL;
+
+    return m_light->callFunctionAsync(m_lightFunction, step.lightArg);
+}
+
+// wait for motor move and light source change to complete, light
+// source settling is counted from the moment its call has returned
+bool ScanEngine::waitReady(QNetworkReply*& moveReply, QNetworkReply*& lightReply, bool firstStep)
+{
+    QElapsedTimer lightDone;
+    if (lightReply)
+    {
+        if (lightReply->isFinished())
+            lightDone.start();
+        else
+            QObject::connect(lightReply, &QNetworkReply::finished, [&lightDone]() { lightDone.start(); });
+    }
+
+    bool success = true;
+    if (moveReply)
+    {
+        // motor board refuses to move to the current position - this
+        // can only happen on the first step
+        if (m_motor.callFunctionResult(moveReply) == -1 && !firstStep)
+        {
+            m_lastErrorStr = "Motor move failed";
+            success = false;
+        }
+        moveReply = NULL;
+
+        success = success && waitMotorStopped();
+    }
+
+    if (lightReply)
+    {
+        if (m_light->callFunctionResult(lightReply) == -1)
+        {
+            m_lastErrorStr = "Light source call failed";
+            success = false;
+        }
+        else if (lightDone.isValid())
+            waitMs(m_lightSettleMs - lightDone.elapsed());
+        else
+            waitMs(m_lightSettleMs);
+        lightReply = NULL;
+    }
+
+    return success;
+}
+
+// poll motor board until the move is done or the timeout runs out
+bool ScanEngine::waitMotorStopped()
+{
+    if (!m_motor.hasVariable(c_motorRunningVar))
+        return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (;;)
+    {
+        QJsonValue running = m_motor.getVariableValue(c_motorRunningVar);
+        if (running.isNull() || running.isUndefined())
+        {
+            m_lastErrorStr = "Motor state read failed";
+            return false;
+        }
+        if (!running.toBool())
+            return true;
+        if (timer.elapsed() >= m_motorTimeoutMs)
+        {
+            m_lastErrorStr = "Motor did not stop in time";
+            return false;
+        }
+
+        waitMs(c_motorPollMs);
+    }
+}
+
+// wait keeping the network requests running
+void ScanEngine::waitMs(qint64 ms)
+{
+    if (ms <= 0)
+        return;
+
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+// collect the pending reply of the cancelled or failed sweep
+void ScanEngine::discardReply(QNetworkReply*& reply, ParticleDevice* device)
+{
+    if (reply && device)
+        device->callFunctionResult(reply);
+    reply = NULL;
+}
+
+// upload plan positions to motor board queue with trigger output - evenly
+// spaced positions are sent as a single sweep
+bool ScanEngine::queuePlan(const TScanPlan& plan, int dwellMs)
+{
+    if (m_motor.callFunction(c_motorQueueFunction, "CLEAR") == -1)
+        return false;
+
+    int step = plan.size() > 1 ? plan.at(1).position - plan.at(0).position : 1;
+    bool even = step != 0;
+    for (int i=1; i<plan.size() && even; i++)
+        even = plan.at(i).position - plan.at(i-1).position == step;
+
+    if (even)
+        return m_motor.callFunction(c_motorQueueFunction,
+                                    QString("SWEEP,%1,%2,%3,%4,TRG")
+                                        .arg(plan.first().position)
+                                        .arg(plan.last().position)
+                                        .arg(step).arg(dwellMs)) == plan.size();
+
+    for (int i=0; i<plan.size(); i++)
+        if (m_motor.callFunction(c_motorQueueFunction,
+                                 QString("ADD,%1,%2,TRG").arg(plan.at(i).position).arg(dwellMs)) != i+1)
+            return false;
+
+    return true;
+}
+
+// ---------------------------
+//     Output
+// ---------------------------
+
+// open output file and write the header with pixel wavelengths - dataset
+// header also holds the device calibration and settings
+bool ScanEngine::openOutput(const QString& outputFile)
+{
+    closeOutput();
+
+    if (m_outputFormat == OF_DATASET)
+    {
+        if (!m_dataset.open(outputFile, m_spectrometer))
+        {
+            m_lastErrorStr = m_dataset.getLastError();
+            return false;
+        }
+        return true;
+    }
+
+    m_output.setFileName(outputFile);
+    if (!m_output.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        m_lastErrorStr = m_output.errorString();
+        return false;
+    }
+
+    QString header;
+    QTextStream stream(&header);
+    stream << "position,integration_us,time_ms";
+    for (int i=0; i<m_spectrometer.totalPixels(); i++)
+        stream << ',' << m_spectrometer.getWavelength(i);
+    stream << '\n';
+    stream.flush();
+    m_output.write(header.toUtf8());
+
+    return true;
+}
+
+void ScanEngine::closeOutput()
+{
+    m_dataset.close();
+    if (m_output.isOpen())
+        m_output.close();
+}
+
+// one line or frame per step - position, integration time, step completion
+// time since sweep start (frame time for dataset) and pixel values
+bool ScanEngine::saveStep(const TScanStep& step, qint64 timeMs)
+{
+    int integTime = step.integTimeUs > 0 ? step.integTimeUs : m_spectrometer.getIntegTime();
+
+    if (m_outputFormat == OF_DATASET)
+    {
+        if (!m_dataset.append(m_spectrometer, step.position, integTime))
+        {
+            m_lastErrorStr = m_dataset.getLastError();
+            return false;
+        }
+        return true;
+    }
+
+    QString line;
+    QTextStream stream(&line);
+
+    stream << step.position << ',' << integTime << ',' << timeMs;
+    for (int i=0; i<m_spectrometer.totalPixels(); i++)
+        stream << ',' << m_spectrometer.getLastMeasurement(i);
+    stream << '\n';
+    stream.flush();
+
+    // flush each step so that it is kept if the sweep is interrupted
+    QByteArray data = line.toUtf8();
+    if (m_output.write(data) != data.size() || !m_output.flush())
+    {
+        m_lastErrorStr = m_output.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+// ---------------------------
+//     Sweep
+// ---------------------------
+
+bool ScanEngine::run(const TScanPlan& plan, const QString& outputFile)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_lastErrorStr.clear();
+
+    if (plan.isEmpty())
+        return true;
+
+    if (!openOutput(outputFile))
+        return false;
+
+    QElapsedTimer total, timer;
+    total.start();
+
+    QNetworkReply* moveReply = startMove(plan.at(0), NULL);
+    QNetworkReply* lightReply = startLight(plan.at(0), NULL);
+
+    bool success = true;
+    for (int i=0; i<plan.size() && success; i++)
+    {
+        const TScanStep& step = plan.at(i);
+        const TScanStep* nextStep = i+1 < plan.size() ? &plan.at(i+1) : NULL;
+
+        timer.start();
+        success = waitReady(moveReply, lightReply, i == 0);
+        m_stats.waitMs += timer.elapsed();
+        if (!success)
+            break;
+
+        timer.start();
+        success = m_spectrometer.measure(step.integTimeUs, false, false);
+        m_stats.measureMs += timer.elapsed();
+        if (!success)
+        {
+            m_lastErrorStr = "Measurement failed";
+            break;
+        }
+
+        // integration is done - next move overlaps with data download
+        if (m_pipelined && nextStep)
+        {
+            moveReply = startMove(*nextStep, &step);
+            lightReply = startLight(*nextStep, &step);
+        }
+
+        timer.start();
+        success = m_spectrometer.readMeasurement();
+        m_stats.readMs += timer.elapsed();
+        if (!success)
+        {
+            m_lastErrorStr = "Reading measurement failed";
+            break;
+        }
+
+        timer.start();
+        success = saveStep(step, total.elapsed());
+        m_stats.saveMs += timer.elapsed();
+        if (!success)
+            break;
+
+        m_stats.steps++;
+        if (!stepDone(i, plan.size()))
+        {
+            m_lastErrorStr = "Cancelled";
+            success = false;
+        }
+        else if (!m_pipelined && nextStep)
+        {
+            moveReply = startMove(*nextStep, &step);
+            lightReply = startLight(*nextStep, &step);
+        }
+    }
+
+    discardReply(moveReply, &m_motor);
+    discardReply(lightReply, m_light);
+    closeOutput();
+    m_stats.totalMs = total.elapsed();
+
+    return success;
+}
+
+// Triggered sweep. Frame sequence numbers count triggers from the start
+// of continuous mode so they are the step indexes - gaps are the frames
+// dropped on the board. Motor board trigger output rises when the dwell
+// starts, so the frame is taken with the motor settled at the position.
+bool ScanEngine::runTriggered(const TScanPlan& plan, int dwellMs, const QString& outputFile)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_lastErrorStr.clear();
+
+    if (plan.isEmpty())
+        return true;
+
+    if (!m_spectrometer.hasLocalTransport())
+    {
+        m_lastErrorStr = "Local frame transport is not open";
+        return false;
+    }
+
+    if (!openOutput(outputFile))
+        return false;
+
+    QElapsedTimer total, timer;
+    total.start();
+
+    if (!queuePlan(plan, dwellMs))
+    {
+        closeOutput();
+        m_lastErrorStr = "Motor queue upload failed";
+        return false;
+    }
+
+    // first move takes the motor to the sweep start - start triggered
+    // frames and then the queue
+    if (!m_spectrometer.startContinuous(plan.first().integTimeUs, true))
+    {
+        closeOutput();
+        m_lastErrorStr = "Starting triggered measurements failed";
+        return false;
+    }
+    if (m_motor.callFunction(c_motorQueueFunction, "RUN") == -1)
+    {
+        m_spectrometer.stopContinuous();
+        closeOutput();
+        m_lastErrorStr = "Motor queue start failed";
+        return false;
+    }
+
+    bool success = true;
+    bool motorRunning = true;
+    QElapsedTimer motorPoll, lastFrame;
+    motorPoll.start();
+    lastFrame.start();
+    while (success)
+    {
+        timer.start();
+        bool frameRead = m_spectrometer.readFrame();
+        m_stats.readMs += timer.elapsed();
+
+        if (frameRead)
+        {
+            lastFrame.start();
+            int stepIdx = m_spectrometer.getLastFrameSeq();
+            if (stepIdx >= plan.size())
+                break;
+
+            timer.start();
+            success = saveStep(plan.at(stepIdx), total.elapsed());
+            m_stats.saveMs += timer.elapsed();
+            if (!success)
+                break;
+
+            m_stats.steps++;
+            if (!stepDone(stepIdx, plan.size()))
+            {
+                m_lastErrorStr = "Cancelled";
+                success = false;
+            }
+            else if (stepIdx == plan.size()-1)
+                break;
+
+            continue;
+        }
+
+        // the last frames may still be queued after the motor has stopped
+        if (!motorRunning)
+        {
+            if (lastFrame.elapsed() > dwellMs + 1000)
+            {
+                m_lastErrorStr = "Triggered frames missing";
+                success = false;
+            }
+        }
+        else if (motorPoll.elapsed() >= c_motorPollMs && m_motor.hasVariable(c_motorRunningVar))
+        {
+            motorPoll.start();
+            QJsonValue running = m_motor.getVariableValue(c_motorRunningVar);
+            if (running.isNull() || running.isUndefined())
+            {
+                m_lastErrorStr = "Motor state read failed";
+                success = false;
+            }
+            else if (!running.toBool())
+            {
+                motorRunning = false;
+                lastFrame.start();
+            }
+        }
+
+        timer.start();
+        waitMs(c_framePollMs);
+        m_stats.waitMs += timer.elapsed();
+    }
+
+    m_spectrometer.stopContinuous();
+    if (!success && motorRunning)
+        m_motor.callFunction(c_motorQueueFunction, "STOP");
+    closeOutput();
+    m_stats.totalMs = total.elapsed();
+
+    // dropped frames leave steps out
+    if (success && m_stats.steps < plan.size())
+    {
+        m_lastErrorStr = QString("%1 steps missing").arg(plan.size() - m_stats.steps);
+        success = false;
+    }
+
+    return success;
+}
@@ -0,0 +1,146 @@
+/*
+ *  spectron_scan.h - Monochromator wavelength sweep with Spectron
+ *                    spectrometer, motor and light source boards
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SPECTRON_SCAN_H
+#define SPECTRON_SCAN_H
+
+#include <QList>
+#include <QFile>
+#include <QString>
+#include "spectron_api.h"
+#include "spectron_dataset.h"
+
+// Single sweep step
+struct TScanStep
+{
+    int     position;     // monochromator position (wavelength for calibrated motor board)
+    int     integTimeUs;  // integration time, 0 for currently set one
+    QString lightArg;     // light source function argument, empty to keep the previous
+};
+
+typedef QList<TScanStep> TScanPlan;
+
+// Sweep timings in milliseconds
+struct TScanStats
+{
+    int     steps;        // steps completed
+    qint64  totalMs;      // whole sweep
+    qint64  waitMs;       // waiting for motor travel and light source settling
+    qint64  measureMs;    // spectrometer measurement calls
+    qint64  readMs;       // measurement data download
+    qint64  saveMs;       // writing steps to disk
+};
+
+//
+// Runs monochromator sweep - for each step the motor board is moved to
+// the step position, light source is set, the spectrum is measured and
+// appended to the output file.
+//
+// In pipelined mode (default) the move to the next step and the light
+// source change are issued as soon as the measurement integration is
+// finished. The motor travel and light source settling then run while
+// the spectrum is downloaded and saved. Otherwise each step is done
+// one call after another.
+//
+// In triggered mode (runTriggered()) the positions are uploaded to the
+// motor board motion queue with trigger output and the spectrometer runs
+// triggered continuous measurements - each dwell starts a frame directly
+// through the trigger line without any calls in between. Frames are read
+// over local frame transport which has to be open.
+//
+// The boards are accessed through ParticleAPI, so the sweep runs
+// against local mock devices when ParticleAPI::setApiUrl() points to
+// a mock server. Calls are synchronous as the rest of the API - run()
+// returns when the sweep is done.
+//
+// Steps are written as CSV lines or appended as frames to binary dataset
+// (spectron_dataset.h) with the step position in each frame record.
+//
+class ScanEngine
+{
+public:
+    enum TOutputFormat {
+        OF_CSV     = 0,   // text, one line per step
+        OF_DATASET = 1    // binary dataset, one frame record per step
+    };
+
+    ScanEngine(SpectronDevice& spectrometer, ParticleDevice& motor);
+    virtual ~ScanEngine();
+
+    // optional light source - function is called with step light argument,
+    // next measurement waits settleMs after the call is complete
+    void setLightSource(ParticleDevice* light, const QString& function, int settleMs = 0);
+    void setPipelined(bool pipelined) { m_pipelined = pipelined; }
+    // longest wait for the motor to stop after a move, the sweep fails
+    // if the motor is still running then
+    void setMotorTimeout(int timeoutMs) { m_motorTimeoutMs = timeoutMs; }
+    void setOutputFormat(TOutputFormat format) { m_outputFormat = format; }
+
+    // steps from fromPos to toPos inclusive
+    static TScanPlan makeSweep(int fromPos, int toPos, int step, int integTimeUs = 0);
+
+    // run the sweep, steps are written to outputFile in selected format -
+    // returns false on failure or when cancelled, the steps done so far
+    // are kept
+    bool run(const TScanPlan& plan, const QString& outputFile);
+
+    // run the sweep in triggered mode - dwellMs is the time motor stays at
+    // each position and must cover the frame time. Integration time of the
+    // first step is used as frame time for all steps, light arguments are
+    // ignored.
+    bool runTriggered(const TScanPlan& plan, int dwellMs, const QString& outputFile);
+
+    TScanStats& getStats()      { return m_stats; }
+    QString&    getLastError()  { return m_lastErrorStr; }
+
+protected:
+    // called after each step is saved, return false to cancel the sweep
+    virtual bool stepDone(int step, int totalSteps) { return true; }
+
+private:
+    QNetworkReply* startMove(const TScanStep& step, const TScanStep* prevStep);
+    QNetworkReply* startLight(const TScanStep& step, const TScanStep* prevStep);
+    bool waitReady(QNetworkReply*& moveReply, QNetworkReply*& lightReply, bool firstStep);
+    bool waitMotorStopped();
+    bool queuePlan(const TScanPlan& plan, int dwellMs);
+    bool openOutput(const QString& outputFile);
+    void closeOutput();
+    void waitMs(qint64 ms);
+    void discardReply(QNetworkReply*& reply, ParticleDevice* device);
+    bool saveStep(const TScanStep& step, qint64 timeMs);
+
+    // members
+    SpectronDevice& m_spectrometer;
+    ParticleDevice& m_motor;
+    ParticleDevice* m_light;
+    QString         m_lightFunction;
+    int             m_lightSettleMs;
+    int             m_motorTimeoutMs;
+    bool            m_pipelined;
+    TOutputFormat   m_outputFormat;
+    QFile           m_output;
+    SpectronDatasetWriter m_dataset;
+    TScanStats      m_stats;
+    QString         m_lastErrorStr;
+};
+
+#endif // SPECTRON_SCAN_H
@@ -0,0 +1,11 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_average
+INCLUDEPATH += ../../common
+SOURCES += tst_average.cpp \
+           ../../common/spectron_average.cpp
+HEADERS += ../../common/spectron_average.h \
+           ../../common/spectron_frame.h
@@ -0,0 +1,318 @@
+/*
+ *  tst_average.cpp - Rolling frame statistics tests against brute force
+ *                    calculation over the last N frames
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <math.h>
+
+#include "spectron_average.h"
+
+// Noisy frames from a fixed seed - pixel 0 is constant so that it has no
+// variation, the others have a large offset relative to the noise as the
+// sensor readings do
+class FrameSource
+{
+public:
+    FrameSource(int pixels) : m_pixels(pixels), m_seed(12345) {}
+
+    TDoubleVec next()
+    {
+        TDoubleVec values(m_pixels);
+        values[0] = 2.0;
+        for (int i=1; i<m_pixels; i++)
+            values[i] = 1000.0*i + random() - 0.5;
+        return values;
+    }
+
+private:
+    double random()
+    {
+        m_seed = m_seed*1103515245 + 12345;
+        return ((m_seed >> 16) & 0x7FFF)/32768.0;
+    }
+
+    int     m_pixels;
+    quint32 m_seed;
+};
+
+static bool nearlyEqual(double value, double expected)
+{
+    return fabs(value - expected) <= 1e-9*qMax(1.0, fabs(expected));
+}
+
+class TestAverage : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void partialWindow();
+    void wrapAround();
+    void singleFrame();
+    void pixelsChange();
+    void windowChange();
+    void longRun();
+    void scaleChange();
+
+private:
+    void checkStats(const FrameAverager& averager, const QList<TDoubleVec>& frames);
+};
+
+// Statistics of the averager match the ones calculated directly from the
+// frames in the window
+void TestAverage::checkStats(const FrameAverager& averager, const QList<TDoubleVec>& frames)
+{
+    QCOMPARE(averager.count(), frames.size());
+    int pixels = frames.first().size();
+    QCOMPARE(averager.pixels(), pixels);
+
+    TDoubleVec variance, minValues, maxValues, snr;
+    averager.getVariance(variance);
+    averager.getMinMax(minValues, maxValues);
+    averager.getSNR(snr);
+    QCOMPARE(averager.getMean().size(), pixels);
+    QCOMPARE(variance.size(), pixels);
+    QCOMPARE(minValues.size(), pixels);
+    QCOMPARE(maxValues.size(), pixels);
+    QCOMPARE(snr.size(), pixels);
+
+    int n = frames.size();
+    for (int i=0; i<pixels; i++)
+    {
+        double sum = 0;
+        double minValue = frames.first().at(i);
+        double maxValue = minValue;
+        for (int f=0; f<n; f++)
+        {
+            double v = frames.at(f).at(i);
+            sum += v;
+            minValue = qMin(minValue, v);
+            maxValue = qMax(maxValue, v);
+        }
+        double mean = sum/n;
+        double sumSq = 0;
+        for (int f=0; f<n; f++)
+            sumSq += (frames.at(f).at(i) - mean)*(frames.at(f).at(i) - mean);
+        double var = n > 1 ? sumSq/(n-1) : 0.0;
+        double stdDev = sqrt(var);
+
+        QString context = QString("frames %1 pixel %2").arg(n).arg(i);
+        QVERIFY2(nearlyEqual(averager.getMean().at(i), mean), qPrintable(context));
+        QVERIFY2(fabs(variance.at(i) - var) <= 1e-6*qMax(var, 1e-3), qPrintable(context));
+        QVERIFY2(minValues.at(i) == minValue, qPrintable(context));
+        QVERIFY2(maxValues.at(i) == maxValue, qPrintable(context));
+        if (stdDev > 0)
+            QVERIFY2(fabs(snr.at(i) - mean/stdDev) <= 1e-6*mean/stdDev, qPrintable(context));
+        else
+            QVERIFY2(snr.at(i) == 0.0, qPrintable(context));
+    }
+}
+
+// Window filling up has statistics of all frames so far
+void TestAverage::partialWindow()
+{
+    FrameAverager averager(8);
+    QCOMPARE(averager.count(), 0);
+    QCOMPARE(averager.pixels(), 0);
+
+    FrameSource source(6);
+    QList<TDoubleVec> frames;
+    for (int f=0; f<7; f++)
+    {
+        frames << source.next();
+        averager.addFrame(frames.last());
+        checkStats(averager, frames);
+        if (QTest::currentTestFailed())
+            return;
+    }
+}
+
+// Full window has statistics of the last N frames, with the ring wrapping
+// around several times and stopping in the middle of it
+void TestAverage::wrapAround()
+{
+    FrameAverager averager(5);
+    FrameSource source(6);
+    QList<TDoubleVec> frames;
+    for (int f=0; f<23; f++)
+    {
+        frames << source.next();
+        if (frames.size() > 5)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+        checkStats(averager, frames);
+        if (QTest::currentTestFailed())
+            return;
+    }
+
+    averager.reset();
+    QCOMPARE(averager.count(), 0);
+    QCOMPARE(averager.getMean(), TDoubleVec(6, 0.0));
+
+    frames.clear();
+    for (int f=0; f<7; f++)
+    {
+        frames << source.next();
+        if (frames.size() > 5)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+    }
+    checkStats(averager, frames);
+}
+
+// One frame window has the last frame as the mean and no variation
+void TestAverage::singleFrame()
+{
+    FrameAverager averager(0);
+    QCOMPARE(averager.getFrames(), 1);
+
+    FrameSource source(4);
+    for (int f=0; f<4; f++)
+    {
+        QList<TDoubleVec> frames;
+        frames << source.next();
+        averager.addFrame(frames.last());
+        checkStats(averager, frames);
+        if (QTest::currentTestFailed())
+            return;
+        QCOMPARE(averager.getMean(), frames.last());
+    }
+}
+
+// Frame with different number of pixels restarts the statistics
+void TestAverage::pixelsChange()
+{
+    FrameAverager averager(4);
+    FrameSource source(10);
+    for (int f=0; f<6; f++)
+        averager.addFrame(source.next());
+    QCOMPARE(averager.count(), 4);
+
+    FrameSource wideSource(12);
+    QList<TDoubleVec> frames;
+    for (int f=0; f<6; f++)
+    {
+        frames << wideSource.next();
+        if (frames.size() > 4)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+        checkStats(averager, frames);
+        if (QTest::currentTestFailed())
+            return;
+    }
+
+    // and back to fewer pixels
+    frames.clear();
+    frames << source.next();
+    averager.addFrame(frames.last());
+    checkStats(averager, frames);
+}
+
+// Changing the window size restarts the statistics with the new size
+void TestAverage::windowChange()
+{
+    FrameAverager averager(6);
+    FrameSource source(5);
+    for (int f=0; f<9; f++)
+        averager.addFrame(source.next());
+
+    averager.setFrames(3);
+    QCOMPARE(averager.getFrames(), 3);
+    QCOMPARE(averager.count(), 0);
+    QCOMPARE(averager.pixels(), 0);
+
+    QList<TDoubleVec> frames;
+    for (int f=0; f<8; f++)
+    {
+        frames << source.next();
+        if (frames.size() > 3)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+        checkStats(averager, frames);
+        if (QTest::currentTestFailed())
+            return;
+    }
+
+    averager.setFrames(10);
+    frames.clear();
+    for (int f=0; f<13; f++)
+    {
+        frames << source.next();
+        if (frames.size() > 10)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+    }
+    checkStats(averager, frames);
+}
+
+// Sliding updates over many window cycles do not drift from the frames
+// in the window
+void TestAverage::longRun()
+{
+    FrameAverager averager(16);
+    FrameSource source(8);
+    QList<TDoubleVec> frames;
+    for (int f=0; f<20000; f++)
+    {
+        frames << source.next();
+        if (frames.size() > 16)
+            frames.removeFirst();
+        averager.addFrame(frames.last());
+
+        // between recalculations as well as right after one
+        if (f % 997 == 0 || f % 16 == 15)
+        {
+            checkStats(averager, frames);
+            if (QTest::currentTestFailed())
+                return;
+        }
+    }
+}
+
+// After a bright spell the sliding updates leave rounding errors far above
+// the variance of the dim frames - they are gone once the window cycle
+// has been recalculated
+void TestAverage::scaleChange()
+{
+    FrameAverager averager(4);
+    FrameSource source(6);
+    QList<TDoubleVec> frames;
+    for (int f=0; f<16; f++)
+    {
+        TDoubleVec values = source.next();
+        for (int i=1; i<values.size(); i++)
+            values[i] = f < 4 ? values.at(i)*1e6 : 1.0 + (values.at(i) - 1000.0*i)*0.01;
+
+        frames << values;
+        if (frames.size() > 4)
+            frames.removeFirst();
+        averager.addFrame(values);
+
+        if (f >= 8 && f % 4 == 3)
+        {
+            checkStats(averager, frames);
+            if (QTest::currentTestFailed())
+                return;
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(TestAverage)
+#include "tst_average.moc"
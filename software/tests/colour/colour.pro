@@ -0,0 +1,10 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_colour
+INCLUDEPATH += ../../common
+SOURCES += tst_colour.cpp \
+           ../../common/spectron_colour.cpp
+HEADERS += ../../common/spectron_colour.h
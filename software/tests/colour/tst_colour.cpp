@@ -0,0 +1,221 @@
+/*
+ *  tst_colour.cpp - Colour metrics checks against published values of
+ *                   CIE standard illuminants
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <math.h>
+
+#include "spectron_colour.h"
+
+// CIE fluorescent illuminants F2, F7 and F11 relative spectral power,
+// 380 to 780nm in 5nm steps (CIE 15:2004)
+#define F_TABLE_SIZE    81
+
+static const double illumF2[F_TABLE_SIZE] = {
+    1.18, 1.48, 1.84, 2.15, 3.44, 15.69, 3.85, 3.74, 4.19, 4.62, 5.06, 34.98,
+    11.81, 6.27, 6.63, 6.93, 7.19, 7.40, 7.54, 7.62, 7.65, 7.62, 7.62, 7.45,
+    7.28, 7.15, 7.05, 7.04, 7.16, 7.47, 8.04, 8.88, 10.01, 24.88, 16.64, 14.59,
+    16.16, 17.56, 18.62, 21.47, 22.79, 19.29, 18.66, 17.73, 16.54, 15.21, 13.80, 12.36,
+    10.95, 9.65, 8.40, 7.32, 6.31, 5.43, 4.68, 4.02, 3.45, 2.96, 2.55, 2.19,
+    1.89, 1.64, 1.53, 1.27, 1.10, 0.99, 0.88, 0.76, 0.68, 0.61, 0.56, 0.54,
+    0.51, 0.47, 0.47, 0.43, 0.46, 0.47, 0.40, 0.33, 0.27
+};
+
+static const double illumF7[F_TABLE_SIZE] = {
+    2.56, 3.18, 3.84, 4.53, 6.15, 19.37, 7.37, 7.05, 7.71, 8.41, 9.15, 44.14,
+    17.52, 11.35, 12.00, 12.58, 13.08, 13.45, 13.71, 13.88, 13.95, 13.93, 13.82, 13.64,
+    13.43, 13.25, 13.08, 12.93, 12.78, 12.60, 12.44, 12.33, 12.26, 29.52, 17.05, 12.44,
+    12.58, 12.72, 12.83, 15.46, 16.75, 12.83, 12.67, 12.45, 12.19, 11.89, 11.60, 11.35,
+    11.12, 10.95, 10.76, 10.42, 10.11, 10.04, 10.02, 10.11, 9.87, 8.65, 7.27, 6.44,
+    5.83, 5.41, 5.04, 4.57, 4.12, 3.77, 3.46, 3.08, 2.73, 2.47, 2.25, 2.06,
+    1.90, 1.75, 1.62, 1.54, 1.45, 1.32, 1.17, 0.99, 0.81
+};
+
+static const double illumF11[F_TABLE_SIZE] = {
+    0.91, 0.63, 0.46, 0.37, 1.29, 12.68, 1.59, 1.79, 2.46, 3.33, 4.49, 33.94,
+    12.13, 6.95, 7.19, 7.12, 6.72, 6.13, 5.46, 4.79, 5.66, 14.29, 14.96, 8.97,
+    4.72, 2.33, 1.47, 1.10, 0.89, 0.83, 1.18, 4.90, 39.59, 72.84, 32.61, 7.52,
+    2.83, 1.96, 1.67, 4.43, 11.28, 14.76, 12.73, 9.74, 7.33, 9.72, 55.27, 42.58,
+    13.18, 13.16, 12.26, 5.11, 2.07, 2.34, 3.58, 3.01, 2.48, 2.14, 1.54, 1.33,
+    1.46, 1.94, 2.00, 1.20, 1.35, 4.10, 5.58, 2.51, 0.57, 0.27, 0.23, 0.21,
+    0.24, 0.24, 0.20, 0.24, 0.32, 0.26, 0.16, 0.12, 0.09
+};
+
+// pixel wavelengths in equal steps
+static TDoubleVec wavelengthGrid(double from, double to, double step)
+{
+    TDoubleVec wavelengths;
+    for (double wavelength = from; wavelength <= to; wavelength += step)
+        wavelengths << wavelength;
+
+    return wavelengths;
+}
+
+// CIE illuminant A as defined in CIE 15:2004 - 2856K with the radiation
+// constant of the time
+static double illumA(double wavelength)
+{
+    return 100*pow(560/wavelength, 5)*(exp(1.435e7/(2848*560.0)) - 1)
+              /(exp(1.435e7/(2848*wavelength)) - 1);
+}
+
+class TestColour : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void illuminantA();
+    void fluorescent_data();
+    void fluorescent();
+    void tm30();
+};
+
+// Planckian radiator is its own CRI reference - everything renders as
+// under the reference at the published CCT. Wavelengths span wider range
+// than the colour matching functions as the sensors do.
+void TestColour::illuminantA()
+{
+    ColourMetrics colour;
+    TDoubleVec wavelengths = wavelengthGrid(340, 850, 2);
+    colour.setWavelengths(wavelengths);
+
+    TDoubleVec spectrum;
+    for (int i=0; i<wavelengths.size(); i++)
+        spectrum << illumA(wavelengths.at(i));
+
+    TColourMetrics metrics;
+    QVERIFY(colour.calculate(spectrum, metrics));
+    QVERIFY(fabs(metrics.x - 0.44757) < 0.0002);
+    QVERIFY(fabs(metrics.y - 0.40745) < 0.0002);
+    QVERIFY2(fabs(metrics.CCT - 2856) < 5, qPrintable(QString("CCT %1").arg(metrics.CCT)));
+    QVERIFY(fabs(metrics.Duv) < 0.0002);
+    QVERIFY(metrics.criValid);
+    QVERIFY2(metrics.Ra > 99.5, qPrintable(QString("Ra %1").arg(metrics.Ra)));
+    for (int i=0; i<CIE_TCS_COUNT; i++)
+        QVERIFY(metrics.R[i] > 99);
+    QVERIFY(!metrics.tm30Valid);
+
+    // empty spectrum has no metrics
+    QVERIFY(!colour.calculate(TDoubleVec(wavelengths.size(), 0.0), metrics));
+}
+
+// Chromaticity, CCT and CIE 13.3 indices of fluorescent illuminants
+// (CIE 15:2004 and CIE 13.3 tables), sampled at 5nm pixels as tabulated
+void TestColour::fluorescent_data()
+{
+    QTest::addColumn<int>("illuminant");
+    QTest::addColumn<double>("x");
+    QTest::addColumn<double>("y");
+    QTest::addColumn<double>("CCT");
+    QTest::addColumn<double>("Ra");
+    QTest::addColumn<double>("R9");
+
+    QTest::newRow("F2")  << 2  << 0.37210 << 0.37510 << 4230.0 << 64.0 << -84.0;
+    QTest::newRow("F7")  << 7  << 0.31285 << 0.32918 << 6500.0 << 90.0 << 61.0;
+    QTest::newRow("F11") << 11 << 0.38052 << 0.37713 << 4000.0 << 83.0 << 25.0;
+}
+
+void TestColour::fluorescent()
+{
+    QFETCH(int, illuminant);
+    QFETCH(double, x);
+    QFETCH(double, y);
+    QFETCH(double, CCT);
+    QFETCH(double, Ra);
+    QFETCH(double, R9);
+
+    const double* table = illuminant == 2 ? illumF2 : (illuminant == 7 ? illumF7 : illumF11);
+    ColourMetrics colour;
+    colour.setWavelengths(wavelengthGrid(380, 780, 5));
+    TDoubleVec spectrum;
+    for (int i=0; i<F_TABLE_SIZE; i++)
+        spectrum << table[i];
+
+    TColourMetrics metrics;
+    QVERIFY(colour.calculate(spectrum, metrics));
+    QString values = QString("x %1 y %2 CCT %3 Ra %4 R9 %5")
+                        .arg(metrics.x).arg(metrics.y).arg(metrics.CCT)
+                        .arg(metrics.Ra).arg(metrics.R[8]);
+    QVERIFY2(fabs(metrics.x - x) < 0.0005 && fabs(metrics.y - y) < 0.0005, qPrintable(values));
+    QVERIFY2(fabs(metrics.CCT - CCT) < 10, qPrintable(values));
+    QVERIFY2(fabs(metrics.Ra - Ra) < 1, qPrintable(values));
+    QVERIFY2(fabs(metrics.R[8] - R9) < 2, qPrintable(values));
+    QVERIFY(metrics.criValid);
+
+    // reference spectrum buffers are reused - same result next time
+    TColourMetrics again;
+    QVERIFY(colour.calculate(spectrum, again));
+    QCOMPARE(again.Ra, metrics.Ra);
+    QCOMPARE(again.R[8], metrics.R[8]);
+}
+
+// Samples covering part of the hue circle only - source rendering as its
+// reference has full fidelity and gamut, fluorescent lamp with spiky
+// spectrum has both lower
+void TestColour::tm30()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    {
+        QTextStream stream(&file);
+        stream << "nm,s1,s2,s3,s4,s5,s6\n";
+        for (int wavelength=380; wavelength<=780; wavelength+=5)
+        {
+            stream << wavelength;
+            static const double centres[] = { 450, 500, 530, 560, 600, 640 };
+            for (int s=0; s<6; s++)
+                stream << "," << 0.1 + 0.7*exp(-pow((wavelength - centres[s])/40.0, 2));
+            stream << "\n";
+        }
+    }
+    file.close();
+
+    ColourMetrics colour;
+    QVERIFY(colour.loadTM30Samples(file.fileName()));
+    QCOMPARE(colour.tm30Samples(), 6);
+    TDoubleVec wavelengths = wavelengthGrid(380, 780, 5);
+    colour.setWavelengths(wavelengths);
+
+    TDoubleVec spectrum;
+    for (int i=0; i<wavelengths.size(); i++)
+        spectrum << planckRadiation(wavelengths.at(i), 3000);
+
+    TColourMetrics metrics;
+    QVERIFY(colour.calculate(spectrum, metrics));
+    QVERIFY(metrics.tm30Valid);
+    QVERIFY2(metrics.Rf > 99.5, qPrintable(QString("Rf %1").arg(metrics.Rf)));
+    QVERIFY2(fabs(metrics.Rg - 100) < 0.5, qPrintable(QString("Rg %1").arg(metrics.Rg)));
+
+    spectrum.clear();
+    for (int i=0; i<F_TABLE_SIZE; i++)
+        spectrum << illumF2[i];
+    QVERIFY(colour.calculate(spectrum, metrics));
+    QVERIFY2(metrics.Rf < 90, qPrintable(QString("Rf %1").arg(metrics.Rf)));
+
+    // reference hues of the samples leave the first hue bin empty, the
+    // gamut polygon is still closed (open one gives Rg 92.2)
+    QVERIFY2(fabs(metrics.Rg - 90.6) < 0.3, qPrintable(QString("Rg %1").arg(metrics.Rg)));
+}
+
+QTEST_GUILESS_MAIN(TestColour)
+#include "tst_colour.moc"
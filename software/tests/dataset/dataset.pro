@@ -0,0 +1,19 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_dataset
+INCLUDEPATH += ../../common
+SOURCES += tst_dataset.cpp \
+           ../../common/spectron_dataset.cpp \
+           ../../common/spectron_export.cpp \
+           ../../common/spectron_api.cpp \
+           ../../common/spectron_frame.cpp \
+           ../../common/particle_api.cpp
+HEADERS += ../../common/spectron_dataset.h \
+           ../../common/spectron_export.h \
+           ../../common/spectron_api.h \
+           ../../common/spectron_frame.h \
+           ../../common/particle_api.h
+LIBS += -lz
@@ -0,0 +1,573 @@
+/*
+ *  tst_dataset.cpp - Dataset file writer and memory mapped reader tests
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QDateTime>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <string.h>
+#include <zlib.h>
+
+#include "spectron_dataset.h"
+
+// 5 pixels take 20 bytes, so the records are padded
+static const int c_pixels      = 5;
+static const int c_pixelOffset = 2;
+static const int c_recordSize  = 56;
+
+//
+// Mock of the Particle cloud API answering each path with set JSON body,
+// unknown paths get 404 - serves the spectrometer state the dataset
+// header is made from.
+//
+class MockParticleServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    MockParticleServer()
+    {
+        connect(&m_server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    }
+
+    quint16 listen()
+    {
+        m_server.listen(QHostAddress::LocalHost);
+        return m_server.serverPort();
+    }
+
+    void setReply(const QString& path, const QByteArray& body)
+    {
+        m_replies[path] = body;
+    }
+
+private slots:
+    void newConnection()
+    {
+        while (m_server.hasPendingConnections())
+        {
+            QTcpSocket* socket = m_server.nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void readRequest()
+    {
+        QTcpSocket* socket = (QTcpSocket*)sender();
+        QByteArray& buf = m_buffers[socket];
+        buf.append(socket->readAll());
+
+        int headerEnd = buf.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        QList<QByteArray> requestLine = buf.left(buf.indexOf('\n')).trimmed().split(' ');
+        QString path = QUrl(QString::fromLatin1(requestLine.value(1))).path();
+        m_buffers.remove(socket);
+
+        QByteArray status = "200 OK";
+        QByteArray body = m_replies.value(path);
+        if (!m_replies.contains(path))
+        {
+            status = "404 Not Found";
+            body = "{\"ok\":false,\"error\":\"Variable not found\"}";
+        }
+
+        socket->write("HTTP/1.1 " + status + "\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n" + body);
+        socket->disconnectFromHost();
+    }
+
+private:
+    QTcpServer                     m_server;
+    QHash<QString, QByteArray>     m_replies;
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+};
+
+// Device info and spState variable of a spectrometer board
+static void setBoard(MockParticleServer& server, const QString& device, int pixels)
+{
+    QString path = "/v1/devices/" + device;
+    server.setReply(path,
+                    QString("{\"id\":\"%1\",\"name\":\"%1\",\"connected\":true,"
+                            "\"variables\":{\"spState\":\"string\"},\"functions\":[]}")
+                        .arg(device).toUtf8());
+    server.setReply(path + "/spState",
+                    QString("{\"name\":\"spState\",\"result\":\"{\\\"v\\\":1,\\\"adc\\\":%1,"
+                            "\\\"mbv\\\":0.25,\\\"gain\\\":%2,\\\"sat\\\":[4.5,2.25],"
+                            "\\\"px\\\":%3,\\\"off\\\":%4,\\\"it\\\":20000,\\\"trg\\\":0,"
+                            "\\\"mt\\\":%5,\\\"os\\\":0,\\\"cal\\\":[300,50,0.5,0,0,0]}\"}")
+                        .arg(SpectronDevice::ADC_4_096V)
+                        .arg(SpectronDevice::HIGH_GAIN)
+                        .arg(pixels)
+                        .arg(c_pixelOffset)
+                        .arg(SpectronDevice::MEASURE_ABSOLUTE).toUtf8());
+}
+
+static TDatasetRecord makeRecord(quint32 seq, qint64 timeMs)
+{
+    TDatasetRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = seq;
+    record.integTimeUs = 10000 + seq;
+    record.position = 400 - 3*(int)seq;
+    record.adcRef = SpectronDevice::ADC_5V;
+    record.gain = SpectronDevice::NO_GAIN;
+    record.measType = SpectronDevice::MEASURE_VOLTAGE;
+    record.dataType = seq % 2 ? SpectronDevice::ET_NOISE : SpectronDevice::ET_MEASUREMENT;
+    record.timeMs = timeMs;
+
+    return record;
+}
+
+// values of the frame, the odd ones are all negative
+static TDoubleVec frameValues(quint32 seq)
+{
+    TDoubleVec values(c_pixels);
+    for (int i=0; i<c_pixels; i++)
+        values[i] = seq % 2 ? -0.25*(i+1) - seq : 0.125*i + seq*0.5;
+
+    return values;
+}
+
+static QByteArray readFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    return file.readAll();
+}
+
+static bool writeFile(const QString& fileName, const QByteArray& data)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+// single member gzip file as written by the export for small outputs
+static QByteArray gunzip(const QByteArray& data)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return QByteArray();
+
+    QByteArray result(1024*1024, 0);
+    stream.next_in = (Bytef*)data.constData();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*)result.data();
+    stream.avail_out = result.size();
+    int ret = inflate(&stream, Z_FINISH);
+    result.resize(ret == Z_STREAM_END ? result.size() - stream.avail_out : 0);
+    inflateEnd(&stream);
+
+    return result;
+}
+
+class TestDataset : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void writeRead();
+    void appendTruncated();
+    void invalidHeader();
+    void refresh();
+    void save();
+    void errors();
+
+private:
+    QString tempFile(const QString& name) { return m_dir.path() + "/" + name; }
+    bool writeFrames(SpectronDatasetWriter& writer, quint32 from, quint32 to, qint64 timeMs);
+    void checkFrames(SpectronDatasetReader& reader, int frames, qint64 timeMs);
+
+    MockParticleServer m_server;
+    SpectronDevice     m_device;
+    QTemporaryDir      m_dir;
+};
+
+void TestDataset::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+
+    quint16 port = m_server.listen();
+    QVERIFY(port != 0);
+    setBoard(m_server, "spec", c_pixels);
+    setBoard(m_server, "spec7", 7);
+
+    ParticleAPI& api = ParticleAPI::instance();
+    api.setApiUrl(QString("http://127.0.0.1:%1/").arg(port));
+    QVERIFY(api.login("test-token"));
+
+    ParticleDevice board("spec");
+    m_device = board;
+    QVERIFY(m_device.refresh());
+    QCOMPARE(m_device.getWavelengths().size(), c_pixels);
+}
+
+bool TestDataset::writeFrames(SpectronDatasetWriter& writer, quint32 from, quint32 to, qint64 timeMs)
+{
+    for (quint32 seq=from; seq<to; seq++)
+        if (!writer.append(makeRecord(seq, timeMs + seq), frameValues(seq)))
+            return false;
+
+    return true;
+}
+
+// frames read through the mapping have the records and values written
+void TestDataset::checkFrames(SpectronDatasetReader& reader, int frames, qint64 timeMs)
+{
+    QCOMPARE(reader.frames(), frames);
+    for (int f=0; f<frames; f++)
+    {
+        TDatasetRecord expected = makeRecord(f, timeMs + f);
+        TDoubleVec values = frameValues(f);
+        float maxValue = 0;
+        for (int i=0; i<c_pixels; i++)
+            maxValue = qMax(maxValue, (float)values.at(i));
+
+        const TDatasetRecord& record = reader.record(f);
+        QCOMPARE(record.seq, expected.seq);
+        QCOMPARE(record.integTimeUs, expected.integTimeUs);
+        QCOMPARE(record.position, expected.position);
+        QCOMPARE(record.adcRef, expected.adcRef);
+        QCOMPARE(record.gain, expected.gain);
+        QCOMPARE(record.measType, expected.measType);
+        QCOMPARE(record.dataType, expected.dataType);
+        QCOMPARE(record.timeMs, expected.timeMs);
+        QCOMPARE(record.maxValue, maxValue);
+        for (int i=0; i<c_pixels; i++)
+            QCOMPARE(reader.values(f)[i], (float)values.at(i));
+    }
+}
+
+// Header is made from the device settings and is followed by the
+// wavelengths and fixed size records
+void TestDataset::writeRead()
+{
+    QString fileName = tempFile("write.spd");
+    qint64 before = QDateTime::currentMSecsSinceEpoch();
+
+    SpectronDatasetWriter writer;
+    QVERIFY2(writer.open(fileName, m_device), qPrintable(writer.getLastError()));
+    QVERIFY(writeFrames(writer, 0, 4, 1000));
+    QCOMPARE(writer.frames(), 4);
+    writer.close();
+    QCOMPARE(writer.frames(), 0);
+
+    qint64 headerSize = sizeof(TDatasetHeader) + c_pixels*sizeof(double);
+    QCOMPARE(QFile(fileName).size(), headerSize + 4*c_recordSize);
+
+    SpectronDatasetReader reader;
+    QVERIFY2(reader.open(fileName), qPrintable(reader.getLastError()));
+    QVERIFY(reader.isOpen());
+
+    const TDatasetHeader& header = reader.header();
+    QCOMPARE(header.pixels, (quint16)c_pixels);
+    QCOMPARE(header.headerSize, (quint32)headerSize);
+    QCOMPARE(header.recordSize, (quint32)c_recordSize);
+    QVERIFY(header.createdMs >= before && header.createdMs <= QDateTime::currentMSecsSinceEpoch());
+    for (int i=0; i<6; i++)
+        QCOMPARE(header.specCalibration[i], m_device.getSpecCalibration()[i]);
+    QCOMPARE(header.minWavelength, m_device.getWavelength(0));
+    QCOMPARE(header.maxWavelength, m_device.getWavelength(c_pixels - 1));
+    QCOMPARE(header.satVoltage[0], 4.5);
+    QCOMPARE(header.satVoltage[1], 2.25);
+    QCOMPARE(header.minBlackVoltage, 0.25);
+    QCOMPARE(header.pixelOffset, (quint16)c_pixelOffset);
+    QCOMPARE(header.supportsGain, (quint8)1);
+    QCOMPARE(header.adcRef, (quint8)SpectronDevice::ADC_4_096V);
+    QCOMPARE(header.gain, (quint8)SpectronDevice::HIGH_GAIN);
+    QCOMPARE(header.measType, (quint8)SpectronDevice::MEASURE_ABSOLUTE);
+
+    // pixel number in the calibration starts with 1
+    QCOMPARE(reader.pixels(), c_pixels);
+    for (int i=0; i<c_pixels; i++)
+    {
+        double p = i + 1 + c_pixelOffset;
+        QCOMPARE(reader.wavelengths()[i], 300 + 50*p + 0.5*p*p);
+    }
+
+    checkFrames(reader, 4, 1000);
+
+    reader.close();
+    QVERIFY(!reader.isOpen());
+    QCOMPARE(reader.frames(), 0);
+}
+
+// Interrupted writer leaves a partial record which the reader skips and
+// the append drops before the new frames
+void TestDataset::appendTruncated()
+{
+    QString fileName = tempFile("append.spd");
+    qint64 headerSize = sizeof(TDatasetHeader) + c_pixels*sizeof(double);
+
+    SpectronDatasetWriter writer;
+    QVERIFY(writer.open(fileName, m_device));
+    QVERIFY(writeFrames(writer, 0, 3, 5000));
+    writer.close();
+
+    QVERIFY(QFile::resize(fileName, headerSize + 2*c_recordSize + 20));
+
+    SpectronDatasetReader reader;
+    QVERIFY(reader.open(fileName));
+    checkFrames(reader, 2, 5000);
+    reader.close();
+
+    QVERIFY2(writer.open(fileName, m_device, true), qPrintable(writer.getLastError()));
+    QCOMPARE(writer.frames(), 2);
+    QCOMPARE(QFile(fileName).size(), headerSize + 2*c_recordSize);
+    QVERIFY(writeFrames(writer, 2, 5, 5000));
+    QCOMPARE(writer.frames(), 5);
+    writer.close();
+
+    QCOMPARE(QFile(fileName).size(), headerSize + 5*c_recordSize);
+    QVERIFY(reader.open(fileName));
+    checkFrames(reader, 5, 5000);
+    reader.close();
+
+    // append to missing or empty file creates it
+    QString newFile = tempFile("append-new.spd");
+    QVERIFY(writer.open(newFile, m_device, true));
+    QVERIFY(writeFrames(writer, 0, 1, 5000));
+    writer.close();
+    QVERIFY(writeFile(newFile, QByteArray()));
+    QVERIFY(writer.open(newFile, m_device, true));
+    QVERIFY(writeFrames(writer, 0, 2, 5000));
+    writer.close();
+    QVERIFY(reader.open(newFile));
+    checkFrames(reader, 2, 5000);
+}
+
+// Files with broken header are rejected by the reader and by the append
+void TestDataset::invalidHeader()
+{
+    QString fileName = tempFile("valid.spd");
+    SpectronDatasetWriter writer;
+    QVERIFY(writer.open(fileName, m_device));
+    QVERIFY(writeFrames(writer, 0, 2, 0));
+    writer.close();
+    QByteArray valid = readFile(fileName);
+    QVERIFY(!valid.isEmpty());
+
+    QList<QByteArray> files;
+    // short file
+    files << valid.left(sizeof(TDatasetHeader) - 1);
+    // file shorter than the header with wavelengths
+    files << valid.left(sizeof(TDatasetHeader) + 8);
+    QByteArray data = valid;
+    ((TDatasetHeader*)data.data())->magic = 0x44435054;
+    files << data;
+    data = valid;
+    ((TDatasetHeader*)data.data())->version = 2;
+    files << data;
+    data = valid;
+    ((TDatasetHeader*)data.data())->headerSize -= 8;
+    files << data;
+    data = valid;
+    ((TDatasetHeader*)data.data())->headerSize += 4;
+    files << data;
+    data = valid;
+    ((TDatasetHeader*)data.data())->recordSize = sizeof(TDatasetRecord) + 8;
+    files << data;
+    data = valid;
+    ((TDatasetHeader*)data.data())->recordSize += 4;
+    files << data;
+
+    for (int i=0; i<files.size(); i++)
+    {
+        QString name = tempFile(QString("invalid%1.spd").arg(i));
+        QVERIFY(writeFile(name, files.at(i)));
+
+        SpectronDatasetReader reader;
+        QVERIFY2(!reader.open(name), qPrintable(name));
+        QCOMPARE(reader.getLastError(), QString("Not a dataset file"));
+        QVERIFY(!reader.isOpen());
+        QVERIFY(!reader.refresh());
+
+        QVERIFY2(!writer.open(name, m_device, true), qPrintable(name));
+        QCOMPARE(writer.getLastError(), QString("Not a dataset file"));
+        QVERIFY(!writer.isOpen());
+
+        // rejected file is left as it was
+        QVERIFY(readFile(name) == files.at(i));
+    }
+
+    // append needs the same number of pixels
+    ParticleDevice board("spec7");
+    SpectronDevice device7;
+    device7 = board;
+    QVERIFY(device7.refresh());
+    QVERIFY(!writer.open(fileName, device7, true));
+    QCOMPARE(writer.getLastError(), QString("Dataset has different number of pixels"));
+    QVERIFY(readFile(fileName) == valid);
+}
+
+// Frames appended while the reader is open appear after refresh(),
+// partial record being written is not counted
+void TestDataset::refresh()
+{
+    QString fileName = tempFile("refresh.spd");
+    SpectronDatasetWriter writer;
+    QVERIFY(writer.open(fileName, m_device));
+    QVERIFY(writeFrames(writer, 0, 1, 200));
+
+    SpectronDatasetReader reader;
+    QVERIFY(reader.open(fileName));
+    checkFrames(reader, 1, 200);
+
+    QVERIFY(writeFrames(writer, 1, 3, 200));
+    QCOMPARE(reader.frames(), 1);
+    QVERIFY(reader.refresh());
+    checkFrames(reader, 3, 200);
+    writer.close();
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    QCOMPARE(file.write(QByteArray(c_recordSize - 8, 0)), (qint64)c_recordSize - 8);
+    file.close();
+    QVERIFY(reader.refresh());
+    checkFrames(reader, 3, 200);
+
+    reader.close();
+    QVERIFY(!reader.refresh());
+}
+
+// Dataset converted to CSV and JSON has the frames with times since the
+// dataset creation
+void TestDataset::save()
+{
+    QString fileName = tempFile("save.spd");
+    SpectronDatasetWriter writer;
+    QVERIFY(writer.open(fileName, m_device));
+    writer.close();
+
+    SpectronDatasetReader reader;
+    QVERIFY(reader.open(fileName));
+    qint64 createdMs = reader.header().createdMs;
+    reader.close();
+
+    QVERIFY(writer.open(fileName, m_device, true));
+    QVERIFY(writeFrames(writer, 0, 3, createdMs + 100));
+    writer.close();
+    QVERIFY(reader.open(fileName));
+
+    QString csvFile = tempFile("save.csv");
+    QVERIFY2(reader.saveCSV(csvFile), qPrintable(reader.getLastError()));
+    QStringList lines = QString::fromUtf8(readFile(csvFile)).split('\n');
+    QCOMPARE(lines.size(), 5);
+    QVERIFY(lines.last().isEmpty());
+
+    QStringList columns = lines.first().split(',');
+    QCOMPARE(columns.size(), 8 + c_pixels);
+    QCOMPARE(columns.at(7), QString("time_ms"));
+    for (int i=0; i<c_pixels; i++)
+        QVERIFY(qAbs(columns.at(8 + i).toDouble() - reader.wavelengths()[i]) < 1e-6);
+
+    for (int f=0; f<3; f++)
+    {
+        TDatasetRecord record = makeRecord(f, 100 + f);
+        TDoubleVec values = frameValues(f);
+        QStringList fields = lines.at(f + 1).split(',');
+        QCOMPARE(fields.size(), 8 + c_pixels);
+        QCOMPARE(fields.at(0), QString(f % 2 ? "noise" : "measurement"));
+        QCOMPARE(fields.at(1).toInt(), (int)record.seq);
+        QCOMPARE(fields.at(2).toInt(), record.position);
+        QCOMPARE(fields.at(3).toInt(), (int)record.integTimeUs);
+        QCOMPARE(fields.at(4).toInt(), (int)record.adcRef);
+        QCOMPARE(fields.at(5).toInt(), (int)record.gain);
+        QCOMPARE(fields.at(6).toInt(), (int)record.measType);
+        QCOMPARE(fields.at(7).toLongLong(), record.timeMs);
+        for (int i=0; i<c_pixels; i++)
+            QCOMPARE(fields.at(8 + i).toDouble(), values.at(i));
+    }
+
+    QString jsonFile = tempFile("save.json.gz");
+    QVERIFY2(reader.saveJSON(jsonFile, true), qPrintable(reader.getLastError()));
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(gunzip(readFile(jsonFile)), &parseError);
+    QCOMPARE(parseError.error, QJsonParseError::NoError);
+    QVERIFY(doc.isObject());
+
+    QJsonArray wavelengths = doc.object()["wavelengths"].toArray();
+    QCOMPARE(wavelengths.size(), c_pixels);
+    for (int i=0; i<c_pixels; i++)
+        QVERIFY(qAbs(wavelengths.at(i).toDouble() - reader.wavelengths()[i]) < 1e-6);
+
+    QJsonArray frames = doc.object()["frames"].toArray();
+    QCOMPARE(frames.size(), 3);
+    for (int f=0; f<3; f++)
+    {
+        QJsonObject frame = frames.at(f).toObject();
+        TDoubleVec values = frameValues(f);
+        QCOMPARE(frame["seq"].toInt(), f);
+        QCOMPARE(frame["position"].toInt(), 400 - 3*f);
+        QCOMPARE((qint64)frame["time_ms"].toDouble(), (qint64)(100 + f));
+        QJsonArray frameValues = frame["values"].toArray();
+        QCOMPARE(frameValues.size(), c_pixels);
+        for (int i=0; i<c_pixels; i++)
+            QCOMPARE(frameValues.at(i).toDouble(), values.at(i));
+    }
+
+    reader.close();
+    QVERIFY(!reader.saveCSV(tempFile("closed.csv")));
+    QCOMPARE(reader.getLastError(), QString("Dataset is not open"));
+    QVERIFY(!QFile::exists(tempFile("closed.csv")));
+}
+
+void TestDataset::errors()
+{
+    SpectronDatasetWriter writer;
+    QVERIFY(!writer.append(makeRecord(0, 0), frameValues(0)));
+    QCOMPARE(writer.getLastError(), QString("Dataset is not open"));
+
+    QVERIFY(!writer.open(tempFile("missing/dir.spd"), m_device));
+    QVERIFY(!writer.getLastError().isEmpty());
+
+    QVERIFY(writer.open(tempFile("errors.spd"), m_device));
+    TDoubleVec values = frameValues(0);
+    values << 1.0;
+    QVERIFY(!writer.append(makeRecord(0, 0), values));
+    QCOMPARE(writer.getLastError(), QString("Frame has different number of pixels"));
+
+    // device has no measurement yet
+    QVERIFY(!writer.append(m_device));
+    QCOMPARE(writer.getLastError(), QString("Frame has different number of pixels"));
+    QCOMPARE(writer.frames(), 0);
+
+    SpectronDatasetReader reader;
+    QVERIFY(!reader.open(tempFile("missing.spd")));
+    QVERIFY(!reader.getLastError().isEmpty());
+    QVERIFY(!reader.isOpen());
+}
+
+QTEST_GUILESS_MAIN(TestDataset)
+#include "tst_dataset.moc"
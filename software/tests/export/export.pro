@@ -0,0 +1,13 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_export
+INCLUDEPATH += ../../common
+SOURCES += tst_export.cpp \
+           ../../common/spectron_export.cpp
+HEADERS += ../../common/spectron_export.h \
+           ../../common/spectron_dataset.h \
+           ../../common/spectron_api.h
+LIBS += -lz
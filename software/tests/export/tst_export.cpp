@@ -0,0 +1,343 @@
+/*
+ *  tst_export.cpp - CSV and JSON export writer tests - file layout, value
+ *                   formatting and gzip output checked with zlib
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <math.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "spectron_export.h"
+
+// Decompress gzip file of one or more members with zlib - CRC and size
+// of every member are checked by inflate()
+static bool gunzip(const QByteArray& data, QByteArray& result, int& members)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return false;
+
+    stream.next_in = (Bytef*)data.constData();
+    stream.avail_in = data.size();
+    result.clear();
+    members = 0;
+
+    bool success = false;
+    char buf[65536];
+    for (;;)
+    {
+        stream.next_out = (Bytef*)buf;
+        stream.avail_out = sizeof(buf);
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+
+        result.append(buf, sizeof(buf) - stream.avail_out);
+        if (ret == Z_STREAM_END)
+        {
+            ++members;
+            if (stream.avail_in == 0)
+            {
+                success = true;
+                break;
+            }
+            inflateReset(&stream);
+        }
+    }
+    inflateEnd(&stream);
+
+    return success;
+}
+
+static QByteArray readFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    return file.readAll();
+}
+
+static TDatasetRecord makeRecord(quint32 seq, int dataType = SpectronDevice::ET_MEASUREMENT)
+{
+    TDatasetRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = seq;
+    record.integTimeUs = 20000;
+    record.position = -12;
+    record.adcRef = SpectronDevice::ADC_4_096V;
+    record.gain = SpectronDevice::HIGH_GAIN;
+    record.measType = SpectronDevice::MEASURE_ABSOLUTE;
+    record.dataType = dataType;
+    record.timeMs = 1546300800123LL;
+
+    return record;
+}
+
+// Values covering the formatting cases - fraction digits, negatives,
+// rounding to zero and the exponent form from 1e12 up
+static TDoubleVec testValues()
+{
+    TDoubleVec values;
+    values << 0.0 << 0.5 << -1.25 << 123456.789012 << -0.0000004 << 0.0000006
+           << 999999999999.9 << 1e12 << -3.5e13 << 2.75e20 << 1.0/3 << -7.0;
+    return values;
+}
+
+class TestExport : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void csvLayout();
+    void jsonLayout();
+    void roundTrip();
+    void compressed();
+    void errors();
+
+private:
+    QString tempFile(const QString& name) { return m_dir.path() + "/" + name; }
+
+    QTemporaryDir m_dir;
+};
+
+void TestExport::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+// Header line with column names and wavelengths, one line per frame
+// with its metadata - NaN is an empty field
+void TestExport::csvLayout()
+{
+    TDoubleVec wavelengths;
+    wavelengths << 350 << 400.5 << 451.25;
+
+    SpectronExportWriter writer;
+    QString fileName = tempFile("layout.csv");
+    QVERIFY(writer.open(fileName, SpectronExportWriter::EF_CSV, wavelengths));
+    QVERIFY(writer.isOpen());
+
+    TDoubleVec values;
+    values << 0.5 << -1.25 << 0;
+    QVERIFY(writer.writeFrame(makeRecord(7), values));
+    float black[] = { 0.125f, NAN, 2.0f };
+    QVERIFY(writer.writeFrame(makeRecord(8, SpectronDevice::ET_BLACK_LEVELS), black));
+    QCOMPARE(writer.frames(), 2);
+    QVERIFY(writer.close());
+    QVERIFY(!writer.isOpen());
+
+    QCOMPARE(QString::fromUtf8(readFile(fileName)),
+             QString("type,seq,position,integration_us,adc_ref,gain,meas_type,time_ms,350,400.5,451.25\n"
+                     "measurement,7,-12,20000,2,1,2,1546300800123,0.5,-1.25,0\n"
+                     "black,8,-12,20000,2,1,2,1546300800123,0.125,,2\n"));
+}
+
+// Object with wavelengths and frames array - NaN is null, the output
+// parses as JSON
+void TestExport::jsonLayout()
+{
+    TDoubleVec wavelengths;
+    wavelengths << 350 << 400.5;
+
+    SpectronExportWriter writer;
+    QString fileName = tempFile("layout.json");
+    QVERIFY(writer.open(fileName, SpectronExportWriter::EF_JSON, wavelengths));
+
+    TDoubleVec values;
+    values << 1.5 << NAN;
+    QVERIFY(writer.writeFrame(makeRecord(1), values));
+    values[1] = -2;
+    QVERIFY(writer.writeFrame(makeRecord(2, SpectronDevice::ET_NORMALISATION), values));
+    QVERIFY(writer.close());
+
+    QByteArray data = readFile(fileName);
+    QCOMPARE(QString::fromUtf8(data),
+             QString("{\"wavelengths\":[350,400.5],\n\"frames\":["
+                     "\n{\"type\":\"measurement\",\"seq\":1,\"position\":-12,\"integration_us\":20000,"
+                     "\"adc_ref\":2,\"gain\":1,\"meas_type\":2,\"time_ms\":1546300800123,\"values\":[1.5,null]},"
+                     "\n{\"type\":\"normalisation\",\"seq\":2,\"position\":-12,\"integration_us\":20000,"
+                     "\"adc_ref\":2,\"gain\":1,\"meas_type\":2,\"time_ms\":1546300800123,\"values\":[1.5,-2]}"
+                     "\n]}\n"));
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(data, &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(doc.object()["frames"].toArray().size(), 2);
+}
+
+// Values read back are within the rounding of the decimals setting, or
+// within 6 significant digits in exponent form
+void TestExport::roundTrip()
+{
+    TDoubleVec values = testValues();
+    values << NAN;
+    TDoubleVec wavelengths;
+    for (int i=0; i<values.size(); i++)
+        wavelengths << 340 + i*2.5;
+
+    for (int decimals=0; decimals<=6; decimals+=3)
+    for (int format=SpectronExportWriter::EF_CSV; format<=SpectronExportWriter::EF_JSON; format++)
+    {
+        SpectronExportWriter writer;
+        writer.setDecimals(decimals);
+        QString fileName = tempFile(QString("values%1.%2").arg(decimals).arg(format));
+        QVERIFY(writer.open(fileName, (SpectronExportWriter::TFormat)format, wavelengths));
+        QVERIFY(writer.writeFrame(makeRecord(1), values));
+        QVERIFY(writer.close());
+
+        QByteArray data = readFile(fileName);
+        QStringList fields;
+        if (format == SpectronExportWriter::EF_CSV)
+        {
+            QStringList lines = QString::fromUtf8(data).split('\n');
+            QCOMPARE(lines.size(), 3);
+            QVERIFY(lines.at(2).isEmpty());
+            fields = lines.at(1).split(',').mid(8);
+        }
+        else
+        {
+            QJsonDocument doc = QJsonDocument::fromJson(data);
+            QJsonArray array = doc.object()["frames"].toArray().at(0).toObject()["values"].toArray();
+            for (int i=0; i<array.size(); i++)
+                fields << (array.at(i).isNull() ? QString() : QString::number(array.at(i).toDouble(), 'g', 17));
+        }
+        QCOMPARE(fields.size(), values.size());
+
+        double step = pow(10.0, -decimals);
+        for (int i=0; i<values.size(); i++)
+        {
+            QString context = QString("decimals %1 format %2 value %3 written %4")
+                                .arg(decimals).arg(format).arg(values.at(i), 0, 'g', 17).arg(fields.at(i));
+            if (values.at(i) != values.at(i))
+            {
+                QVERIFY2(fields.at(i).isEmpty(), qPrintable(context));
+                continue;
+            }
+
+            bool ok;
+            double value = fields.at(i).toDouble(&ok);
+            QVERIFY2(ok, qPrintable(context));
+            double tolerance = fabs(values.at(i)) >= 1e12 ? fabs(values.at(i))*5e-6 : step/2 + 1e-9;
+            QVERIFY2(fabs(value - values.at(i)) <= tolerance, qPrintable(context));
+
+            // exponent form from 1e12 up, otherwise no trailing zeros and
+            // no more decimals than set
+            if (format != SpectronExportWriter::EF_CSV)
+                continue;
+            QVERIFY2(fields.at(i).contains("e") == (fabs(values.at(i)) >= 1e12), qPrintable(context));
+            if (fabs(values.at(i)) < 1e12)
+            {
+                int point = fields.at(i).indexOf('.');
+                QVERIFY2(point < 0 || (!fields.at(i).endsWith('0')
+                                       && fields.at(i).size() - point - 1 <= decimals),
+                         qPrintable(context));
+                QVERIFY2(!fields.at(i).startsWith("-0") || fields.at(i).startsWith("-0."),
+                         qPrintable(context));
+            }
+        }
+    }
+}
+
+// Output above the buffer size is written as several gzip members which
+// zlib reads as one stream with the same contents as uncompressed output
+void TestExport::compressed()
+{
+    TDoubleVec wavelengths;
+    for (int i=0; i<288; i++)
+        wavelengths << 340 + i*1.8;
+
+    QString plainName = tempFile("frames.csv");
+    QString gzipName = tempFile("frames.csv.gz");
+    SpectronExportWriter plain, gzip;
+    QVERIFY(plain.open(plainName, SpectronExportWriter::EF_CSV, wavelengths));
+    QVERIFY(gzip.open(gzipName, SpectronExportWriter::EF_CSV, wavelengths, true));
+
+    TDoubleVec values(wavelengths.size());
+    for (int f=0; f<400; f++)
+    {
+        for (int i=0; i<values.size(); i++)
+            values[i] = sin(f*0.1 + i*0.05)*(i%7 + 1) - 0.5;
+        QVERIFY(plain.writeFrame(makeRecord(f), values));
+        QVERIFY(gzip.writeFrame(makeRecord(f), values));
+    }
+    QVERIFY(plain.close());
+    QVERIFY(gzip.close());
+
+    QByteArray expected = readFile(plainName);
+    QVERIFY2(expected.size() > 3*256*1024, qPrintable(QString("%1 bytes").arg(expected.size())));
+
+    QByteArray data = readFile(gzipName);
+    QVERIFY(data.size() < expected.size()/2);
+    QByteArray result;
+    int members = 0;
+    QVERIFY(gunzip(data, result, members));
+    // buffer is written out when the next item does not fit, so members
+    // can be a few bytes short of the buffer size
+    const int bufferSize = 256*1024;
+    QVERIFY2(members >= (expected.size() + bufferSize - 1)/bufferSize
+             && members <= expected.size()/(bufferSize - 64) + 1,
+             qPrintable(QString("%1 members").arg(members)));
+    QVERIFY(result == expected);
+
+    // damaged member fails the CRC check
+    data[data.size()/2] = data.at(data.size()/2) ^ 0x55;
+    QVERIFY(!gunzip(data, result, members) || result != expected);
+
+    // output smaller than the buffer is a single member
+    QVERIFY(gzip.open(gzipName, SpectronExportWriter::EF_JSON, wavelengths, true));
+    QVERIFY(gzip.writeFrame(makeRecord(1), values));
+    QVERIFY(gzip.close());
+    QVERIFY(gunzip(readFile(gzipName), result, members));
+    QCOMPARE(members, 1);
+    QVERIFY(QJsonDocument::fromJson(result).isObject());
+}
+
+void TestExport::errors()
+{
+    TDoubleVec wavelengths;
+    wavelengths << 350 << 400;
+    TDoubleVec values;
+    values << 1;
+
+    // closed writer has no pixels
+    SpectronExportWriter writer;
+    QVERIFY(!writer.writeFrame(makeRecord(1), TDoubleVec()));
+    QCOMPARE(writer.getLastError(), QString("Export file is not open"));
+
+    QVERIFY(!writer.open(m_dir.path() + "/missing/file.csv", SpectronExportWriter::EF_CSV, wavelengths));
+    QVERIFY(!writer.getLastError().isEmpty());
+
+    QVERIFY(writer.open(tempFile("errors.csv"), SpectronExportWriter::EF_CSV, wavelengths));
+    QVERIFY(!writer.writeFrame(makeRecord(1), values));
+    QCOMPARE(writer.getLastError(), QString("Frame has different number of pixels"));
+    QCOMPARE(writer.frames(), 0);
+    QVERIFY(writer.close());
+}
+
+QTEST_GUILESS_MAIN(TestExport)
+#include "tst_export.moc"
@@ -0,0 +1,10 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_frame
+INCLUDEPATH += ../../common
+SOURCES += tst_frame.cpp \
+           ../../common/spectron_frame.cpp
+HEADERS += ../../common/spectron_frame.h
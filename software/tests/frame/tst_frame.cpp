@@ -0,0 +1,394 @@
+/*
+ *  tst_frame.cpp - Frame packet parsing and frame client tests against
+ *                  a stand-in board frame server
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QtEndian>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QHash>
+#include <string.h>
+
+#include "spectron_frame.h"
+
+static const int c_headerSize = 40;
+
+// Packet as built by buildFramePacket() in board firmware
+static QByteArray framePacket(quint32 seq,
+                              quint8 format,
+                              const QVector<double>& values,
+                              float scale = 1.0f,
+                              quint32 magic = 0x46435053,
+                              quint16 version = 1)
+{
+    int valueSize = format == TFrameHeader::FF_UINT16 ? 2 : 4;
+    QByteArray packet(c_headerSize + values.size()*valueSize, 0);
+    uchar* data = (uchar*)packet.data();
+
+    quint32 scaleBits;
+    memcpy(&scaleBits, &scale, sizeof(float));
+
+    qToLittleEndian<quint32>(magic, data);
+    qToLittleEndian<quint16>(version, data+4);
+    qToLittleEndian<quint16>(c_headerSize, data+6);
+    qToLittleEndian<quint32>(values.size()*valueSize, data+8);
+    qToLittleEndian<quint32>(seq, data+12);
+    qToLittleEndian<quint32>(1000+seq, data+16);       // timeMs
+    qToLittleEndian<quint32>(20000, data+20);          // integTimeUs
+    data[24] = 0;                                      // measurement
+    data[25] = format;
+    data[26] = 1;                                      // adcRef
+    data[27] = 0;                                      // gain
+    data[28] = 2;                                      // measType
+    qToLittleEndian<quint16>(values.size(), data+30);
+    qToLittleEndian<quint16>(3, data+32);              // pixelOffset
+    qToLittleEndian<quint16>(4, data+34);              // readings
+    qToLittleEndian<quint32>(scaleBits, data+36);
+
+    uchar* payload = data + c_headerSize;
+    for (int i=0; i<values.size(); i++)
+    {
+        if (format == TFrameHeader::FF_UINT16)
+            qToLittleEndian<quint16>(qRound(values[i]/scale), payload+i*2);
+        else
+        {
+            float fValue = values[i];
+            quint32 bits;
+            memcpy(&bits, &fValue, sizeof(float));
+            qToLittleEndian<quint32>(bits, payload+i*4);
+        }
+    }
+
+    return packet;
+}
+
+//
+// Stand-in for the board frame server - answers each request line with
+// the packet set for it. The packet is written in parts with a pause in
+// between to make the client reassemble it, and a negative part count
+// writes only the first part and leaves the request unanswered.
+//
+class FrameServer : public QThread
+{
+public:
+    FrameServer() : m_port(0) {}
+
+    void setReply(const QString& request, const QByteArray& packet, int parts = 1)
+    {
+        m_replies[request] = packet;
+        m_parts[request] = parts;
+    }
+
+    // start and wait until the server listens on the port
+    quint16 startServer()
+    {
+        start();
+        m_ready.acquire();
+        return m_port;
+    }
+
+    void stopServer()
+    {
+        requestInterruption();
+        wait();
+    }
+
+protected:
+    void run() override
+    {
+        QTcpServer server;
+        server.listen(QHostAddress::LocalHost);
+        m_port = server.serverPort();
+        m_ready.release();
+
+        while (!isInterruptionRequested())
+        {
+            if (!server.waitForNewConnection(50))
+                continue;
+
+            QTcpSocket* socket = server.nextPendingConnection();
+            while (!isInterruptionRequested()
+                   && socket->state() == QAbstractSocket::ConnectedState)
+            {
+                if (!socket->canReadLine() && !socket->waitForReadyRead(50))
+                    continue;
+                if (!socket->canReadLine())
+                    continue;
+
+                QString request = QString::fromLatin1(socket->readLine()).trimmed();
+                QByteArray packet = m_replies.value(request);
+                int parts = m_parts.value(request, 1);
+                int count = qAbs(parts);
+                int partSize = (packet.size() + count - 1)/count;
+
+                for (int i=0; i<count; i++)
+                {
+                    socket->write(packet.mid(i*partSize, partSize));
+                    socket->waitForBytesWritten(1000);
+                    if (parts < 0)
+                        break;
+                    msleep(20);
+                }
+            }
+            delete socket;
+        }
+    }
+
+private:
+    QHash<QString, QByteArray> m_replies;
+    QHash<QString, int>        m_parts;
+    QSemaphore m_ready;
+    quint16    m_port;
+};
+
+class TestFrame : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parseFloat32();
+    void parseUInt16();
+    void parseTruncated();
+    void parseInvalid();
+    void parseEmpty();
+    void parseConsecutive();
+    void clientRequests();
+    void clientTimeout();
+    void clientInvalidPacket();
+};
+
+void TestFrame::parseFloat32()
+{
+    QVector<double> values = { 0.25, 1.5, 0.75, 3.0, 0.125 };
+    QByteArray packet = framePacket(7, TFrameHeader::FF_FLOAT32, values);
+    QCOMPARE(packet.size(), c_headerSize + 5*4);
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue = -1;
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), packet.size());
+
+    QCOMPARE(header.seq, 7u);
+    QCOMPARE(header.timeMs, 1007u);
+    QCOMPARE(header.integTimeUs, 20000u);
+    QCOMPARE((int)header.dataType, 0);
+    QCOMPARE((int)header.format, (int)TFrameHeader::FF_FLOAT32);
+    QCOMPARE((int)header.adcRef, 1);
+    QCOMPARE((int)header.gain, 0);
+    QCOMPARE((int)header.measType, 2);
+    QCOMPARE((int)header.pixels, 5);
+    QCOMPARE((int)header.pixelOffset, 3);
+    QCOMPARE((int)header.readings, 4);
+    QCOMPARE(header.scale, 1.0f);
+    QCOMPARE(parsed, values);
+    QCOMPARE(maxValue, 3.0);
+}
+
+void TestFrame::parseUInt16()
+{
+    const float scale = 1.0f/4096;
+    QVector<double> values = { 100*scale, 4000*scale, 65535*scale, 0 };
+    QByteArray packet = framePacket(8, TFrameHeader::FF_UINT16, values, scale);
+    QCOMPARE(packet.size(), c_headerSize + 4*2);
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue = -1;
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), packet.size());
+
+    QCOMPARE((int)header.format, (int)TFrameHeader::FF_UINT16);
+    QCOMPARE(header.scale, scale);
+    QCOMPARE(parsed.size(), values.size());
+    for (int i=0; i<values.size(); i++)
+        QCOMPARE(parsed[i], values[i]);
+    QCOMPARE(maxValue, 65535*(double)scale);
+}
+
+void TestFrame::parseTruncated()
+{
+    QVector<double> values = { 1, 2, 3 };
+    QByteArray packet = framePacket(1, TFrameHeader::FF_FLOAT32, values);
+
+    // every prefix is incomplete - before magic, within header, within payload
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    for (int size=0; size<packet.size(); size++)
+        QCOMPARE(parseFramePacket(packet.left(size), header, parsed, maxValue), 0);
+}
+
+void TestFrame::parseInvalid()
+{
+    QVector<double> values = { 1, 2 };
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+
+    // wrong magic or version is detected as soon as 8 bytes are there
+    QByteArray packet = framePacket(1, TFrameHeader::FF_FLOAT32, values, 1.0f, 0x12345678);
+    QCOMPARE(parseFramePacket(packet.left(8), header, parsed, maxValue), -1);
+    packet = framePacket(1, TFrameHeader::FF_FLOAT32, values, 1.0f, 0x46435053, 2);
+    QCOMPARE(parseFramePacket(packet.left(8), header, parsed, maxValue), -1);
+
+    // header shorter than 40 bytes
+    packet = framePacket(1, TFrameHeader::FF_FLOAT32, values);
+    qToLittleEndian<quint16>(32, (uchar*)packet.data()+6);
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), -1);
+
+    // payload size does not match format and pixels
+    packet = framePacket(1, TFrameHeader::FF_FLOAT32, values);
+    packet[25] = TFrameHeader::FF_UINT16;
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), -1);
+
+    // unknown format
+    packet = framePacket(1, TFrameHeader::FF_FLOAT32, values);
+    packet[25] = 5;
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), -1);
+}
+
+void TestFrame::parseEmpty()
+{
+    QByteArray packet = framePacket(0, TFrameHeader::FF_FLOAT32, QVector<double>());
+    QCOMPARE(packet.size(), c_headerSize);
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    QCOMPARE(parseFramePacket(packet, header, parsed, maxValue), c_headerSize);
+    QCOMPARE((int)header.pixels, 0);
+}
+
+void TestFrame::parseConsecutive()
+{
+    // only the first packet is consumed, the rest stays for the next call
+    QVector<double> first = { 1, 2 };
+    QVector<double> second = { 5, 4, 3 };
+    QByteArray packet1 = framePacket(1, TFrameHeader::FF_FLOAT32, first);
+    QByteArray buf = packet1 + framePacket(2, TFrameHeader::FF_FLOAT32, second);
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    int size = parseFramePacket(buf, header, parsed, maxValue);
+    QCOMPARE(size, packet1.size());
+    QCOMPARE(parsed, first);
+
+    buf.remove(0, size);
+    QCOMPARE(parseFramePacket(buf, header, parsed, maxValue), buf.size());
+    QCOMPARE(header.seq, 2u);
+    QCOMPARE(parsed, second);
+    QCOMPARE(maxValue, 5.0);
+}
+
+void TestFrame::clientRequests()
+{
+    QVector<double> values;
+    for (int i=0; i<288; i++)
+        values.append(i/288.0);
+    const float scale = 1.0f/65536;
+
+    FrameServer server;
+    server.setReply("0", framePacket(11, TFrameHeader::FF_FLOAT32, values));
+    server.setReply("0,U16", framePacket(12, TFrameHeader::FF_UINT16, values, scale), 3);
+    server.setReply("FRAME", framePacket(0, TFrameHeader::FF_FLOAT32, QVector<double>()));
+    quint16 port = server.startServer();
+
+    SpectronFrameClient client;
+    QVERIFY(client.open("127.0.0.1", port, 2000));
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    QVERIFY(client.request("0", header, parsed, maxValue));
+    QCOMPARE(header.seq, 11u);
+    QCOMPARE(parsed, values);
+
+    // packet arriving in parts is reassembled
+    QVERIFY(client.request("0,U16", header, parsed, maxValue));
+    QCOMPARE(header.seq, 12u);
+    QCOMPARE(parsed.size(), values.size());
+    for (int i=0; i<values.size(); i++)
+        QVERIFY(qAbs(parsed[i] - values[i]) <= scale/2);
+
+    // empty packet fails the request but keeps the connection
+    QVERIFY(!client.request("FRAME", header, parsed, maxValue));
+    QCOMPARE(client.getLastError(), QString("No frame data available"));
+    QVERIFY(client.isOpen());
+
+    QVERIFY(client.request("0", header, parsed, maxValue));
+    QCOMPARE(header.seq, 11u);
+
+    client.close();
+    server.stopServer();
+}
+
+void TestFrame::clientTimeout()
+{
+    QVector<double> values = { 1, 2, 3, 4 };
+
+    FrameServer server;
+    server.setReply("0", framePacket(1, TFrameHeader::FF_FLOAT32, values), -2);
+    quint16 port = server.startServer();
+
+    SpectronFrameClient client;
+    QVERIFY(client.open("127.0.0.1", port, 300));
+
+    // truncated reply times out and drops the connection
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!client.request("0", header, parsed, maxValue));
+    QVERIFY(timer.elapsed() >= 250);
+    QVERIFY(!client.isOpen());
+
+    QVERIFY(!client.request("0", header, parsed, maxValue));
+    QCOMPARE(client.getLastError(), QString("Frame transport is not connected"));
+
+    server.stopServer();
+}
+
+void TestFrame::clientInvalidPacket()
+{
+    QVector<double> values = { 1, 2 };
+
+    FrameServer server;
+    server.setReply("0", framePacket(1, TFrameHeader::FF_FLOAT32, values, 1.0f, 0x12345678));
+    quint16 port = server.startServer();
+
+    SpectronFrameClient client;
+    QVERIFY(client.open("127.0.0.1", port, 2000));
+
+    TFrameHeader header;
+    TDoubleVec parsed;
+    double maxValue;
+    QVERIFY(!client.request("0", header, parsed, maxValue));
+    QCOMPARE(client.getLastError(), QString("Invalid frame packet received"));
+    QVERIFY(!client.isOpen());
+
+    server.stopServer();
+}
+
+QTEST_GUILESS_MAIN(TestFrame)
+#include "tst_frame.moc"
@@ -0,0 +1,10 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_particle
+INCLUDEPATH += ../../common
+SOURCES += tst_particle.cpp \
+           ../../common/particle_api.cpp
+HEADERS += ../../common/particle_api.h
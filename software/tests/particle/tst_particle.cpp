@@ -0,0 +1,286 @@
+/*
+ *  tst_particle.cpp - ParticleAPI request tests against a mock Particle
+ *                     cloud HTTP server
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QHash>
+#include <QElapsedTimer>
+
+#include "particle_api.h"
+
+//
+// Mock of the Particle cloud API - each path is answered with set JSON
+// body after set delay, unknown paths get 404. Every reply closes the
+// connection, so parallel requests come on separate connections and the
+// number of requests being served at the same time is tracked.
+//
+class MockParticleServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    MockParticleServer() : m_active(0), m_maxActive(0)
+    {
+        connect(&m_server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    }
+
+    quint16 listen()
+    {
+        m_server.listen(QHostAddress::LocalHost);
+        return m_server.serverPort();
+    }
+
+    void setReply(const QString& path, const QByteArray& body, int delayMs = 0)
+    {
+        m_replies[path] = body;
+        m_delays[path] = delayMs;
+    }
+
+    void resetStats()           { m_maxActive = m_active; m_requests.clear(); }
+    int maxActive()             { return m_maxActive; }
+    QStringList& requests()     { return m_requests; }
+    QByteArray& lastBody()      { return m_lastBody; }
+
+private slots:
+    void newConnection()
+    {
+        while (m_server.hasPendingConnections())
+        {
+            QTcpSocket* socket = m_server.nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void readRequest()
+    {
+        QTcpSocket* socket = (QTcpSocket*)sender();
+        QByteArray& buf = m_buffers[socket];
+        buf.append(socket->readAll());
+
+        int headerEnd = buf.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        // request body (POST) follows the headers
+        int contentLength = 0;
+        QList<QByteArray> lines = buf.left(headerEnd).split('\n');
+        foreach (const QByteArray& line, lines)
+            if (line.toLower().startsWith("content-length:"))
+                contentLength = line.mid(15).trimmed().toInt();
+        if (buf.size() < headerEnd + 4 + contentLength)
+            return;
+
+        QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+        QString path = QUrl(QString::fromLatin1(requestLine.value(1))).path();
+        m_lastBody = buf.mid(headerEnd + 4, contentLength);
+        m_buffers.remove(socket);
+
+        m_requests.append(QString("%1 %2").arg(QString::fromLatin1(requestLine.value(0))).arg(path));
+        m_maxActive = qMax(m_maxActive, ++m_active);
+
+        QPointer<QTcpSocket> target(socket);
+        QTimer::singleShot(m_delays.value(path, 0), this, [this, target, path]() {
+            --m_active;
+            if (!target || target->state() != QAbstractSocket::ConnectedState)
+                return;
+
+            QByteArray status = "200 OK";
+            QByteArray body = m_replies.value(path);
+            if (!m_replies.contains(path))
+            {
+                status = "404 Not Found";
+                body = "{\"ok\":false,\"error\":\"Variable not found\"}";
+            }
+
+            QByteArray reply = "HTTP/1.1 " + status + "\r\n"
+                               "Content-Type: application/json\r\n"
+                               "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+            target->write(reply);
+            target->disconnectFromHost();
+        });
+    }
+
+private:
+    QTcpServer                    m_server;
+    QHash<QString, QByteArray>    m_replies;
+    QHash<QString, int>           m_delays;
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+    QStringList                   m_requests;
+    QByteArray                    m_lastBody;
+    int                           m_active;
+    int                           m_maxActive;
+};
+
+class TestParticle : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void refreshDevice();
+    void parallelReads();
+    void failedRead();
+    void batchTimeout();
+    void callFunction();
+
+private:
+    MockParticleServer m_server;
+};
+
+static const int c_readDelayMs = 300;
+
+void TestParticle::initTestCase()
+{
+    quint16 port = m_server.listen();
+    QVERIFY(port != 0);
+
+    ParticleAPI& api = ParticleAPI::instance();
+    api.setApiUrl(QString("http://127.0.0.1:%1/").arg(port));
+    QVERIFY(api.login("test-token"));
+
+    m_server.setReply("/v1/devices/dev1",
+                      "{\"id\":\"dev1\",\"name\":\"Spectron\",\"connected\":true,"
+                      "\"variables\":{\"a\":\"int32\",\"b\":\"double\",\"c\":\"string\",\"d\":\"int32\"},"
+                      "\"functions\":[\"spSet\"]}");
+    m_server.setReply("/v1/devices/dev1/a", "{\"name\":\"a\",\"result\":1}", c_readDelayMs);
+    m_server.setReply("/v1/devices/dev1/b", "{\"name\":\"b\",\"result\":2.5}", c_readDelayMs);
+    m_server.setReply("/v1/devices/dev1/c", "{\"name\":\"c\",\"result\":\"x\"}", c_readDelayMs);
+    m_server.setReply("/v1/devices/dev1/d", "{\"name\":\"d\",\"result\":4}", c_readDelayMs);
+    m_server.setReply("/v1/devices/dev1/slow", "{\"name\":\"slow\",\"result\":0}", 3000);
+    m_server.setReply("/v1/devices/dev1/spSet", "{\"id\":\"dev1\",\"connected\":true,\"return_value\":5}");
+}
+
+void TestParticle::init()
+{
+    ParticleAPI::instance().setNetworkTimeout(120000);
+    m_server.resetStats();
+}
+
+void TestParticle::refreshDevice()
+{
+    ParticleDevice device("dev1");
+    QVERIFY(device.refresh());
+    QVERIFY(device.isValid());
+    QVERIFY(device.isConnected());
+    QVERIFY(device.hasFunction("spSet"));
+    QCOMPARE(device.getVariableType("a"), ParticleDevice::VAR_INT);
+    QCOMPARE(device.getVariableType("b"), ParticleDevice::VAR_DOUBLE);
+    QCOMPARE(device.getVariableType("c"), ParticleDevice::VAR_STRING);
+    QCOMPARE(device.getVariableType("e"), ParticleDevice::VAR_NONE);
+    QCOMPARE(m_server.requests(), QStringList() << "GET /v1/devices/dev1");
+}
+
+void TestParticle::parallelReads()
+{
+    ParticleDevice device("dev1");
+    QVERIFY(device.refresh());
+    m_server.resetStats();
+
+    // four reads served in parallel take about one read delay
+    ParticleDevice::TVarValues values;
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(device.getVariableValues(ParticleDevice::TStringList() << "a" << "b" << "c" << "d", values));
+    qint64 elapsed = timer.elapsed();
+
+    QCOMPARE(m_server.requests().size(), 4);
+    QCOMPARE(m_server.maxActive(), 4);
+    QVERIFY2(elapsed < 3*c_readDelayMs, qPrintable(QString("took %1 ms").arg(elapsed)));
+
+    QCOMPARE(values.size(), 4);
+    QCOMPARE(values["a"].toInt(), 1);
+    QCOMPARE(values["b"].toDouble(), 2.5);
+    QCOMPARE(values["c"].toString(), QString("x"));
+    QCOMPARE(values["d"].toInt(), 4);
+
+    // single read goes through the same path
+    QCOMPARE(device.getVariableValue("b").toDouble(), 2.5);
+}
+
+void TestParticle::failedRead()
+{
+    // not refreshed device requests any variable, server has no "e"
+    ParticleDevice device("dev1");
+    ParticleDevice::TVarValues values;
+    QVERIFY(!device.getVariableValues(ParticleDevice::TStringList() << "a" << "e" << "d", values));
+    QCOMPARE(values.size(), 2);
+    QVERIFY(values.contains("a"));
+    QVERIFY(values.contains("d"));
+    QVERIFY(!ParticleAPI::instance().getLastError().isEmpty());
+
+    // refreshed device does not request unknown variables at all
+    QVERIFY(device.refresh());
+    m_server.resetStats();
+    values.clear();
+    QVERIFY(!device.getVariableValues(ParticleDevice::TStringList() << "a" << "e", values));
+    QCOMPARE(m_server.requests(), QStringList() << "GET /v1/devices/dev1/a");
+    QCOMPARE(values.size(), 1);
+}
+
+void TestParticle::batchTimeout()
+{
+    ParticleAPI::instance().setNetworkTimeout(1000);
+
+    // timeout covers the whole batch - finished reads are kept
+    ParticleDevice device("dev1");
+    ParticleDevice::TVarValues values;
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!device.getVariableValues(ParticleDevice::TStringList() << "a" << "slow" << "b", values));
+    qint64 elapsed = timer.elapsed();
+
+    QVERIFY2(elapsed >= 1000 && elapsed < 2500, qPrintable(QString("took %1 ms").arg(elapsed)));
+    QCOMPARE(values.size(), 2);
+    QCOMPARE(values["a"].toInt(), 1);
+    QCOMPARE(values["b"].toDouble(), 2.5);
+    QCOMPARE(ParticleAPI::instance().getLastError(),
+             QString("The connection to the remote server timed out"));
+
+    // next request is not affected by the aborted one
+    ParticleAPI::instance().setNetworkTimeout(120000);
+    QCOMPARE(device.getVariableValue("d").toInt(), 4);
+    QVERIFY(ParticleAPI::instance().getLastError().isEmpty());
+}
+
+void TestParticle::callFunction()
+{
+    ParticleDevice device("dev1");
+    QVERIFY(device.refresh());
+    m_server.resetStats();
+
+    QCOMPARE(device.callFunction("spSet", "12"), 5);
+    QCOMPARE(m_server.requests(), QStringList() << "POST /v1/devices/dev1/spSet");
+    QCOMPARE(m_server.lastBody(), QByteArray("arg=12"));
+
+    // unknown function is not called
+    QCOMPARE(device.callFunction("spNone", "1"), -1);
+    QCOMPARE(m_server.requests().size(), 1);
+}
+
+QTEST_GUILESS_MAIN(TestParticle)
+#include "tst_particle.moc"
@@ -0,0 +1,20 @@
+QT += testlib network
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_scan
+INCLUDEPATH += ../../common
+SOURCES += tst_scan.cpp \
+           ../../common/spectron_scan.cpp \
+           ../../common/spectron_api.cpp \
+           ../../common/spectron_frame.cpp \
+           ../../common/spectron_dataset.cpp \
+           ../../common/spectron_export.cpp \
+           ../../common/particle_api.cpp
+HEADERS += ../../common/spectron_scan.h \
+           ../../common/spectron_api.h \
+           ../../common/spectron_frame.h \
+           ../../common/spectron_dataset.h \
+           ../../common/spectron_export.h \
+           ../../common/particle_api.h
@@ -0,0 +1,796 @@
+/*
+ *  tst_scan.cpp - Monochromator sweep tests against mock motor, light
+ *                 source and spectrometer boards
+ *
+ *  Copyright 2019 Alexey Danilchenko
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3, or (at your option)
+ *  any later version with ADDITION (see below).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, 51 Franklin Street - Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QtEndian>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QUrlQuery>
+#include <functional>
+#include <string.h>
+
+#include "spectron_scan.h"
+
+// Board timings in milliseconds
+static const int c_latencyMs    = 10;   // every cloud request
+static const int c_dataReadMs   = 150;  // spData variables with pixel data
+static const int c_travelMs     = 150;  // motor move between sweep steps
+static const int c_lightCallMs  = 30;   // light source function call
+static const int c_settleMs     = 100;  // light source settling after the call
+static const int c_firstMoveMs  = 150;  // queue run - move to the first position
+static const int c_queueMoveMs  = 30;   // queue run - move between positions
+
+static const int c_pixels       = 8;
+static const int c_integTimeUs  = 50000;
+
+//
+// State of the mock boards shared between the cloud server and the frame
+// server thread. The spectrometer measurement records motor position and
+// light source level, or -1 if the motor was moving or the light was not
+// settled at any time during the integration.
+//
+struct BoardState
+{
+    QMutex        mutex;
+    QElapsedTimer clock;
+
+    // motor board
+    int           position;
+    qint64        movingUntil;
+    int           travelMs;     // move between sweep steps
+    QVector<int>  queue;
+    int           dwellMs;
+    qint64        queueStart;   // -1 until the queue is run
+
+    // light source board
+    int           lightLevel;   // -1 until set
+    qint64        settledAt;
+
+    // spectrometer board
+    QByteArray    data;         // contents of spData1..3
+    bool          continuous;
+    int           frameTimeMs;
+    quint32       nextSeq;
+
+    void reset()
+    {
+        position = 0;
+        movingUntil = 0;
+        travelMs = c_travelMs;
+        queue.clear();
+        dwellMs = 0;
+        queueStart = -1;
+        lightLevel = -1;
+        settledAt = 0;
+        data.clear();
+        continuous = false;
+        frameTimeMs = 0;
+        nextSeq = 0;
+    }
+
+    bool motorRunning()  { return clock.elapsed() < movingUntil; }
+    int  measuredPos()   { return motorRunning() ? -1 : position; }
+    int  measuredLight() { return clock.elapsed() >= settledAt - 2 ? lightLevel : -1; }
+
+    // queue run trigger time of the position
+    qint64 triggerTime(int idx) { return queueStart + c_firstMoveMs + idx*(dwellMs + c_queueMoveMs); }
+};
+
+// Pixel values - measured position and light level followed by a ramp
+static QVector<float> pixelValues(int position, int light)
+{
+    QVector<float> values;
+    values << position << light;
+    for (int i=2; i<c_pixels; i++)
+        values << i*0.1f;
+
+    return values;
+}
+
+// Packet as built by buildFramePacket() in board firmware
+static QByteArray framePacket(quint32 seq, quint32 timeMs, const QVector<float>& values)
+{
+    static const int headerSize = 40;
+    QByteArray packet(headerSize + values.size()*4, 0);
+    uchar* data = (uchar*)packet.data();
+
+    float scale = 1.0f;
+    quint32 bits;
+    memcpy(&bits, &scale, sizeof(float));
+
+    qToLittleEndian<quint32>(0x46435053, data);
+    qToLittleEndian<quint16>(1, data+4);
+    qToLittleEndian<quint16>(headerSize, data+6);
+    qToLittleEndian<quint32>(values.size()*4, data+8);
+    qToLittleEndian<quint32>(seq, data+12);
+    qToLittleEndian<quint32>(timeMs, data+16);
+    qToLittleEndian<quint32>(c_integTimeUs, data+20);
+    data[28] = SpectronDevice::MEASURE_VOLTAGE;
+    qToLittleEndian<quint16>(values.size(), data+30);
+    qToLittleEndian<quint32>(bits, data+36);
+
+    for (int i=0; i<values.size(); i++)
+    {
+        memcpy(&bits, &values[i], sizeof(float));
+        qToLittleEndian<quint32>(bits, data+headerSize+i*4);
+    }
+
+    return packet;
+}
+
+//
+// Mock of the Particle cloud API serving motor ("motor"), light source
+// ("light") and spectrometer ("spec") boards. Each request is answered
+// after the board delay with the reply made at that time, so the board
+// state changes while the request is being served as on the real ones.
+//
+class MockBoards : public QObject
+{
+    Q_OBJECT
+
+public:
+    MockBoards(BoardState& state) : m_state(state)
+    {
+        connect(&m_server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    }
+
+    quint16 listen()
+    {
+        m_server.listen(QHostAddress::LocalHost);
+        return m_server.serverPort();
+    }
+
+    QStringList& requests() { return m_requests; }
+
+private slots:
+    void newConnection()
+    {
+        while (m_server.hasPendingConnections())
+        {
+            QTcpSocket* socket = m_server.nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void readRequest()
+    {
+        QTcpSocket* socket = (QTcpSocket*)sender();
+        QByteArray& buf = m_buffers[socket];
+        buf.append(socket->readAll());
+
+        int headerEnd = buf.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        int contentLength = 0;
+        QList<QByteArray> lines = buf.left(headerEnd).split('\n');
+        foreach (const QByteArray& line, lines)
+            if (line.toLower().startsWith("content-length:"))
+                contentLength = line.mid(15).trimmed().toInt();
+        if (buf.size() < headerEnd + 4 + contentLength)
+            return;
+
+        QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+        QString method = QString::fromLatin1(requestLine.value(0));
+        QStringList path = QUrl(QString::fromLatin1(requestLine.value(1))).path()
+                               .split('/', QString::SkipEmptyParts);
+        QString arg = QUrlQuery(QString::fromLatin1(buf.mid(headerEnd + 4, contentLength)))
+                          .queryItemValue("arg", QUrl::FullyDecoded);
+        m_buffers.remove(socket);
+
+        QString device = path.value(2);
+        QString name = path.value(3);
+        m_requests.append(QString("%1 %2 %3").arg(device).arg(name).arg(arg).trimmed());
+
+        int delayMs = c_latencyMs;
+        std::function<QByteArray()> reply;
+        {
+            QMutexLocker lock(&m_state.mutex);
+            if (name.isEmpty())
+                reply = deviceInfo(device);
+            else if (method == "GET")
+                reply = variable(device, name, delayMs);
+            else
+                reply = function(device, name, arg, delayMs);
+        }
+
+        QPointer<QTcpSocket> target(socket);
+        QTimer::singleShot(delayMs, this, [this, target, reply]() {
+            QByteArray status = "200 OK";
+            QByteArray body;
+            if (reply)
+            {
+                QMutexLocker lock(&m_state.mutex);
+                body = reply();
+            }
+            else
+            {
+                status = "404 Not Found";
+                body = "{\"ok\":false,\"error\":\"Not found\"}";
+            }
+
+            if (!target || target->state() != QAbstractSocket::ConnectedState)
+                return;
+
+            target->write("HTTP/1.1 " + status + "\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n" + body);
+            target->disconnectFromHost();
+        });
+    }
+
+private:
+    typedef std::function<QByteArray()> TReply;
+
+    static QByteArray json(const QJsonObject& object)
+    {
+        return QJsonDocument(object).toJson(QJsonDocument::Compact);
+    }
+
+    static TReply value(const QString& name, const QJsonValue& result)
+    {
+        return [name, result]() { return json(QJsonObject{ {"name", name}, {"result", result} }); };
+    }
+
+    static TReply returnValue(int result)
+    {
+        return [result]() { return json(QJsonObject{ {"connected", true}, {"return_value", result} }); };
+    }
+
+    TReply deviceInfo(const QString& device)
+    {
+        QJsonObject variables;
+        QJsonArray functions;
+        if (device == "motor")
+        {
+            variables["drvRunning"] = "bool";
+            functions << "drvMoveToPos" << "drvQueue";
+        }
+        else if (device == "light")
+            functions << "ledSetBrtns";
+        else if (device == "spec")
+        {
+            variables["spState"] = "string";
+            variables["spData1"] = "string";
+            variables["spData2"] = "string";
+            variables["spData3"] = "string";
+            functions << "spMeasure" << "spGetData" << "spContinuous";
+        }
+        else
+            return TReply();
+
+        QJsonObject info{ {"id", device}, {"name", device}, {"connected", true},
+                          {"variables", variables}, {"functions", functions} };
+        return [info]() { return json(info); };
+    }
+
+    TReply variable(const QString& device, const QString& name, int& delayMs)
+    {
+        if (device == "motor" && name == "drvRunning")
+            return [this]() { return value("drvRunning", m_state.motorRunning())(); };
+
+        if (device == "spec" && name == "spState")
+        {
+            QJsonObject state{ {"v", 1}, {"adc", SpectronDevice::ADC_5V}, {"mbv", 0.1},
+                               {"sat", QJsonArray{ 4.5 }}, {"px", c_pixels}, {"off", 0},
+                               {"it", c_integTimeUs}, {"trg", 0},
+                               {"mt", SpectronDevice::MEASURE_VOLTAGE}, {"os", 0},
+                               {"cal", QJsonArray{ 300, 50, 0, 0, 0, 0 }} };
+            return value(name, QString::fromUtf8(json(state)));
+        }
+
+        // pixel data is split over 3 variables
+        if (device == "spec" && name.startsWith("spData"))
+        {
+            int part = name.mid(6).toInt() - 1;
+            if (part < 0 || part > 2)
+                return TReply();
+
+            delayMs += c_dataReadMs;
+            return [this, name, part]() {
+                int partSize = (m_state.data.size() + 2)/3;
+                return value(name, QString::fromLatin1(m_state.data.mid(part*partSize, partSize)))();
+            };
+        }
+
+        return TReply();
+    }
+
+    TReply function(const QString& device, const QString& name, const QString& arg, int& delayMs)
+    {
+        qint64 now = m_state.clock.elapsed();
+
+        if (device == "motor" && name == "drvMoveToPos")
+        {
+            int position = arg.toInt();
+            if (m_state.motorRunning() || position == m_state.position)
+                return returnValue(-1);
+
+            m_state.position = position;
+            m_state.movingUntil = now + m_state.travelMs;
+            return returnValue(0);
+        }
+
+        if (device == "motor" && name == "drvQueue")
+            return returnValue(queue(arg, now));
+
+        // light level is set when the call returns
+        if (device == "light" && name == "ledSetBrtns")
+        {
+            delayMs += c_lightCallMs;
+            int level = arg.toInt();
+            return [this, level]() {
+                m_state.lightLevel = level;
+                m_state.settledAt = m_state.clock.elapsed() + c_settleMs;
+                return returnValue(0)();
+            };
+        }
+
+        // measurement state is sampled at the start and at the end of the
+        // integration, results are staged in the data variables
+        if (device == "spec" && name == "spMeasure")
+        {
+            int integTimeUs = arg.isEmpty() ? c_integTimeUs : arg.section(',', 0, 0).toInt();
+            delayMs += integTimeUs/1000;
+            int position = m_state.measuredPos();
+            int light = m_state.measuredLight();
+            return [this, position, light]() {
+                int endPosition = m_state.measuredPos();
+                int endLight = m_state.measuredLight();
+                QVector<float> values = pixelValues(endPosition == position ? position : -1,
+                                                    endLight == light ? light : -1);
+                QByteArray bytes((const char*)values.constData(), values.size()*sizeof(float));
+                m_state.data = bytes.toBase64(QByteArray::OmitTrailingEquals).replace('/', '_');
+                return returnValue(0)();
+            };
+        }
+
+        if (device == "spec" && name == "spContinuous")
+        {
+            m_state.continuous = arg != "STOP";
+            if (m_state.continuous)
+            {
+                m_state.frameTimeMs = arg.section(',', 0, 0).toInt()/1000;
+                m_state.nextSeq = 0;
+            }
+            return returnValue(0);
+        }
+
+        if (device == "spec" && name == "spGetData")
+            return returnValue(0);
+
+        return TReply();
+    }
+
+    // motion queue as drvQueue() in motor board firmware
+    int queue(const QString& arg, qint64 now)
+    {
+        if (arg == "STOP")
+        {
+            m_state.movingUntil = now;
+            return 0;
+        }
+        if (m_state.motorRunning())
+            return -1;
+
+        QStringList values = arg.split(',');
+        if (arg == "CLEAR")
+            m_state.queue.clear();
+        else if (arg == "RUN")
+        {
+            if (m_state.queue.isEmpty())
+                return -1;
+            m_state.queueStart = now;
+            m_state.movingUntil = m_state.triggerTime(m_state.queue.size()) - c_queueMoveMs;
+            m_state.position = m_state.queue.last();
+        }
+        else if (values.first() == "ADD" && values.size() >= 3)
+        {
+            m_state.queue << values.at(1).toInt();
+            m_state.dwellMs = values.at(2).toInt();
+        }
+        else if (values.first() == "SWEEP" && values.size() >= 5 && values.at(3).toInt() != 0)
+        {
+            int from = values.at(1).toInt();
+            int to = values.at(2).toInt();
+            int step = from <= to ? qAbs(values.at(3).toInt()) : -qAbs(values.at(3).toInt());
+            for (int pos = from; step > 0 ? pos <= to : pos >= to; pos += step)
+                m_state.queue << pos;
+            m_state.dwellMs = values.at(4).toInt();
+        }
+        else
+            return -1;
+
+        return m_state.queue.size();
+    }
+
+    // members
+    BoardState&                    m_state;
+    QTcpServer                     m_server;
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+    QStringList                    m_requests;
+};
+
+//
+// Stand-in for the spectrometer board frame server in triggered
+// continuous mode - a frame for each queue position is available once
+// its dwell has started and the frame time has passed, FRAME requests
+// get the next one or empty packet if it is not there yet.
+//
+class MockFrameServer : public QThread
+{
+public:
+    MockFrameServer(BoardState& state) : m_state(state), m_port(0) {}
+
+    quint16 startServer()
+    {
+        start();
+        m_ready.acquire();
+        return m_port;
+    }
+
+    void stopServer()
+    {
+        requestInterruption();
+        wait();
+    }
+
+protected:
+    void run() override
+    {
+        QTcpServer server;
+        server.listen(QHostAddress::LocalHost);
+        m_port = server.serverPort();
+        m_ready.release();
+
+        while (!isInterruptionRequested())
+        {
+            if (!server.waitForNewConnection(50))
+                continue;
+
+            QTcpSocket* socket = server.nextPendingConnection();
+            while (!isInterruptionRequested()
+                   && socket->state() == QAbstractSocket::ConnectedState)
+            {
+                if (!socket->canReadLine() && !socket->waitForReadyRead(50))
+                    continue;
+                if (!socket->canReadLine())
+                    continue;
+
+                socket->readLine();
+                socket->write(nextFrame());
+                socket->waitForBytesWritten(1000);
+            }
+            delete socket;
+        }
+    }
+
+private:
+    QByteArray nextFrame()
+    {
+        QMutexLocker lock(&m_state.mutex);
+
+        quint32 seq = m_state.nextSeq;
+        qint64 frameDone = m_state.triggerTime(seq) + m_state.frameTimeMs;
+        if (!m_state.continuous || m_state.queueStart < 0
+            || (int)seq >= m_state.queue.size() || m_state.clock.elapsed() < frameDone)
+            return framePacket(0, 0, QVector<float>());
+
+        ++m_state.nextSeq;
+        return framePacket(seq, frameDone, pixelValues(m_state.queue.at(seq), -1));
+    }
+
+    BoardState& m_state;
+    QSemaphore  m_ready;
+    quint16     m_port;
+};
+
+// Sweep engine cancelling the sweep after set number of steps
+class CancelledScan : public ScanEngine
+{
+public:
+    CancelledScan(SpectronDevice& spectrometer, ParticleDevice& motor, int steps)
+        : ScanEngine(spectrometer, motor), m_steps(steps) {}
+
+protected:
+    bool stepDone(int step, int totalSteps) override { return step+1 < m_steps; }
+
+private:
+    int m_steps;
+};
+
+class TestScan : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestScan() : m_boards(m_state), m_frameServer(m_state) {}
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void makeSweep();
+    void runModes();
+    void cancel();
+    void motorTimeout();
+    void triggered();
+
+private:
+    TScanPlan plan();
+    void checkOutput(const QString& fileName, const TScanPlan& plan, int steps, bool light);
+
+    BoardState      m_state;
+    MockBoards      m_boards;
+    MockFrameServer m_frameServer;
+    quint16         m_framePort;
+    QTemporaryDir   m_dir;
+};
+
+void TestScan::initTestCase()
+{
+    m_state.clock.start();
+    m_state.reset();
+
+    quint16 port = m_boards.listen();
+    QVERIFY(port != 0);
+    m_framePort = m_frameServer.startServer();
+    QVERIFY(m_framePort != 0);
+    QVERIFY(m_dir.isValid());
+
+    ParticleAPI& api = ParticleAPI::instance();
+    api.setApiUrl(QString("http://127.0.0.1:%1/").arg(port));
+    QVERIFY(api.login("test-token"));
+}
+
+void TestScan::cleanupTestCase()
+{
+    m_frameServer.stopServer();
+}
+
+void TestScan::init()
+{
+    QMutexLocker lock(&m_state.mutex);
+    m_state.reset();
+    m_boards.requests().clear();
+}
+
+// five steps with light source level changing at each one
+TScanPlan TestScan::plan()
+{
+    TScanPlan plan = ScanEngine::makeSweep(400, 440, 10, c_integTimeUs);
+    for (int i=0; i<plan.size(); i++)
+        plan[i].lightArg = QString::number(i+1);
+
+    return plan;
+}
+
+// CSV output has a line for each step done with the values measured at
+// the step position and light level
+void TestScan::checkOutput(const QString& fileName, const TScanPlan& plan, int steps, bool light)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+    QStringList lines = QString::fromUtf8(file.readAll()).split('\n', QString::SkipEmptyParts);
+
+    QCOMPARE(lines.size(), steps + 1);
+    QVERIFY2(lines.first().startsWith("position,integration_us,time_ms,350,400,450,"),
+             qPrintable(lines.first()));
+
+    qint64 lastTime = -1;
+    for (int i=0; i<steps; i++)
+    {
+        QStringList values = lines.at(i+1).split(',');
+        QCOMPARE(values.size(), 3 + c_pixels);
+        QCOMPARE(values.at(0).toInt(), plan.at(i).position);
+        QCOMPARE(values.at(1).toInt(), c_integTimeUs);
+        QVERIFY(values.at(2).toLongLong() > lastTime);
+        lastTime = values.at(2).toLongLong();
+
+        // measured with motor stopped at the position and light settled
+        QVERIFY2(values.at(3).toDouble() == plan.at(i).position, qPrintable(lines.at(i+1)));
+        if (light)
+            QVERIFY2(values.at(4).toDouble() == plan.at(i).lightArg.toInt(), qPrintable(lines.at(i+1)));
+        QCOMPARE(values.at(5).toDouble(), 0.2);
+    }
+}
+
+void TestScan::makeSweep()
+{
+    TScanPlan plan = ScanEngine::makeSweep(380, 400, 10, 2000);
+    QCOMPARE(plan.size(), 3);
+    QCOMPARE(plan.at(2).position, 400);
+    QCOMPARE(plan.at(0).integTimeUs, 2000);
+
+    // descending range, step sign does not matter
+    plan = ScanEngine::makeSweep(400, 385, 10);
+    QCOMPARE(plan.size(), 2);
+    QCOMPARE(plan.at(1).position, 390);
+    QCOMPARE(plan.at(1).integTimeUs, 0);
+}
+
+// Serial sweep waits for each move and light settling in full, pipelined
+// one overlaps them with the data download
+void TestScan::runModes()
+{
+    ParticleDevice board("spec");
+    SpectronDevice spec;
+    spec = board;
+    ParticleDevice motor("motor");
+    ParticleDevice light("light");
+    QVERIFY(spec.refresh());
+    QVERIFY(motor.refresh());
+    QVERIFY(light.refresh());
+    QCOMPARE(spec.totalPixels(), c_pixels);
+
+    TScanPlan scanPlan = plan();
+    ScanEngine engine(spec, motor);
+    engine.setLightSource(&light, "ledSetBrtns", c_settleMs);
+
+    engine.setPipelined(false);
+    QString serialFile = m_dir.path() + "/serial.csv";
+    QVERIFY2(engine.run(scanPlan, serialFile), qPrintable(engine.getLastError()));
+    TScanStats serial = engine.getStats();
+    checkOutput(serialFile, scanPlan, scanPlan.size(), true);
+
+    init();
+    engine.setPipelined(true);
+    QString pipelinedFile = m_dir.path() + "/pipelined.csv";
+    QVERIFY2(engine.run(scanPlan, pipelinedFile), qPrintable(engine.getLastError()));
+    TScanStats pipelined = engine.getStats();
+    checkOutput(pipelinedFile, scanPlan, scanPlan.size(), true);
+
+    QString timings = QString("serial %1 ms (wait %2, read %3), pipelined %4 ms (wait %5, read %6)")
+                        .arg(serial.totalMs).arg(serial.waitMs).arg(serial.readMs)
+                        .arg(pipelined.totalMs).arg(pipelined.waitMs).arg(pipelined.readMs);
+    qDebug() << qPrintable(timings);
+
+    for (int i=0; i<2; i++)
+    {
+        TScanStats& stats = i == 0 ? serial : pipelined;
+        QCOMPARE(stats.steps, scanPlan.size());
+        QVERIFY2(stats.readMs >= scanPlan.size()*c_dataReadMs, qPrintable(timings));
+        QVERIFY2(stats.measureMs >= scanPlan.size()*c_integTimeUs/1000, qPrintable(timings));
+        QVERIFY2(stats.waitMs + stats.measureMs + stats.readMs + stats.saveMs <= stats.totalMs,
+                 qPrintable(timings));
+    }
+
+    // every move is waited for in serial mode, only the first one and
+    // the rest of travel after the download in pipelined mode
+    QVERIFY2(serial.waitMs >= scanPlan.size()*c_travelMs, qPrintable(timings));
+    QVERIFY2(pipelined.waitMs < serial.waitMs/2, qPrintable(timings));
+    QVERIFY2(pipelined.totalMs < serial.totalMs*3/4, qPrintable(timings));
+
+    // motor is moved to every position and light set for each step
+    QCOMPARE(m_boards.requests().filter("motor drvMoveToPos").size(), scanPlan.size());
+    QCOMPARE(m_boards.requests().filter("light ledSetBrtns").size(), scanPlan.size());
+}
+
+// Cancelled sweep keeps the steps done, next move already issued in
+// pipelined mode is collected
+void TestScan::cancel()
+{
+    ParticleDevice board("spec");
+    SpectronDevice spec;
+    spec = board;
+    ParticleDevice motor("motor");
+    QVERIFY(spec.refresh());
+    QVERIFY(motor.refresh());
+
+    TScanPlan scanPlan = plan();
+    CancelledScan engine(spec, motor, 3);
+    QString fileName = m_dir.path() + "/cancelled.csv";
+    QVERIFY(!engine.run(scanPlan, fileName));
+    QCOMPARE(engine.getLastError(), QString("Cancelled"));
+    QCOMPARE(engine.getStats().steps, 3);
+    checkOutput(fileName, scanPlan, 3, false);
+    QCOMPARE(m_boards.requests().filter("motor drvMoveToPos").size(), 4);
+    QVERIFY(m_boards.requests().filter("light").isEmpty());
+}
+
+// Sweep fails when the motor is still running after the timeout
+void TestScan::motorTimeout()
+{
+    ParticleDevice board("spec");
+    SpectronDevice spec;
+    spec = board;
+    ParticleDevice motor("motor");
+    QVERIFY(spec.refresh());
+    QVERIFY(motor.refresh());
+    {
+        QMutexLocker lock(&m_state.mutex);
+        m_state.travelMs = 60000;
+    }
+
+    TScanPlan scanPlan = plan();
+    ScanEngine engine(spec, motor);
+    engine.setMotorTimeout(500);
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!engine.run(scanPlan, m_dir.path() + "/timeout.csv"));
+    QCOMPARE(engine.getLastError(), QString("Motor did not stop in time"));
+    QCOMPARE(engine.getStats().steps, 0);
+    QVERIFY2(timer.elapsed() < 3000, qPrintable(QString("took %1 ms").arg(timer.elapsed())));
+    QVERIFY(m_boards.requests().filter("spec spMeasure").isEmpty());
+}
+
+// Triggered sweep uploads the positions as a single sweep and takes one
+// frame per dwell over local frame transport
+void TestScan::triggered()
+{
+    ParticleDevice board("spec");
+    SpectronDevice spec;
+    spec = board;
+    ParticleDevice motor("motor");
+    QVERIFY(spec.refresh());
+    QVERIFY(motor.refresh());
+
+    TScanPlan scanPlan = plan();
+    ScanEngine engine(spec, motor);
+    const int dwellMs = 100;
+    QString fileName = m_dir.path() + "/triggered.csv";
+
+    // frames can only be read over local transport
+    QVERIFY(!engine.runTriggered(scanPlan, dwellMs, fileName));
+    QCOMPARE(engine.getLastError(), QString("Local frame transport is not open"));
+
+    QVERIFY(spec.openLocalTransport("127.0.0.1", m_framePort));
+    QVERIFY2(engine.runTriggered(scanPlan, dwellMs, fileName), qPrintable(engine.getLastError()));
+    checkOutput(fileName, scanPlan, scanPlan.size(), false);
+
+    TScanStats& stats = engine.getStats();
+    QCOMPARE(stats.steps, scanPlan.size());
+    qint64 lastFrameMs = c_firstMoveMs + (scanPlan.size()-1)*(dwellMs + c_queueMoveMs)
+                         + c_integTimeUs/1000;
+    QVERIFY2(stats.totalMs >= lastFrameMs && stats.totalMs < lastFrameMs + 1000,
+             qPrintable(QString("took %1 ms").arg(stats.totalMs)));
+
+    // queue is uploaded before the frames are started and run after
+    QStringList calls;
+    foreach (const QString& request, m_boards.requests())
+        if (request.contains("drvQueue") || request.contains("spContinuous"))
+            calls << request;
+    QCOMPARE(calls, QStringList() << "motor drvQueue CLEAR"
+                                  << "motor drvQueue SWEEP,400,440,10,100,TRG"
+                                  << "spec spContinuous 50000,TRG"
+                                  << "motor drvQueue RUN"
+                                  << "spec spContinuous STOP");
+    QVERIFY(!m_state.continuous);
+
+    spec.closeLocalTransport();
+}
+
+QTEST_GUILESS_MAIN(TestScan)
+#include "tst_scan.moc"
@@ -0,0 +1,12 @@
+#
+# Host tests for the SpectrometerApp common modules - build with qmake
+# and run with "make check"
+#
+TEMPLATE = subdirs
+SUBDIRS = frame \
+          particle \
+          colour \
+          scan \
+          export \
+          dataset \
+          average